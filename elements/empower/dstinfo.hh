@@ -5,30 +5,35 @@
 #include <click/hashcode.hh>
 #include <click/timer.hh>
 #include <click/vector.hh>
+#include <click/integers.hh>
 #include "frame.hh"
 #include "sma.hh"
 CLICK_DECLS
 
 class DstInfo {
 public:
+
+	typedef EtherAddress key_type;
+	typedef const EtherAddress &key_const_reference;
+
 	EtherAddress _eth;
     int _sender_type;
-	int _accum_rssi;
-	int _squares_rssi;
-	int _packets;
+	uint64_t _accum_rssi;
+	uint64_t _squares_rssi;
+	uint32_t _packets;
 	int _last_rssi;
 	int _last_std;
 	int _last_packets;
-	SMA *_sma_rssi;
+	SMA _sma_rssi;
 	unsigned _silent_window_count;
 	int _hist_packets;
 	int _iface_id;
 	Timestamp _last_received;
+	DstInfo *_hashnext; // chains the table, or the free entries of the pool
 
 	DstInfo() {
 		_eth = EtherAddress();
 		_sender_type = 0;
-		_sma_rssi = 0;
 		_accum_rssi = 0;
 		_squares_rssi = 0;
 		_silent_window_count = 0;
@@ -38,33 +43,44 @@ public:
 		_last_packets= 0;
 		_hist_packets = 0;
 		_iface_id = -1;
+		_hashnext = 0;
 	}
 
-	~DstInfo() {
-		delete _sma_rssi;
+	const EtherAddress &hashkey() const {
+		return _eth;
 	}
 
+	// The mean and the deviation of the period come from the exact sums of
+	// the samples and of their squares: n^2 var = n sum(x^2) - sum(x)^2.
 	void update() {
 		_hist_packets += _packets;
-		_last_rssi = (_packets > 0) ? _accum_rssi / (double) _packets : 0;
-		_last_std = (_packets > 0) ? sqrt( (_squares_rssi / (double) _packets) - (_last_rssi * _last_rssi) ) : 0;
+		if (_packets > 0) {
+			_last_rssi = _accum_rssi / _packets;
+			uint64_t spread = _packets * _squares_rssi - _accum_rssi * _accum_rssi;
+			_last_std = int_sqrt(spread / ((uint64_t) _packets * _packets));
+		} else {
+			_last_rssi = 0;
+			_last_std = 0;
+		}
 		_last_packets = _packets;
 		if (_packets == 0) {
 			_silent_window_count++;
 		} else {
 			_silent_window_count = 0;
-			_sma_rssi->add(_last_rssi);
+			_sma_rssi.add(_last_rssi);
 		}
 		_packets = 0;
 		_accum_rssi = 0;
 		_squares_rssi = 0;
 	}
 
-	void add_sample(uint8_t rssi) {
-		_packets++;
-		_accum_rssi += rssi;
-		_squares_rssi += rssi * rssi;
-		_last_received.assign_now();
+	// Adds the samples that one thread accumulated since the last update.
+	void add_samples(uint32_t packets, uint64_t accum_rssi, uint64_t squares_rssi, const Timestamp &last_received) {
+		_packets += packets;
+		_accum_rssi += accum_rssi;
+		_squares_rssi += squares_rssi;
+		if (last_received > _last_received)
+			_last_received = last_received;
 	}
 
 	String unparse() {
@@ -73,7 +89,7 @@ public:
 		Timestamp age = now - _last_received;
 		sa << _eth.unparse();
 		sa << (_sender_type == 0 ? " STA" : " AP");
-		sa << " sma_rssi " << _sma_rssi->avg();
+		sa << " sma_rssi " << _sma_rssi.avg();
 		sa << " last_rssi_avg " << _last_rssi;
 		sa << " last_rssi_std " << _last_std;
 		sa << " last_packets " << _last_packets;
@@ -85,5 +101,76 @@ public:
 	}
 };
 
+/*
+ * Hands out DstInfo from chunks of CHUNK entries that are only given back
+ * to the system when the pool goes, so that neighbours that come and go,
+ * a flood of probe requests from random addresses for instance, do not
+ * call malloc. Not thread safe: each pool belongs to one neighbour table.
+ */
+class DstInfoPool {
+public:
+
+	enum { CHUNK = 256 };
+
+	DstInfoPool() : _free(0), _allocs(0), _frees(0), _live(0), _peak(0) {
+	}
+
+	~DstInfoPool() {
+		for (int i = 0; i < _chunks.size(); i++) {
+			delete[] _chunks[i];
+		}
+	}
+
+	DstInfo *allocate() {
+		if (!_free) {
+			grow();
+		}
+		DstInfo *nfo = _free;
+		_free = nfo->_hashnext;
+		*nfo = DstInfo();
+		_allocs++;
+		if (++_live > _peak) {
+			_peak = _live;
+		}
+		return nfo;
+	}
+
+	void deallocate(DstInfo *nfo) {
+		nfo->_hashnext = _free;
+		_free = nfo;
+		_frees++;
+		_live--;
+	}
+
+	uint32_t chunks() const { return _chunks.size(); }
+	uint64_t allocs() const { return _allocs; }
+	uint64_t frees() const { return _frees; }
+	uint32_t live() const { return _live; }
+	uint32_t peak() const { return _peak; }
+
+private:
+
+	DstInfo *_free;
+	Vector<DstInfo *> _chunks;
+
+	uint64_t _allocs;
+	uint64_t _frees;
+	uint32_t _live;
+	uint32_t _peak;
+
+	void grow() {
+		DstInfo *chunk = new DstInfo[CHUNK];
+		_chunks.push_back(chunk);
+		for (int i = 0; i < CHUNK; i++) {
+			chunk[i]._hashnext = _free;
+			_free = &chunk[i];
+		}
+	}
+
+	DstInfoPool(const DstInfoPool &);
+	DstInfoPool &operator=(const DstInfoPool &);
+
+};
+
 CLICK_ENDDECLS
 #endif /* CLICK_EMPOWER_DSTINFO_HH */
@@ -29,10 +29,16 @@
 CLICK_DECLS
 
 EmpowerBeaconSource::EmpowerBeaconSource() :
-		_el(0), _period(500), _timer(this), _debug(false) {
+		_el(0), _period(500), _timer(this), _slots(10), _slot(0), _jitter_sum(0),
+		_jitter_max(0), _slots_sent(0), _max_burst(0), _period_burst(0), _probe_hold(500), _probe_cache(4096),
+		_probes_forwarded(0), _probes_suppressed(0), _probes_answered(0), _periods(0), _template_hits(0),
+		_template_builds(0), _debug(false) {
 }
 
 EmpowerBeaconSource::~EmpowerBeaconSource() {
+	for (BTIter it = _templates.begin(); it.live(); it++) {
+		it.value()._frame->kill();
+	}
 }
 
 int EmpowerBeaconSource::configure(Vector<String> &conf, ErrorHandler *errh) {
@@ -40,8 +46,22 @@ int EmpowerBeaconSource::configure(Vector<String> &conf, ErrorHandler *errh) {
 	int ret = Args(conf, this, errh)
               .read_m("EL", ElementCastArg("EmpowerLVAPManager"), _el)
 			  .read("PERIOD", _period)
+			  .read("SLOTS", _slots)
+			  .read("PROBE_HOLD", _probe_hold)
+			  .read("PROBE_CACHE", _probe_cache)
 			  .read("DEBUG", _debug).complete();
 
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (_slots < 1 || _slots > _period) {
+		return errh->error("SLOTS must be between 1 and PERIOD");
+	}
+
+	_slot_length = Timestamp::make_usec((uint64_t) _period * 1000 / _slots);
+	_slot_beacons.assign(_slots, 0);
+
 	return ret;
 
 }
@@ -54,8 +74,29 @@ int EmpowerBeaconSource::initialize(ErrorHandler *) {
 
 void EmpowerBeaconSource::run_timer(Timer *) {
 
+	// how late this slot is
+	Timestamp now = Timestamp::now_steady();
+	if (_timer.expiry_steady() && now > _timer.expiry_steady()) {
+		uint32_t jitter = (now - _timer.expiry_steady()).usecval();
+		_jitter_sum += jitter;
+		if (jitter > _jitter_max) {
+			_jitter_max = jitter;
+		}
+	}
+	_slots_sent++;
+
+	if (_slot == 0) {
+		_periods++;
+		_period_burst = 0;
+	}
+
+	uint32_t burst = 0;
+
 	// send LVAP beacon
 	for (LVAPIter it = _el->lvaps()->begin(); it.live(); it++) {
+		if (slot(it.value()._sta) != _slot) {
+			continue;
+		}
 		int current_channel = _el->ifaces()->get(it.value()._iface_id)->_channel;
 		for (int i = 0; i < it.value()._networks.size(); i++) {
 			EtherAddress bssid = it.value()._networks[i]._bssid;
@@ -65,20 +106,59 @@ void EmpowerBeaconSource::run_timer(Timer *) {
 			} else {
 				send_beacon(it.value()._sta, bssid, ssid, current_channel, it.value()._iface_id, false, false, 0, 0, 0);
 			}
+			burst++;
 		}
 	}
 
 	// send VAP beacons
 	for (VAPIter it = _el->vaps()->begin(); it.live(); it++) {
+		if (slot(it.value()._bssid) != _slot) {
+			continue;
+		}
 		int current_channel = _el->ifaces()->get(it.value()._iface_id)->_channel;
 		send_beacon(EtherAddress::make_broadcast(), it.value()._bssid,
 				it.value()._ssid, current_channel, it.value()._iface_id,
 				false, false, 0, 0, 0);
+		burst++;
+	}
+
+	_slot_beacons[_slot] = burst;
+	if (burst > _period_burst) {
+		_period_burst = burst;
+	}
+	if (burst > _max_burst) {
+		_max_burst = burst;
+	}
+
+	// drop the templates of LVAPs and VAPs that are gone
+	if (_slot == 0 && _periods % TEMPLATE_IDLE_PERIODS == 0) {
+		expire_templates();
+	}
+
+	if (_slot == 0) {
+		expire_probe_holds();
+	}
+
+	if (++_slot == _slots) {
+		_slot = 0;
+	}
+
+	// slots start a slot length apart whatever this one took, unless the
+	// timer is late by more than a period: then start over from now
+	if (!_timer.expiry_steady() || now - _timer.expiry_steady() > Timestamp::make_msec(_period)) {
+		_timer.schedule_after(_slot_length);
+	} else {
+		_timer.reschedule_after(_slot_length);
 	}
 
-	// re-schedule the timer with some jitter
-	_timer.schedule_after_msec(_period);
+}
 
+void EmpowerBeaconSource::reset_stats() {
+	_jitter_sum = 0;
+	_jitter_max = 0;
+	_slots_sent = 0;
+	_max_burst = 0;
+	_period_burst = 0;
 }
 
 void EmpowerBeaconSource::send_lvap_csa_beacon(EmpowerStationState *ess) {
@@ -118,20 +198,14 @@ void EmpowerBeaconSource::send_lvap_csa_beacon(EmpowerStationState *ess) {
 
 }
 
-void EmpowerBeaconSource::send_beacon(EtherAddress dst, EtherAddress bssid,
+/*
+ * Builds a beacon, or a probe response, with no destination. If csa_active,
+ * the channel switch announcement has a count of 0 and csa_offset is where
+ * the count goes, else csa_offset is 0.
+ */
+WritablePacket *EmpowerBeaconSource::build_beacon(EtherAddress bssid,
 		String ssid, int channel, int iface_id, bool probe, bool csa_active,
-		int csa_mode, int csa_count, int csa_channel) {
-
-	if (_debug) {
-		click_chatter("%{element} :: %s :: dst %s bssid %s ssid %s channel %u iface_id %u",
-					  this,
-					  __func__,
-					  dst.unparse().c_str(),
-					  bssid.unparse().c_str(),
-					  ssid.c_str(),
-					  channel,
-					  iface_id);
-	}
+		int csa_mode, int csa_channel, int &csa_offset) {
 
 	/* order elements by standard
 	 * needed by sloppy 802.11b driver implementations
@@ -158,15 +232,16 @@ void EmpowerBeaconSource::send_beacon(EtherAddress dst, EtherAddress bssid,
 	}
 
 	WritablePacket *p = Packet::make(max_len);
-	memset(p->data(), 0, p->length());
 
 	if (!p) {
 		click_chatter("%{element} :: %s :: cannot make packet!",
 				      this,
 				      __func__);
-		return;
+		return 0;
 	}
 
+	memset(p->data(), 0, p->length());
+
 	struct click_wifi *w = (struct click_wifi *) p->data();
 
 	w->i_fc[0] = WIFI_FC0_VERSION_0 | WIFI_FC0_TYPE_MGT;
@@ -178,13 +253,14 @@ void EmpowerBeaconSource::send_beacon(EtherAddress dst, EtherAddress bssid,
 
 	w->i_fc[1] = WIFI_FC1_DIR_NODS;
 
-    memcpy(w->i_addr1, dst.data(), 6);
 	memcpy(w->i_addr2, bssid.data(), 6);
 	memcpy(w->i_addr3, bssid.data(), 6);
 
 	w->i_dur = 0;
 	w->i_seq = 0;
 
+	csa_offset = 0;
+
 	uint8_t *ptr;
 
 	ptr = (uint8_t *) p->data() + sizeof(struct click_wifi);
@@ -259,7 +335,8 @@ void EmpowerBeaconSource::send_beacon(EtherAddress dst, EtherAddress bssid,
 		ptr[1] = 3; // length
 		ptr[2] = (uint8_t) csa_mode;
 		ptr[3] = (uint8_t) csa_channel;
-		ptr[4] = (uint8_t) csa_count;
+		ptr[4] = 0;
+		csa_offset = actual_length + 4;
 		ptr += 2 + 3;
 		actual_length += 2 + 3;
 	}
@@ -363,11 +440,126 @@ void EmpowerBeaconSource::send_beacon(EtherAddress dst, EtherAddress bssid,
 	}
 
 	p->take(max_len - actual_length);
+	return p;
+
+}
+
+void EmpowerBeaconSource::send_beacon(EtherAddress dst, EtherAddress bssid,
+		String ssid, int channel, int iface_id, bool probe, bool csa_active,
+		int csa_mode, int csa_count, int csa_channel) {
+
+	if (_debug) {
+		click_chatter("%{element} :: %s :: dst %s bssid %s ssid %s channel %u iface_id %u",
+					  this,
+					  __func__,
+					  dst.unparse().c_str(),
+					  bssid.unparse().c_str(),
+					  ssid.c_str(),
+					  channel,
+					  iface_id);
+	}
+
+	int kind = csa_active ? BEACON_KIND_CSA : (probe ? BEACON_KIND_PROBE : BEACON_KIND_BEACON);
+	BeaconKey key(bssid, ssid, iface_id, kind);
+
+	TransmissionPolicies *tx_table = _el->get_tx_policies(iface_id);
+	ResourceElement *elm = _el->ifaces()->get(iface_id);
+
+	BeaconTemplate &t = _templates[key];
+
+	if (!t._frame || t._channel != channel || t._band != elm->_band
+			|| t._policies != tx_table->generation()
+			|| (csa_active && (t._csa_mode != csa_mode || t._csa_channel != csa_channel))) {
+		if (t._frame) {
+			t._frame->kill();
+		}
+		t._frame = build_beacon(bssid, ssid, channel, iface_id, probe, csa_active, csa_mode, csa_channel, t._csa_offset);
+		if (!t._frame) {
+			_templates.erase(key);
+			return;
+		}
+		t._channel = channel;
+		t._band = elm->_band;
+		t._policies = tx_table->generation();
+		t._csa_mode = csa_mode;
+		t._csa_channel = csa_channel;
+		_template_builds++;
+	} else {
+		_template_hits++;
+	}
+
+	t._last_sent = _periods;
+
+	WritablePacket *p = Packet::make(t._frame->data(), t._frame->length());
+
+	if (!p) {
+		click_chatter("%{element} :: %s :: cannot make packet!",
+				      this,
+				      __func__);
+		return;
+	}
+
+	struct click_wifi *w = (struct click_wifi *) p->data();
+	memcpy(w->i_addr1, dst.data(), 6);
+
+	if (t._csa_offset) {
+		p->data()[t._csa_offset] = (uint8_t) csa_count;
+	}
+
 	SET_PAINT_ANNO(p, iface_id);
 	output(0).push(p);
 
 }
 
+void EmpowerBeaconSource::expire_templates() {
+	for (BTIter it = _templates.begin(); it.live();) {
+		if (_periods - it.value()._last_sent > TEMPLATE_IDLE_PERIODS) {
+			it.value()._frame->kill();
+			it = _templates.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+/*
+ * Whether a probe request from src for ssid on iface_id is to be held back,
+ * because one went to the controller less than PROBE_HOLD msecs ago.
+ */
+bool EmpowerBeaconSource::hold_probe(EtherAddress src, const String &ssid, int iface_id) {
+
+	if (!_probe_hold) {
+		return false;
+	}
+
+	Timestamp now = Timestamp::now_steady();
+	ProbeKey key(src, ssid, iface_id);
+	PHIter it = _probe_holds.find(key);
+
+	if (it.live()) {
+		if (now - it.value() < Timestamp::make_msec(_probe_hold)) {
+			return true;
+		}
+		it.value() = now;
+	} else if ((unsigned) _probe_holds.size() < _probe_cache) {
+		_probe_holds.set(key, now);
+	}
+
+	return false;
+
+}
+
+void EmpowerBeaconSource::expire_probe_holds() {
+	Timestamp expired = Timestamp::now_steady() - Timestamp::make_msec(_probe_hold);
+	for (PHIter it = _probe_holds.begin(); it.live();) {
+		if (it.value() <= expired) {
+			it = _probe_holds.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
 void EmpowerBeaconSource::push(int, Packet *p) {
 
 	if (p->length() < sizeof(struct click_wifi)) {
@@ -406,6 +598,28 @@ void EmpowerBeaconSource::push(int, Packet *p) {
 	uint8_t *ptr = (uint8_t *) p->data() + sizeof(struct click_wifi);
 	uint8_t *end = (uint8_t *) p->data() + p->length();
 
+	EtherAddress src = EtherAddress(w->i_addr2);
+
+	// the SSID element comes first, enough to tell a repeated request
+	String probed = "";
+	if (ptr + 2 <= end && ptr[0] == WIFI_ELEMID_SSID && ptr[1] && ptr + 2 + ptr[1] <= end) {
+		probed = String((char *) ptr + 2, WIFI_MIN((int) ptr[1], WIFI_NWID_MAXSIZE));
+	}
+
+	if (hold_probe(src, probed, iface_id)) {
+		_probes_suppressed++;
+		EmpowerStationState *ess = _el->lvaps()->get_pointer(src);
+		// the controller answered the first one, the LVAP says so
+		if (ess && ess->_iface_id == iface_id && ess->_set_mask) {
+			send_probe_response(ess, probed);
+			_probes_answered++;
+		}
+		p->kill();
+		return;
+	}
+
+	_probes_forwarded++;
+
 	uint8_t *ssid_l = NULL;
 	uint8_t *rates_l = NULL;
 	uint8_t *rates_x = NULL;
@@ -437,7 +651,6 @@ void EmpowerBeaconSource::push(int, Packet *p) {
 		ptr += ptr[1] + 2;
 	}
 
-	EtherAddress src = EtherAddress(w->i_addr2);
 	String ssid = "";
 
     if (ssid_l && ssid_l[1]) {
@@ -696,11 +909,49 @@ void EmpowerBeaconSource::send_probe_response(EmpowerStationState *ess, String s
 
 enum {
 	H_DEBUG,
+	H_TEMPLATES,
+	H_JITTER,
+	H_BURSTS,
+	H_RESET_STATS,
+	H_PROBES,
 };
 
 String EmpowerBeaconSource::read_handler(Element *e, void *thunk) {
 	EmpowerBeaconSource *td = (EmpowerBeaconSource *) e;
 	switch ((uintptr_t) thunk) {
+	case H_JITTER: {
+		StringAccum sa;
+		sa << "avg " << (td->_slots_sent ? td->_jitter_sum / td->_slots_sent : 0);
+		sa << " max " << td->_jitter_max << " slots " << td->_slots_sent << "\n";
+		return sa.take_string();
+	}
+	case H_BURSTS: {
+		StringAccum sa;
+		sa << "max " << td->_max_burst << " period " << td->_period_burst << " slots [";
+		for (unsigned i = 0; i < td->_slots; i++) {
+			sa << " " << td->_slot_beacons[i];
+		}
+		sa << " ]\n";
+		return sa.take_string();
+	}
+	case H_PROBES: {
+		StringAccum sa;
+		sa << "forwarded " << td->_probes_forwarded << " suppressed " << td->_probes_suppressed;
+		sa << " answered " << td->_probes_answered << " held " << td->_probe_holds.size() << "\n";
+		return sa.take_string();
+	}
+	case H_TEMPLATES: {
+		StringAccum sa;
+		sa << "templates " << td->_templates.size() << " hits " << td->_template_hits;
+		sa << " builds " << td->_template_builds << "\n";
+		for (BTIter it = td->_templates.begin(); it.live(); it++) {
+			const BeaconKey &key = it.key();
+			sa << key._bssid.unparse() << " " << key._ssid << " iface " << key._iface_id;
+			sa << (key._kind == BEACON_KIND_PROBE ? " probe" : (key._kind == BEACON_KIND_CSA ? " csa" : " beacon"));
+			sa << " length " << it.value()._frame->length() << "\n";
+		}
+		return sa.take_string();
+	}
 	case H_DEBUG:
 		return String(td->_debug) + "\n";
 	default:
@@ -715,6 +966,10 @@ int EmpowerBeaconSource::write_handler(const String &in_s, Element *e,
 	String s = cp_uncomment(in_s);
 
 	switch ((intptr_t) vparam) {
+	case H_RESET_STATS: {
+		f->reset_stats();
+		break;
+	}
 	case H_DEBUG: {    //debug
 		bool debug;
 		if (!BoolArg().parse(s, debug))
@@ -728,6 +983,11 @@ int EmpowerBeaconSource::write_handler(const String &in_s, Element *e,
 
 void EmpowerBeaconSource::add_handlers() {
 	add_read_handler("debug", read_handler, (void *) H_DEBUG);
+	add_read_handler("templates", read_handler, (void *) H_TEMPLATES);
+	add_read_handler("jitter", read_handler, (void *) H_JITTER);
+	add_read_handler("bursts", read_handler, (void *) H_BURSTS);
+	add_read_handler("probes", read_handler, (void *) H_PROBES);
+	add_write_handler("reset_stats", write_handler, (void *) H_RESET_STATS);
 	add_write_handler("debug", write_handler, (void *) H_DEBUG);
 }
 
@@ -4,6 +4,7 @@
 #include <click/element.hh>
 #include <click/config.h>
 #include <click/timer.hh>
+#include <click/hashtable.hh>
 #include "empowerlvapmanager.hh"
 CLICK_DECLS
 
@@ -39,14 +40,145 @@ The wireless channel it is operating on.
 =item PERIOD
 How often beacon packets are sent, in milliseconds.
 
+=item SLOTS
+Number of slots the period is split in, default 10. Every LVAP and VAP is
+hashed to a slot and its beacons are sent at the start of that slot, so
+the beacons of a period go out in small batches spread over the period
+rather than in one burst. At most PERIOD.
+
+=item PROBE_HOLD
+How long, in milliseconds, probe requests from a station for an SSID on an
+interface are held back after one was sent to the controller, default 500.
+0 sends every probe request on.
+
+=item PROBE_CACHE
+Most stations, SSIDs and interfaces held back at once, default 4096. Probe
+requests beyond that are sent on.
+
 =item DEBUG
 Turn debug on/off
 
 =back 8
 
+A probe request that is held back is dropped, unless the station has an
+LVAP on the interface: then it is answered here, from the templates, as the
+controller would.
+
+Beacons and probe responses are built once for each BSSID, SSID and
+interface and kept as templates. A template is built again when the channel
+or band of its interface or the transmission policies of the interface
+change; sending copies it and writes in the destination, and the count of
+a channel switch announcement. Templates that were not sent for a while are
+dropped.
+
+=h jitter read-only
+
+How late the slots started, average and maximum, in microseconds
+
+=h bursts read-only
+
+The most beacons sent in one slot, ever and in the current period, and the
+beacons each slot sent the last time it came round
+
+=h reset_stats write-only
+
+Clears the jitter and burst statistics
+
+=h probes read-only
+
+Probe requests sent to the controller, held back and answered here, and
+the entries of the hold cache
+
+=h templates read-only
+
+The templates, and how many frames were sent from a template and how many
+templates were built
+
 =a EmpowerLVAPManager
 */
 
+enum empower_beacon_kind {
+	BEACON_KIND_BEACON = 0,
+	BEACON_KIND_PROBE = 1,
+	BEACON_KIND_CSA = 2,
+};
+
+class BeaconKey {
+public:
+
+	EtherAddress _bssid;
+	String _ssid;
+	int _iface_id;
+	int _kind;
+
+	BeaconKey() : _iface_id(0), _kind(BEACON_KIND_BEACON) {
+	}
+
+	BeaconKey(EtherAddress bssid, String ssid, int iface_id, int kind) :
+		_bssid(bssid), _ssid(ssid), _iface_id(iface_id), _kind(kind) {
+	}
+
+	inline hashcode_t hashcode() const {
+		return CLICK_NAME(hashcode)(_bssid) + CLICK_NAME(hashcode)(_ssid) + (_iface_id << 2) + _kind;
+	}
+
+	inline bool operator==(const BeaconKey &b) const {
+		return _bssid == b._bssid && _ssid == b._ssid && _iface_id == b._iface_id && _kind == b._kind;
+	}
+
+};
+
+// A frame ready to be sent but for its destination, and what it was built
+// from
+class BeaconTemplate {
+public:
+
+	WritablePacket *_frame;
+	int _channel;
+	empower_bands_types _band;
+	uint32_t _policies;   // generation of the transmission policies
+	int _csa_mode;
+	int _csa_channel;
+	int _csa_offset;      // of the CSA count, 0 if none
+	uint32_t _last_sent;  // period
+
+	BeaconTemplate() : _frame(0), _channel(0), _band(EMPOWER_BT_L20), _policies(0),
+		_csa_mode(0), _csa_channel(0), _csa_offset(0), _last_sent(0) {
+	}
+
+};
+
+typedef HashTable<BeaconKey, BeaconTemplate> BeaconTemplates;
+typedef BeaconTemplates::iterator BTIter;
+
+class ProbeKey {
+public:
+
+	EtherAddress _src;
+	String _ssid;
+	int _iface_id;
+
+	ProbeKey() : _iface_id(0) {
+	}
+
+	ProbeKey(EtherAddress src, String ssid, int iface_id) :
+		_src(src), _ssid(ssid), _iface_id(iface_id) {
+	}
+
+	inline hashcode_t hashcode() const {
+		return CLICK_NAME(hashcode)(_src) + CLICK_NAME(hashcode)(_ssid) + _iface_id;
+	}
+
+	inline bool operator==(const ProbeKey &b) const {
+		return _src == b._src && _ssid == b._ssid && _iface_id == b._iface_id;
+	}
+
+};
+
+// When the last probe request of a key went to the controller
+typedef HashTable<ProbeKey, Timestamp> ProbeHolds;
+typedef ProbeHolds::iterator PHIter;
+
 class EmpowerBeaconSource: public Element {
 public:
 
@@ -76,8 +208,44 @@ private:
 	unsigned int _period; // msecs
 	Timer _timer;
 
+	unsigned _slots;
+	unsigned _slot;         // the next to be sent
+	Timestamp _slot_length;
+
+	// emission statistics
+	uint64_t _jitter_sum;   // usecs
+	uint32_t _jitter_max;   // usecs
+	uint32_t _slots_sent;
+	uint32_t _max_burst;
+	uint32_t _period_burst; // of the current period
+	Vector<uint32_t> _slot_beacons;
+
+	unsigned _probe_hold;   // msecs
+	unsigned _probe_cache;
+	ProbeHolds _probe_holds;
+	uint32_t _probes_forwarded;
+	uint32_t _probes_suppressed;
+	uint32_t _probes_answered;
+
+	BeaconTemplates _templates;
+	uint32_t _periods;
+	uint32_t _template_hits;
+	uint32_t _template_builds;
+
 	bool _debug;
 
+	enum { TEMPLATE_IDLE_PERIODS = 16 };
+
+	WritablePacket *build_beacon(EtherAddress, String, int, int, bool, bool, int, int, int &);
+	void expire_templates();
+	void reset_stats();
+	bool hold_probe(EtherAddress, const String &, int);
+	void expire_probe_holds();
+
+	unsigned slot(EtherAddress eth) const {
+		return empower_address_hash(eth) % _slots;
+	}
+
 	// Read/Write handlers
 	static String read_handler(Element *e, void *user_data);
 	static int write_handler(const String &, Element *, void *, ErrorHandler *);
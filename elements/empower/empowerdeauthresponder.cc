@@ -156,7 +156,9 @@ void EmpowerDeAuthResponder::push(int, Packet *p) {
 	ess->_authentication_status = false;
 	ess->_ssid = "";
 	ess->_bssid = EtherAddress();
+	_el->publish_lvap(src);
 
+	_el->update_fanout(ess->_iface_id);
 	_el->send_status_lvap(src);
 
 	p->kill();
@@ -143,7 +143,9 @@ void EmpowerDisassocResponder::push(int, Packet *p) {
 
 	ess->_association_status = false;
 	ess->_ssid = "";
+	_el->publish_lvap(src);
 
+	_el->update_fanout(ess->_iface_id);
 	_el->send_status_lvap(src);
 
 	p->kill();
@@ -0,0 +1,187 @@
+/*
+ * empowerframer.{cc,hh} -- splits the controller stream into messages
+ *
+ * Copyright (c) 2018 CREATE-NET
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "empowerframer.hh"
+#include "empowerpacket.hh"
+CLICK_DECLS
+
+EmpowerFramer::EmpowerFramer() :
+	_chunk(0), _offset(0), _prefix_length(0), _partial(0), _partial_length(0),
+	_done(0), _chunks(0), _messages(0), _reassembled(0), _copied_bytes(0),
+	_errors(0) {
+}
+
+EmpowerFramer::~EmpowerFramer() {
+	reset();
+}
+
+void EmpowerFramer::reset() {
+	drop_chunk();
+	if (_partial) {
+		_partial->kill();
+		_partial = 0;
+	}
+	_partial_length = 0;
+	_prefix_length = 0;
+}
+
+void EmpowerFramer::drop_chunk() {
+	if (_done) {
+		_done->kill();
+		_done = 0;
+	}
+	if (_chunk) {
+		_chunk->kill();
+		_chunk = 0;
+	}
+	_offset = 0;
+}
+
+void EmpowerFramer::push(Packet *p) {
+	drop_chunk();
+	_chunk = p;
+	_chunks++;
+}
+
+/*
+ * Checks the first PREFIX bytes of a message and reads its length.
+ */
+bool EmpowerFramer::valid(const uint8_t *prefix, uint32_t &length) {
+	empower_header *h = (empower_header *) prefix;
+	length = h->length();
+	return h->version() == _empower_version && length >= sizeof(empower_header) && length <= MAX_LENGTH;
+}
+
+/*
+ * Moves bytes of the current chunk into the split message. Returns 1 once
+ * the message is complete, 0 if the chunk ran out first, -1 on a bad
+ * header.
+ */
+int EmpowerFramer::fill(uint32_t &offset) {
+
+	uint32_t avail = _chunk->length() - offset;
+
+	if (!_partial) {
+		uint32_t n = PREFIX - _prefix_length;
+		n = n < avail ? n : avail;
+		memcpy(_prefix + _prefix_length, _chunk->data() + offset, n);
+		_prefix_length += n;
+		_copied_bytes += n;
+		offset += n;
+		avail -= n;
+		if (_prefix_length < PREFIX) {
+			return 0;
+		}
+		uint32_t length;
+		if (!valid(_prefix, length)) {
+			return -1;
+		}
+		_partial = Packet::make(length);
+		if (!_partial) {
+			return -1;
+		}
+		memcpy(_partial->data(), _prefix, PREFIX);
+		_partial_length = PREFIX;
+		_prefix_length = 0;
+	}
+
+	uint32_t n = _partial->length() - _partial_length;
+	n = n < avail ? n : avail;
+	memcpy(_partial->data() + _partial_length, _chunk->data() + offset, n);
+	_partial_length += n;
+	_copied_bytes += n;
+	offset += n;
+
+	return _partial_length == _partial->length() ? 1 : 0;
+
+}
+
+int EmpowerFramer::next(Packet *&p, uint32_t &offset) {
+
+	if (_done) {
+		_done->kill();
+		_done = 0;
+	}
+
+	if (!_chunk) {
+		return 0;
+	}
+
+	// finish a message split across chunks first
+	if (_partial || _prefix_length) {
+		int ret = fill(_offset);
+		if (ret > 0) {
+			_reassembled++;
+			_messages++;
+			_done = _partial;
+			_partial = 0;
+			_partial_length = 0;
+			p = _done;
+			offset = 0;
+			return 1;
+		}
+		if (ret < 0) {
+			_errors++;
+			reset();
+			return -1;
+		}
+		drop_chunk();
+		return 0;
+	}
+
+	uint32_t avail = _chunk->length() - _offset;
+
+	if (avail >= PREFIX) {
+		uint32_t length;
+		if (!valid(_chunk->data() + _offset, length)) {
+			_errors++;
+			reset();
+			return -1;
+		}
+		if (avail >= length) {
+			p = _chunk;
+			offset = _offset;
+			_offset += length;
+			_messages++;
+			return 1;
+		}
+	}
+
+	// keep the tail for the next chunk
+	if (avail) {
+		int ret = fill(_offset);
+		if (ret < 0) {
+			_errors++;
+			reset();
+			return -1;
+		}
+	}
+
+	drop_chunk();
+	return 0;
+
+}
+
+String EmpowerFramer::unparse() const {
+	StringAccum sa;
+	sa << "chunks " << _chunks << " messages " << _messages << " reassembled " << _reassembled;
+	sa << " copied_bytes " << _copied_bytes << " buffered " << buffered() << " errors " << _errors << "\n";
+	return sa.take_string();
+}
+
+CLICK_ENDDECLS
+ELEMENT_PROVIDES(EmpowerFramer)
@@ -0,0 +1,79 @@
+#ifndef CLICK_EMPOWER_EMPOWERFRAMER_HH
+#define CLICK_EMPOWER_EMPOWERFRAMER_HH
+#include <click/packet.hh>
+#include <click/straccum.hh>
+CLICK_DECLS
+
+/*
+ * Splits the byte stream of the controller connection into messages. Each
+ * message starts with an empower_header whose length field covers the
+ * whole message, so chunks read from the socket may hold several messages,
+ * or only part of one.
+ *
+ * Messages that lie entirely in a chunk are handed out in place, as the
+ * chunk and the offset of the message in it. Only a message split across
+ * chunks is copied, into a packet of its own. A header with a bad version
+ * or length means the stream lost sync: the buffered bytes and the rest of
+ * the chunk are dropped.
+ *
+ * Usage:
+ *
+ *	framer.push(p);
+ *	while ((r = framer.next(m, offset)) > 0)
+ *		dispatch(m, offset);
+ */
+class EmpowerFramer {
+public:
+
+	// version, type and length, the part of the header needed to know
+	// how long a message is
+	enum { PREFIX = 6, MAX_LENGTH = 65536 };
+
+	EmpowerFramer();
+	~EmpowerFramer();
+
+	// Appends a chunk of the stream, takes ownership of p. Any message
+	// not yet returned by next() is dropped.
+	void push(Packet *p);
+
+	// Returns 1 and the next complete message, 0 if there is none left in
+	// the chunk, -1 if the stream lost sync. The message stays valid until
+	// the following call to next() or push().
+	int next(Packet *&p, uint32_t &offset);
+
+	// Drops the buffered bytes, for example on reconnection.
+	void reset();
+
+	uint32_t buffered() const { return _partial ? _partial_length : _prefix_length; }
+
+	String unparse() const;
+
+private:
+
+	Packet *_chunk;
+	uint32_t _offset;
+
+	// a message split across chunks: its first PREFIX bytes until its
+	// length is known, then the message itself
+	uint8_t _prefix[PREFIX];
+	uint32_t _prefix_length;
+	WritablePacket *_partial;
+	uint32_t _partial_length;
+
+	// the reassembled message last returned by next()
+	Packet *_done;
+
+	uint32_t _chunks;
+	uint32_t _messages;
+	uint32_t _reassembled;
+	uint32_t _copied_bytes;
+	uint32_t _errors;
+
+	bool valid(const uint8_t *prefix, uint32_t &length);
+	int fill(uint32_t &offset);
+	void drop_chunk();
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,286 @@
+/*
+ * empowerlvapcache.{cc,hh} -- lock-free view of the LVAPs for the data path
+ *
+ * Copyright (c) 2018 CREATE-NET
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "empowerlvapcache.hh"
+CLICK_DECLS
+
+EmpowerLVAPCache::EmpowerLVAPCache() :
+	_slots(0), _mask(0), _live(0), _used(0), _generation(0), _rebuilds(0),
+	_nb_ssids(0), _next_ssid(1) {
+	_table_seq = 0;
+	memset(_ssid_refs, 0, sizeof(_ssid_refs));
+	_slots = new Slot[MIN_CAPACITY];
+	_mask = MIN_CAPACITY - 1;
+	for (uint32_t i = 0; i <= _mask; i++) {
+		_slots[i]._seq = 0;
+		_slots[i]._used = false;
+		_slots[i]._live = false;
+	}
+}
+
+EmpowerLVAPCache::~EmpowerLVAPCache() {
+	delete[] _slots;
+	for (int i = 0; i < _retired.size(); i++) {
+		delete[] _retired[i];
+	}
+}
+
+bool EmpowerLVAPCache::lookup(EtherAddress sta, EmpowerLVAPRecord &r) const {
+
+	for (;;) {
+
+		uint32_t table_seq = _table_seq.value();
+		if (table_seq & 1) {
+			// a writer is moving the table, let it finish
+			click_relax_fence();
+			continue;
+		}
+		click_read_fence();
+
+		// the mask before the slots: a larger table is always in place by
+		// the time its mask is
+		uint32_t mask = _mask;
+		click_read_fence();
+		const Slot *slots = _slots;
+
+		uint32_t i = empower_address_hash(sta) & mask;
+		bool found = false;
+
+		for (uint32_t probes = 0; probes <= mask; ) {
+			const Slot *s = &slots[i];
+			uint32_t seq = s->_seq.value();
+			if (seq & 1) {
+				click_relax_fence();
+				continue;
+			}
+			click_read_fence();
+			bool used = s->_used;
+			bool live = s->_live;
+			EmpowerLVAPRecord record = s->_record;
+			click_read_fence();
+			if (s->_seq.value() != seq) {
+				continue;
+			}
+			if (!used) {
+				break;
+			}
+			if (record._sta == sta) {
+				if (live) {
+					r = record;
+					found = true;
+				}
+				break;
+			}
+			i = (i + 1) & mask;
+			probes++;
+		}
+
+		click_read_fence();
+		if (_table_seq.value() == table_seq) {
+			return found;
+		}
+
+	}
+
+}
+
+/*
+ * Returns the slot that holds sta, live or not, or else the first free
+ * slot of its probe sequence. Called with the lock held.
+ */
+EmpowerLVAPCache::Slot *EmpowerLVAPCache::find_slot(EtherAddress sta) {
+	uint32_t i = empower_address_hash(sta) & _mask;
+	while (_slots[i]._used && _slots[i]._record._sta != sta) {
+		i = (i + 1) & _mask;
+	}
+	return &_slots[i];
+}
+
+void EmpowerLVAPCache::write_slot(Slot *s, const EmpowerLVAPRecord &r, bool live) {
+	s->_seq++;
+	click_write_fence();
+	s->_used = true;
+	s->_live = live;
+	s->_record = r;
+	click_write_fence();
+	s->_seq++;
+}
+
+/*
+ * Moves the live records into a table of the given capacity, dropping the
+ * slots of removed stations. A table of the same size is rebuilt in place.
+ */
+void EmpowerLVAPCache::rebuild(uint32_t capacity) {
+
+	Vector<EmpowerLVAPRecord> records;
+	for (uint32_t i = 0; i <= _mask; i++) {
+		if (_slots[i]._live) {
+			records.push_back(_slots[i]._record);
+		}
+	}
+
+	Slot *slots = _slots;
+	if (capacity != _mask + 1) {
+		slots = new Slot[capacity];
+	}
+
+	_table_seq++;
+	click_write_fence();
+
+	for (uint32_t i = 0; i < capacity; i++) {
+		slots[i]._seq = 0;
+		slots[i]._used = false;
+		slots[i]._live = false;
+	}
+
+	if (slots != _slots) {
+		_retired.push_back(_slots);
+		_slots = slots;
+		click_write_fence();
+		_mask = capacity - 1;
+	}
+
+	for (int i = 0; i < records.size(); i++) {
+		Slot *s = find_slot(records[i]._sta);
+		s->_used = true;
+		s->_live = true;
+		s->_record = records[i];
+	}
+
+	_used = records.size();
+	_live = records.size();
+	_rebuilds++;
+
+	click_write_fence();
+	_table_seq++;
+
+}
+
+void EmpowerLVAPCache::publish(const EmpowerLVAPRecord &r) {
+
+	_lock.acquire();
+
+	Slot *s = find_slot(r._sta);
+
+	if (!s->_used) {
+		// keep the table at most three quarters full, counting the slots
+		// of removed stations
+		if ((_used + 1) * 4 > (_mask + 1) * 3) {
+			uint32_t capacity = MIN_CAPACITY;
+			while (capacity < (_live + 1) * 2) {
+				capacity *= 2;
+			}
+			rebuild(capacity > _mask + 1 ? capacity : _mask + 1);
+			s = find_slot(r._sta);
+		}
+		_used++;
+	}
+
+	if (!s->_live) {
+		_live++;
+	} else {
+		unref(s->_record._ssid_id);
+	}
+
+	write_slot(s, r, true);
+	_generation++;
+
+	_lock.release();
+
+}
+
+void EmpowerLVAPCache::remove(EtherAddress sta) {
+
+	_lock.acquire();
+
+	Slot *s = find_slot(sta);
+
+	if (s->_live) {
+		unref(s->_record._ssid_id);
+		write_slot(s, s->_record, false);
+		_live--;
+		_generation++;
+	}
+
+	_lock.release();
+
+}
+
+uint16_t EmpowerLVAPCache::intern(const String &ssid) {
+
+	if (!ssid) {
+		return 0;
+	}
+
+	_lock.acquire();
+
+	uint16_t id = 0;
+
+	for (uint32_t i = 1; i < MAX_SSIDS; i++) {
+		if (_ssid_refs[i] && _ssids[i] == ssid) {
+			id = i;
+			break;
+		}
+	}
+
+	// a free index, looking from the last one given out: an index that was
+	// just freed may still be in records copied by the data path
+	for (uint32_t n = 1; !id && n < MAX_SSIDS; n++) {
+		uint32_t i = _next_ssid;
+		_next_ssid = (_next_ssid + 1 < MAX_SSIDS) ? _next_ssid + 1 : 1;
+		if (!_ssid_refs[i]) {
+			_ssids[i] = ssid;
+			_nb_ssids++;
+			id = i;
+		}
+	}
+
+	if (id) {
+		_ssid_refs[id]++;
+	}
+
+	_lock.release();
+
+	return id;
+
+}
+
+void EmpowerLVAPCache::release(uint16_t id) {
+	_lock.acquire();
+	unref(id);
+	_lock.release();
+}
+
+void EmpowerLVAPCache::unref(uint16_t id) {
+	if (!id || id >= MAX_SSIDS || !_ssid_refs[id]) {
+		return;
+	}
+	if (!--_ssid_refs[id]) {
+		_ssids[id] = String();
+		_nb_ssids--;
+	}
+}
+
+String EmpowerLVAPCache::unparse() const {
+	StringAccum sa;
+	sa << "entries " << _live << " capacity " << (_mask + 1) << " used " << _used;
+	sa << " generation " << _generation << " rebuilds " << _rebuilds << " ssids " << _nb_ssids << "\n";
+	return sa.take_string();
+}
+
+CLICK_ENDDECLS
+ELEMENT_PROVIDES(EmpowerLVAPCache)
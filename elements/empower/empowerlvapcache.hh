@@ -0,0 +1,147 @@
+#ifndef CLICK_EMPOWER_EMPOWERLVAPCACHE_HH
+#define CLICK_EMPOWER_EMPOWERLVAPCACHE_HH
+#include <click/etheraddress.hh>
+#include <click/atomic.hh>
+#include <click/sync.hh>
+#include <click/vector.hh>
+#include <click/straccum.hh>
+CLICK_DECLS
+
+class TxPolicyInfo;
+
+/*
+ * Hash of a station address for tables, shards and slots indexed by its
+ * low bits. EtherAddress::hashcode() keeps the low bits of the address
+ * almost as they are, and stations of one vendor, or made up by a test,
+ * differ only in the last bytes, so the bits are mixed first.
+ */
+static inline uint32_t empower_address_hash(EtherAddress eth) {
+	uint32_t h = eth.hashcode();
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+// What the data path needs to know about an LVAP, copied out of the
+// EmpowerStationState whenever the manager changes it.
+class EmpowerLVAPRecord {
+public:
+
+	enum {
+		VALID = (1<<0),
+		AUTHENTICATED = (1<<1),
+		ASSOCIATED = (1<<2),
+		SET_MASK = (1<<3)
+	};
+
+	EtherAddress _sta;
+	EtherAddress _bssid;
+	EtherAddress _encap;
+	TxPolicyInfo *_txp;
+	int _iface_id;
+	uint16_t _ssid_id;
+	uint8_t _flags;
+
+	EmpowerLVAPRecord() : _txp(0), _iface_id(-1), _ssid_id(0), _flags(0) {
+	}
+
+	// same test as EmpowerStationState::is_valid()
+	bool is_valid(int iface_id) const {
+		return _iface_id == iface_id && (_flags & VALID);
+	}
+
+	bool authenticated() const { return _flags & AUTHENTICATED; }
+	bool associated() const { return _flags & ASSOCIATED; }
+	bool set_mask() const { return _flags & SET_MASK; }
+
+};
+
+/*
+ * Read-mostly table of LVAP records, indexed by station address, for the
+ * elements on the data path. A lookup costs one probe sequence in an open
+ * addressing table and no lock, and returns a copy of the record that is
+ * consistent even if the manager changes the LVAP at the same time on
+ * another thread.
+ *
+ * Every slot carries a sequence number that is odd while the slot is being
+ * written: readers copy the slot and try again if the number moved. Growing
+ * or compacting the table bumps a sequence number of the table in the same
+ * way. Tables that were replaced are kept until the cache is destroyed,
+ * since a reader may still be probing one; they only go when the table
+ * doubles.
+ *
+ * SSIDs are interned: a record holds the index of its SSID. Indexes are
+ * counted references, taken by intern() and dropped by release(), and a
+ * published record owns the one it carries until it is replaced or
+ * removed. An index whose last reference is dropped is given to another
+ * SSID later on, as late as possible. Index 0 is the empty SSID, or no
+ * index at all.
+ *
+ * Writers are serialized by a lock of their own.
+ */
+class EmpowerLVAPCache {
+public:
+
+	enum { MAX_SSIDS = 256, MIN_CAPACITY = 64 };
+
+	EmpowerLVAPCache();
+	~EmpowerLVAPCache();
+
+	// Copies the record of sta into r. Returns false if sta has no LVAP.
+	bool lookup(EtherAddress sta, EmpowerLVAPRecord &r) const;
+
+	// Adds or replaces the record of r._sta, which takes over the reference
+	// to r._ssid_id.
+	void publish(const EmpowerLVAPRecord &r);
+	void remove(EtherAddress sta);
+
+	// Returns the index of ssid with a reference taken, 0 if the SSID table
+	// is full.
+	uint16_t intern(const String &ssid);
+	void release(uint16_t id);
+
+	// Bumped by every change, for readers that keep results of their own.
+	uint32_t generation() const { return _generation; }
+
+	uint32_t size() const { return _live; }
+
+	String unparse() const;
+
+private:
+
+	struct Slot {
+		atomic_uint32_t _seq;
+		bool _used;
+		bool _live;
+		EmpowerLVAPRecord _record;
+	};
+
+	Slot *_slots;
+	uint32_t _mask;
+	atomic_uint32_t _table_seq;
+	Vector<Slot *> _retired;
+
+	uint32_t _live;
+	uint32_t _used;
+	uint32_t _generation;
+	uint32_t _rebuilds;
+
+	String _ssids[MAX_SSIDS];
+	uint32_t _ssid_refs[MAX_SSIDS];
+	uint32_t _nb_ssids;
+	uint32_t _next_ssid;
+
+	Spinlock _lock;
+
+	Slot *find_slot(EtherAddress sta);
+	void write_slot(Slot *, const EmpowerLVAPRecord &, bool live);
+	void rebuild(uint32_t capacity);
+	void unref(uint16_t id);
+
+};
+
+CLICK_ENDDECLS
+#endif
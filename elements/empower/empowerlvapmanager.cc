@@ -37,17 +37,33 @@
 CLICK_DECLS
 
 EmpowerLVAPManager::EmpowerLVAPManager() :
-		_period(2000), _timer(this), _e11k(0), _ebs(0), _eauthr(0), _eassor(0),
-		_edeauthr(0), _ers(0), _mtbl(0), _seq(0), _debug(false) {
+		_period(2000), _timer(this), _batch(0), _batch_messages(0),
+		_batch_size(8192), _max_delay(2), _flush_timer(this), _flushes(0),
+		_flushed_messages(0), _flushed_bytes(0), _max_flush_messages(0),
+		_max_flush_bytes(0), _e11k(0), _ebs(0), _eauthr(0), _eassor(0),
+		_edeauthr(0), _ers(0), _mtbl(0), _mask_delay(20), _mask_thread(-1), _mask_timer(this),
+		_mask_task(this), _mask_updates(0), _mask_recomputes(0), _mask_changes(0),
+		_mask_writes(0), _mask_write_errors(0), _seq(0), _debug(false) {
 }
 
 EmpowerLVAPManager::~EmpowerLVAPManager() {
+	if (_batch) {
+		_batch->kill();
+	}
 }
 
 int EmpowerLVAPManager::initialize(ErrorHandler *) {
+	_mask_timer.initialize(this);
+	_mask_task.initialize(this, false);
+	if (_mask_thread >= 0) {
+		_mask_task.move_thread(_mask_thread);
+	}
 	compute_bssid_mask();
+	// first write right away, the data path is not running yet
+	write_masks();
 	_timer.initialize(this);
 	_timer.schedule_now();
+	_flush_timer.initialize(this);
 	return 0;
 }
 
@@ -86,9 +102,17 @@ int EmpowerLVAPManager::configure(Vector<String> &conf,
 			          .read("REGMONS", regmon_strings)
 								.read("MTBL", ElementCastArg("EmpowerMulticastTable"), _mtbl)
 				  			.read("PERIOD", _period)
+			          .read("MAX_DELAY", _max_delay)
+			          .read("BATCH_SIZE", _batch_size)
+			          .read("MASK_DELAY", _mask_delay)
+			          .read("MASK_THREAD", _mask_thread)
 			          .read("DEBUG", _debug)
 			          .complete();
 
+	if (_batch_size < sizeof(empower_header)) {
+		return errh->error("BATCH_SIZE must be at least %u bytes", sizeof(empower_header));
+	}
+
 	cp_spacevec(debugfs_strings, _debugfs_strings);
 
 	for (int i = 0; i < _debugfs_strings.size(); i++) {
@@ -172,11 +196,30 @@ int EmpowerLVAPManager::configure(Vector<String> &conf,
 		return errh->error("regmons has %u values, while masks has %u values", _regmons.size(), _masks.size());
 	}
 
+	for (int i = 0; i < _masks.size(); i++) {
+		EmpowerBSSIDMask mask;
+		if (_ifaces.find(i) != _ifaces.end()) {
+			mask.set_hwaddr(_ifaces.get(i)->_hwaddr);
+		}
+		_bssid_masks.push_back(mask);
+		_mask_dirty.push_back(true);
+	}
+
 	return res;
 
 }
 
-void EmpowerLVAPManager::run_timer(Timer *) {
+void EmpowerLVAPManager::run_timer(Timer *timer) {
+
+	if (timer == &_flush_timer) {
+		flush();
+		return;
+	}
+
+	if (timer == &_mask_timer) {
+		_mask_task.reschedule();
+		return;
+	}
 
 	// send hello request
 	send_hello_request();
@@ -304,9 +347,85 @@ void EmpowerLVAPManager::send_probe_request(uint32_t iface_id, EtherAddress src,
 }
 
 void EmpowerLVAPManager::send_message(Packet *p) {
+
+	if (!_max_delay) {
+		account_flush(1, p->length());
+		output(0).push(p);
+		return;
+	}
+
+	// the batch is sent with the lock held, so that messages leave in
+	// the order they were queued
+	_batch_lock.acquire();
+
+	if (_batch && _batch->length() + p->length() > _batch_size) {
+		flush_batch();
+	}
+
+	if (p->length() >= _batch_size) {
+		account_flush(1, p->length());
+		output(0).push(p);
+		_batch_lock.release();
+		return;
+	}
+
+	if (!_batch) {
+		_batch = Packet::make(0, 0, 0, _batch_size);
+		if (!_batch) {
+			click_chatter("%{element} :: %s :: cannot make packet!",
+					      this,
+					      __func__);
+			account_flush(1, p->length());
+			output(0).push(p);
+			_batch_lock.release();
+			return;
+		}
+		_flush_timer.schedule_after_msec(_max_delay);
+	}
+
+	// in place, the batch has room for _batch_size bytes
+	uint32_t length = p->length();
+	_batch = _batch->put(length);
+	memcpy(_batch->end_data() - length, p->data(), length);
+	_batch_messages++;
+	p->kill();
+
+	_batch_lock.release();
+
+}
+
+/*
+ * Sends the waiting messages. The caller holds _batch_lock.
+ */
+void EmpowerLVAPManager::flush_batch() {
+	if (!_batch) {
+		return;
+	}
+	WritablePacket *p = _batch;
+	account_flush(_batch_messages, p->length());
+	_batch = 0;
+	_batch_messages = 0;
 	output(0).push(p);
 }
 
+void EmpowerLVAPManager::flush() {
+	_batch_lock.acquire();
+	flush_batch();
+	_batch_lock.release();
+}
+
+void EmpowerLVAPManager::account_flush(uint32_t messages, uint32_t bytes) {
+	_flushes++;
+	_flushed_messages += messages;
+	_flushed_bytes += bytes;
+	if (messages > _max_flush_messages) {
+		_max_flush_messages = messages;
+	}
+	if (bytes > _max_flush_bytes) {
+		_max_flush_bytes = bytes;
+	}
+}
+
 void EmpowerLVAPManager::send_hello_request() {
 
 	WritablePacket *p = Packet::make(sizeof(empower_hello_request));
@@ -367,6 +486,17 @@ void EmpowerLVAPManager::send_status_slice(uint32_t iface_id, String ssid, int d
 		status->set_flag(EMPOWER_AMSDU_AGGREGATION);
 	}
 
+	if (queue->_aqm._enabled) {
+		status->set_flag(EMPOWER_AQM);
+	}
+
+	if (queue->_aqm._ecn) {
+		status->set_flag(EMPOWER_AQM_ECN);
+	}
+
+	status->set_aqm_target(queue->_aqm._target.usecval());
+	status->set_aqm_interval(queue->_aqm._interval.usecval());
+
 	send_message(p);
 }
 
@@ -375,7 +505,14 @@ int EmpowerLVAPManager::handle_slice_stats_request(Packet *p, uint32_t offset) {
 	empower_slice_stats_request *q = (empower_slice_stats_request *) (p->data() + offset);
 	String ssid = q->ssid();
 	uint8_t dscp = q->dscp();
-	send_slice_stats_response(ssid, dscp, q->xid());
+	// controllers that do not know about the extended stats get the
+	// original response
+	if (q->length() < sizeof(empower_slice_stats_ext_request)) {
+		send_slice_stats_response(ssid, dscp, q->xid());
+		return 0;
+	}
+	empower_slice_stats_ext_request *r = (empower_slice_stats_ext_request *) q;
+	send_slice_stats_ext_response(ssid, dscp, q->xid(), r->flags(EMPOWER_SLICE_STATS_STATIONS));
     return 0;
 }
 
@@ -427,6 +564,8 @@ void EmpowerLVAPManager::send_slice_stats_response(String ssid, uint8_t dscp, ui
     stats->set_seq(get_next_seq());
     stats->set_xid(xid);
     stats->set_wtp(_wtp);
+    stats->set_ssid(ssid);
+    stats->set_dscp(dscp);
     stats->set_nb_entries(_eqms.size());
 
 	uint8_t *ptr = (uint8_t *) stats;
@@ -441,21 +580,15 @@ void EmpowerLVAPManager::send_slice_stats_response(String ssid, uint8_t dscp, ui
 		assert (ptr <= end);
 
 		empower_slice_stats_entry *entry = (empower_slice_stats_entry *) ptr;
-
-		SIter itr = _eqms[i]->slices()->find(slice);
+		SliceQueue *queue = _eqms[i]->slices()->get(slice);
 
 		entry->set_iface_id(i);
 
-		if (itr != _eqms[i]->slices()->end()) {
-			entry->set_deficit_used(itr.value()->_deficit_used);
-			entry->set_max_queue_length(itr.value()->_max_queue_length);
-			entry->set_tx_bytes(itr.value()->_tx_bytes);
-			entry->set_tx_packets(itr.value()->_tx_packets);
-		} else {
-			entry->set_deficit_used(0);
-			entry->set_max_queue_length(0);
-			entry->set_tx_bytes(0);
-			entry->set_tx_packets(0);
+		if (queue) {
+			entry->set_deficit_used(queue->_deficit_used);
+			entry->set_max_queue_length(queue->_max_queue_length);
+			entry->set_tx_bytes(queue->_tx_bytes);
+			entry->set_tx_packets(queue->_tx_packets);
 		}
 
 		ptr += sizeof(empower_slice_stats_entry);
@@ -466,6 +599,116 @@ void EmpowerLVAPManager::send_slice_stats_response(String ssid, uint8_t dscp, ui
 
 }
 
+void EmpowerLVAPManager::send_slice_stats_ext_response(String ssid, uint8_t dscp, uint32_t xid, bool stations) {
+
+	Slice slice = Slice(ssid, dscp);
+
+	// One entry per interface, followed by one entry per station if asked
+	// for. The station queues are counted first and each slice is locked
+	// again only while its stations are written: stations that show up in
+	// the meantime are left out, and the room of those that went away is
+	// trimmed off the end.
+	Vector<SliceQueue *> queues;
+	Vector<uint32_t> room;
+	uint32_t len = sizeof(empower_slice_stats_response);
+
+	for (int i = 0; i < _eqms.size(); i++) {
+		SliceQueue *queue = _eqms[i]->slices()->get(slice);
+		uint32_t nb_stations = 0;
+		if (queue && stations) {
+			queue->_queues_lock.acquire_read();
+			nb_stations = queue->_queues.size();
+			queue->_queues_lock.release_read();
+			if (nb_stations > 0xFFFF) {
+				nb_stations = 0xFFFF;
+			}
+		}
+		queues.push_back(queue);
+		room.push_back(nb_stations);
+		len += sizeof(empower_slice_stats_ext_entry) + nb_stations * sizeof(empower_slice_stats_station_entry);
+	}
+
+    WritablePacket *p = Packet::make(len);
+
+    if (!p) {
+        click_chatter("%{element} :: %s :: cannot make packet!",
+                      this,
+                      __func__);
+        return;
+    }
+
+    memset(p->data(), 0, p->length());
+
+    empower_slice_stats_response *stats = (empower_slice_stats_response *) (p->data());
+    stats->set_version(_empower_version);
+    stats->set_type(EMPOWER_PT_SLICE_STATS_EXT_RESPONSE);
+    stats->set_seq(get_next_seq());
+    stats->set_xid(xid);
+    stats->set_wtp(_wtp);
+    stats->set_ssid(ssid);
+    stats->set_dscp(dscp);
+    stats->set_nb_entries(_eqms.size());
+
+	uint8_t *ptr = (uint8_t *) stats;
+	ptr += sizeof(empower_slice_stats_response);
+
+	for (int i = 0; i < _eqms.size(); i++) {
+
+		empower_slice_stats_ext_entry *entry = (empower_slice_stats_ext_entry *) ptr;
+		SliceQueue *queue = queues[i];
+
+		entry->set_iface_id(i);
+
+		ptr += sizeof(empower_slice_stats_ext_entry);
+
+		if (!queue) {
+			continue;
+		}
+
+		entry->set_deficit_used(queue->_deficit_used);
+		entry->set_max_queue_length(queue->_max_queue_length);
+		entry->set_tx_bytes(queue->_tx_bytes);
+		entry->set_tx_packets(queue->_tx_packets);
+		entry->set_aqm_drops(queue->_aqm._drops);
+		entry->set_aqm_marks(queue->_aqm._marks);
+		for (int b = 0; b < SojournAQMParams::HISTOGRAM_BUCKETS; b++) {
+			entry->set_sojourn(b, queue->_aqm._histogram[b]);
+		}
+		entry->set_ur_repeats(queue->_ur_repeats);
+		entry->set_ur_airtime(queue->_ur_airtime);
+
+		if (!room[i]) {
+			continue;
+		}
+
+		uint32_t nb_stations = 0;
+
+		queue->_queues_lock.acquire_read();
+		for (AQIter it = queue->_queues.begin(); it != queue->_queues.end() && nb_stations < room[i]; it++) {
+			empower_slice_stats_station_entry *sta = (empower_slice_stats_station_entry *) ptr;
+			AggregationQueue *aq = it.value();
+			sta->set_sta(aq->pair()._ra);
+			sta->set_airtime_used(aq->_airtime);
+			sta->set_tx_packets(aq->_tx_packets);
+			sta->set_tx_bytes(aq->_tx_bytes);
+			ptr += sizeof(empower_slice_stats_station_entry);
+			nb_stations++;
+		}
+		queue->_queues_lock.release_read();
+
+		entry->set_nb_stations(nb_stations);
+
+	}
+
+	uint32_t used = ptr - p->data();
+	assert(used <= len);
+	p->take(len - used);
+	stats->set_length(used);
+
+    send_message(p);
+
+}
+
 void EmpowerLVAPManager::send_status_lvap(EtherAddress sta) {
 
 	EmpowerStationState *ess = _lvaps.get_pointer(sta);
@@ -632,26 +875,8 @@ void EmpowerLVAPManager::send_img_response(uint32_t iface_id, int type, uint32_t
 
 	// Select stations active on the specified resource element (iface_id)
 
-	Vector<DstInfo> neighbors;
-	_ers->lock.acquire_read();
-
-	if (type == EMPOWER_PT_UCQM_RESPONSE) {
-		for (NTIter iter = _ers->stas.begin(); iter.live(); iter++) {
-			if (iter.value()._iface_id != iface_id) {
-				continue;
-			}
-			neighbors.push_back(iter.value());
-		}
-	} else {
-		for (NTIter iter = _ers->aps.begin(); iter.live(); iter++) {
-			if (iter.value()._iface_id != iface_id) {
-				continue;
-			}
-			neighbors.push_back(iter.value());
-		}
-	}
-
-	_ers->lock.release_read();
+	Vector<NeighborStats> neighbors;
+	_ers->neighbors(type == EMPOWER_PT_UCQM_RESPONSE, iface_id, neighbors);
 
 	int len = sizeof(empower_cqm_response) + neighbors.size() * sizeof(cqm_entry);
 	WritablePacket *p = Packet::make(len);
@@ -688,7 +913,7 @@ void EmpowerLVAPManager::send_img_response(uint32_t iface_id, int type, uint32_t
 		entry->set_last_rssi_std(neighbors[i]._last_std);
 		entry->set_last_packets(neighbors[i]._last_packets);
 		entry->set_hist_packets(neighbors[i]._hist_packets);
-		entry->set_mov_rssi(neighbors[i]._sma_rssi->avg());
+		entry->set_mov_rssi(neighbors[i]._sma_rssi);
 		ptr += sizeof(cqm_entry);
 	}
 
@@ -756,9 +981,62 @@ void EmpowerLVAPManager::send_wifi_stats_response(uint32_t iface_id, uint32_t xi
 
 }
 
+void EmpowerLVAPManager::send_wifi_stats_range_response(uint32_t iface_id, uint32_t xid, uint8_t tier, uint64_t from, uint64_t to) {
+
+	RegmonBuckets buckets[3];
+	int nb_entries = 0;
+
+	for (int i = 0; i < 3; i++) {
+		_regmons[iface_id]->registers(i)->history(tier, from, to, buckets[i]);
+		nb_entries += buckets[i].size();
+	}
+
+	int len = sizeof(empower_wifi_stats_range_response) + sizeof(wifi_stats_range_entry) * nb_entries;
+	WritablePacket *p = Packet::make(len);
+
+	if (!p) {
+		click_chatter("%{element} :: %s :: cannot make packet!",
+					  this,
+					  __func__);
+		return;
+	}
+
+	memset(p->data(), 0, p->length());
+
+	empower_wifi_stats_range_response *stats = (empower_wifi_stats_range_response *) (p->data());
+	stats->set_version(_empower_version);
+	stats->set_length(len);
+	stats->set_type(EMPOWER_PT_WIFI_STATS_RANGE_RESPONSE);
+	stats->set_seq(get_next_seq());
+	stats->set_xid(xid);
+	stats->set_wtp(_wtp);
+	stats->set_iface_id(iface_id);
+	stats->set_tier(tier);
+	stats->set_nb_entries(nb_entries);
+
+	wifi_stats_range_entry *entry = (wifi_stats_range_entry *) (p->data() + sizeof(empower_wifi_stats_range_response));
+
+	for (int i = 0; i < 3; i++) {
+		uint8_t type = _regmons[iface_id]->registers(i)->_type;
+		for (RegmonBuckets::const_iterator it = buckets[i].begin(); it != buckets[i].end(); it++) {
+			entry->set_type(type);
+			entry->set_timestamp(it->_timestamp);
+			entry->set_min(it->_min);
+			entry->set_avg(it->avg());
+			entry->set_max(it->_max);
+			entry->set_count(it->_count);
+			entry++;
+		}
+	}
+
+	send_message(p);
+
+}
+
 void EmpowerLVAPManager::send_summary_trigger(SummaryTrigger * summary) {
 
-	int len = sizeof(empower_summary_trigger) + summary->_frames.size() * sizeof(summary_entry);
+	uint32_t nb_frames = summary->size();
+	int len = sizeof(empower_summary_trigger) + nb_frames * sizeof(summary_entry);
 	WritablePacket *p = Packet::make(len);
 
 	if (!p) {
@@ -768,7 +1046,7 @@ void EmpowerLVAPManager::send_summary_trigger(SummaryTrigger * summary) {
 		return;
 	}
 
-	memset(p->data(), 0, p->length());
+	memset(p->data(), 0, sizeof(empower_summary_trigger));
 
 	empower_summary_trigger* request = (empower_summary_trigger *) (p->data());
 	request->set_version(_empower_version);
@@ -777,29 +1055,34 @@ void EmpowerLVAPManager::send_summary_trigger(SummaryTrigger * summary) {
 	request->set_seq(get_next_seq());
 	request->set_xid(summary->_trigger_id);
 	request->set_wtp(_wtp);
-	request->set_nb_frames(summary->_frames.size());
+	request->set_nb_frames(nb_frames);
 	request->set_iface_id(summary->_iface_id);
 
-	uint8_t *ptr = (uint8_t *) request;
-	ptr += sizeof(empower_summary_trigger);
-	uint8_t *end = ptr + (len - sizeof(empower_summary_trigger));
+	summary_entry *entry = (summary_entry *) (p->data() + sizeof(empower_summary_trigger));
 
-	for (int i = 0; i < summary->_frames.size(); i++) {
-		assert (ptr <= end);
-		summary_entry *entry = (summary_entry *) ptr;
-		entry->set_ra(summary->_frames[i]._ra);
-		entry->set_ta(summary->_frames[i]._ta);
-		entry->set_tsft(summary->_frames[i]._tsft);
-		entry->set_seq(summary->_frames[i]._seq);
-		entry->set_rssi(summary->_frames[i]._rssi);
-		entry->set_rate(summary->_frames[i]._rate);
-		entry->set_length(summary->_frames[i]._length);
-		entry->set_type(summary->_frames[i]._type);
-		entry->set_subtype(summary->_frames[i]._subtype);
-		ptr += sizeof(summary_entry);
+	// every field of an entry is written, straight from the ring
+	for (uint32_t i = 0; i < nb_frames; i++, entry++) {
+		const Frame &frame = summary->frame(i);
+		entry->set_ra(frame._ra);
+		entry->set_ta(frame._ta);
+		entry->set_tsft(frame._tsft);
+		entry->set_seq(frame._seq);
+		entry->set_rssi(frame._rssi);
+		entry->set_rate(frame._rate);
+		entry->set_length(frame._length);
+		entry->set_type(frame._type);
+		entry->set_subtype(frame._subtype);
+	}
+
+	if (summary->_dropped && _debug) {
+		click_chatter("%{element} :: %s :: summary %u dropped %u frames",
+				      this,
+				      __func__,
+				      summary->_trigger_id,
+				      summary->_dropped);
 	}
 
-	summary->_frames.clear();
+	summary->reset();
 
 	send_message(p);
 
@@ -1197,8 +1480,11 @@ int EmpowerLVAPManager::handle_add_vap(Packet *p, uint32_t offset) {
 		state._iface_id = iface_id;
 		_vaps.set(bssid, state);
 
-		/* Regenerate the BSSID mask */
-		compute_bssid_mask();
+		/* Add the BSSID to the mask */
+		mask_vap(_vaps.get_pointer(bssid), true);
+		update_masks();
+
+		update_fanout(iface_id);
 
 		/* create default slice */
 		if (ssid != "") {
@@ -1229,10 +1515,15 @@ int EmpowerLVAPManager::handle_del_vap(Packet *p, uint32_t offset) {
 		return -1;
 	}
 
-	_vaps.erase(_vaps.find(bssid));
+	int iface_id = _vaps.find(bssid).value()._iface_id;
 
 	// Remove this VAP's BSSID from the mask
-	compute_bssid_mask();
+	mask_vap(_vaps.get_pointer(bssid), false);
+	update_masks();
+
+	_vaps.erase(_vaps.find(bssid));
+
+	update_fanout(iface_id);
 
 	return 0;
 
@@ -1309,8 +1600,11 @@ int EmpowerLVAPManager::handle_add_lvap(Packet *p, uint32_t offset) {
 
 		_lvaps.set(sta, state);
 
-		/* Regenerate the BSSID mask */
-		compute_bssid_mask();
+		/* Add the LVAP's BSSIDs to the mask */
+		mask_lvap(_lvaps.get_pointer(sta), true);
+		update_masks();
+
+		publish_lvap(sta);
 
 		/* send add lvap response message */
 		send_add_del_lvap_response(EMPOWER_PT_ADD_LVAP_RESPONSE, state._sta, xid, 0);
@@ -1323,6 +1617,8 @@ int EmpowerLVAPManager::handle_add_lvap(Packet *p, uint32_t offset) {
 			_eqms[iface_id]->set_default_slice(ssid);
 		}
 
+		update_fanout(iface_id);
+
 		return 0;
 
 	}
@@ -1330,6 +1626,8 @@ int EmpowerLVAPManager::handle_add_lvap(Packet *p, uint32_t offset) {
 	/* just update lvap with new configuration */
 	EmpowerStationState *ess = _lvaps.get_pointer(sta);
 
+	mask_lvap(ess, false);
+
 	ess->_bssid = bssid;
 	ess->_ssid = ssid;
 	ess->_networks = networks;
@@ -1340,11 +1638,21 @@ int EmpowerLVAPManager::handle_add_lvap(Packet *p, uint32_t offset) {
 	ess->_set_mask = set_mask;
 	ess->_ht_caps_info = ht_caps_info;
 
+	/* The BSSIDs or the mask flag may have changed */
+	mask_lvap(ess, true);
+	update_masks();
+
+	publish_lvap(sta);
+
 	/* send add lvap response message */
 	send_add_del_lvap_response(EMPOWER_PT_ADD_LVAP_RESPONSE, ess->_sta, xid, 0);
 
+	int lvap_iface_id = ess->_iface_id;
+
 	_lock.release_write();
 
+	update_fanout(lvap_iface_id);
+
 	return 0;
 
 }
@@ -1414,6 +1722,7 @@ int EmpowerLVAPManager::handle_set_port(Packet *p, uint32_t offset) {
 
 	_rcs[iface_id]->tx_policies()->insert(addr, mcs, ht_mcs, no_ack, tx_mcast, ur, rts_cts, max_amsdu_len);
 	_rcs[iface_id]->forget_station(addr);
+	publish_lvap(addr);
 
 	MinstrelDstInfo *nfo = _rcs.at(iface_id)->neighbors()->findp(addr);
 
@@ -1437,6 +1746,7 @@ int EmpowerLVAPManager::handle_del_port(Packet *p, uint32_t offset) {
 
 	_rcs[iface_id]->tx_policies()->remove(addr);
 	_rcs[iface_id]->forget_station(addr);
+	publish_lvap(addr);
 
 	return 0;
 
@@ -1466,6 +1776,87 @@ int EmpowerLVAPManager::handle_del_summary_trigger(Packet *p, uint32_t offset) {
 	return 0;
 }
 
+int EmpowerLVAPManager::remove_lvap(EtherAddress sta) {
+
+	EmpowerStationState *ess = _lvaps.get_pointer(sta);
+
+	// Stop the data path first
+	_lvap_cache.remove(sta);
+
+	// Forget station
+	_rcs[ess->_iface_id]->tx_policies()->remove(ess->_sta);
+	_rcs[ess->_iface_id]->forget_station(ess->_sta);
+
+	// Drop its queues and whatever is still in them
+	_eqms[ess->_iface_id]->forget_station(ess->_sta);
+
+	// No more multicast for it
+	if (_mtbl) {
+		_mtbl->leave_all_groups(ess->_sta);
+	}
+
+	int iface_id = ess->_iface_id;
+
+	// Remove this LVAP's BSSIDs from the mask
+	mask_lvap(ess, false);
+	update_masks();
+
+	// Erase lvap
+	_lvaps.erase(_lvaps.find(sta));
+
+	update_fanout(iface_id);
+
+	return 0;
+
+}
+
+/*
+ * Copies the LVAP of sta, as it is now, to the records read by the data
+ * path. Called after every change to an LVAP or to its transmission policy.
+ */
+void EmpowerLVAPManager::publish_lvap(EtherAddress sta) {
+
+	EmpowerStationState *ess = _lvaps.get_pointer(sta);
+
+	if (!ess) {
+		_lvap_cache.remove(sta);
+		return;
+	}
+
+	EmpowerLVAPRecord r;
+	r._sta = ess->_sta;
+	r._bssid = ess->_bssid;
+	r._encap = ess->_encap;
+	r._iface_id = ess->_iface_id;
+	r._ssid_id = _lvap_cache.intern(ess->_ssid);
+
+	if (ess->_iface_id >= 0 && ess->_iface_id < _rcs.size()) {
+		r._txp = _rcs[ess->_iface_id]->tx_policies()->lookup(ess->_sta);
+	}
+
+	if (ess->_authentication_status) {
+		r._flags |= EmpowerLVAPRecord::AUTHENTICATED;
+	}
+	if (ess->_association_status) {
+		r._flags |= EmpowerLVAPRecord::ASSOCIATED;
+	}
+	if (ess->_set_mask) {
+		r._flags |= EmpowerLVAPRecord::SET_MASK;
+	}
+	if (r._txp && r._ssid_id && ess->is_valid(ess->_iface_id)) {
+		r._flags |= EmpowerLVAPRecord::VALID;
+	}
+
+	_lvap_cache.publish(r);
+
+}
+
+void EmpowerLVAPManager::update_fanout(int iface_id) {
+	if (iface_id >= 0 && iface_id < _eqms.size()) {
+		_eqms[iface_id]->update_fanout();
+	}
+}
+
 int EmpowerLVAPManager::handle_del_lvap(Packet *p, uint32_t offset) {
 
 	empower_del_lvap *q = (empower_del_lvap *) (p->data() + offset);
@@ -1554,9 +1945,39 @@ int EmpowerLVAPManager::handle_counters_request(Packet *p, uint32_t offset) {
 }
 
 int EmpowerLVAPManager::handle_wifi_stats_request(Packet *p, uint32_t offset) {
+
 	empower_wifi_stats_request *q = (empower_wifi_stats_request *) (p->data() + offset);
-	send_wifi_stats_response(q->iface_id(), q->xid());
+
+	uint32_t iface_id = q->iface_id();
+
+	if (iface_id >= (uint32_t) _regmons.size()) {
+		click_chatter("%{element} :: %s :: invalid iface_id %u",
+					  this,
+					  __func__,
+					  iface_id);
+		return 0;
+	}
+
+	// controllers that do not know about tiers get all the raw samples
+	if (q->length() < sizeof(empower_wifi_stats_range_request)) {
+		send_wifi_stats_response(iface_id, q->xid());
+		return 0;
+	}
+
+	empower_wifi_stats_range_request *r = (empower_wifi_stats_range_request *) q;
+
+	if (r->tier() > EMPOWER_REGMON_60S) {
+		click_chatter("%{element} :: %s :: invalid tier %u",
+					  this,
+					  __func__,
+					  r->tier());
+		return 0;
+	}
+
+	send_wifi_stats_range_response(iface_id, q->xid(), r->tier(), r->from(), r->to());
+
 	return 0;
+
 }
 
 int EmpowerLVAPManager::handle_uimg_request(Packet *p, uint32_t offset) {
@@ -1588,8 +2009,19 @@ int EmpowerLVAPManager::handle_set_slice(Packet *p, uint32_t offset) {
 	uint32_t quantum = add_slice->quantum();
 	bool amsdu_aggregation = add_slice->flags(EMPOWER_AMSDU_AGGREGATION);
 	uint8_t scheduler = add_slice->scheduler();
+	bool aqm = add_slice->flags(EMPOWER_AQM);
+	bool ecn = add_slice->flags(EMPOWER_AQM_ECN);
+
+	// controllers that predate the AQM send the message without its fields
+	uint32_t aqm_target = 5000;
+	uint32_t aqm_interval = 100000;
+
+	if (add_slice->length() >= sizeof(empower_set_slice)) {
+		aqm_target = add_slice->aqm_target() ? add_slice->aqm_target() : aqm_target;
+		aqm_interval = add_slice->aqm_interval() ? add_slice->aqm_interval() : aqm_interval;
+	}
 
-	_eqms[iface_id]->set_slice(ssid, dscp, quantum, amsdu_aggregation, scheduler);
+	_eqms[iface_id]->set_slice(ssid, dscp, quantum, amsdu_aggregation, scheduler, aqm, ecn, aqm_target, aqm_interval);
 
 	return 0;
 
@@ -1613,132 +2045,131 @@ int EmpowerLVAPManager::handle_del_slice(Packet *p, uint32_t offset) {
 void EmpowerLVAPManager::push(int, Packet *p) {
 
 	/* This is a control packet coming from a Socket
-	 * element.
+	 * element, that is a chunk of the stream from the
+	 * controller. It may carry several messages, or
+	 * only part of one.
 	 */
 
-	if (p->length() < sizeof(empower_header)) {
-		click_chatter("%{element} :: %s :: Packet too small: %d Vs. %d",
+	_framer.push(p);
+
+	Packet *m;
+	uint32_t offset;
+	int ret;
+
+	while ((ret = _framer.next(m, offset)) > 0) {
+		dispatch(m, offset);
+	}
+
+	if (ret < 0) {
+		click_chatter("%{element} :: %s :: Invalid message header, dropping buffered stream (%s)",
 				      this,
 				      __func__,
-				      p->length(),
-				      sizeof(empower_header));
-		p->kill();
-		return;
+				      _framer.unparse().c_str());
 	}
 
-	uint32_t offset = 0;
+	// the replies to this chunk leave together
+	flush();
 
-	empower_header *w = (empower_header *) (p->data() + offset);
+}
 
-	if (w->version() != 0) {
-                click_chatter("%{element} :: %s :: Invalid version: expected 0, got %d",
-                                      this,
-                                      __func__,
-                                      w->version());
-                p->kill();
-                return;
-        }
+void EmpowerLVAPManager::dispatch(Packet *p, uint32_t offset) {
 
-	//while (offset < p->length()) {
-		switch (w->type()) {
-		case EMPOWER_PT_HELLO_RESPONSE:
-			handle_hello_response(p, offset);
-			break;
-		case EMPOWER_PT_TRIGGER_BEACON:
-			handle_trigger_beacon(p, offset);
-			break;
-		case EMPOWER_PT_ADD_LVAP:
-			handle_add_lvap(p, offset);
-			break;
-		case EMPOWER_PT_DEL_LVAP:
-			handle_del_lvap(p, offset);
-			break;
-		case EMPOWER_PT_ADD_VAP:
-			handle_add_vap(p, offset);
-			break;
-		case EMPOWER_PT_DEL_VAP:
-			handle_del_vap(p, offset);
-			break;
-		case EMPOWER_PT_PROBE_RESPONSE:
-			handle_probe_response(p, offset);
-			break;
-		case EMPOWER_PT_AUTH_RESPONSE:
-			handle_auth_response(p, offset);
-			break;
-		case EMPOWER_PT_ASSOC_RESPONSE:
-			handle_assoc_response(p, offset);
-			break;
-		case EMPOWER_PT_COUNTERS_REQUEST:
-			handle_counters_request(p, offset);
-			break;
-		case EMPOWER_PT_TXP_COUNTERS_REQUEST:
-			handle_txp_counters_request(p, offset);
-			break;
-		case EMPOWER_PT_ADD_RSSI_TRIGGER:
-			handle_add_rssi_trigger(p, offset);
-			break;
-		case EMPOWER_PT_DEL_RSSI_TRIGGER:
-			handle_del_rssi_trigger(p, offset);
-			break;
-		case EMPOWER_PT_ADD_SUMMARY_TRIGGER:
-			handle_add_summary_trigger(p, offset);
-			break;
-		case EMPOWER_PT_DEL_SUMMARY_TRIGGER:
-			handle_del_summary_trigger(p, offset);
-			break;
-		case EMPOWER_PT_UCQM_REQUEST:
-			handle_uimg_request(p, offset);
-			break;
-		case EMPOWER_PT_NCQM_REQUEST:
-			handle_nimg_request(p, offset);
-			break;
-		case EMPOWER_PT_SET_PORT:
-			handle_set_port(p, offset);
-			break;
-		case EMPOWER_PT_DEL_PORT:
-			handle_del_port(p, offset);
-			break;
-		case EMPOWER_PT_LVAP_STATS_REQUEST:
-			handle_lvap_stats_request(p, offset);
-			break;
-		case EMPOWER_PT_WIFI_STATS_REQUEST:
-			handle_wifi_stats_request(p, offset);
-			break;
-		case EMPOWER_PT_CAPS_REQUEST:
-			handle_caps_request(p, offset);
-			break;
-		case EMPOWER_PT_LVAP_STATUS_REQ:
-			handle_lvap_status_request(p, offset);
-			break;
-		case EMPOWER_PT_VAP_STATUS_REQ:
-			handle_vap_status_request(p, offset);
-			break;
-		case EMPOWER_PT_SET_SLICE:
-			handle_set_slice(p, offset);
-			break;
-		case EMPOWER_PT_DEL_SLICE:
-			handle_del_slice(p, offset);
-			break;
-		case EMPOWER_PT_SLICE_STATS_REQUEST:
-			handle_slice_stats_request(p, offset);
-			break;
-		case EMPOWER_PT_SLICE_STATUS_REQ:
-			handle_slice_status_request(p, offset);
-			break;
-		case EMPOWER_PT_PORT_STATUS_REQ:
-			handle_port_status_request(p, offset);
-			break;
-		default:
-			click_chatter("%{element} :: %s :: Unknown packet type: %d",
-					      this,
-					      __func__,
-					      w->type());
-		}
-		//offset += w->length();
-	//}
+	empower_header *w = (empower_header *) (p->data() + offset);
 
-	p->kill();
-	return;
+	switch (w->type()) {
+	case EMPOWER_PT_HELLO_RESPONSE:
+		handle_hello_response(p, offset);
+		break;
+	case EMPOWER_PT_TRIGGER_BEACON:
+		handle_trigger_beacon(p, offset);
+		break;
+	case EMPOWER_PT_ADD_LVAP:
+		handle_add_lvap(p, offset);
+		break;
+	case EMPOWER_PT_DEL_LVAP:
+		handle_del_lvap(p, offset);
+		break;
+	case EMPOWER_PT_ADD_VAP:
+		handle_add_vap(p, offset);
+		break;
+	case EMPOWER_PT_DEL_VAP:
+		handle_del_vap(p, offset);
+		break;
+	case EMPOWER_PT_PROBE_RESPONSE:
+		handle_probe_response(p, offset);
+		break;
+	case EMPOWER_PT_AUTH_RESPONSE:
+		handle_auth_response(p, offset);
+		break;
+	case EMPOWER_PT_ASSOC_RESPONSE:
+		handle_assoc_response(p, offset);
+		break;
+	case EMPOWER_PT_COUNTERS_REQUEST:
+		handle_counters_request(p, offset);
+		break;
+	case EMPOWER_PT_TXP_COUNTERS_REQUEST:
+		handle_txp_counters_request(p, offset);
+		break;
+	case EMPOWER_PT_ADD_RSSI_TRIGGER:
+		handle_add_rssi_trigger(p, offset);
+		break;
+	case EMPOWER_PT_DEL_RSSI_TRIGGER:
+		handle_del_rssi_trigger(p, offset);
+		break;
+	case EMPOWER_PT_ADD_SUMMARY_TRIGGER:
+		handle_add_summary_trigger(p, offset);
+		break;
+	case EMPOWER_PT_DEL_SUMMARY_TRIGGER:
+		handle_del_summary_trigger(p, offset);
+		break;
+	case EMPOWER_PT_UCQM_REQUEST:
+		handle_uimg_request(p, offset);
+		break;
+	case EMPOWER_PT_NCQM_REQUEST:
+		handle_nimg_request(p, offset);
+		break;
+	case EMPOWER_PT_SET_PORT:
+		handle_set_port(p, offset);
+		break;
+	case EMPOWER_PT_DEL_PORT:
+		handle_del_port(p, offset);
+		break;
+	case EMPOWER_PT_LVAP_STATS_REQUEST:
+		handle_lvap_stats_request(p, offset);
+		break;
+	case EMPOWER_PT_WIFI_STATS_REQUEST:
+		handle_wifi_stats_request(p, offset);
+		break;
+	case EMPOWER_PT_CAPS_REQUEST:
+		handle_caps_request(p, offset);
+		break;
+	case EMPOWER_PT_LVAP_STATUS_REQ:
+		handle_lvap_status_request(p, offset);
+		break;
+	case EMPOWER_PT_VAP_STATUS_REQ:
+		handle_vap_status_request(p, offset);
+		break;
+	case EMPOWER_PT_SET_SLICE:
+		handle_set_slice(p, offset);
+		break;
+	case EMPOWER_PT_DEL_SLICE:
+		handle_del_slice(p, offset);
+		break;
+	case EMPOWER_PT_SLICE_STATS_REQUEST:
+		handle_slice_stats_request(p, offset);
+		break;
+	case EMPOWER_PT_SLICE_STATUS_REQ:
+		handle_slice_status_request(p, offset);
+		break;
+	case EMPOWER_PT_PORT_STATUS_REQ:
+		handle_port_status_request(p, offset);
+		break;
+	default:
+		click_chatter("%{element} :: %s :: Unknown packet type: %d",
+				      this,
+				      __func__,
+				      w->type());
+	}
 
 }
 
@@ -1754,89 +2185,141 @@ Vector<EtherAddress>::iterator find(Vector<EtherAddress>::iterator begin, Vector
 }
 
 /*
- * This re-computes the BSSID mask for this node
- * using all the BSSIDs of the VAPs, and sets the
- * hardware register accordingly.
+ * Adds the BSSIDs of an LVAP to the mask of its interface, or removes
+ * them. Only LVAPs that set the mask count.
+ */
+void EmpowerLVAPManager::mask_lvap(EmpowerStationState *ess, bool add) {
+	if (!ess->_set_mask || ess->_iface_id < 0 || ess->_iface_id >= _bssid_masks.size()) {
+		return;
+	}
+	_mask_lock.acquire();
+	EmpowerBSSIDMask &mask = _bssid_masks[ess->_iface_id];
+	for (int k = 0; k < ess->_networks.size(); k++) {
+		if (add) {
+			mask.add(ess->_networks[k]._bssid);
+		} else {
+			mask.remove(ess->_networks[k]._bssid);
+		}
+	}
+	_mask_lock.release();
+}
+
+void EmpowerLVAPManager::mask_vap(EmpowerVAPState *vap, bool add) {
+	if (vap->_iface_id < 0 || vap->_iface_id >= _bssid_masks.size()) {
+		return;
+	}
+	_mask_lock.acquire();
+	if (add) {
+		_bssid_masks[vap->_iface_id].add(vap->_bssid);
+	} else {
+		_bssid_masks[vap->_iface_id].remove(vap->_bssid);
+	}
+	_mask_lock.release();
+}
+
+/*
+ * Reads the masks back from the bit counts. Masks that changed are written
+ * to debugfs once the MASK_DELAY window closes, together with any other
+ * change made in the meantime.
+ */
+void EmpowerLVAPManager::update_masks() {
+
+	bool changed = false;
+
+	_mask_lock.acquire();
+	_mask_updates++;
+	for (int i = 0; i < _bssid_masks.size(); i++) {
+		EtherAddress mask = _bssid_masks[i].mask();
+		if (mask != _masks[i]) {
+			_masks[i] = mask;
+			_mask_dirty[i] = true;
+			_mask_changes++;
+			changed = true;
+		}
+	}
+	_mask_lock.release();
+
+	if (changed && !_mask_timer.scheduled()) {
+		_mask_timer.schedule_after_msec(_mask_delay);
+	}
+
+}
+
+/*
+ * Rebuilds the masks from all LVAPs and VAPs.
  */
 void EmpowerLVAPManager::compute_bssid_mask() {
 
-	// clear _masks vector
-	_masks.clear();
+	_mask_lock.acquire();
 
-	for (unsigned j = 0; j < _ifaces.size(); j++) {
+	_mask_recomputes++;
 
-		// start building mask
-		uint8_t bssid_mask[6];
-		int i;
+	for (int i = 0; i < _bssid_masks.size(); i++) {
+		_bssid_masks[i].clear();
+	}
 
-		// Start with a mask of ff:ff:ff:ff:ff:ff
-		for (i = 0; i < 6; i++) {
-			bssid_mask[i] = 0xff;
-		}
+	_mask_lock.release();
 
-		// For each LVAP, update the bssid mask to include
-		// the common bits of all LVAPs.
-		for (LVAPIter it = _lvaps.begin(); it.live(); it++) {
-			// check iface
-			unsigned iface_id = it.value()._iface_id;
-			if (iface_id != j) {
-				continue;
-			}
-			// check if lvap is DL+UL
-			if (!it.value()._set_mask) {
-				continue;
-			}
-			// add each bssid in the networks
-			const uint8_t *hw = (const uint8_t *) _ifaces[iface_id]->_hwaddr.data();
-			for (int k = 0; k < it.value()._networks.size(); k ++) {
-				const uint8_t *bssid = (const uint8_t *) it.value()._networks[k]._bssid.data();
-				for (i = 0; i < 6; i++) {
-					bssid_mask[i] &= ~(hw[i] ^ bssid[i]);
-				}
-			}
-		}
+	for (LVAPIter it = _lvaps.begin(); it.live(); it++) {
+		mask_lvap(&it.value(), true);
+	}
 
-		// For each VAP, update the bssid mask to include
-		// the common bits of all VAPs.
-		for (VAPIter it = _vaps.begin(); it.live(); it++) {
-			// check iface
-			unsigned iface_id = it.value()._iface_id;
-			if (iface_id != j) {
-				continue;
-			}
-			// add to mask
-			const uint8_t *hw = (const uint8_t *) _ifaces[iface_id]->_hwaddr.data();
-			for (i = 0; i < 6; i++) {
-				const uint8_t *bssid = (const uint8_t *) it.value()._bssid.data();
-				bssid_mask[i] &= ~(hw[i] ^ bssid[i]);
-			}
-		}
+	for (VAPIter it = _vaps.begin(); it.live(); it++) {
+		mask_vap(&it.value(), true);
+	}
+
+	update_masks();
+
+}
+
+bool EmpowerLVAPManager::run_task(Task *) {
+	write_masks();
+	return true;
+}
+
+/*
+ * Writes the masks that changed to the bssid_extra files. The file writes
+ * may block, no lock is held meanwhile.
+ */
+void EmpowerLVAPManager::write_masks() {
 
-		_masks.push_back(EtherAddress(bssid_mask));
+	Vector<int> ifaces;
+	Vector<EtherAddress> masks;
 
+	_mask_lock.acquire();
+	for (int i = 0; i < _masks.size(); i++) {
+		if (_mask_dirty[i]) {
+			_mask_dirty[i] = false;
+			ifaces.push_back(i);
+			masks.push_back(_masks[i]);
+		}
 	}
+	_mask_lock.release();
 
 	// Update bssid masks register through debugfs
-	for (int i = 0; i < _masks.size(); i++) {
+	for (int i = 0; i < ifaces.size(); i++) {
 
-		FILE *debugfs_file = fopen(_debugfs_strings[i].c_str(), "w");
+		FILE *debugfs_file = fopen(_debugfs_strings[ifaces[i]].c_str(), "w");
 
 		if (debugfs_file != NULL) {
 			if (_debug) {
 				click_chatter("%{element} :: %s :: %s",
 							  this,
 							  __func__,
-							  _masks[i].unparse_colon().c_str());
+							  masks[i].unparse_colon().c_str());
 			}
-			fprintf(debugfs_file, "%s\n", _masks[i].unparse_colon().c_str());
+			fprintf(debugfs_file, "%s\n", masks[i].unparse_colon().c_str());
 			fclose(debugfs_file);
+			_mask_writes++;
 			continue;
 		}
 
+		_mask_write_errors++;
+
 		click_chatter("%{element} :: %s :: unable to open debugfs file %s",
 					  this,
 					  __func__,
-					  _debugfs_strings[i].c_str());
+					  _debugfs_strings[ifaces[i]].c_str());
 
 	}
 
@@ -1852,6 +2335,10 @@ enum {
 	H_DEL_LVAP,
 	H_RECONNECT,
 	H_INTERFACES,
+	H_FRAMER,
+	H_BATCH,
+	H_MASK_STATS,
+	H_LVAP_CACHE,
 };
 
 String EmpowerLVAPManager::read_handler(Element *e, void *thunk) {
@@ -1915,6 +2402,27 @@ String EmpowerLVAPManager::read_handler(Element *e, void *thunk) {
 		}
 		return sa.take_string();
 	}
+	case H_FRAMER:
+		return td->_framer.unparse();
+	case H_LVAP_CACHE:
+		return td->_lvap_cache.unparse();
+	case H_MASK_STATS: {
+		StringAccum sa;
+		sa << "updates " << td->_mask_updates << " recomputes " << td->_mask_recomputes;
+		sa << " changes " << td->_mask_changes << " writes " << td->_mask_writes;
+		sa << " write_errors " << td->_mask_write_errors << "\n";
+		return sa.take_string();
+	}
+	case H_BATCH: {
+		StringAccum sa;
+		uint32_t flushes = td->_flushes;
+		sa << "flushes " << flushes << " messages " << td->_flushed_messages << " bytes " << td->_flushed_bytes;
+		sa << " messages_per_flush " << (flushes ? (double) td->_flushed_messages / flushes : 0.0);
+		sa << " bytes_per_flush " << (flushes ? (double) td->_flushed_bytes / flushes : 0.0);
+		sa << " max_messages " << td->_max_flush_messages << " max_bytes " << td->_max_flush_bytes;
+		sa << " max_delay " << td->_max_delay << " batch_size " << td->_batch_size << "\n";
+		return sa.take_string();
+	}
 	case H_INTERFACES: {
 		StringAccum sa;
 		for (REIter iter = td->_ifaces.begin(); iter.live(); iter++) {
@@ -1993,6 +2501,8 @@ int EmpowerLVAPManager::write_handler(const String &in_s, Element *e,
 		case H_RECONNECT: {
 			// clear triggers
 			f->_ers->clear_triggers();
+			// a message split across the old connection never completes
+			f->_framer.reset();
 		}
 	}
 	return 0;
@@ -2005,6 +2515,10 @@ void EmpowerLVAPManager::add_handlers() {
 	add_read_handler("masks", read_handler, (void *) H_MASKS);
 	add_read_handler("bytes", read_handler, (void *) H_BYTES);
 	add_read_handler("interfaces", read_handler, (void *) H_INTERFACES);
+	add_read_handler("framer", read_handler, (void *) H_FRAMER);
+	add_read_handler("batch", read_handler, (void *) H_BATCH);
+	add_read_handler("mask_stats", read_handler, (void *) H_MASK_STATS);
+	add_read_handler("lvap_cache", read_handler, (void *) H_LVAP_CACHE);
 	add_write_handler("reconnect", write_handler, (void *) H_RECONNECT);
 	add_write_handler("debug", write_handler, (void *) H_DEBUG);
 }
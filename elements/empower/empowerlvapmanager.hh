@@ -3,6 +3,7 @@
 #include <click/config.h>
 #include <click/element.hh>
 #include <click/timer.hh>
+#include <click/task.hh>
 #include <click/etheraddress.hh>
 #include <click/ipaddress.hh>
 #include <click/hashtable.hh>
@@ -13,6 +14,8 @@
 #include "empowerpacket.hh"
 #include "igmppacket.hh"
 #include "empowermulticasttable.hh"
+#include "empowerframer.hh"
+#include "empowerlvapcache.hh"
 CLICK_DECLS
 
 /*
@@ -51,6 +54,24 @@ An EmpowerPowerSaveBuffer element
 =item PERIOD
 Interval between hello messages to the Access Controller (in msec), default is 5000
 
+=item MAX_DELAY
+Longest time an outbound message waits to be packed with others before
+being sent (in msec), default is 2. Messages are also sent when
+BATCH_SIZE bytes are waiting and after each chunk from the Access
+Controller is processed. 0 sends every message on its own.
+
+=item BATCH_SIZE
+Largest number of bytes packed in one send, default is 8192
+
+=item MASK_DELAY
+Changes to the BSSID masks are collected for this long before the
+DEBUGFS files are written (in msec), default is 20
+
+=item MASK_THREAD
+Thread that writes the DEBUGFS files, default is the thread of this
+element. Set it to a thread that runs no data path, so that the file
+writes do not stall forwarding.
+
 =item EDEAUTHR
 An EmpowerDeAuthResponder element
 
@@ -86,7 +107,13 @@ enum empower_bands_types {
 };
 
 enum empower_slice_flags {
-	EMPOWER_AMSDU_AGGREGATION = (1<<0)
+	EMPOWER_AMSDU_AGGREGATION = (1<<0),
+	EMPOWER_AQM = (1<<1),
+	EMPOWER_AQM_ECN = (1<<2)
+};
+
+enum empower_slice_stats_flags {
+	EMPOWER_SLICE_STATS_STATIONS = (1<<0),
 };
 
 enum empower_slice_scheduleruler {
@@ -101,6 +128,13 @@ enum empower_regmon_types {
 	EMPOWER_REGMON_ED = 0x2,
 };
 
+enum empower_regmon_tiers {
+	EMPOWER_REGMON_RAW = 0x0,
+	EMPOWER_REGMON_1S = 0x1,
+	EMPOWER_REGMON_10S = 0x2,
+	EMPOWER_REGMON_60S = 0x3,
+};
+
 typedef HashTable<uint16_t, uint32_t> CBytes;
 typedef CBytes::iterator CBytesIter;
 
@@ -192,6 +226,63 @@ typedef VAP::iterator VAPIter;
 typedef HashTable<EtherAddress, EmpowerStationState> LVAP;
 typedef LVAP::iterator LVAPIter;
 
+// BSSID mask of one interface. For each of the 48 address bits, counts the
+// BSSIDs served on the interface that differ from its hardware address in
+// that bit: a bit is set in the mask as long as no BSSID differs there.
+class EmpowerBSSIDMask {
+public:
+
+	EmpowerBSSIDMask() : _nb_bssids(0) {
+		memset(_counts, 0, sizeof(_counts));
+	}
+
+	void set_hwaddr(EtherAddress hwaddr) { _hwaddr = hwaddr; }
+
+	void clear() {
+		memset(_counts, 0, sizeof(_counts));
+		_nb_bssids = 0;
+	}
+
+	void add(EtherAddress bssid) { update(bssid, 1); }
+	void remove(EtherAddress bssid) { update(bssid, -1); }
+
+	EtherAddress mask() const {
+		uint8_t mask[6];
+		for (int i = 0; i < 6; i++) {
+			mask[i] = 0xff;
+			for (int j = 0; j < 8; j++) {
+				if (_counts[i * 8 + j]) {
+					mask[i] &= ~(0x80 >> j);
+				}
+			}
+		}
+		return EtherAddress(mask);
+	}
+
+	uint32_t nb_bssids() const { return _nb_bssids; }
+
+private:
+
+	EtherAddress _hwaddr;
+	uint32_t _counts[48];
+	uint32_t _nb_bssids;
+
+	void update(EtherAddress bssid, int delta) {
+		const uint8_t *hw = _hwaddr.data();
+		const uint8_t *b = bssid.data();
+		for (int i = 0; i < 6; i++) {
+			uint8_t diff = hw[i] ^ b[i];
+			for (int j = 0; diff; j++, diff <<= 1) {
+				if (diff & 0x80) {
+					_counts[i * 8 + j] += delta;
+				}
+			}
+		}
+		_nb_bssids += delta;
+	}
+
+};
+
 class ResourceElement {
 public:
 
@@ -254,6 +345,7 @@ public:
 	int configure(Vector<String> &, ErrorHandler *);
 	void add_handlers();
 	void run_timer(Timer *);
+	bool run_task(Task *);
 	void reset();
 
 	void push(int, Packet *);
@@ -301,6 +393,7 @@ public:
 	void send_txp_counters_response(uint32_t iface_id, uint32_t xid, EtherAddress mcast);
 	void send_img_response(uint32_t iface_id, int type, uint32_t xid);
 	void send_wifi_stats_response(uint32_t iface_id, uint32_t xid);
+	void send_wifi_stats_range_response(uint32_t iface_id, uint32_t xid, uint8_t tier, uint64_t from, uint64_t to);
 	void send_caps_response();
 	void send_rssi_trigger(uint32_t iface_id, uint32_t xid, uint8_t current);
 	void send_summary_trigger(SummaryTrigger * summary);
@@ -309,6 +402,7 @@ public:
 	void send_igmp_report(EtherAddress, Vector<IPAddress>*, Vector<enum empower_igmp_record_type>*);
 	void send_add_del_lvap_response(uint8_t type, EtherAddress sta, uint32_t xid, uint32_t status);
 	void send_slice_stats_response(String ssid, uint8_t dscp, uint32_t xid);
+	void send_slice_stats_ext_response(String ssid, uint8_t dscp, uint32_t xid, bool stations);
 
 	ReadWriteLock* lock() { return &_lock; }
 	LVAP* lvaps() { return &_lvaps; }
@@ -317,23 +411,8 @@ public:
 
 	uint32_t get_next_seq() { return ++_seq; }
 
-	int remove_lvap(EtherAddress sta) {
-
-		EmpowerStationState *ess = _lvaps.get_pointer(sta);
-
-		// Forget station
-		_rcs[ess->_iface_id]->tx_policies()->tx_table()->erase(ess->_sta);
-		_rcs[ess->_iface_id]->forget_station(ess->_sta);
-
-		// Erase lvap
-		_lvaps.erase(_lvaps.find(ess->_sta));
-
-		// Remove this VAP's BSSID from the mask
-		compute_bssid_mask();
-
-		return 0;
-
-	}
+	int remove_lvap(EtherAddress sta);
+	void update_fanout(int iface_id);
 
 	RETable* ifaces() {
 		return &_ifaces;
@@ -343,6 +422,11 @@ public:
 		return _lvaps.get_pointer(sta);
 	}
 
+	// Lock-free copies of the LVAPs, for the data path
+	EmpowerLVAPCache * lvap_cache() { return &_lvap_cache; }
+
+	void publish_lvap(EtherAddress sta);
+
 	TxPolicyInfo * get_txp(EtherAddress sta) {
 		EmpowerStationState *ess = _lvaps.get_pointer(sta);
 		if (!ess) {
@@ -382,8 +466,28 @@ private:
 	unsigned int _period; // msecs
 	Timer _timer;
 
+	EmpowerFramer _framer;
+
+	// outbound messages waiting to be sent together
+	Spinlock _batch_lock;
+	WritablePacket *_batch;
+	uint32_t _batch_messages;
+	uint32_t _batch_size;
+	unsigned int _max_delay; // msecs
+	Timer _flush_timer;
+	uint32_t _flushes;
+	uint32_t _flushed_messages;
+	uint64_t _flushed_bytes;
+	uint32_t _max_flush_messages;
+	uint32_t _max_flush_bytes;
+
+	void flush();
+	void flush_batch();
+	void account_flush(uint32_t, uint32_t);
+
 	void compute_bssid_mask();
 	void send_message(Packet *);
+	void dispatch(Packet *, uint32_t);
 
 	class Empower11k *_e11k;
 	class EmpowerBeaconSource *_ebs;
@@ -395,7 +499,28 @@ private:
 
 	LVAP _lvaps;
 	VAP _vaps;
+	EmpowerLVAPCache _lvap_cache;
 	Vector<EtherAddress> _masks;
+
+	// incremental BSSID masks, written to debugfs by _mask_task at most
+	// once every _mask_delay msecs and only when they changed
+	Spinlock _mask_lock;
+	Vector<EmpowerBSSIDMask> _bssid_masks;
+	Vector<bool> _mask_dirty;
+	unsigned int _mask_delay; // msecs
+	int _mask_thread;
+	Timer _mask_timer;
+	Task _mask_task;
+	uint32_t _mask_updates;
+	uint32_t _mask_recomputes;
+	uint32_t _mask_changes;
+	uint32_t _mask_writes;
+	uint32_t _mask_write_errors;
+
+	void mask_lvap(EmpowerStationState *, bool);
+	void mask_vap(EmpowerVAPState *, bool);
+	void update_masks();
+	void write_masks();
 	Vector<Minstrel *> _rcs;
 	Vector<EmpowerRegmon *> _regmons;
 	Vector<EmpowerQOSManager *> _eqms;
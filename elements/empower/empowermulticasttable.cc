@@ -34,6 +34,9 @@ EmpowerMulticastTable::EmpowerMulticastTable() :
 }
 
 EmpowerMulticastTable::~EmpowerMulticastTable() {
+	for (MGIter i = _groups.begin(); i.live(); i++) {
+		delete i.value();
+	}
 }
 
 int EmpowerMulticastTable::configure(Vector<String> &conf, ErrorHandler *errh) {
@@ -53,129 +56,174 @@ bool EmpowerMulticastTable::add_group(IPAddress group) {
 					  group.unparse().c_str());
 	}
 
-    Vector<EmpowerMulticastGroup>::iterator i;
-    for (i = multicastgroups.begin(); i != multicastgroups.end(); i++) {
-        if (i->group == group) {
-            return false;
-        }
-    }
+	if (_groups.get(group)) {
+		return false;
+	}
+
+	EmpowerMulticastGroup *newgroup = new EmpowerMulticastGroup;
 
-    EmpowerMulticastGroup newgroup;
+	newgroup->group = group;
+	newgroup->mac_group = ip_mcast_addr_to_mac(group);
+	newgroup->mac_next = 0;
 
-    newgroup.group = group;
-    newgroup.mac_group = ip_mcast_addr_to_mac(group);
+	_groups.set(group, newgroup);
 
-    multicastgroups.push_back(newgroup);
+	// behind the groups that have the same MAC address already
+	EmpowerMulticastGroup **last = &_macs[newgroup->mac_group];
+	while (*last) {
+		last = &(*last)->mac_next;
+	}
+	*last = newgroup;
 
-    return true;
+	return true;
 
 }
 
 bool EmpowerMulticastTable::join_group(EtherAddress sta, IPAddress group) {
 
-	Vector<EmpowerMulticastGroup>::iterator i;
-	for (i = multicastgroups.begin(); i != multicastgroups.end(); i++) {
-		if (i->group == group) {
-			Vector<EtherAddress>::iterator a;
-			for (a = i->receivers.begin(); a != i->receivers.end(); a++) {
-				if (*a == sta) {
-					if (_debug) {
-						click_chatter("%{element} :: %s :: Station %s already in IGMP group %s.",
-									  this,
-									  __func__,
-									  sta.unparse().c_str(),
-									  group.unparse().c_str());
-					}
-					return false;
-				}
-			}
-			i->receivers.push_back(sta);
-			if (_debug) {
-				click_chatter("%{element} :: %s :: Station %s added to IGMP group %s.",
-							  this,
-							  __func__,
-							  sta.unparse().c_str(),
-							  group.unparse().c_str());
-			}
-			return true;
+	EmpowerMulticastGroup *i = _groups.get(group);
+
+	if (!i) {
+		return false;
+	}
+
+	if (i->positions.get_pointer(sta)) {
+		if (_debug) {
+			click_chatter("%{element} :: %s :: Station %s already in IGMP group %s.",
+						  this,
+						  __func__,
+						  sta.unparse().c_str(),
+						  group.unparse().c_str());
 		}
+		return false;
+	}
+
+	i->positions.set(sta, i->receivers.size());
+	i->receivers.push_back(sta);
+	_memberships[sta].push_back(i);
+
+	if (_debug) {
+		click_chatter("%{element} :: %s :: Station %s added to IGMP group %s.",
+					  this,
+					  __func__,
+					  sta.unparse().c_str(),
+					  group.unparse().c_str());
 	}
 
-	return false;
+	return true;
+
+}
+
+// Takes sta out of the receivers of group, the last receiver fills its place.
+void EmpowerMulticastTable::remove_receiver(EmpowerMulticastGroup *group, EtherAddress sta) {
+	int pos = group->positions.get(sta);
+	EtherAddress last = group->receivers.back();
+	group->receivers[pos] = last;
+	group->positions.set(last, pos);
+	group->receivers.pop_back();
+	group->positions.erase(sta);
+}
+
+void EmpowerMulticastTable::remove_group(EmpowerMulticastGroup *group) {
+
+	if (_debug) {
+		click_chatter("%{element} :: %s :: IGMP group %s is empty. Remove it.",
+					  this,
+					  __func__,
+					  group->group.unparse().c_str());
+	}
+
+	EmpowerMulticastGroup **g = _macs.get_pointer(group->mac_group);
+	while (*g != group) {
+		g = &(*g)->mac_next;
+	}
+	*g = group->mac_next;
+	if (!*_macs.get_pointer(group->mac_group)) {
+		_macs.erase(group->mac_group);
+	}
+
+	_groups.erase(group->group);
+	delete group;
 
 }
 
 bool EmpowerMulticastTable::leave_group(EtherAddress sta, IPAddress group) {
 
-	Vector<EmpowerMulticastGroup>::iterator i;
-	for (i = multicastgroups.begin(); i != multicastgroups.end(); i++) {
-		if (i->group == group) {
-			Vector<EtherAddress>::iterator a;
-			for (a = i->receivers.begin(); a != i->receivers.end(); a++) {
-				if (*a == sta) {
-					i->receivers.erase(a);
-					if (_debug) {
-						click_chatter("%{element} :: %s :: Station %s removed from IGMP group %s",
-									  this,
-									  __func__,
-									  sta.unparse().c_str(),
-									  group.unparse().c_str());
-					}
-					// The group is deleted if no more receivers belong to it
-					if (i->receivers.begin() == i->receivers.end()) {
-						multicastgroups.erase(i);
-						if (_debug) {
-							click_chatter("%{element} :: %s :: IGMP group %s is empty. Remove it.",
-										  this,
-										  __func__,
-										  group.unparse().c_str());
-						}
-					}
-					return true;
-				}
-			}
+	EmpowerMulticastGroup *i = _groups.get(group);
+
+	if (!i || !i->positions.get_pointer(sta)) {
+		return false;
+	}
+
+	remove_receiver(i, sta);
+
+	Vector<EmpowerMulticastGroup *> &groups = _memberships[sta];
+	for (int g = 0; g < groups.size(); g++) {
+		if (groups[g] == i) {
+			groups[g] = groups.back();
+			groups.pop_back();
+			break;
 		}
 	}
+	if (groups.empty()) {
+		_memberships.erase(sta);
+	}
 
-	return false;
+	if (_debug) {
+		click_chatter("%{element} :: %s :: Station %s removed from IGMP group %s",
+					  this,
+					  __func__,
+					  sta.unparse().c_str(),
+					  group.unparse().c_str());
+	}
+
+	// The group is deleted if no more receivers belong to it
+	if (i->receivers.empty()) {
+		remove_group(i);
+	}
+
+	return true;
 
 }
 
 bool EmpowerMulticastTable::leave_all_groups(EtherAddress sta) {
 
-	Vector<EmpowerMulticastGroup>::iterator i;
-	for (i = multicastgroups.begin(); i != multicastgroups.end(); i++) {
-		Vector<EtherAddress>::iterator a;
-		for (a = i->receivers.begin(); a != i->receivers.end(); a++) {
-			if (*a == sta) {
-				i->receivers.erase(a);
-				click_chatter("%{element} :: %s :: Station %s removed from IGMP group %s",
-							  this,
-							  __func__,
-							  sta.unparse().c_str(),
-							  i->group.unparse().c_str());
-				// The group is deleted if no more receivers belong to it
-				if (i->receivers.begin() == i->receivers.end()) {
-					multicastgroups.erase(i);
-					click_chatter("%{element} :: %s :: IGMP group %s is empty. Remove it.",
-								  this,
-								  __func__,
-								  i->group.unparse().c_str());
-				}
-			}
+	MMIter it = _memberships.find(sta);
+
+	if (!it.live()) {
+		return true;
+	}
+
+	Vector<EmpowerMulticastGroup *> &groups = it.value();
+
+	for (int g = 0; g < groups.size(); g++) {
+		EmpowerMulticastGroup *i = groups[g];
+		remove_receiver(i, sta);
+		if (_debug) {
+			click_chatter("%{element} :: %s :: Station %s removed from IGMP group %s",
+						  this,
+						  __func__,
+						  sta.unparse().c_str(),
+						  i->group.unparse().c_str());
+		}
+		// The group is deleted if no more receivers belong to it
+		if (i->receivers.empty()) {
+			remove_group(i);
 		}
 	}
 
+	_memberships.erase(it);
+
 	return true;
 
 }
 
 Vector<EtherAddress>* EmpowerMulticastTable::get_receivers(EtherAddress group) {
 
-	for (MGIter i = multicastgroups.begin(); i != multicastgroups.end(); i++) {
-		if (i->mac_group == group) {
-			return &(i->receivers);
-		}
+	EmpowerMulticastGroup *i = _macs.get(group);
+
+	if (i) {
+		return &(i->receivers);
 	}
 
 	return 0;
@@ -194,8 +242,8 @@ String EmpowerMulticastTable::read_handler(Element *e, void *thunk) {
 		return String(td->_debug) + "\n";
 	case H_MULTICAST_TABLE: {
 		StringAccum sa;
-		Vector<EmpowerMulticastGroup>::iterator i;
-		for (i = td->multicastgroups.begin(); i != td->multicastgroups.end(); i++) {
+		for (MGIter it = td->_groups.begin(); it.live(); it++) {
+			EmpowerMulticastGroup *i = it.value();
 			sa << i->group.unparse() << " " << i->mac_group.unparse();
 			Vector<EtherAddress>::iterator a;
 			sa << " receivers [ ";
@@ -4,6 +4,8 @@
 #include <click/element.hh>
 #include <click/config.h>
 #include <click/etheraddress.hh>
+#include <click/ipaddress.hh>
+#include <click/hashtable.hh>
 CLICK_DECLS
 
 /*
@@ -32,6 +34,16 @@ Turn debug on/off
 
 =back 8
 
+Groups are found by IP address, and by MAC address for the data path, in
+hash tables. Each group keeps the position of every receiver in its list,
+and each station the groups it joined, so that joining, leaving and
+leaving all the groups of a station take no scan. The order of the
+receivers of a group is not kept.
+
+=h multicast_table read-only
+
+The groups and their receivers
+
 =a EmpowerLVAPManager
 */
 
@@ -39,11 +51,21 @@ struct EmpowerMulticastGroup {
 	IPAddress group; // group address
 	EtherAddress mac_group;
 	Vector<EtherAddress> receivers;
+	HashTable<EtherAddress, int> positions; // in receivers
+	// the next group with the same MAC address, 32 IP groups share one
+	EmpowerMulticastGroup *mac_next;
 };
 
-typedef Vector<EmpowerMulticastGroup> MulticastGroups;
+typedef HashTable<IPAddress, EmpowerMulticastGroup *> MulticastGroups;
 typedef MulticastGroups::iterator MGIter;
 
+// The first group added of each MAC address
+typedef HashTable<EtherAddress, EmpowerMulticastGroup *> MulticastMacs;
+
+// The groups each station joined
+typedef HashTable<EtherAddress, Vector<EmpowerMulticastGroup *> > MulticastMemberships;
+typedef MulticastMemberships::iterator MMIter;
+
 
 class EmpowerMulticastTable: public Element {
 public:
@@ -57,8 +79,6 @@ public:
 	int configure(Vector<String> &, ErrorHandler *);
 	void add_handlers();
 
-	MulticastGroups multicastgroups;
-
 	EtherAddress ip_mcast_addr_to_mac(IPAddress ip) {
 
 		unsigned long ip_addr = ntohl(ip.addr());
@@ -80,10 +100,19 @@ public:
 	bool leave_all_groups(EtherAddress);
 	Vector<EtherAddress> *get_receivers(EtherAddress);
 
+	int nb_groups() const { return _groups.size(); }
+
 private:
 
+	MulticastGroups _groups;
+	MulticastMacs _macs;
+	MulticastMemberships _memberships;
+
 	bool _debug;
 
+	void remove_receiver(EmpowerMulticastGroup *, EtherAddress);
+	void remove_group(EmpowerMulticastGroup *);
+
 	// Read/Write handlers
 	static String read_handler(Element *e, void *user_data);
 	static int write_handler(const String &, Element *, void *, ErrorHandler *);
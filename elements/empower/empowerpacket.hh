@@ -74,6 +74,12 @@ enum empower_packet_types {
     EMPOWER_PT_SLICE_STATS_REQUEST = 0x4C,   		// ac -> wtp
     EMPOWER_PT_SLICE_STATS_RESPONSE = 0x4D,  		// wtp -> ac
 
+    // wifi stats of a tier over a time range
+    EMPOWER_PT_WIFI_STATS_RANGE_RESPONSE = 0x4E,    // wtp -> ac
+
+    // Slice Stats with per station entries
+    EMPOWER_PT_SLICE_STATS_EXT_RESPONSE = 0x4F,     // wtp -> ac
+
 	/* Primitives 0x80 - 0xCF*/
 
     // Link Stats
@@ -303,6 +309,19 @@ struct empower_wifi_stats_request : public empower_header {
     uint32_t iface_id() { return ntohl(_iface_id); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
+/* wifi stats request format with a tier and a time range, answered by a
+   wifi stats range response; a shorter request gets all the raw samples */
+struct empower_wifi_stats_range_request : public empower_wifi_stats_request {
+  private:
+    uint8_t  _tier;     /* see empower_regmon_tiers */
+    uint64_t _from;     /* Timestamp in microseconds, 0 for the oldest */
+    uint64_t _to;       /* Timestamp in microseconds, 0 for the newest */
+  public:
+    uint8_t  tier()     { return _tier; }
+    uint64_t from()     { return be64toh(_from); }
+    uint64_t to()       { return be64toh(_to); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
 /* wifi stats entry format */
 struct wifi_stats_entry {
   private:
@@ -325,6 +344,36 @@ struct empower_wifi_stats_response : public empower_header {
     void set_nb_entries(uint16_t nb_entries) { _nb_entries = htons(nb_entries); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
+/* wifi stats range entry format */
+struct wifi_stats_range_entry {
+  private:
+      uint8_t  _type;       /* see empower_regmon_types */
+      uint64_t _timestamp;  /* Start of the period in microseconds (int) */
+      uint32_t _min;        /* Lowest sample of the period (int) */
+      uint32_t _avg;        /* Average sample of the period (int) */
+      uint32_t _max;        /* Highest sample of the period (int) */
+      uint32_t _count;      /* Samples in the period (int) */
+  public:
+    void set_type(uint8_t type)                         { _type = type; }
+    void set_timestamp(uint64_t timestamp)              { _timestamp = htobe64(timestamp); }
+    void set_min(uint32_t min)                          { _min = htonl(min); }
+    void set_avg(uint32_t avg)                          { _avg = htonl(avg); }
+    void set_max(uint32_t max)                          { _max = htonl(max); }
+    void set_count(uint32_t count)                      { _count = htonl(count); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* wifi stats range response packet format */
+struct empower_wifi_stats_range_response : public empower_header {
+  private:
+    uint32_t _iface_id;       /* Int */
+    uint8_t  _tier;           /* see empower_regmon_tiers */
+    uint16_t _nb_entries;     /* Int */
+  public:
+    void set_iface_id(uint32_t iface_id)     { _iface_id = htonl(iface_id); }
+    void set_tier(uint8_t tier)              { _tier = tier; }
+    void set_nb_entries(uint16_t nb_entries) { _nb_entries = htons(nb_entries); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
 /* channel quality map request packet format */
 struct empower_cqm_request : public empower_header {
   private:
@@ -696,6 +745,8 @@ struct empower_set_slice : public empower_header {
     uint8_t     _flags;         			/* Flags (empower_slice_flags) */
     uint32_t    _quantum;       			/* Priority of the slice (int) */
     char        _ssid[WIFI_NWID_MAXSIZE+1];	/* Null terminated SSID */
+    uint32_t    _aqm_target;    			/* AQM sojourn target in usecs (int) */
+    uint32_t    _aqm_interval;  			/* AQM interval in usecs (int) */
   public:
     uint32_t     iface_id()             { return ntohl(_iface_id); }
     uint8_t      dscp()          		{ return _dscp; }
@@ -703,6 +754,8 @@ struct empower_set_slice : public empower_header {
     bool         flags(int f)    		{ return _flags & f; }
     uint32_t     quantum()       		{ return ntohl(_quantum); }
     String       ssid()          		{ return String((char *) _ssid); }
+    uint32_t     aqm_target()           { return ntohl(_aqm_target); }
+    uint32_t     aqm_interval()         { return ntohl(_aqm_interval); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
 struct empower_del_slice : public empower_header {
@@ -725,6 +778,8 @@ struct empower_status_slice : public empower_header {
     uint8_t     _flags;         			/* Flags (empower_slice_flags) */
     uint32_t    _quantum;       			/* Priority of the slice (int) */
     char        _ssid[WIFI_NWID_MAXSIZE+1];	/* Null terminated SSID */
+    uint32_t    _aqm_target;    			/* AQM sojourn target in usecs (int) */
+    uint32_t    _aqm_interval;  			/* AQM interval in usecs (int) */
   public:
     void set_iface_id(uint32_t iface_id)        				{ _iface_id = htonl(iface_id); }
     void set_dscp(uint8_t dscp)                 				{ _dscp = dscp; }
@@ -732,6 +787,8 @@ struct empower_status_slice : public empower_header {
     void set_flag(uint16_t f)                  					{ _flags = _flags | f; }
     void set_quantum(uint32_t quantum)          				{ _quantum = htonl(quantum); }
     void set_ssid(String ssid)                  				{ memset(_ssid, 0, WIFI_NWID_MAXSIZE+1); memcpy(_ssid, ssid.data(), ssid.length()); }
+    void set_aqm_target(uint32_t aqm_target)    				{ _aqm_target = htonl(aqm_target); }
+    void set_aqm_interval(uint32_t aqm_interval)				{ _aqm_interval = htonl(aqm_interval); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
 /* slice stats request packet format */
@@ -744,6 +801,16 @@ struct empower_slice_stats_request : public empower_header {
     uint32_t dscp() 				{ return _dscp; }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
+/* slice stats request format of controllers that want the extended stats,
+   answered by a slice stats ext response; a shorter request gets the
+   original slice stats response */
+struct empower_slice_stats_ext_request : public empower_slice_stats_request {
+  private:
+    uint8_t _flags;                     /* Flags (empower_slice_stats_flags) */
+  public:
+    bool flags(int f)               { return _flags & f; }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
 /* slice queue status packet format */
 struct empower_slice_stats_entry {
   private:
@@ -760,7 +827,52 @@ struct empower_slice_stats_entry {
     void set_tx_bytes(uint32_t tx_bytes)                    { _tx_bytes = htonl(tx_bytes); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
-/* slice stats response packet format */
+/* slice queue extended status packet format, followed by nb_stations
+   station entries */
+struct empower_slice_stats_ext_entry {
+  private:
+    uint32_t 	_iface_id; 						/* Interface id (int) */
+    uint32_t    _deficit_used;      			/* Total deficit used by this queue */
+    uint32_t    _max_queue_length;  			/* Maximum queue length reached */
+    uint32_t    _tx_packets;        			/* Int */
+    uint32_t    _tx_bytes;          			/* Int */
+    uint32_t    _aqm_drops;         			/* Frames dropped by the AQM (int) */
+    uint32_t    _aqm_marks;         			/* Frames ECN marked by the AQM (int) */
+    uint32_t    _sojourn[12];       			/* Sojourn time histogram, log2 ms buckets (int) */
+    uint32_t    _ur_repeats;        			/* Unreliable multicast repeats sent (int) */
+    uint32_t    _ur_airtime;        			/* Airtime of those repeats, usecs (int) */
+    uint16_t    _nb_stations;          			/* Number of station entries following (int) */
+  public:
+    void set_iface_id(uint32_t iface_id)            		{ _iface_id = htonl(iface_id); }
+    void set_deficit_used(uint32_t deficit_used)            { _deficit_used = htonl(deficit_used); }
+    void set_max_queue_length(uint32_t max_queue_length)    { _max_queue_length = htonl(max_queue_length); }
+    void set_tx_packets(uint32_t tx_packets)                { _tx_packets = htonl(tx_packets); }
+    void set_tx_bytes(uint32_t tx_bytes)                    { _tx_bytes = htonl(tx_bytes); }
+    void set_aqm_drops(uint32_t aqm_drops)                  { _aqm_drops = htonl(aqm_drops); }
+    void set_aqm_marks(uint32_t aqm_marks)                  { _aqm_marks = htonl(aqm_marks); }
+    void set_sojourn(int i, uint32_t sojourn)               { _sojourn[i] = htonl(sojourn); }
+    void set_ur_repeats(uint32_t ur_repeats)                { _ur_repeats = htonl(ur_repeats); }
+    void set_ur_airtime(uint32_t ur_airtime)                { _ur_airtime = htonl(ur_airtime); }
+    void set_nb_stations(uint16_t nb_stations)              { _nb_stations = htons(nb_stations); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* slice queue per-station status packet format */
+struct empower_slice_stats_station_entry {
+  private:
+    uint8_t     _sta[6];                        /* EtherAddress */
+    uint32_t    _airtime_used;                  /* Estimated airtime used in usecs (int) */
+    uint32_t    _tx_packets;                    /* Int */
+    uint32_t    _tx_bytes;                      /* Int */
+  public:
+    void set_sta(EtherAddress sta)                          { memcpy(_sta, sta.data(), 6); }
+    void set_airtime_used(uint32_t airtime_used)            { _airtime_used = htonl(airtime_used); }
+    void set_tx_packets(uint32_t tx_packets)                { _tx_packets = htonl(tx_packets); }
+    void set_tx_bytes(uint32_t tx_bytes)                    { _tx_bytes = htonl(tx_bytes); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* slice stats response packet format, followed by nb_entries slice queue
+   status entries, or by nb_entries extended ones in a slice stats ext
+   response */
 struct empower_slice_stats_response : public empower_header {
   private:
     char    	_ssid[WIFI_NWID_MAXSIZE+1];		/* Null terminated SSID */
@@ -33,8 +33,13 @@
 #include "empowerlvapmanager.hh"
 CLICK_DECLS
 
+const uint32_t SliceQueue::DEFAULT_MAX_AMSDU_LEN;
+
 EmpowerQOSManager::EmpowerQOSManager() :
-		_el(0), _rc(0), _sleepiness(0), _capacity(500), _quantum(1470), _iface_id(0), _debug(false) {
+		_el(0), _rc(0), _gc_timer(this), _idle_timeout(10000), _collected(0),
+		_sleepiness(0), _capacity(500), _quantum(1470), _iface_id(0),
+		_pulls(0), _pull_cycles(0), _fanouts(0), _fanout_copies(0), _fanout_nsecs(0), _debug(false) {
+	_nb_pending = 0;
 }
 
 EmpowerQOSManager::~EmpowerQOSManager() {
@@ -43,14 +48,93 @@ EmpowerQOSManager::~EmpowerQOSManager() {
 int EmpowerQOSManager::configure(Vector<String> &conf,
 		ErrorHandler *errh) {
 
-	return Args(conf, this, errh)
+	uint32_t budget = _pool.budget();
+
+	int res = Args(conf, this, errh)
 			.read_m("EL", ElementCastArg("EmpowerLVAPManager"), _el)
 			.read_m("RC", ElementCastArg("Minstrel"), _rc)
 			.read_m("IFACE_ID", _iface_id)
 			.read("QUANTUM", _quantum)
+			.read("CAPACITY", _capacity)
+			.read("BUDGET", budget)
+			.read("IDLE_TIMEOUT", _idle_timeout)
 			.read("DEBUG", _debug)
 			.complete();
 
+	_pool.set_budget(budget);
+
+	return res;
+
+}
+
+int EmpowerQOSManager::initialize(ErrorHandler *) {
+	_gc_timer.initialize(this);
+	_gc_timer.schedule_after_msec(GC_PERIOD);
+	return 0;
+}
+
+void EmpowerQOSManager::cleanup(CleanupStage) {
+	// the station queues give their slots back to the pool
+	for (SIter itr = _slices.begin(); itr != _slices.end(); itr++) {
+		delete itr.value();
+	}
+	_slices.clear();
+}
+
+void EmpowerQOSManager::run_timer(Timer *) {
+
+	uint32_t max_idle_ticks = (_idle_timeout + GC_PERIOD - 1) / GC_PERIOD;
+
+	// look for idle queues without stopping the data path, and only lock
+	// it out when there is something to drop
+	bool expired = false;
+	_lock.acquire_read();
+	for (SIter itr = _slices.begin(); itr != _slices.end(); itr++) {
+		if (itr.value()->age(max_idle_ticks)) {
+			expired = true;
+		}
+	}
+	_lock.release_read();
+
+	if (expired) {
+		uint32_t collected = 0;
+		_lock.acquire_write();
+		for (SIter itr = _slices.begin(); itr != _slices.end(); itr++) {
+			collected += itr.value()->collect_idle(max_idle_ticks);
+		}
+		_collected += collected;
+		_lock.release_write();
+		if (_debug) {
+			click_chatter("%{element} :: %s :: dropped %u idle station queues",
+						  this,
+						  __func__,
+						  collected);
+		}
+	}
+
+	_gc_timer.schedule_after_msec(GC_PERIOD);
+
+}
+
+void EmpowerQOSManager::forget_station(EtherAddress sta) {
+
+	uint32_t collected = 0;
+
+	_lock.acquire_write();
+	for (SIter itr = _slices.begin(); itr != _slices.end(); itr++) {
+		collected += itr.value()->collect(sta);
+	}
+	_collected += collected;
+	_lock.release_write();
+
+	if (_debug) {
+		click_chatter("%{element} :: %s :: dropped %u station queues of %s",
+					  this,
+					  __func__,
+					  collected,
+					  sta.unparse().c_str());
+	}
+
 }
 
 void * EmpowerQOSManager::cast(const char *n) {
@@ -92,23 +176,21 @@ EmpowerQOSManager::push(int, Packet *p) {
 
 	// If traffic is unicast we need to check if the lvap is active
 	if (!dst.is_broadcast() && !dst.is_group()) {
-		EmpowerStationState *ess = _el->get_ess(dst);
-		if (!ess) {
+		EmpowerLVAPRecord lvap;
+		if (!_el->lvap_cache()->lookup(dst, lvap) || !lvap.is_valid(iface_id)) {
 			p->kill();
 			return;
 		}
-		_el->lock()->acquire_read();
-		if (!ess->is_valid(iface_id)){
-			p->kill();
-		} else {
-	        _el->get_txp(ess->_sta)->update_tx(p->length());
-	        store(ess->_ssid, dscp, p, dst, ess->_bssid);
-		}
-		_el->lock()->release_read();
+		lvap._txp->update_tx(p->length());
+		store(lvap._ssid_id, dscp, p, dst, lvap._bssid);
 		return;
 	}
 
-	if (_rc->tx_policies()->lookup(dst)->_tx_mcast == TX_MCAST_DMS) {
+	// one lookup tells both whether the group is known and how to serve it
+	TxPolicyInfo *mcast_tx_policy = _rc->tx_policies()->supported(dst);
+	TxPolicyInfo *tx_policy = mcast_tx_policy ? mcast_tx_policy : _rc->tx_policies()->default_tx_policy();
+
+	if (tx_policy->_tx_mcast == TX_MCAST_DMS) {
 
 		/*
 		 * DMS mcast policy. Duplicate the frame for each station in the mcast group
@@ -122,24 +204,7 @@ EmpowerQOSManager::push(int, Packet *p) {
 			return;
 		}
 
-		Vector<EtherAddress>::iterator itr;
-		for (itr = mcast_receivers->begin(); itr != mcast_receivers->end(); itr++) {
-			EmpowerStationState * ess = _el->lvaps()->get_pointer(*itr);
-			if (!ess) {
-				continue;
-			}
-			_el->lock()->acquire_read();
-			if (!ess->is_valid(iface_id)){
-				continue;
-			} else {
-				Packet *q = p->clone();
-				if (!q) {
-					continue;
-				}
-				store(ess->_ssid, dscp, q, *itr, ess->_bssid);
-			}
-			_el->lock()->release_read();
-		}
+		fanout_dms(p, dscp, iface_id, mcast_receivers, now);
 
 	} else {
 
@@ -151,8 +216,6 @@ EmpowerQOSManager::push(int, Packet *p) {
 		 * Notice that here we can have both mcast and bcast address.
 		 */
 
-		TxPolicyInfo *mcast_tx_policy = _rc->tx_policies()->supported(dst);
-
 		// Mcast address unknown, report to the controller
 		if (!dst.is_broadcast() && dst.is_group() && !mcast_tx_policy) {
 			if (_debug){
@@ -168,8 +231,9 @@ EmpowerQOSManager::push(int, Packet *p) {
 		if (mcast_tx_policy) {
 
 			/* If there is a transmission policy, it means that destination is a multicast address
-			 * and the policy is set to legacy, so frames must be sent just to the bssids of the
-			 * multicast receptors that subscribed that multicast group.
+			 * and the policy is set to legacy or UR, so frames must be sent just to the bssids of the
+			 * multicast receptors that subscribed that multicast group. UR frames are queued once
+			 * as well, their repeats are left to the scheduler.
 			 */
 
 			Vector<EtherAddress> *mcast_receivers = _el->get_mcast_receivers(dst);
@@ -185,15 +249,15 @@ EmpowerQOSManager::push(int, Packet *p) {
 			}
 
 			EtherAddress sta = mcast_receivers->front();
-			EmpowerStationState *first = _el->lvaps()->get_pointer(sta);
+			EmpowerLVAPRecord first;
 
-			if (!first) {
+			if (!_el->lvap_cache()->lookup(sta, first)) {
 				p->kill();
 				return;
 			}
 
 			Packet *q = p->clone();
-			store(first->_ssid, dscp, q, dst, first->_bssid);
+			store(first._ssid_id, dscp, q, dst, first._bssid);
 
 		} else {
 
@@ -201,31 +265,8 @@ EmpowerQOSManager::push(int, Packet *p) {
 			 * destination, all of the lvaps and vaps have to receive it.
 			 */
 
-			// handle unique LVAPs
-			_el->lock()->acquire_read();
-			for (LVAPIter it = _el->lvaps()->begin(); it.live(); it++) {
-				if (!it.value().is_valid(iface_id)) {
-					continue;
-				}
-				if (!_el->is_unique_lvap(it.value()._sta)) {
-					continue;
-				}
-				Packet *q = p->clone();
-				if (!q) {
-					continue;
-				}
-				store(it.value()._ssid, dscp, q, it.value()._sta, it.value()._bssid);
-			}
-			_el->lock()->release_read();
+			fanout(p, dscp, dst, now);
 
-			// handle VAPs
-			for (VAPIter it = _el->vaps()->begin(); it.live(); it++) {
-				if (it.value()._iface_id != iface_id) {
-					continue;
-				}
-				Packet *q = p->clone();
-				store(it.value()._ssid, dscp, q, dst, it.value()._bssid);
-			}
 		}
 	}
 
@@ -234,93 +275,411 @@ EmpowerQOSManager::push(int, Packet *p) {
 
 }
 
-void EmpowerQOSManager::store(String ssid, int dscp, Packet *q, EtherAddress ra, EtherAddress ta) {
+/*
+ * Copies the frame to every unique LVAP and every VAP of the interface, as
+ * listed by the fan-out set. The slice queue is looked up once per tenant.
+ */
+void EmpowerQOSManager::fanout(Packet *p, int dscp, EtherAddress dst, const Timestamp &start) {
 
-	_lock.acquire_write();
+	uint32_t copies = 0;
 
-	Slice slice = Slice(ssid, dscp);
-	SliceQueue *sliceq = 0;
+	_lock.acquire_read();
+
+	for (FanOutIter it = _fanout.begin(); it != _fanout.end(); it++) {
+
+		SliceQueue *sliceq = _slice_index.get(it->_tenant, dscp);
+
+		if (!sliceq) {
+			continue;
+		}
+
+		for (int i = 0; i < it->_lvaps.size(); i++) {
+			Packet *q = p->clone();
+			if (!q) {
+				continue;
+			}
+			copies += enqueue(sliceq, q, it->_lvaps[i]._ra, it->_lvaps[i]._ta);
+		}
+
+		for (int i = 0; i < it->_vaps.size(); i++) {
+			Packet *q = p->clone();
+			if (!q) {
+				continue;
+			}
+			copies += enqueue(sliceq, q, dst, it->_vaps[i]);
+		}
 
-	if (_slices.find(slice) == _slices.end()) {
-		slice = Slice(ssid, 0);
-		assert(_slices.find(slice) != _slices.end());
 	}
 
-	sliceq = _slices.get(slice);
+	_lock.release_read();
 
-	if (sliceq->enqueue(q, ra, ta)) {
-		// check if queue was empty and no packet in buffer
-		if (sliceq->_size == 1 && _head_table.find(slice).value() == 0) {
-			sliceq->_deficit = 0;
-			_active_list.push_back(slice);
+	account_fanout(copies, start);
+
+}
+
+/*
+ * Copies the frame to every valid receiver of a DMS group. Receivers of the
+ * same tenant share one slice queue lookup.
+ */
+void EmpowerQOSManager::fanout_dms(Packet *p, int dscp, int iface_id, Vector<EtherAddress> *mcast_receivers, const Timestamp &start) {
+
+	uint32_t copies = 0;
+
+	_lock.acquire_read();
+
+	Vector<EtherAddress>::iterator itr;
+	for (itr = mcast_receivers->begin(); itr != mcast_receivers->end(); itr++) {
+		EmpowerLVAPRecord lvap;
+		if (!_el->lvap_cache()->lookup(*itr, lvap) || !lvap.is_valid(iface_id)) {
+			continue;
 		}
+		SliceQueue *sliceq = _slice_index.get(lvap._ssid_id, dscp);
+		if (!sliceq) {
+			continue;
+		}
+		Packet *q = p->clone();
+		if (!q) {
+			continue;
+		}
+		copies += enqueue(sliceq, q, *itr, lvap._bssid);
+	}
+
+	_lock.release_read();
+
+	account_fanout(copies, start);
+
+}
+
+void EmpowerQOSManager::account_fanout(uint32_t copies, const Timestamp &start) {
+	_fanouts++;
+	_fanout_copies += copies;
+	_fanout_nsecs += (Timestamp::now() - start).nsecval();
+}
+
+/*
+ * Rebuilds the fan-out set from the LVAPs and VAPs of this interface. Called
+ * by the EmpowerLVAPManager whenever one is added or removed, or an LVAP
+ * loses its association.
+ */
+void EmpowerQOSManager::update_fanout() {
+
+	FanOut fanout;
+
+	_el->lock()->acquire_read();
+	for (LVAPIter it = _el->lvaps()->begin(); it.live(); it++) {
+		if (!it.value().is_valid(_iface_id)) {
+			continue;
+		}
+		if (!_el->is_unique_lvap(it.value()._sta)) {
+			continue;
+		}
+		fanout_tenant(fanout, it.value()._ssid)->_lvaps.push_back(EtherPair(it.value()._sta, it.value()._bssid));
+	}
+	_el->lock()->release_read();
+
+	for (VAPIter it = _el->vaps()->begin(); it.live(); it++) {
+		if (it.value()._iface_id != _iface_id) {
+			continue;
+		}
+		fanout_tenant(fanout, it.value()._ssid)->_vaps.push_back(it.value()._bssid);
+	}
+
+	_lock.acquire_write();
+	_fanout.swap(fanout);
+	_lock.release_write();
+
+	for (FanOutIter it = fanout.begin(); it != fanout.end(); it++) {
+		_el->lvap_cache()->release(it->_tenant);
+	}
+
+}
+
+FanOutTenant *EmpowerQOSManager::fanout_tenant(FanOut &fanout, String ssid) {
+	for (FanOutIter it = fanout.begin(); it != fanout.end(); it++) {
+		if (it->_ssid == ssid) {
+			return it;
+		}
+	}
+	fanout.push_back(FanOutTenant(ssid, _el->lvap_cache()->intern(ssid)));
+	return &fanout.back();
+}
+
+bool EmpowerQOSManager::enqueue(SliceQueue *sliceq, Packet *q, EtherAddress ra, EtherAddress ta) {
+	if (sliceq->enqueue(q, ra, ta)) {
 		// wake up queue
 		_empty_note.wake();
-		// reset sleepiness
-		_sleepiness = 0;
+		return true;
+	}
+	q->kill();
+	return false;
+}
+
+void EmpowerQOSManager::store(uint16_t tenant, int dscp, Packet *q, EtherAddress ra, EtherAddress ta) {
+
+	_lock.acquire_read();
+
+	SliceQueue *sliceq = _slice_index.get(tenant, dscp);
+
+	// the LVAP may be published before its default slice is created
+	if (sliceq) {
+		enqueue(sliceq, q, ra, ta);
 	} else {
 		q->kill();
 	}
 
-	_lock.release_write();
+	_lock.release_read();
+
+}
 
+void EmpowerQOSManager::activate(SliceQueue *sliceq) {
+	_pending_lock.acquire();
+	_pending.push_back(sliceq);
+	_nb_pending++;
+	_pending_lock.release();
+}
+
+void EmpowerQOSManager::splice_pending() {
+	_pending_lock.acquire();
+	while (SliceQueue *sliceq = _pending.front()) {
+		_pending.pop_front();
+		// a slice starts a new busy period with no credit
+		sliceq->_deficit = 0;
+		sliceq->_scheduled = true;
+		_active_list.push_back(sliceq);
+	}
+	_nb_pending = 0;
+	_pending_lock.release();
 }
 
 Packet * EmpowerQOSManager::pull(int) {
+	click_cycles_t start = click_get_cycles();
+	Packet *p = schedule();
+	_pull_cycles += click_get_cycles() - start;
+	_pulls++;
+	return p;
+}
+
+Packet * EmpowerQOSManager::schedule() {
+
+	_lock.acquire_read();
+
+	if (_nb_pending) {
+		splice_pending();
+	}
 
 	if (_active_list.empty()) {
+		_lock.release_read();
 		if (++_sleepiness == SLEEPINESS_TRIGGER) {
 			_empty_note.sleep();
+#if HAVE_MULTITHREAD
+			// a producer may have queued a frame and woken us up in the
+			// meantime, which sleep() just undid: check whether we should
+			// wake again
+			click_fence();
+			if (_nb_pending || !_active_list.empty()) {
+				_empty_note.wake();
+			}
+#endif
 		}
 		return 0;
 	}
 
-	_lock.acquire_write();
+	_sleepiness = 0;
 
-	Slice slice = _active_list[0];
+	SliceQueue* queue = _active_list.front();
 	_active_list.pop_front();
 
-	SIter active = _slices.find(slice);
-	HItr head = _head_table.find(slice);
-	SliceQueue* queue = active.value();
-
 	Packet *p = 0;
-	if (head.value()) {
-		p = head.value();
-		_head_table.set(slice, 0);
+	uint32_t deficit = 0;
+	if (queue->_head) {
+		p = queue->_head;
+		deficit = queue->_head_usecs;
+		queue->_head = 0;
+	} else if (queue->_ur_frame) {
+		deficit = queue->_ur_usecs;
+		p = queue->next_ur();
 	} else {
-		p = queue->dequeue();
+		p = queue->dequeue(deficit);
+		if (p) {
+			if (uint32_t count = ur_count(p)) {
+				p = queue->hold_ur(p, count, deficit);
+			}
+		}
 	}
 
 	if (!p) {
 		queue->_deficit = 0;
-	} else if (_rc->estimate_usecs_wifi_packet(p) <= queue->_deficit) {
-		uint32_t deficit = _rc->estimate_usecs_wifi_packet(p);
+		if (!queue->deactivate()) {
+			_active_list.push_back(queue);
+		} else {
+			queue->_scheduled = false;
+		}
+		_lock.release_read();
+		return 0;
+	}
+
+	if (deficit <= queue->_deficit) {
 		queue->_deficit -= deficit;
 		queue->_deficit_used += deficit;
 		queue->_tx_bytes += p->length();
 		queue->_tx_packets++;
-		if (queue->_size > 0) {
-			_active_list.push_front(slice);
+		if (!queue->empty() || !queue->deactivate()) {
+			_active_list.push_front(queue);
+		} else {
+			queue->_scheduled = false;
 		}
-		_lock.release_write();
+		_lock.release_read();
 		return p;
 	} else {
-		_head_table.set(slice, p);
-		_active_list.push_back(slice);
+		queue->_head = p;
+		queue->_head_usecs = deficit;
+		_active_list.push_back(queue);
 		queue->_deficit += queue->_quantum;
 	}
 
-	_lock.release_write();
+	_lock.release_read();
 
 	return 0;
 }
 
+/*
+ * Number of times a frame is sent again after the first one: _ur_mcast_count
+ * if the receiver is a group with an unreliable multicast policy, 0 otherwise.
+ */
+uint32_t EmpowerQOSManager::ur_count(Packet *p) {
+	const click_wifi *w = (const click_wifi *) p->data();
+	EtherAddress ra = EtherAddress(w->i_addr1);
+	if (!ra.is_group() || ra.is_broadcast()) {
+		return 0;
+	}
+	TxPolicyInfo *tx_policy = _rc->tx_policies()->supported(ra);
+	if (!tx_policy || tx_policy->_tx_mcast != TX_MCAST_UR || tx_policy->_ur_mcast_count <= 0) {
+		return 0;
+	}
+	// the transmission number must fit in UR_REPEAT_ANNO
+	return tx_policy->_ur_mcast_count < 255 ? tx_policy->_ur_mcast_count : 255;
+}
+
+uint32_t EmpowerQOSManager::estimate_usecs(Packet *p) {
+	return _rc->estimate_usecs_wifi_packet(p);
+}
+
+uint32_t EmpowerQOSManager::max_amsdu_len(EtherAddress ra) {
+	return _rc->tx_policies()->lookup(ra)->_max_amsdu_len;
+}
+
+Packet *SliceQueue::dequeue(uint32_t &usecs) {
+
+	if (_nb_pending) {
+		splice_pending();
+	}
+
+	while (AggregationQueue *queue = _active_list.front()) {
+
+		_active_list.pop_front();
+
+		Packet *p;
+
+		if (queue->_head) {
+			p = queue->_head;
+			usecs = queue->_head_usecs;
+			queue->_head = 0;
+		} else {
+			if (_amsdu_aggregation) {
+				p = queue->aggregate(_eqm ? _eqm->max_amsdu_len(queue->pair()._ra) : DEFAULT_MAX_AMSDU_LEN);
+			} else {
+				p = queue->pull(true);
+			}
+			if (!p) {
+				// the frames left could not be encapsulated
+				if (queue->empty() && queue->deactivate()) {
+					queue->_deficit = 0;
+					queue->_scheduled = false;
+				} else {
+					_active_list.push_back(queue);
+				}
+				continue;
+			}
+			usecs = _eqm ? _eqm->estimate_usecs(p) : 0;
+		}
+
+		if (_scheduler != EMPOWER_ROUND_ROBIN) {
+			uint32_t cost = (_scheduler == EMPOWER_DEFICIT_ROUND_ROBIN) ? p->length() : usecs;
+			if (cost > queue->_deficit) {
+				// hold the frame back and let the next station go
+				queue->_head = p;
+				queue->_head_usecs = usecs;
+				if (_scheduler == EMPOWER_DEFICIT_ROUND_ROBIN) {
+					queue->_deficit += STATION_QUANTUM_BYTES;
+				} else {
+					queue->_deficit += STATION_QUANTUM_USECS;
+				}
+				_active_list.push_back(queue);
+				continue;
+			}
+			queue->_deficit -= cost;
+		}
+
+		queue->_tx_packets++;
+		queue->_tx_bytes += p->length();
+		queue->_airtime += usecs;
+
+		if (queue->empty() && queue->deactivate()) {
+			// a station starts a new busy period with no credit
+			queue->_deficit = 0;
+			queue->_scheduled = false;
+		} else if (_scheduler == EMPOWER_ROUND_ROBIN) {
+			_active_list.push_back(queue);
+		} else {
+			// deficit schedulers keep serving a station until its deficit
+			// runs out
+			_active_list.push_front(queue);
+		}
+
+		return p;
+
+	}
+
+	return 0;
+
+}
+
+Packet *SliceQueue::hold_ur(Packet *p, uint32_t count, uint32_t usecs) {
+	SET_UR_REPEAT_ANNO(p, 0);
+	Packet *q = p->clone();
+	if (!q) {
+		// no repeats then, but the frame still goes out once
+		return p;
+	}
+	_ur_frame = p;
+	_ur_left = count;
+	_ur_usecs = usecs;
+	_ur_sent = 0;
+	return q;
+}
+
+Packet *SliceQueue::next_ur() {
+	if (!_ur_frame) {
+		return 0;
+	}
+	Packet *q = (--_ur_left) ? _ur_frame->clone() : 0;
+	if (!q) {
+		q = _ur_frame;
+		_ur_frame = 0;
+		_ur_left = 0;
+	}
+	SET_UR_REPEAT_ANNO(q, ++_ur_sent);
+	_ur_repeats++;
+	_ur_airtime += _ur_usecs;
+	return q;
+}
+
 void EmpowerQOSManager::set_default_slice(String ssid) {
-	set_slice(ssid, 0, 12000, false, 0);
+	set_slice(ssid, 0, 12000, false, 0, false, false, 5000, 100000);
 }
 
-void EmpowerQOSManager::set_slice(String ssid, int dscp, uint32_t quantum, bool amsdu_aggregation, uint8_t scheduler) {
+void EmpowerQOSManager::set_slice(String ssid, int dscp, uint32_t quantum, bool amsdu_aggregation, uint8_t scheduler,
+								  bool aqm, bool ecn, uint32_t target_usecs, uint32_t interval_usecs) {
 
 	_lock.acquire_write();
 
@@ -329,36 +688,50 @@ void EmpowerQOSManager::set_slice(String ssid, int dscp, uint32_t quantum, bool
 
 	if (itr == _slices.end()) {
 		if (_debug) {
-			click_chatter("%{element} :: %s :: Creating new slice queue for ssid %s dscp %u quantum %u A-MSDU %s scheduler %u",
+			click_chatter("%{element} :: %s :: Creating new slice queue for ssid %s dscp %u quantum %u A-MSDU %s scheduler %u AQM %s target %u interval %u ECN %s",
 						  this,
 						  __func__,
 						  slice._ssid.c_str(),
 						  slice._dscp,
 						  quantum,
 						  amsdu_aggregation ? "yes" : "no",
-						  scheduler);
+						  scheduler,
+						  aqm ? "yes" : "no",
+						  target_usecs,
+						  interval_usecs,
+						  ecn ? "yes" : "no");
 		}
 
 		uint32_t tr_quantum = (quantum == 0) ? _quantum : quantum;
-		SliceQueue *queue = new SliceQueue(this, slice, _capacity, tr_quantum, amsdu_aggregation, scheduler);
+		SliceQueue *queue = new SliceQueue(this, &_pool, slice, _capacity, tr_quantum, amsdu_aggregation, scheduler);
+		queue->_aqm._enabled = aqm;
+		queue->_aqm._ecn = ecn;
+		queue->_aqm.set_target(target_usecs, interval_usecs);
 		_slices.set(slice, queue);
-		_head_table.set(slice, 0);
+		index_slices(ssid);
 	} else {
 		if (_debug) {
-			click_chatter("%{element} :: %s :: Updating slice queue for ssid %s dscp %u quantum %u A-MSDU %s scheduler %u",
+			click_chatter("%{element} :: %s :: Updating slice queue for ssid %s dscp %u quantum %u A-MSDU %s scheduler %u AQM %s target %u interval %u ECN %s",
 						  this,
 						  __func__,
 						  slice._ssid.c_str(),
 						  slice._dscp,
 						  quantum,
 						  amsdu_aggregation ? "yes" : "no",
-						  scheduler);
+						  scheduler,
+						  aqm ? "yes" : "no",
+						  target_usecs,
+						  interval_usecs,
+						  ecn ? "yes" : "no");
 		}
 
 		SliceQueue* queue = itr.value();
-		queue->_quantum = quantum;
+		queue->_quantum = (quantum == 0) ? _quantum : quantum;
 		queue->_amsdu_aggregation = amsdu_aggregation;
 		queue->_scheduler = scheduler;
+		queue->_aqm._enabled = aqm;
+		queue->_aqm._ecn = ecn;
+		queue->_aqm.set_target(target_usecs, interval_usecs);
 	}
 
 	_el->send_status_slice(_iface_id, ssid, dscp);
@@ -378,52 +751,75 @@ void EmpowerQOSManager::del_slice(String ssid, int dscp) {
 					  dscp);
 	}
 
-	// remove from active list
-	Vector<Slice>::iterator it = _active_list.begin();
-	while (it != _active_list.end()) {
-		if (it->_ssid == ssid && it->_dscp == dscp) {
-			it = _active_list.erase(it);
-			break;
-		}
-		it++;
-	}
-
 	Slice slice = Slice(ssid, dscp);
 
 	// remove slice
 	SIter itr = _slices.find(slice);
 	if (itr == _slices.end()) {
+		_lock.release_write();
 		return;
 	}
 	SliceQueue *sliceq = itr.value();
-	delete sliceq;
-	_slices.erase(itr);
 
-	// remove from head table
-	HItr itr2 = _head_table.find(slice);
-	Packet *p = itr2.value();
-	if (p){
-		p->kill();
+	// remove from active and pending lists, producers and scheduler are
+	// both locked out at this point
+	if (sliceq->_scheduled) {
+		_active_list.erase(sliceq);
+	} else if (sliceq->_active) {
+		_pending_lock.acquire();
+		_pending.erase(sliceq);
+		_nb_pending--;
+		_pending_lock.release();
 	}
-	_head_table.erase(itr2);
+
+	_slices.erase(itr);
+	index_slices(ssid);
+	delete sliceq;
 
 	_lock.release_write();
 
 }
 
+/*
+ * Refreshes the index entries of the tenant ssid after one of its slices
+ * was created or deleted, taking a number for the tenant with its first
+ * slice and giving it back with its last one. A tenant that got no number
+ * tries again with its next slice. Called with the lock held for writing.
+ */
+void EmpowerQOSManager::index_slices(const String &ssid) {
+	uint16_t tenant = _tenants.get(ssid);
+	if (!tenant) {
+		tenant = _el->lvap_cache()->intern(ssid);
+		if (!tenant) {
+			click_chatter("%{element} :: %s :: no tenant id left for ssid %s, its slices are not reachable",
+						  this,
+						  __func__,
+						  ssid.c_str());
+			return;
+		}
+		_tenants.set(ssid, tenant);
+	}
+	if (!_slice_index.update(tenant, ssid, _slices)) {
+		_tenants.erase(ssid);
+		_el->lvap_cache()->release(tenant);
+	}
+}
+
 String EmpowerQOSManager::list_slices() {
 	StringAccum result;
+	_lock.acquire_read();
 	SIter itr = _slices.begin();
 	while (itr != _slices.end()) {
 		SliceQueue *sliceq = itr.value();
 		result << sliceq->unparse();
 		itr++;
 	} // end while
+	_lock.release_read();
 	return result.take_string();
 }
 
 enum {
-	H_DEBUG, H_SLICES
+	H_DEBUG, H_SLICES, H_PULL_COST, H_POOL, H_FANOUT_COST
 };
 
 String EmpowerQOSManager::read_handler(Element *e, void *thunk) {
@@ -433,6 +829,24 @@ String EmpowerQOSManager::read_handler(Element *e, void *thunk) {
 		return (td->list_slices());
 	case H_DEBUG:
 		return String(td->_debug) + "\n";
+	case H_PULL_COST: {
+		StringAccum sa;
+		sa << "pulls " << td->_pulls << " cycles " << td->_pull_cycles;
+		sa << " cycles_per_pull " << (td->_pulls ? td->_pull_cycles / td->_pulls : 0) << "\n";
+		return sa.take_string();
+	}
+	case H_FANOUT_COST: {
+		StringAccum sa;
+		sa << "fanouts " << td->_fanouts << " copies " << td->_fanout_copies << " nsecs " << td->_fanout_nsecs;
+		sa << " nsecs_per_copy " << (td->_fanout_copies ? td->_fanout_nsecs / td->_fanout_copies : 0) << "\n";
+		return sa.take_string();
+	}
+	case H_POOL: {
+		StringAccum sa;
+		sa << td->_pool.unparse();
+		sa << "collected " << td->_collected << "\n";
+		return sa.take_string();
+	}
 	default:
 		return String();
 	}
@@ -456,9 +870,12 @@ int EmpowerQOSManager::write_handler(const String &in_s, Element *e, void *vpara
 void EmpowerQOSManager::add_handlers() {
 	add_read_handler("debug", read_handler, (void *) H_DEBUG);
 	add_read_handler("slices", read_handler, (void *) H_SLICES);
+	add_read_handler("pull_cost", read_handler, (void *) H_PULL_COST);
+	add_read_handler("pool", read_handler, (void *) H_POOL);
+	add_read_handler("fanout_cost", read_handler, (void *) H_FANOUT_COST);
 	add_write_handler("debug", write_handler, (void *) H_DEBUG);
 }
 
 CLICK_ENDDECLS
 EXPORT_ELEMENT(EmpowerQOSManager)
-ELEMENT_REQUIRES(userlevel)
+ELEMENT_REQUIRES(userlevel RWSpinlock PacketSlotPool SojournAQM)
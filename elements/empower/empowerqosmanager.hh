@@ -12,7 +12,12 @@
 #include <click/straccum.hh>
 #include <clicknet/wifi.h>
 #include <clicknet/llc.h>
+#include <click/sync.hh>
+#include <click/list.hh>
 #include <elements/standard/simplequeue.hh>
+#include "rwspinlock.hh"
+#include "packetslotpool.hh"
+#include "sojournaqm.hh"
 CLICK_DECLS
 
 /*
@@ -32,16 +37,58 @@ Also maintains a dedicated queue for each pair tenant/dscp.
 Strips the Ethernet header off the front of the packet and pushes
 an 802.11 frame header and LLC header onto the packet.
 
+A slice may run a CoDel sojourn time AQM (see CoDel) on each of its station
+queues. The controller enables it, with optional ECN marking, target and
+interval, through the set slice message; it is off by default. Drops, marks
+and a histogram of the sojourn times are reported in the slice stats.
+
+Frames to a multicast group with an unreliable multicast (UR) policy are
+queued once, to the slice of the first receiver of the group as with the
+legacy policy. When the slice sends such a frame, it sends it again
+_ur_mcast_count times right after, as clones of the queued frame numbered
+in UR_REPEAT_ANNO. The clones share the payload while queued, but an
+element that writes them further down, such as WifiSeq, copies them
+first. Every repeat is charged its airtime at the UR rate (see Minstrel)
+against the slice deficit and counted in the slice stats.
+
 Arguments are:
 
 =item EL
 An EmpowerLVAPManager element
 
+=item CAPACITY
+Soft limit on the frames queued for each station, default 500. A station
+may go past it while less than half of BUDGET is in use.
+
+=item BUDGET
+Bytes that may be queued for all the stations together, default 4194304
+
+=item IDLE_TIMEOUT
+Station queues with nothing queued and nothing sent for this many
+milliseconds are dropped, default 10000. The queues of a station are also
+dropped as soon as its LVAP is removed.
+
 =item DEBUG
 Turn debug on/off
 
 =back 8
 
+=h slices read-only
+Lists the slices and their station queues, with the UR repeats sent by each
+slice and their airtime
+
+=h pull_cost read-only
+Number of pulls and CPU cycles spent scheduling them
+
+=h fanout_cost read-only
+Number of broadcast and multicast frames copied to several receivers, the
+copies made and the time spent making them
+
+=h pool read-only
+Frames, bytes and slot segments in use, their high-water marks, frames
+dropped for lack of budget or over the station limit, and the number of
+station queues dropped so far
+
 =a EmpowerWifiDecap
 */
 
@@ -87,38 +134,50 @@ class AggregationQueue {
 
 public:
 
-    AggregationQueue(EmpowerQOSManager * eqm, uint32_t capacity, EtherPair pair) {
+    AggregationQueue(EmpowerQOSManager * eqm, PacketSlotPool *pool, uint32_t capacity, EtherPair pair, SojournAQMParams *aqm_params = 0) {
         _eqm = eqm;
-        _q = new Packet*[capacity];
+        _pool = pool;
+        _aqm_params = aqm_params;
         _deficit = 0;
+        _head = 0;
+        _head_usecs = 0;
+        _tx_packets = 0;
+        _tx_bytes = 0;
+        _airtime = 0;
         _capacity = capacity;
         _pair = pair;
-        _nb_pkts = 0;
         _drops = 0;
-        _head = 0;
-        _tail = 0;
-        for (unsigned i = 0; i < _capacity; i++) {
-            _q[i] = 0;
+        _active = 0;
+        _scheduled = false;
+        _gc_tx_packets = 0;
+        _idle_ticks = 0;
+        _cur_ring = 0;
+        // one single-producer ring for each thread that can push
+#if HAVE_MULTITHREAD
+        _nb_rings = click_max_cpu_ids();
+#else
+        _nb_rings = 1;
+#endif
+        _rings = new PacketSlotQueue[_nb_rings];
+        for (unsigned i = 0; i < _nb_rings; i++) {
+            _rings[i].set_pool(_pool);
         }
     }
 
     String unparse() {
         StringAccum result;
-        _queue_lock.acquire_read();
-        result << _pair.unparse() << " -> status: " << _nb_pkts << "/" << _capacity << "\n";
-        _queue_lock.release_read();
+        result << _pair.unparse() << " -> status: " << nb_pkts() << "/" << _capacity << ", airtime: " << _airtime << "\n";
         return result.take_string();
     }
 
     ~AggregationQueue() {
-        _queue_lock.acquire_write();
-        for (uint32_t i = 0; i < _capacity; i++) {
-            if (_q[i]) {
-                _q[i]->kill();
-            }
+        while (Packet *p = pull_raw()) {
+            p->kill();
+        }
+        delete[] _rings;
+        if (_head) {
+            _head->kill();
         }
-        delete[] _q;
-        _queue_lock.release_write();
     }
 
     Packet * wifi_encap(Packet *p) {
@@ -171,21 +230,21 @@ public:
 
     }
 
-    Packet* pull(bool encap) {
-
+    // Scheduler side: takes the next frame off the rings as it was pushed.
+    Packet* pull_raw() {
         Packet* p = 0;
-
-        _queue_lock.acquire_write();
-
-        if (_nb_pkts > 0) {
-            p = _q[_head];
-            _q[_head] = 0;
-            _head++;
-            _head %= _capacity;
-            _nb_pkts--;
+        if (PacketSlotQueue *ring = next_ring()) {
+            p = ring->pull();
+            _cur_ring = (_cur_ring + 1) % _nb_rings;
+            _pool->release(p->length());
         }
+        return p;
+    }
+
+    // Scheduler side: the next frame the slice AQM, if any, lets through.
+    Packet* pull(bool encap) {
 
-        _queue_lock.release_write();
+        Packet* p = _aqm_params ? _aqm.dequeue(this, _aqm_params) : pull_raw();
 
         if (!p) {
             return 0;
@@ -199,208 +258,270 @@ public:
 
     }
 
-    WritablePacket * amsdu_encap(WritablePacket *q, Packet *p) {
-
-        click_ether *eh = (click_ether *) p->data();
-        EtherAddress sa = EtherAddress(eh->ether_shost);
+    // Builds an A-MSDU out of the frames queued for this station, as long as
+    // the A-MSDU (802.11 header excluded) fits in max_len bytes. Tailroom
+    // for the whole aggregate is reserved when the first subframe is built,
+    // so every MSDU is copied at most once, straight to its final place.
+    Packet* aggregate(uint32_t max_len) {
 
-        // The A-MSDU did not exist so far
-        if (!q) {
-
-            q = p->uniqueify();
+        Packet* p = pull(false);
 
-            if (!q) {
-                return 0;
-            }
+        if (!p) {
+            return 0;
+        }
 
-            uint8_t mode = WIFI_FC1_DIR_FROMDS;
-            uint16_t ethtype;
+        WritablePacket *q = amsdu_start(p, max_len);
 
-            memcpy(&ethtype, q->data() + 12, 2);
+        if (!q) {
+            return 0;
+        }
 
-            q->pull(sizeof(struct click_ether));
-            q = q->push(sizeof(struct click_llc));
+        uint32_t amsdu_length = q->length() - sizeof(click_wifi) - sizeof(click_qos_control);
+        uint32_t subframe_length = amsdu_length;
 
-            if (!q) {
-                return 0;
+        while (const Packet *next = top()) {
+            uint32_t padding = calculate_padding(subframe_length);
+            uint32_t length = next->length() + AMSDU_SUBFRAME_OVERHEAD;
+            if (amsdu_length + padding + length > max_len || q->tailroom() < padding + length) {
+                break;
+            }
+            // the AQM decides on the first MSDU only, the others ride along
+            Packet *p = pull_raw();
+            if (_aqm_params) {
+                _aqm_params->record(p);
             }
+            amsdu_append(q, p, padding);
+            amsdu_length += padding + length;
+            subframe_length = length;
+        }
 
-            memcpy(q->data(), WIFI_LLC_HEADER, WIFI_LLC_HEADER_LEN);
-            memcpy(q->data() + 6, &ethtype, 2);
+        return q;
 
-            // First A-MSDU subframe
-            q = q->push(sizeof(struct click_wifi_amsdu_subframe_header));
+    }
 
-            if (!q) {
-                return 0;
-            }
+    uint16_t calculate_padding(uint32_t msdu_length) { return (4 - (msdu_length % 4)) % 4; }
 
-            struct click_wifi_amsdu_subframe_header *wa = (struct click_wifi_amsdu_subframe_header *) (q->data());
-            memset(q->data(), 0, sizeof(click_wifi_amsdu_subframe_header));
+    // Replaces the Ethernet header of the first MSDU with the 802.11 header,
+    // the first subframe header and the LLC header. The frame buffer is
+    // reused when it is big enough, otherwise the MSDU is copied once into a
+    // buffer with room for the whole A-MSDU.
+    WritablePacket *amsdu_start(Packet *p, uint32_t max_len) {
 
-            memcpy(wa->da, _pair._ra.data(), 6);
-            memcpy(wa->sa, sa.data(), 6);
+        click_ether eh;
+        memcpy(&eh, p->data(), sizeof(click_ether));
 
-            uint16_t len = (uint16_t) (q->length() - sizeof(click_wifi_amsdu_subframe_header));
-            wa->len = htons(len);
+        uint32_t length = p->length() + AMSDU_SUBFRAME_OVERHEAD;
+        uint32_t tailroom = (max_len > length) ? max_len - length : 0;
 
-            // QoS Control field for enabling A-MSDU aggregation
-            q = q->push((sizeof(struct click_wifi) + sizeof(struct click_qos_control)));
+        WritablePacket *q;
 
-            if (!q) {
-                return 0;
+        if (!p->shared() && p->headroom() >= AMSDU_HEADROOM && p->tailroom() >= tailroom) {
+            q = p->uniqueify();
+        } else {
+            q = Packet::make(Packet::default_headroom + AMSDU_HEADROOM, p->data(), p->length(), tailroom);
+            if (q) {
+                q->copy_annotations(p);
             }
+            p->kill();
+        }
 
-            struct click_wifi *w = (struct click_wifi *) q->data();
-            memset(q->data(), 0, sizeof(click_wifi));
-
-            w->i_fc[0] = (uint8_t) (WIFI_FC0_VERSION_0 | (WIFI_FC0_TYPE_DATA | WIFI_FC0_SUBTYPE_QOS));
-            w->i_fc[1] = 0;
-            w->i_fc[1] |= (uint8_t) (WIFI_FC1_DIR_MASK & mode);
+        if (!q) {
+            return 0;
+        }
 
-            memcpy(w->i_addr1, _pair._ra.data(), 6);
-            memcpy(w->i_addr2, _pair._ta.data(), 6);
-            memcpy(w->i_addr3, sa.data(), 6);
+        q->pull(sizeof(click_ether));
+        q = q->push(sizeof(click_wifi) + sizeof(click_qos_control) + sizeof(click_wifi_amsdu_subframe_header) + sizeof(click_llc));
 
-            struct click_qos_control *z = (struct click_qos_control *) (q->data() + sizeof(click_wifi));
-            memset(q->data()  + sizeof(click_wifi), 0, sizeof(click_qos_control));
+        if (!q) {
+            return 0;
+        }
 
-            z->qos_control = (uint16_t) WIFI_QOS_CONTROL_QOS_AMSDU_PRESENT_MASK;
+        memset(q->data(), 0, sizeof(click_wifi) + sizeof(click_qos_control));
 
-            return q;
+        struct click_wifi *w = (struct click_wifi *) q->data();
 
-        }
+        w->i_fc[0] = (uint8_t) (WIFI_FC0_VERSION_0 | (WIFI_FC0_TYPE_DATA | WIFI_FC0_SUBTYPE_QOS));
+        w->i_fc[1] = (uint8_t) (WIFI_FC1_DIR_MASK & WIFI_FC1_DIR_FROMDS);
 
-        uint16_t ethtype;
-        WritablePacket *z = p->uniqueify();
+        memcpy(w->i_addr1, _pair._ra.data(), 6);
+        memcpy(w->i_addr2, _pair._ta.data(), 6);
+        memcpy(w->i_addr3, eh.ether_shost, 6);
 
-        memcpy(&ethtype, z->data() + 12, 2);
-        z->pull(sizeof(struct click_ether));
-        z = z->push(sizeof(struct click_llc));
+        // QoS Control field for enabling A-MSDU aggregation
+        struct click_qos_control *z = (struct click_qos_control *) (q->data() + sizeof(click_wifi));
+        z->qos_control = (uint16_t) WIFI_QOS_CONTROL_QOS_AMSDU_PRESENT_MASK;
 
-        if (!z) {
-            return 0;
-        }
+        amsdu_subframe(q->data() + sizeof(click_wifi) + sizeof(click_qos_control), &eh, length);
 
-        // LLC
-        memcpy(z->data(), WIFI_LLC_HEADER, WIFI_LLC_HEADER_LEN);
-        memcpy(z->data() + 6, &ethtype, 2);
+        return q;
 
-        // A-MSDU substructure creation
-        z = z->push(sizeof(struct click_wifi_amsdu_subframe_header));
+    }
 
-        if (!z) {
-            return 0;
-        }
+    // Appends one MSDU, preceded by the padding of the previous subframe.
+    // The caller made sure the aggregate has enough tailroom.
+    void amsdu_append(WritablePacket *q, Packet *p, uint32_t padding) {
 
-        struct click_wifi_amsdu_subframe_header *w = (struct click_wifi_amsdu_subframe_header *) (z->data());
-        memset(z->data(), 0, sizeof(click_wifi_amsdu_subframe_header));
+        uint32_t length = p->length() + AMSDU_SUBFRAME_OVERHEAD;
+        uint8_t *ptr = q->end_data();
 
-        uint16_t len = (uint16_t) (z->length() - sizeof(click_wifi_amsdu_subframe_header));
+        q = q->put(padding + length);
+        assert(q && q->end_data() == ptr + padding + length);
 
-        memcpy(w->da, _pair._ra.data(), 6);
-        memcpy(w->sa, sa.data(), 6);
-        w->len = htons(len);
+        memset(ptr, 0, padding);
+        ptr += padding;
 
-        uint32_t current_length = q->length();
+        ptr = amsdu_subframe(ptr, (const click_ether *) p->data(), length);
+        memcpy(ptr, p->data() + sizeof(click_ether), p->length() - sizeof(click_ether));
 
-        q = q->put(z->length());
+        p->kill();
 
-        if (!q) {
-            return 0;
-        }
+    }
 
-        memcpy((q->data() + current_length), z->data(), z->length());
+    // Writes the subframe and LLC headers for an MSDU with Ethernet header
+    // eh, returns where the payload goes.
+    uint8_t *amsdu_subframe(uint8_t *ptr, const click_ether *eh, uint32_t length) {
 
-        z->kill();
+        struct click_wifi_amsdu_subframe_header *wa = (struct click_wifi_amsdu_subframe_header *) ptr;
 
-        return q;
+        memcpy(wa->da, _pair._ra.data(), 6);
+        memcpy(wa->sa, eh->ether_shost, 6);
+        wa->len = htons((uint16_t) (length - sizeof(click_wifi_amsdu_subframe_header)));
 
-    }
+        ptr += sizeof(click_wifi_amsdu_subframe_header);
 
-    Packet* aggregate(WritablePacket *q, uint32_t &slice_queue_size) {
+        memcpy(ptr, WIFI_LLC_HEADER, WIFI_LLC_HEADER_LEN);
+        memcpy(ptr + WIFI_LLC_HEADER_LEN, &eh->ether_type, 2);
 
-    	// this should be instead taken by a TXP object
-    	uint32_t max_aggr_length = 7935;
+        return ptr + sizeof(click_llc);
 
-        Packet* p = pull(false);
+    }
 
-        if (!p) {
-            return q;
+    // Producer side, lock-free: each thread owns one of the rings. The
+    // capacity is a soft limit, see PacketSlotPool.
+    bool push(Packet* p) {
+        unsigned id = click_current_cpu_id();
+        PacketSlotQueue *ring = &_rings[id < _nb_rings ? id : id % _nb_rings];
+        uint32_t length = p->length();
+        if (!_pool->admit(length, nb_pkts() >= _capacity)) {
+            _drops++;
+            return false;
         }
+        if (!ring->push(p)) {
+            _pool->release(length);
+            _drops++;
+            return false;
+        }
+        return true;
+    }
 
-        slice_queue_size--;
-
-        // Keep track of the MSDU size in case we need to add padding
-        uint32_t msdu_length = p->length() + 8; // click_wifi_amsdu_subframe_header + click_llc - click_ether
+    const Packet* top() {
+        PacketSlotQueue *ring = next_ring();
+        return ring ? ring->top() : 0;
+    }
 
-        // Append to _amsdu packet (do not use p anymore after this call!)
-        q = amsdu_encap(q, p);
+    uint32_t nb_pkts() {
+        uint32_t nb_pkts = 0;
+        for (unsigned i = 0; i < _nb_rings; i++) {
+            nb_pkts += _rings[i].size();
+        }
+        return nb_pkts;
+    }
 
-        if (top() && (q->length() + top()->length() + 8 + 3) <= max_aggr_length) {
-            uint16_t padding = calculate_padding(msdu_length);
-            q = q->put(padding);
-            if (!q) {
-                return 0;
+    bool empty() {
+        for (unsigned i = 0; i < _nb_rings; i++) {
+            if (!_rings[i].empty()) {
+                return false;
             }
-            return aggregate(q, slice_queue_size);
         }
+        return true;
+    }
 
-        return q;
+    uint32_t drops() { return _drops; }
+    EtherPair pair() { return _pair; }
+    bool active() { return _active != 0; }
 
-    }
+    // Links the queue into its slice's active or pending list, _scheduled
+    // tells which one.
+    List_member<AggregationQueue> _link;
+    bool _scheduled;
 
-    uint16_t calculate_padding(uint32_t msdu_length) { return (4 - (msdu_length % 4)) % 4; }
+    // Idle collection: frames sent when the queue was last looked at, and
+    // how many looks in a row found it idle since.
+    uint32_t _gc_tx_packets;
+    uint32_t _idle_ticks;
 
-    bool push(Packet* p) {
-        bool result = false;
-        _queue_lock.acquire_write();
-        if (_nb_pkts == _capacity) {
-            _drops++;
-            result = false;
-        } else {
-            _q[_tail] = p;
-            _tail++;
-            _tail %= _capacity;
-            _nb_pkts++;
-            result = true;
-        }
-        _queue_lock.release_write();
-        return result;
-    }
+    // Scheduler side: per-station deficit, in bytes or usecs depending on
+    // the slice scheduler, and the frame held back until it is large enough.
+    uint32_t _deficit;
+    Packet *_head;
+    uint32_t _head_usecs;
 
-    const Packet* top() {
-      Packet* p = 0;
-      _queue_lock.acquire_write();
-      if(_head != _tail) {
-        p = _q[_head];
-      }
-      _queue_lock.release_write();
-      return p;
+    // Scheduler side: frames, bytes and estimated airtime (usecs) sent
+    uint32_t _tx_packets;
+    uint32_t _tx_bytes;
+    uint32_t _airtime;
+
+    // Producer side. Returns true if the caller turned the queue from idle
+    // to active and must therefore hand it over to the scheduler.
+    bool activate() {
+        // the packet must be visible in the ring before we look at the flag,
+        // otherwise we could miss a concurrent deactivate()
+        click_fence();
+        return !_active && _active.compare_swap(0, 1) == 0;
     }
 
-    uint32_t nb_pkts() { return _nb_pkts; }
+    // Scheduler side. Returns false if a producer refilled the queue after
+    // it was found empty, in which case the queue stays scheduled.
+    bool deactivate() {
+        _active.swap(0);
+        if (!empty() && _active.compare_swap(0, 1) == 0) {
+            return false;
+        }
+        return true;
+    }
 
 private:
 
+    // An MSDU in an A-MSDU trades its Ethernet header for a subframe header
+    // and a LLC header; the first one also needs room for the 802.11 header.
+    enum {
+        AMSDU_SUBFRAME_OVERHEAD = sizeof(click_wifi_amsdu_subframe_header) + sizeof(click_llc) - sizeof(click_ether),
+        AMSDU_HEADROOM = sizeof(click_wifi) + sizeof(click_qos_control) + AMSDU_SUBFRAME_OVERHEAD
+    };
+
 	EmpowerQOSManager * _eqm;
+    PacketSlotPool *_pool;
+
+    SojournAQM _aqm;
+    SojournAQMParams *_aqm_params;
 
-    ReadWriteLock _queue_lock;
-    Packet** _q;
+    PacketSlotQueue *_rings;
+    unsigned _nb_rings;
+    unsigned _cur_ring;
 
-    //uint32_t _quantum;
     uint32_t _capacity;
-    uint32_t _deficit;
     EtherPair _pair;
-    uint32_t _nb_pkts;
-    uint32_t _drops;
-    uint32_t _head;
-    uint32_t _tail;
+    atomic_uint32_t _drops;
+    atomic_uint32_t _active;
+
+    // Scheduler side: serve the producer rings round robin, one packet
+    // per turn.
+    PacketSlotQueue *next_ring() {
+        for (unsigned i = 0; i < _nb_rings; i++) {
+            PacketSlotQueue *ring = &_rings[_cur_ring];
+            if (!ring->empty()) {
+                return ring;
+            }
+            _cur_ring = (_cur_ring + 1) % _nb_rings;
+        }
+        return 0;
+    }
 
 };
 
 typedef HashTable<EtherPair, AggregationQueue*> AggregationQueues;
 typedef AggregationQueues::iterator AQIter;
+typedef List<AggregationQueue, &AggregationQueue::_link> AggregationQueueList;
 
 class Slice {
   public:
@@ -439,26 +560,58 @@ class SliceQueue {
 public:
 
 	EmpowerQOSManager * _eqm;
+    PacketSlotPool *_pool;
 
+    // Stations with queued frames. The scheduler owns _active_list, the
+    // producers hand newly active stations over through _pending. A queue
+    // is on at most one of the two lists, as told by its _active flag.
+    RWSpinlock _queues_lock;
     AggregationQueues _queues;
-    Vector<EtherPair> _active_list;
+    AggregationQueueList _active_list;
+    SimpleSpinlock _pending_lock;
+    AggregationQueueList _pending;
+    atomic_uint32_t _nb_pending;
+    atomic_uint32_t _active;
+
+    // Frame held back by the ADRR scheduler until the slice has enough
+    // deficit, and its estimated airtime
+    Packet *_head;
+    uint32_t _head_usecs;
+
+    // Frame to an unreliable multicast group that the slice sends again,
+    // how many more times, and the estimated airtime of each time
+    Packet *_ur_frame;
+    uint32_t _ur_left;
+    uint32_t _ur_usecs;
+    uint8_t _ur_sent;
+
+    // Links the slice into the manager's active or pending list, _scheduled
+    // tells which one. Both are owned by the scheduler.
+    List_member<SliceQueue> _link;
+    bool _scheduled;
 
     Slice _slice;
     uint32_t _capacity;
-    uint32_t _size;
-    uint32_t _drops;
+    atomic_uint32_t _drops;
     uint32_t _deficit;
     uint32_t _quantum;
     bool _amsdu_aggregation;
     uint32_t _deficit_used;
-    uint32_t _max_queue_length;
+    atomic_uint32_t _max_queue_length;
     uint32_t _tx_packets;
     uint32_t _tx_bytes;
+    uint32_t _ur_repeats;
+    uint32_t _ur_airtime;
     uint8_t _scheduler;
+    SojournAQMParams _aqm;
 
-    SliceQueue(EmpowerQOSManager * eqm, Slice slice, uint32_t capacity, uint32_t quantum, bool amsdu_aggregation, uint8_t scheduler) :
-		_eqm(eqm), _slice(slice), _capacity(capacity), _size(0), _drops(0), _deficit(0), _quantum(quantum), _amsdu_aggregation(amsdu_aggregation),
-		_deficit_used(0), _max_queue_length(0), _tx_packets(0), _tx_bytes(0), _scheduler(scheduler) {
+    SliceQueue(EmpowerQOSManager * eqm, PacketSlotPool *pool, Slice slice, uint32_t capacity, uint32_t quantum, bool amsdu_aggregation, uint8_t scheduler) :
+		_eqm(eqm), _pool(pool), _head(0), _head_usecs(0), _ur_frame(0), _ur_left(0), _ur_usecs(0), _ur_sent(0), _scheduled(false), _slice(slice), _capacity(capacity), _deficit(0), _quantum(quantum), _amsdu_aggregation(amsdu_aggregation),
+		_deficit_used(0), _tx_packets(0), _tx_bytes(0), _ur_repeats(0), _ur_airtime(0), _scheduler(scheduler) {
+        _nb_pending = 0;
+        _active = 0;
+        _drops = 0;
+        _max_queue_length = 0;
     }
 
     ~SliceQueue() {
@@ -469,98 +622,247 @@ public:
             itr++;
         }
         _queues.clear();
+        if (_head) {
+            _head->kill();
+        }
+        if (_ur_frame) {
+            _ur_frame->kill();
+        }
     }
 
-    bool enqueue(Packet *p, EtherAddress ra, EtherAddress ta) {
-
-        EtherPair pair = EtherPair(ra, ta);
-
-        if (_queues.find(pair) == _queues.end()) {
-            AggregationQueue *queue = new AggregationQueue(_eqm, _capacity, pair);
-            _queues.set(pair, queue);
-            _active_list.push_back(pair);
+    // Producer side. Safe to call from several threads at once, as long as
+    // the slice itself is not deleted meanwhile.
+    inline bool enqueue(Packet *p, EtherAddress ra, EtherAddress ta);
+
+    // Scheduler side. Only one thread at a time may call this. Returns the
+    // next frame according to the slice scheduler and sets usecs to its
+    // estimated airtime.
+    Packet *dequeue(uint32_t &usecs);
+
+    // Scheduler side, unreliable multicast. hold_ur() keeps frame p to send
+    // it count more times, each one estimated at usecs, and returns the first
+    // transmission. next_ur() returns the next repeat, 0 once there is none.
+    // Repeats are clones, the last one is p itself.
+    Packet *hold_ur(Packet *p, uint32_t count, uint32_t usecs);
+    Packet *next_ur();
+
+    // Scheduler side. Returns false if a producer activated a station after
+    // the slice was found empty, in which case the slice stays scheduled.
+    bool deactivate() {
+        _active.swap(0);
+        if (_nb_pending && _active.compare_swap(0, 1) == 0) {
+            return false;
         }
+        return true;
+    }
 
-        AggregationQueue *queue = _queues.get(pair);
+    bool empty() {
+        return !_head && !_ur_frame && _active_list.empty() && !_nb_pending;
+    }
 
-        if (queue->push(p)) {
-            // check if ra is in active list
-            if (find(_active_list.begin(), _active_list.end(), pair) == _active_list.end()) {
-                _active_list.push_back(pair);
-            }
-            if (queue->nb_pkts() > _max_queue_length) {
-                _max_queue_length = queue->nb_pkts();
-            }
-             _size++;
-            return true;
+    uint32_t size() {
+        uint32_t size = 0;
+        _queues_lock.acquire_read();
+        for (AQIter itr = _queues.begin(); itr != _queues.end(); itr++) {
+            size += itr.value()->nb_pkts();
         }
-
-        _drops++;
-        return false;
-
+        _queues_lock.release_read();
+        return size;
     }
 
-    Packet *dequeue() {
-
-        if (_active_list.empty()) {
-            return 0;
+    // Control side, with producers and scheduler locked out: drops the
+    // queues of station ra, or those found idle at least max_idle_ticks
+    // times in a row. Returns how many were dropped.
+    uint32_t collect(EtherAddress ra) {
+        uint32_t collected = 0;
+        _queues_lock.acquire_write();
+        for (AQIter itr = _queues.begin(); itr != _queues.end(); ) {
+            if (itr.key()._ra == ra) {
+                itr = erase(itr);
+                collected++;
+            } else {
+                itr++;
+            }
         }
+        _queues_lock.release_write();
+        return collected;
+    }
 
-        EtherPair pair = _active_list[0];
-        _active_list.pop_front();
-
-        AQIter active = _queues.find(pair);
-        AggregationQueue* queue = active.value();
-
-        Packet *p;
-
-        if (_amsdu_aggregation) {
-            WritablePacket *q = 0;
-            p = queue->aggregate(q, _size);
-        } else {
-            p = queue->pull(true);
-            if (p) {
-            	_size--;
+    uint32_t collect_idle(uint32_t max_idle_ticks) {
+        uint32_t collected = 0;
+        _queues_lock.acquire_write();
+        for (AQIter itr = _queues.begin(); itr != _queues.end(); ) {
+            AggregationQueue *queue = itr.value();
+            if (queue->_idle_ticks >= max_idle_ticks && !queue->active() && queue->empty()) {
+                itr = erase(itr);
+                collected++;
+            } else {
+                itr++;
             }
         }
+        _queues_lock.release_write();
+        return collected;
+    }
 
-        if (!p) {
-            return dequeue();
+    // Control side, concurrently with the data path: counts one more idle
+    // look for the queues with nothing queued and nothing sent since the
+    // last one. Returns true if some queue reached max_idle_ticks.
+    bool age(uint32_t max_idle_ticks) {
+        bool expired = false;
+        _queues_lock.acquire_read();
+        for (AQIter itr = _queues.begin(); itr != _queues.end(); itr++) {
+            AggregationQueue *queue = itr.value();
+            uint32_t tx_packets = queue->_tx_packets;
+            if (queue->active() || tx_packets != queue->_gc_tx_packets) {
+                queue->_gc_tx_packets = tx_packets;
+                queue->_idle_ticks = 0;
+            } else if (++queue->_idle_ticks >= max_idle_ticks) {
+                expired = true;
+            }
         }
-
-        _active_list.push_back(pair);
-
-        return p;
-
+        _queues_lock.release_read();
+        return expired;
     }
 
     String unparse() {
         StringAccum result;
         result << _slice.unparse();
-        result << " -> capacity: " << _capacity << ", " << "quantum: " << _quantum << ", " << "size: " << _size;
+        result << " -> capacity: " << _capacity << ", " << "quantum: " << _quantum << ", " << "size: " << size() << ", " << "scheduler: " << (int) _scheduler;
         if (_amsdu_aggregation) {
             result << " aggregation on";
         } else {
         	result << " aggregation off";
         }
-        result << "\n";
+        result << ", " << _aqm.unparse();
+        result << ", ur repeats: " << _ur_repeats << ", ur airtime: " << _ur_airtime << "\n";
 
+        _queues_lock.acquire_read();
         AQIter itr = _queues.begin();
         while (itr != _queues.end()) {
             AggregationQueue *aq = itr.value();
             result << "  " << aq->unparse();
             itr++;
         }
+        _queues_lock.release_read();
         return result.take_string();
     }
 
+private:
+
+    // Deficit added to a station each time it runs out of it, in bytes
+    // for DRR and in usecs for ADRR.
+    enum { STATION_QUANTUM_BYTES = 1500, STATION_QUANTUM_USECS = 300 };
+
+    // A-MSDU limit used when there is no EmpowerQOSManager to ask for the
+    // station transmission policy
+    static const uint32_t DEFAULT_MAX_AMSDU_LEN = 3839;
+
+    AggregationQueue *lookup(EtherPair pair) {
+        _queues_lock.acquire_read();
+        AggregationQueue *queue = _queues.get(pair);
+        _queues_lock.release_read();
+        if (queue) {
+            return queue;
+        }
+        _queues_lock.acquire_write();
+        queue = _queues.get(pair);
+        if (!queue) {
+            queue = new AggregationQueue(_eqm, _pool, _capacity, pair, &_aqm);
+            _queues.set(pair, queue);
+        }
+        _queues_lock.release_write();
+        return queue;
+    }
+
+    AQIter erase(AQIter itr) {
+        AggregationQueue *queue = itr.value();
+        if (queue->_scheduled) {
+            _active_list.erase(queue);
+        } else if (queue->active()) {
+            _pending.erase(queue);
+            _nb_pending--;
+        }
+        delete queue;
+        return _queues.erase(itr);
+    }
+
+    void splice_pending() {
+        _pending_lock.acquire();
+        while (AggregationQueue *queue = _pending.front()) {
+            _pending.pop_front();
+            queue->_scheduled = true;
+            _active_list.push_back(queue);
+        }
+        _nb_pending = 0;
+        _pending_lock.release();
+    }
+
+};
+
+// Broadcast receivers of one tenant on an interface: its unique LVAPs, as
+// (station, BSSID) pairs, and the BSSIDs of its VAPs. Holds a reference to
+// the tenant number.
+class FanOutTenant {
+  public:
+
+    String _ssid;
+    uint16_t _tenant;
+    Vector<EtherPair> _lvaps;
+    Vector<EtherAddress> _vaps;
+
+    FanOutTenant() : _tenant(0) {
+    }
+
+    FanOutTenant(String ssid, uint16_t tenant) : _ssid(ssid), _tenant(tenant) {
+    }
+
 };
 
+typedef Vector<FanOutTenant> FanOut;
+typedef FanOut::iterator FanOutIter;
+
 typedef HashTable<Slice, SliceQueue*> Slices;
 typedef Slices::iterator SIter;
+typedef List<SliceQueue, &SliceQueue::_link> SliceQueueList;
+
+// Slice queues indexed by tenant and DSCP, for the data path. Tenants are
+// numbered by interning their SSID in the EmpowerLVAPCache, so the number
+// is in the LVAP record of each station. Every tenant has a row of NB_DSCP
+// entries, each pointing to the slice of that DSCP or, if there is none,
+// to the default slice of the tenant (DSCP 0). The manager holds a
+// reference to the number of every tenant whose row points to a slice.
+class SliceIndex {
+  public:
+
+    enum { NB_DSCP = 64 };
+
+    SliceQueue *get(uint16_t tenant, int dscp) const {
+        uint32_t i = tenant * NB_DSCP + (dscp & (NB_DSCP - 1));
+        return i < (uint32_t) _table.size() ? _table[i] : 0;
+    }
+
+    // Refreshes the row of tenant from the slices of ssid. Returns false if
+    // the tenant has no slice left.
+    bool update(uint16_t tenant, const String &ssid, Slices &slices) {
+        uint32_t row = tenant * NB_DSCP;
+        if ((uint32_t) _table.size() < row + NB_DSCP) {
+            _table.resize(row + NB_DSCP, 0);
+        }
+        SliceQueue *def = slices.get(Slice(ssid, 0));
+        bool any = false;
+        for (int dscp = 0; dscp < NB_DSCP; dscp++) {
+            SliceQueue *sliceq = slices.get(Slice(ssid, dscp));
+            _table[row + dscp] = sliceq ? sliceq : def;
+            any = any || _table[row + dscp];
+        }
+        return any;
+    }
 
-typedef HashTable<Slice, Packet*> HeadTable;
-typedef HeadTable::iterator HItr;
+  private:
+
+    Vector<SliceQueue *> _table;
+
+};
 
 class EmpowerQOSManager: public Element {
 
@@ -575,40 +877,94 @@ public:
     void *cast(const char *);
 
     int configure(Vector<String> &, ErrorHandler *);
+    int initialize(ErrorHandler *);
+    void cleanup(CleanupStage);
+    void run_timer(Timer *);
 
     void push(int, Packet *);
     Packet *pull(int);
 
     void add_handlers();
     void set_default_slice(String);
-    void set_slice(String, int, uint32_t, bool, uint8_t);
+    void set_slice(String, int, uint32_t, bool, uint8_t, bool, bool, uint32_t, uint32_t);
     void del_slice(String, int);
+    void forget_station(EtherAddress);
+    void update_fanout();
 
     Slices * slices() { return &_slices; }
 
+    void activate(SliceQueue *);
+    uint32_t estimate_usecs(Packet *);
+    uint32_t max_amsdu_len(EtherAddress);
+
 private:
 
-    ReadWriteLock _lock;
+    // Taken for reading on the push and pull paths and for writing by the
+    // control path when slices are created or deleted.
+    RWSpinlock _lock;
 
     enum { SLEEPINESS_TRIGGER = 9 };
+    enum { GC_PERIOD = 1000 };
 
     ActiveNotifier _empty_note;
     class EmpowerLVAPManager *_el;
     class Minstrel * _rc;
 
     Slices _slices;
-    HeadTable _head_table;
-    Vector<Slice> _active_list;
 
+    // The same slices, as the data path looks them up, and the number of
+    // each tenant that has some
+    SliceIndex _slice_index;
+    HashTable<String, uint16_t> _tenants;
+
+    // Receivers of the broadcast frames, grouped by tenant
+    FanOut _fanout;
+
+    // Slots for the frames of all the station queues, and the byte budget
+    // they share
+    PacketSlotPool _pool;
+
+    // Station queues idle for _idle_timeout msecs are dropped, checked
+    // every GC_PERIOD msecs
+    Timer _gc_timer;
+    uint32_t _idle_timeout;
+    uint32_t _collected;
+
+    // Slices with queued frames. The scheduler owns _active_list, the
+    // producers hand newly active slices over through _pending.
+    SliceQueueList _active_list;
+    SimpleSpinlock _pending_lock;
+    SliceQueueList _pending;
+    atomic_uint32_t _nb_pending;
+
+    // empty pulls in a row, scheduler side only
     int _sleepiness;
     uint32_t _capacity;
     uint32_t _quantum;
 
     int _iface_id;
 
+    // time spent in pull(), reported by the pull_cost handler
+    uint64_t _pulls;
+    click_cycles_t _pull_cycles;
+
+    // time spent copying group frames, reported by the fanout_cost handler
+    uint64_t _fanouts;
+    uint64_t _fanout_copies;
+    uint64_t _fanout_nsecs;
+
     bool _debug;
 
-    void store(String, int, Packet *, EtherAddress, EtherAddress);
+    void store(uint16_t, int, Packet *, EtherAddress, EtherAddress);
+    void fanout(Packet *, int, EtherAddress, const Timestamp &);
+    void fanout_dms(Packet *, int, int, Vector<EtherAddress> *, const Timestamp &);
+    void account_fanout(uint32_t, const Timestamp &);
+    FanOutTenant *fanout_tenant(FanOut &, String);
+    void index_slices(const String &);
+    bool enqueue(SliceQueue *, Packet *, EtherAddress, EtherAddress);
+    void splice_pending();
+    Packet *schedule();
+    uint32_t ur_count(Packet *);
     String list_slices();
 
     static int write_handler(const String &, Element *, void *, ErrorHandler *);
@@ -616,5 +972,34 @@ private:
 
 };
 
+inline bool SliceQueue::enqueue(Packet *p, EtherAddress ra, EtherAddress ta) {
+
+    AggregationQueue *queue = lookup(EtherPair(ra, ta));
+
+    if (!queue->push(p)) {
+        _drops++;
+        return false;
+    }
+
+    uint32_t nb_pkts = queue->nb_pkts();
+    uint32_t max_queue_length;
+    while ((max_queue_length = _max_queue_length) < nb_pkts
+           && _max_queue_length.compare_swap(max_queue_length, nb_pkts) != max_queue_length) {
+    }
+
+    if (queue->activate()) {
+        _pending_lock.acquire();
+        _pending.push_back(queue);
+        _nb_pending++;
+        _pending_lock.release();
+        if (_eqm && !_active && _active.compare_swap(0, 1) == 0) {
+            _eqm->activate(this);
+        }
+    }
+
+    return true;
+
+}
+
 CLICK_ENDDECLS
 #endif
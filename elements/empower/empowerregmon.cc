@@ -1,210 +1,441 @@
-/*
- * empowerregmon.{cc,hh} -- Regmon Element (EmPOWER Access Point)
- * Giovanni Baggio
- *
- * Copyright (c) 2017 FBK CREATE-NET
- * Permission is hereby granted, free of charge, to any person obtaining a
- * copy of this software and associated documentation files (the "Software"),
- * to deal in the Software without restriction, subject to the conditions
- * listed in the Click LICENSE file. These conditions include: you must
- * preserve this copyright notice, and you cannot mention the copyright
- * holders in advertising related to the Software without their permission.
- * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
- * notice is a summary of the Click LICENSE file; the license in that file is
- * legally binding.
- */
-
-#include <stdio.h>
-#include <inttypes.h>
-#include <click/config.h>
-#include "empowerregmon.hh"
-#include <click/args.hh>
-#include <click/straccum.hh>
-#include <click/error.hh>
-#include <click/packet_anno.hh>
-#include "empowerlvapmanager.hh"
-CLICK_DECLS
-
-EmpowerRegmon::EmpowerRegmon() :
-		_el(0), _iface_id(0), _elem_period(4000), _reg_period(1000),
-		_timer(this), _debug(false), _register_log_file(0), _last_mac_ticks(0) {
-}
-
-EmpowerRegmon::~EmpowerRegmon() {
-}
-
-
-int EmpowerRegmon::initialize(ErrorHandler *) {
-
-	RegmonRegister reg_tx = RegmonRegister(EMPOWER_REGMON_TX, _iface_id, 100);
-	_registers.push_back(reg_tx);
-
-	RegmonRegister reg_rx = RegmonRegister(EMPOWER_REGMON_RX, _iface_id, 100);
-	_registers.push_back(reg_rx);
-
-	RegmonRegister reg_ed = RegmonRegister(EMPOWER_REGMON_ED, _iface_id, 100);
-	_registers.push_back(reg_ed);
-
-	_last_mac_ticks = 0;
-
-	// set sampling interval
-	String period_file_path = _debugfs + "/sampling_interval";
-	FILE *period_file = fopen(period_file_path.c_str(), "w");
-
-	if (period_file != NULL) {
-		fprintf(period_file, "%d", _reg_period * 1000000);
-		fclose(period_file);
-	} else {
-		click_chatter("%{element} :: %s :: unable to open sampling period file %s",
-					  this,
-					  __func__,
-					  period_file_path.c_str());
-	}
-
-	// flush measurements register and keep the file open
-	// due to bugs in the driver patch, the fread can return more data than the one available in the buffer
-	// it is also likely that the read handler reports lines instead of bytes
-	String register_log_file_path = _debugfs + "/register_log";
-	_register_log_file = fopen(register_log_file_path.c_str(), "r");
-	char* buffer[8192];
-	int nread;
-
-	do {
-		nread = fread(&buffer, 1, sizeof buffer, _register_log_file);
-	} while (nread > 0); // fixme, read operation could be slower than kernel measurements writing
-
-	_timer.initialize(this);
-	_timer.schedule_now();
-
-	if (_debug) {
-		click_chatter("%{element} :: %s :: iface_id %d initialised",
-					  this,
-					  __func__,
-					  _iface_id);
-	}
-
-	return 0;
-}
-
-int EmpowerRegmon::configure(Vector<String> &conf, ErrorHandler *errh) {
-
-	int ret = Args(conf, this, errh)
-              .read_m("EL", ElementCastArg("EmpowerLVAPManager"), _el)
-			  .read_m("IFACE_ID", _iface_id)
-			  .read("ELEM_PERIOD", _elem_period)
-			  .read("REG_PERIOD", _reg_period)
-			  .read_m("DEBUGFS", _debugfs)
-			  .read("DEBUG", _debug).complete();
-
-	return ret;
-
-}
-
-void EmpowerRegmon::run_timer(Timer *) {
-
-	Timestamp start = Timestamp::now();
-
-	FILE * fp;
-	char * line = NULL;
-	size_t len = 0;
-	ssize_t read;
-
-	String register_log_file_path = _debugfs + "/register_log";
-	fp = fopen(register_log_file_path.c_str(), "r");
-
-	if (fp == NULL) {
-		click_chatter("%{element} :: %s :: unable to open file %s",
-					  this,
-					  __func__,
-					  register_log_file_path.c_str());
-		_timer.schedule_after_msec(_elem_period);
-		return;
-	}
-
-	while ((read = getline(&line, &len, fp)) != -1) {
-		Vector<String> values;
-		char* token = strtok(line, ",");
-		while (token != NULL) {
-			values.push_back(String(token));
-			token = strtok(NULL, ",");
-		}
-		uint32_t sec = strtoul(values[0].c_str(), NULL, 10);
-		uint32_t nsec = strtoul(values[1].c_str(), NULL, 10);
-		uint32_t mac_ticks = strtoul(values[3].c_str(), NULL, 16);
-		uint32_t tx = strtoul(values[4].c_str(), NULL, 16);
-		uint32_t rx = strtoul(values[5].c_str(), NULL, 16);
-		uint32_t ed = strtoul(values[6].c_str(), NULL, 16);
-
-		bool valid;
-		uint32_t mac_ticks_delta = 0;
-
-		if (mac_ticks < _last_mac_ticks) {
-
-			_last_mac_ticks = mac_ticks;
-			valid = false;
-		}
-		else {
-
-			mac_ticks_delta = mac_ticks - _last_mac_ticks;
-			_last_mac_ticks = mac_ticks;
-			valid = true;
-		}
-
-		uint64_t ts_int = sec * 1000000LL + nsec / 1000;
-		_registers[EMPOWER_REGMON_TX].add_sample(ts_int, tx, mac_ticks_delta, valid);
-		_registers[EMPOWER_REGMON_RX].add_sample(ts_int, rx, mac_ticks_delta, valid);
-		_registers[EMPOWER_REGMON_ED].add_sample(ts_int, ed, mac_ticks_delta, valid);
-	}
-
-	fclose(fp);
-
-	Timestamp delta = Timestamp::now() -start;
-
-	if (delta.msec() > _elem_period) {
-		click_chatter("%{element} :: %s :: processing samples took too much time %s",
-				      this,
-					  __func__,
-					  delta.unparse().c_str());
-	}
-
-	_timer.schedule_after_msec(_elem_period - delta.msec());
-	return;
-
-}
-
-enum {
-	H_STATUS,
-	H_FULL,
-};
-
-String EmpowerRegmon::read_handler(Element *e, void *thunk) {
-	StringAccum sa;
-	EmpowerRegmon *eg = (EmpowerRegmon *) e;
-	switch ((uintptr_t) thunk) {
-	case H_STATUS: {
-		for (RegistersIter iter = eg->_registers.begin(); iter != eg->_registers.end(); iter++) {
-			sa << iter->unparse() << "\n";
-		}
-		return sa.take_string();
-	}
-	case H_FULL: {
-		for (RegistersIter iter = eg->_registers.begin(); iter != eg->_registers.end(); iter++) {
-			sa << iter->unparse() << "\n";
-			for (int i = 0; i < 100; i++) {
-				sa << iter->_timestamps[i] << " " << iter->_samples[i] << '\n';
-			}
-		}
-		return sa.take_string();
-	}
-	default:
-		return String();
-	}
-}
-
-void EmpowerRegmon::add_handlers() {
-	add_read_handler("status", read_handler, (void *) H_STATUS);
-	add_read_handler("full", read_handler, (void *) H_FULL);
-}
-
-CLICK_ENDDECLS
-EXPORT_ELEMENT(EmpowerRegmon)
+/*
+ * empowerregmon.{cc,hh} -- Regmon Element (EmPOWER Access Point)
+ * Giovanni Baggio
+ *
+ * Copyright (c) 2017 FBK CREATE-NET
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <click/config.h>
+#include "empowerregmon.hh"
+#include <click/args.hh>
+#include <click/straccum.hh>
+#include <click/error.hh>
+#include <click/packet_anno.hh>
+#include "empowerlvapmanager.hh"
+CLICK_DECLS
+
+// value of each character as a hex digit, 0xff if it is not one
+static uint8_t hex_digits[256];
+
+static void init_hex_digits() {
+	memset(hex_digits, 0xff, sizeof(hex_digits));
+	for (int c = 0; c < 10; c++) {
+		hex_digits['0' + c] = c;
+	}
+	for (int c = 0; c < 6; c++) {
+		hex_digits['a' + c] = hex_digits['A' + c] = 10 + c;
+	}
+}
+
+RegmonReader::RegmonReader() : _binary(false), _head(0), _tail(0), _reads(0), _bytes(0),
+	_samples(0), _bad_lines(0) {
+	init_hex_digits();
+}
+
+ssize_t RegmonReader::fill(int fd) {
+
+	// move what is left of the last block to the front
+	if (_head) {
+		memmove(_buffer, _buffer + _head, _tail - _head);
+		_tail -= _head;
+		_head = 0;
+	}
+
+	// a line longer than the buffer can only be garbage
+	if (_tail == BUFFER_SIZE) {
+		_bad_lines++;
+		_tail = 0;
+	}
+
+	ssize_t n;
+	do {
+		n = read(fd, _buffer + _tail, BUFFER_SIZE - _tail);
+	} while (n < 0 && errno == EINTR);
+
+	if (n > 0) {
+		_tail += n;
+		_reads++;
+		_bytes += n;
+	}
+
+	return n;
+
+}
+
+/*
+ * Reads an unsigned number from [p, end), skipping leading blanks and a
+ * 0x before hex digits. Returns where the number ends, or 0 if there is no
+ * number.
+ */
+static inline const char *parse_uint(const char *p, const char *end, bool hex, uint32_t &value) {
+
+	while (p != end && (*p == ' ' || *p == '\t')) {
+		p++;
+	}
+
+	if (hex && end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+		p += 2;
+	}
+
+	const char *start = p;
+	uint32_t v = 0;
+
+	if (hex) {
+		uint32_t digit;
+		for (; p != end && (digit = hex_digits[(uint8_t) *p]) != 0xff; p++) {
+			v = (v << 4) | digit;
+		}
+	} else {
+		for (; p != end && *p >= '0' && *p <= '9'; p++) {
+			v = v * 10 + (*p - '0');
+		}
+	}
+
+	value = v;
+	return p != start ? p : 0;
+
+}
+
+/*
+ * Parses the line [p, end), without its newline, into s. The third field
+ * is not used, and fields after the seventh are ignored.
+ */
+bool RegmonReader::parse_line(const char *p, const char *end, RegmonSample &s) {
+
+	uint32_t fields[7];
+
+	for (int i = 0; i < 7; i++) {
+		if (i && (p == end || *p++ != ',')) {
+			return false;
+		}
+		if (i == 2) {
+			while (p != end && *p != ',') {
+				p++;
+			}
+			continue;
+		}
+		if (!(p = parse_uint(p, end, i > 2, fields[i]))) {
+			return false;
+		}
+	}
+
+	while (p != end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+		p++;
+	}
+
+	if (p != end && *p != ',') {
+		return false;
+	}
+
+	s._sec = fields[0];
+	s._nsec = fields[1];
+	s._mac_ticks = fields[3];
+	s._tx = fields[4];
+	s._rx = fields[5];
+	s._ed = fields[6];
+
+	return true;
+
+}
+
+bool RegmonReader::next(RegmonSample &s) {
+
+	if (_binary) {
+		if (_tail - _head < sizeof(RegmonSample)) {
+			return false;
+		}
+		memcpy(&s, _buffer + _head, sizeof(RegmonSample));
+		_head += sizeof(RegmonSample);
+		_samples++;
+		return true;
+	}
+
+	while (_head != _tail) {
+		const char *line = _buffer + _head;
+		const char *nl = (const char *) memchr(line, '\n', _tail - _head);
+		if (!nl) {
+			return false;
+		}
+		_head = nl + 1 - _buffer;
+		if (parse_line(line, nl, s)) {
+			_samples++;
+			return true;
+		}
+		// empty lines are not worth counting
+		if (nl != line) {
+			_bad_lines++;
+		}
+	}
+
+	return false;
+
+}
+
+String RegmonReader::unparse() const {
+	StringAccum sa;
+	sa << "reads " << _reads << " bytes " << _bytes << " samples " << _samples;
+	sa << " bad_lines " << _bad_lines << " buffered " << (_tail - _head);
+	return sa.take_string();
+}
+
+EmpowerRegmon::EmpowerRegmon() :
+		_el(0), _iface_id(0), _elem_period(4000), _reg_period(1000),
+		_timer(this), _debug(false), _binary(false), _reopen(false), _fd(-1),
+		_last_mac_ticks(0), _runs(0), _ingest_nsecs(0), _max_ingest_nsecs(0) {
+}
+
+EmpowerRegmon::~EmpowerRegmon() {
+}
+
+
+int EmpowerRegmon::initialize(ErrorHandler *) {
+
+	static const empower_regmon_types types[] = { EMPOWER_REGMON_TX, EMPOWER_REGMON_RX, EMPOWER_REGMON_ED };
+	static const uint64_t periods[] = { 1000000, 10000000, 60000000 };
+
+	for (int i = 0; i < 3; i++) {
+		RegmonRegister reg = RegmonRegister(types[i], _iface_id, _tier_sizes[EMPOWER_REGMON_RAW]);
+		for (int t = 0; t < RegmonRegister::NB_TIERS; t++) {
+			reg._tiers[t].configure(periods[t], _tier_sizes[t + 1]);
+		}
+		_registers.push_back(reg);
+	}
+
+	_last_mac_ticks = 0;
+
+	// set sampling interval
+	String period_file_path = _debugfs + "/sampling_interval";
+	FILE *period_file = fopen(period_file_path.c_str(), "w");
+
+	if (period_file != NULL) {
+		fprintf(period_file, "%d", _reg_period * 1000000);
+		fclose(period_file);
+	} else {
+		click_chatter("%{element} :: %s :: unable to open sampling period file %s",
+					  this,
+					  __func__,
+					  period_file_path.c_str());
+	}
+
+	// flush measurements register and keep the file open
+	// due to bugs in the driver patch, the read can return more data than the one available in the buffer
+	// it is also likely that the read handler reports lines instead of bytes
+	_reader.set_binary(_binary);
+
+	if (open_log()) {
+		RegmonSample sample;
+		while (_reader.fill(_fd) > 0) { // fixme, read operation could be slower than kernel measurements writing
+			while (_reader.next(sample)) {
+			}
+		}
+		_reader.reset();
+	}
+
+	_timer.initialize(this);
+	_timer.schedule_now();
+
+	if (_debug) {
+		click_chatter("%{element} :: %s :: iface_id %d initialised",
+					  this,
+					  __func__,
+					  _iface_id);
+	}
+
+	return 0;
+}
+
+int EmpowerRegmon::configure(Vector<String> &conf, ErrorHandler *errh) {
+
+	_tier_sizes[EMPOWER_REGMON_RAW] = 100;
+	_tier_sizes[EMPOWER_REGMON_1S] = 300;
+	_tier_sizes[EMPOWER_REGMON_10S] = 360;
+	_tier_sizes[EMPOWER_REGMON_60S] = 1440;
+
+	int ret = Args(conf, this, errh)
+              .read_m("EL", ElementCastArg("EmpowerLVAPManager"), _el)
+			  .read_m("IFACE_ID", _iface_id)
+			  .read("ELEM_PERIOD", _elem_period)
+			  .read("REG_PERIOD", _reg_period)
+			  .read_m("DEBUGFS", _debugfs)
+			  .read("BINARY", _binary)
+			  .read("REOPEN", _reopen)
+			  .read("RAW_SAMPLES", _tier_sizes[EMPOWER_REGMON_RAW])
+			  .read("SAMPLES_1S", _tier_sizes[EMPOWER_REGMON_1S])
+			  .read("SAMPLES_10S", _tier_sizes[EMPOWER_REGMON_10S])
+			  .read("SAMPLES_60S", _tier_sizes[EMPOWER_REGMON_60S])
+			  .read("DEBUG", _debug).complete();
+
+	if (ret < 0) {
+		return ret;
+	}
+
+	for (int i = 0; i <= EMPOWER_REGMON_60S; i++) {
+		if (_tier_sizes[i] < 1 || _tier_sizes[i] > MAX_TIER_SIZE) {
+			return errh->error("RAW_SAMPLES and SAMPLES_* must be between 1 and %d", MAX_TIER_SIZE);
+		}
+	}
+
+	return ret;
+
+}
+
+void EmpowerRegmon::cleanup(CleanupStage) {
+	close_log();
+}
+
+bool EmpowerRegmon::open_log() {
+
+	String register_log_file_path = _debugfs + "/register_log";
+	_fd = open(register_log_file_path.c_str(), O_RDONLY);
+
+	if (_fd < 0) {
+		click_chatter("%{element} :: %s :: unable to open file %s",
+					  this,
+					  __func__,
+					  register_log_file_path.c_str());
+		return false;
+	}
+
+	return true;
+
+}
+
+void EmpowerRegmon::close_log() {
+	if (_fd >= 0) {
+		close(_fd);
+		_fd = -1;
+	}
+	// a line cut by the old descriptor would never be completed
+	_reader.reset();
+}
+
+void EmpowerRegmon::add_sample(const RegmonSample &s) {
+
+	bool valid;
+	uint32_t mac_ticks_delta = 0;
+
+	if (s._mac_ticks < _last_mac_ticks) {
+
+		_last_mac_ticks = s._mac_ticks;
+		valid = false;
+	}
+	else {
+
+		mac_ticks_delta = s._mac_ticks - _last_mac_ticks;
+		_last_mac_ticks = s._mac_ticks;
+		valid = true;
+	}
+
+	uint64_t ts_int = s._sec * 1000000LL + s._nsec / 1000;
+	_registers[EMPOWER_REGMON_TX].add_sample(ts_int, s._tx, mac_ticks_delta, valid);
+	_registers[EMPOWER_REGMON_RX].add_sample(ts_int, s._rx, mac_ticks_delta, valid);
+	_registers[EMPOWER_REGMON_ED].add_sample(ts_int, s._ed, mac_ticks_delta, valid);
+
+}
+
+void EmpowerRegmon::run_timer(Timer *) {
+
+	Timestamp start = Timestamp::now();
+
+	if (_reopen) {
+		close_log();
+	}
+
+	if (_fd < 0 && !open_log()) {
+		_timer.schedule_after_msec(_elem_period);
+		return;
+	}
+
+	RegmonSample sample;
+	ssize_t n;
+
+	while ((n = _reader.fill(_fd)) > 0) {
+		while (_reader.next(sample)) {
+			add_sample(sample);
+		}
+	}
+
+	if (n < 0) {
+		click_chatter("%{element} :: %s :: error reading register_log: %s",
+					  this,
+					  __func__,
+					  strerror(errno));
+		close_log();
+	}
+
+	Timestamp delta = Timestamp::now() -start;
+
+	_runs++;
+	_ingest_nsecs += delta.nsecval();
+	if ((uint64_t) delta.nsecval() > _max_ingest_nsecs) {
+		_max_ingest_nsecs = delta.nsecval();
+	}
+
+	if (delta.msec() > _elem_period) {
+		click_chatter("%{element} :: %s :: processing samples took too much time %s",
+				      this,
+					  __func__,
+					  delta.unparse().c_str());
+	}
+
+	_timer.schedule_after_msec(_elem_period - delta.msec());
+	return;
+
+}
+
+enum {
+	H_STATUS,
+	H_FULL,
+	H_INGEST,
+};
+
+String EmpowerRegmon::read_handler(Element *e, void *thunk) {
+	StringAccum sa;
+	EmpowerRegmon *eg = (EmpowerRegmon *) e;
+	switch ((uintptr_t) thunk) {
+	case H_STATUS: {
+		for (RegistersIter iter = eg->_registers.begin(); iter != eg->_registers.end(); iter++) {
+			sa << iter->unparse() << "\n";
+		}
+		return sa.take_string();
+	}
+	case H_FULL: {
+		for (RegistersIter iter = eg->_registers.begin(); iter != eg->_registers.end(); iter++) {
+			sa << iter->unparse() << "\n";
+			for (int i = 0; i < iter->_size; i++) {
+				sa << iter->_timestamps[i] << " " << iter->_samples[i] << '\n';
+			}
+		}
+		return sa.take_string();
+	}
+	case H_INGEST: {
+		sa << eg->_reader.unparse() << " runs " << eg->_runs << " nsecs " << eg->_ingest_nsecs;
+		sa << " max_nsecs " << eg->_max_ingest_nsecs << "\n";
+		return sa.take_string();
+	}
+	default:
+		return String();
+	}
+}
+
+void EmpowerRegmon::add_handlers() {
+	add_read_handler("status", read_handler, (void *) H_STATUS);
+	add_read_handler("full", read_handler, (void *) H_FULL);
+	add_read_handler("ingest", read_handler, (void *) H_INGEST);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(EmpowerRegmon)
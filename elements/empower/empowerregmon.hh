@@ -1,142 +1,431 @@
-#ifndef CLICK_EMPOWEREGMON_HH
-#define CLICK_EMPOWEREGMON_HH
-#include <click/element.hh>
-#include <click/config.h>
-#include <click/timer.hh>
-#include <click/vector.hh>
-#include <click/straccum.hh>
-#include <unistd.h>
-#include "empowerlvapmanager.hh"
-CLICK_DECLS
-
-
-class RegmonRegister {
-public:
-
-	RegmonRegister(empower_regmon_types type, int iface_id, uint32_t size) {
-		_type = type;
-		_iface_id = iface_id;
-		_size = size;
-		_samples = new uint32_t[size]();
-		_timestamps = new uint64_t[size]();
-		_index = 0;
-		_last_value = 0;
-		_skipped = 0;
-		_min_value = 0xffffffff;
-		_max_value = 0;
-		_first_run = true;
-		memset(_samples, 0, _size);
-	}
-
-	void add_sample(uint64_t timestamp, uint32_t value, uint32_t mac_ticks_delta, bool valid) {
-
-		if (_first_run) {
-			_first_run = false;
-			_samples[_index] = 0;
-			_timestamps[_index] = timestamp;
-		} else {
-
-			if (!valid)
-
-				_samples[_index] = 36000;
-			else {
-
-				uint64_t value_delta = value - _last_value;
-				_samples[_index] = (uint32_t)((value_delta * 18000) / mac_ticks_delta);
-			}
-
-			_timestamps[_index] = timestamp;
-		}
-
-		_last_value = value;
-
-		if (value > _max_value)
-			_max_value = value;
-
-		if (value < _min_value)
-			_min_value = value;
-
-		_index++;
-		_index %= _size;
-
-	}
-
-	String unparse() {
-
-		StringAccum sa;
-
-		if (_type == EMPOWER_REGMON_TX) {
-			sa << "Register=tx\t";
-		} else if (_type == EMPOWER_REGMON_RX) {
-			sa << "Register=rx\t";
-		} else {
-			sa << "Register=ed\t";
-		}
-
-		sa << "Id=" << _iface_id << "\t";
-		sa << "Size=" << _size << "\t";
-		sa << "Index=" << _index << "\t";
-		sa << "Skipped=" << _skipped << "\t";
-		sa << "MinValue=" << _min_value << "\t\t";
-		sa << "MaxValue=" << _max_value;
-
-		return sa.take_string();
-
-	}
-
-	empower_regmon_types _type;
-	int _iface_id;
-	int _size;
-	uint32_t *_samples;
-	uint64_t *_timestamps;
-	int _index;
-	uint32_t _last_value;
-	int _skipped;
-	uint32_t _min_value;
-	uint32_t _max_value;
-	bool _first_run;
-
-};
-
-typedef Vector<RegmonRegister> Registers;
-typedef Registers::iterator RegistersIter;
-
-class EmpowerRegmon: public Element {
-public:
-
-	EmpowerRegmon();
-	~EmpowerRegmon();
-
-	const char *class_name() const { return "EmpowerRegmon"; }
-
-	int configure(Vector<String> &, ErrorHandler *);
-	void add_handlers();
-	int initialize(ErrorHandler *);
-	void run_timer(Timer *);
-	RegmonRegister * registers(int i) { return &_registers.at(i); }
-
-private:
-
-	class EmpowerLVAPManager *_el;
-    int _iface_id;
-
-	uint32_t _elem_period; // msecs
-	uint32_t _reg_period; // msecs
-	Timer _timer;
-
-	bool _debug;
-
-	String _debugfs;
-
-	FILE *_register_log_file;
-	uint32_t _last_mac_ticks;
-
-	Registers _registers;
-
-	static int write_handler(const String &, Element *, void *, ErrorHandler *);
-	static String read_handler(Element *, void *);
-
-};
-
-CLICK_ENDDECLS
-#endif
+#ifndef CLICK_EMPOWEREGMON_HH
+#define CLICK_EMPOWEREGMON_HH
+#include <click/element.hh>
+#include <click/config.h>
+#include <click/timer.hh>
+#include <click/vector.hh>
+#include <click/straccum.hh>
+#include <unistd.h>
+#include "empowerlvapmanager.hh"
+CLICK_DECLS
+
+/*
+=c
+
+EmpowerRegmon(EL, IFACE_ID, DEBUGFS, [I<KEYWORDS>])
+
+=s EmPOWER
+
+Samples the tx, rx and channel busy registers of an interface
+
+=d
+
+Every ELEM_PERIOD msecs, reads the samples that the regmon driver patch
+logged to DEBUGFS/register_log since the last read, and turns them into
+the share of time spent transmitting, receiving and sensing the channel
+busy. The file stays open, and is read in blocks of 64 KB that are parsed
+in place.
+
+Each register keeps its last RAW_SAMPLES samples, and the minimum, average
+and maximum of its samples over periods of 1, 10 and 60 seconds. The
+controller asks for one of these tiers over a time range, or for all the
+raw samples.
+
+Keyword arguments are:
+
+=over 8
+
+=item EL
+An EmpowerLVAPManager element
+
+=item IFACE_ID
+The interface the registers belong to
+
+=item DEBUGFS
+The regmon directory of the interface in debugfs
+
+=item ELEM_PERIOD
+How often the log is read, in msecs, default 4000
+
+=item REG_PERIOD
+How often the driver samples the registers, in msecs, default 1000
+
+=item RAW_SAMPLES
+Raw samples kept per register, default 100
+
+=item SAMPLES_1S
+Periods of 1 second kept per register, default 300
+
+=item SAMPLES_10S
+Periods of 10 seconds kept per register, default 360
+
+=item SAMPLES_60S
+Periods of 60 seconds kept per register, default 1440
+
+=item BINARY
+If true, register_log holds fixed size RegmonSample records in host byte
+order instead of lines of text. Default false.
+
+=item REOPEN
+If true, register_log is opened again at every read, for drivers that only
+return new samples to a fresh open. Default false.
+
+=item DEBUG
+Turn debug on/off
+
+=back 8
+
+=h status read-only
+
+The registers and the bounds of their values, and the last period of each
+tier
+
+=h full read-only
+
+The registers and all their raw samples
+
+=h ingest read-only
+
+Reads, bytes, samples and malformed lines taken from register_log, and the
+time spent on them
+
+=a EmpowerLVAPManager
+*/
+
+// One sample of register_log: when it was taken, the MAC clock and the tx,
+// rx and energy-detect counters of the card. A line of text holds these
+// fields in this order, the last four in hex, with an unused third field
+// after the nanoseconds; a binary record is this structure in host byte
+// order.
+struct RegmonSample {
+	uint32_t _sec;
+	uint32_t _nsec;
+	uint32_t _mac_ticks;
+	uint32_t _tx;
+	uint32_t _rx;
+	uint32_t _ed;
+};
+
+// Reads register_log in blocks and splits it into samples without copying
+// the text. A line or record cut at the end of a block is kept for the
+// next one. Malformed lines are counted and skipped.
+//
+// Usage:
+//
+//	while ((n = reader.fill(fd)) > 0)
+//		while (reader.next(sample))
+//			add_sample(sample);
+class RegmonReader {
+public:
+
+	enum { BUFFER_SIZE = 65536 };
+
+	RegmonReader();
+
+	void set_binary(bool binary) { _binary = binary; reset(); }
+
+	// Appends what fd has to offer, up to a buffer. Returns the bytes
+	// read, 0 at the end of the file, -1 on error.
+	ssize_t fill(int fd);
+
+	// Returns the next complete sample of the buffer, false if there is
+	// none left.
+	bool next(RegmonSample &);
+
+	// Drops the buffered bytes, for example when the file is reopened.
+	void reset() { _head = _tail = 0; }
+
+	uint64_t samples() const { return _samples; }
+	uint32_t bad_lines() const { return _bad_lines; }
+
+	String unparse() const;
+
+private:
+
+	bool _binary;
+	uint32_t _head;
+	uint32_t _tail;
+	char _buffer[BUFFER_SIZE];
+
+	uint32_t _reads;
+	uint64_t _bytes;
+	uint64_t _samples;
+	uint32_t _bad_lines;
+
+	bool parse_line(const char *, const char *, RegmonSample &);
+
+};
+
+
+// Lowest, highest and total of the samples of a register over one period
+// of a tier. A raw sample is a bucket of its own, with a count of 1.
+struct RegmonBucket {
+
+	uint64_t _timestamp; // start of the period, usecs
+	uint32_t _min;
+	uint32_t _max;
+	uint64_t _sum;
+	uint32_t _count;
+
+	void reset(uint64_t timestamp, uint32_t sample) {
+		_timestamp = timestamp;
+		_min = _max = sample;
+		_sum = sample;
+		_count = 1;
+	}
+
+	void add(uint32_t sample) {
+		if (sample < _min)
+			_min = sample;
+		if (sample > _max)
+			_max = sample;
+		_sum += sample;
+		_count++;
+	}
+
+	uint32_t avg() const { return _count ? _sum / _count : 0; }
+
+};
+
+typedef Vector<RegmonBucket> RegmonBuckets;
+
+// The last _size periods of _period usecs of a register, downsampled from
+// its raw samples. Periods start at multiples of _period, and a period in
+// which no valid sample was taken has no bucket.
+class RegmonTier {
+public:
+
+	RegmonTier() : _period(0), _index(0), _used(0) {
+	}
+
+	void configure(uint64_t period, int size) {
+		_period = period;
+		_buckets.resize(size);
+		_index = 0;
+		_used = 0;
+	}
+
+	void add_sample(uint64_t timestamp, uint32_t sample) {
+		if (_buckets.empty())
+			return;
+		uint64_t start = timestamp - timestamp % _period;
+		if (_used && _buckets[_index]._timestamp == start) {
+			_buckets[_index].add(sample);
+			return;
+		}
+		if (_used) {
+			_index = (_index + 1) % _buckets.size();
+		}
+		if (_used < _buckets.size()) {
+			_used++;
+		}
+		_buckets[_index].reset(start, sample);
+	}
+
+	// Appends to out, oldest first, the buckets that overlap [from, to].
+	// A to of 0 means up to the newest one. The bucket of the current
+	// period is included, as far as it goes.
+	void select(uint64_t from, uint64_t to, RegmonBuckets &out) const {
+		int size = _buckets.size();
+		for (int i = 0; i < _used; i++) {
+			const RegmonBucket &b = _buckets[(_index - _used + 1 + i + size) % size];
+			if (b._timestamp + _period > from && (!to || b._timestamp <= to))
+				out.push_back(b);
+		}
+	}
+
+	uint64_t _period; // usecs
+	RegmonBuckets _buckets;
+	int _index; // bucket of the current period
+	int _used;
+
+};
+
+class RegmonRegister {
+public:
+
+	RegmonRegister(empower_regmon_types type, int iface_id, uint32_t size) {
+		_type = type;
+		_iface_id = iface_id;
+		_size = size;
+		_samples = new uint32_t[size]();
+		_timestamps = new uint64_t[size]();
+		_index = 0;
+		_last_value = 0;
+		_skipped = 0;
+		_min_value = 0xffffffff;
+		_max_value = 0;
+		_first_run = true;
+		memset(_samples, 0, _size);
+	}
+
+	void add_sample(uint64_t timestamp, uint32_t value, uint32_t mac_ticks_delta, bool valid) {
+
+		if (_first_run) {
+			_first_run = false;
+			_samples[_index] = 0;
+			_timestamps[_index] = timestamp;
+		} else {
+
+			if (!valid)
+
+				_samples[_index] = 36000;
+			else {
+
+				uint64_t value_delta = value - _last_value;
+				_samples[_index] = (uint32_t)((value_delta * 18000) / mac_ticks_delta);
+
+				// only measurements go into the tiers, the first sample
+				// and the ones across a wrap of the mac clock are markers
+				for (int i = 0; i < NB_TIERS; i++) {
+					_tiers[i].add_sample(timestamp, _samples[_index]);
+				}
+			}
+
+			_timestamps[_index] = timestamp;
+		}
+
+		_last_value = value;
+
+		if (value > _max_value)
+			_max_value = value;
+
+		if (value < _min_value)
+			_min_value = value;
+
+		_index++;
+		_index %= _size;
+
+	}
+
+	String unparse() {
+
+		StringAccum sa;
+
+		if (_type == EMPOWER_REGMON_TX) {
+			sa << "Register=tx\t";
+		} else if (_type == EMPOWER_REGMON_RX) {
+			sa << "Register=rx\t";
+		} else {
+			sa << "Register=ed\t";
+		}
+
+		sa << "Id=" << _iface_id << "\t";
+		sa << "Size=" << _size << "\t";
+		sa << "Index=" << _index << "\t";
+		sa << "Skipped=" << _skipped << "\t";
+		sa << "MinValue=" << _min_value << "\t\t";
+		sa << "MaxValue=" << _max_value;
+
+		for (int i = 0; i < NB_TIERS; i++) {
+			const RegmonTier &t = _tiers[i];
+			sa << "\n\tTier=" << (t._period / 1000000) << "s\t";
+			sa << "Size=" << t._buckets.size() << "\t";
+			sa << "Used=" << t._used;
+			if (t._used) {
+				const RegmonBucket &b = t._buckets[t._index];
+				sa << "\tLast=" << b._timestamp << "\t";
+				sa << "Min=" << b._min << "\tAvg=" << b.avg() << "\tMax=" << b._max;
+			}
+		}
+
+		return sa.take_string();
+
+	}
+
+	// Appends to out, oldest first, the samples of tier taken between from
+	// and to, in usecs. A to of 0 means up to the last sample.
+	void history(int tier, uint64_t from, uint64_t to, RegmonBuckets &out) const {
+		if (tier != EMPOWER_REGMON_RAW) {
+			_tiers[tier - 1].select(from, to, out);
+			return;
+		}
+		for (int i = 0; i < _size; i++) {
+			int j = (_index + i) % _size;
+			// slots that were never written have no timestamp
+			if (!_timestamps[j] || _timestamps[j] < from || (to && _timestamps[j] > to))
+				continue;
+			RegmonBucket b;
+			b.reset(_timestamps[j], _samples[j]);
+			out.push_back(b);
+		}
+	}
+
+	enum { NB_TIERS = EMPOWER_REGMON_60S };
+
+	empower_regmon_types _type;
+	int _iface_id;
+	int _size;
+	uint32_t *_samples;
+	uint64_t *_timestamps;
+	int _index;
+	uint32_t _last_value;
+	int _skipped;
+	uint32_t _min_value;
+	uint32_t _max_value;
+	bool _first_run;
+	RegmonTier _tiers[NB_TIERS]; // 1s, 10s and 60s
+
+};
+
+typedef Vector<RegmonRegister> Registers;
+typedef Registers::iterator RegistersIter;
+
+class EmpowerRegmon: public Element {
+public:
+
+	// 3 registers of 16384 entries fit in the 16 bits of nb_entries
+	enum { MAX_TIER_SIZE = 16384 };
+
+	EmpowerRegmon();
+	~EmpowerRegmon();
+
+	const char *class_name() const { return "EmpowerRegmon"; }
+
+	int configure(Vector<String> &, ErrorHandler *);
+	void add_handlers();
+	int initialize(ErrorHandler *);
+	void run_timer(Timer *);
+	RegmonRegister * registers(int i) { return &_registers.at(i); }
+	void cleanup(CleanupStage);
+
+private:
+
+	class EmpowerLVAPManager *_el;
+    int _iface_id;
+
+	uint32_t _elem_period; // msecs
+	uint32_t _reg_period; // msecs
+	Timer _timer;
+
+	bool _debug;
+
+	String _debugfs;
+
+	// samples kept per register, by tier
+	int _tier_sizes[EMPOWER_REGMON_60S + 1];
+
+	bool _binary;
+	bool _reopen;
+	int _fd;
+	RegmonReader _reader;
+	uint32_t _last_mac_ticks;
+
+	// time spent reading register_log, reported by the ingest handler
+	uint32_t _runs;
+	uint64_t _ingest_nsecs;
+	uint64_t _max_ingest_nsecs;
+
+	bool open_log();
+	void close_log();
+	void add_sample(const RegmonSample &);
+
+	Registers _registers;
+
+	static int write_handler(const String &, Element *, void *, ErrorHandler *);
+	static String read_handler(Element *, void *);
+
+};
+
+CLICK_ENDDECLS
+#endif
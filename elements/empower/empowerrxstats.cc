@@ -31,10 +31,10 @@ CLICK_DECLS
 void send_summary_trigger_callback(Timer *timer, void *data) {
 	// send summary
 	SummaryTrigger *summary = (SummaryTrigger *) data;
-	summary->_ers->lock.acquire_write();
+	summary->_ers->summary_lock.acquire();
 	summary->_el->send_summary_trigger(summary);
 	summary->_sent++;
-	summary->_ers->lock.release_write();
+	summary->_ers->summary_lock.release();
 	if (summary->_limit > 0 && summary->_sent >= (unsigned) summary->_limit) {
 		summary->_ers->del_summary_trigger(summary->_trigger_id);
 		return;
@@ -46,33 +46,19 @@ void send_summary_trigger_callback(Timer *timer, void *data) {
 void send_rssi_trigger_callback(Timer *timer, void *data) {
 	// process triggers
 	RssiTrigger *rssi = (RssiTrigger *) data;
-	rssi->_ers->lock.acquire_write();
-	for (NTIter iter = rssi->_ers->stas.begin(); iter.live(); iter++) {
-		DstInfo *nfo = &iter.value();
-		// not matching the address
-		if (nfo->_eth != rssi->_eth) {
-			continue;
-		}
-		// check if condition matches
-		if (rssi->matches(nfo) && !rssi->_dispatched) {
-			rssi->_el->send_rssi_trigger(nfo->_iface_id, rssi->_trigger_id, nfo->_sma_rssi->avg());
-			rssi->_dispatched = true;
-		} else if (!rssi->matches(nfo) && rssi->_dispatched) {
-			rssi->_dispatched = false;
-		}
-	}
-	rssi->_ers->lock.release_write();
+	rssi->_ers->check_rssi_trigger(rssi);
 	// re-schedule the timer
 	timer->schedule_after_msec(rssi->_period);
 }
 
 EmpowerRXStats::EmpowerRXStats() :
-		_el(0), _timer(this), _signal_offset(0), _period(500),
-		_sma_period(13), _max_silent_window_count(10), _debug(false) {
-
+		_el(0), _timer(this), _accums(0), _nb_accums(0), _summary_frames(1024),
+		_signal_offset(0), _period(500), _sma_period(13), _max_silent_window_count(10), _debug(false) {
+	memset(_summary_filter, 0, sizeof(_summary_filter));
 }
 
 EmpowerRXStats::~EmpowerRXStats() {
+	delete[] _accums;
 }
 
 int EmpowerRXStats::initialize(ErrorHandler *) {
@@ -88,46 +74,170 @@ int EmpowerRXStats::configure(Vector<String> &conf, ErrorHandler *errh) {
 			.read("SMA_PERIOD", _sma_period)
 			.read("SIGNAL_OFFSET", _signal_offset)
 			.read("PERIOD", _period)
+			.read("SUMMARY_FRAMES", _summary_frames)
 			.read("DEBUG", _debug)
 			.complete();
 
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (_sma_period < 1 || _sma_period > SMA::MAX_PERIOD) {
+		return errh->error("SMA_PERIOD must be between 1 and %d", SMA::MAX_PERIOD);
+	}
+
+	// the summary message counts its frames on 16 bits
+	if (_summary_frames < 1 || _summary_frames > MAX_SUMMARY_FRAMES) {
+		return errh->error("SUMMARY_FRAMES must be between 1 and %d", MAX_SUMMARY_FRAMES);
+	}
+
+	// one set of accumulators for each thread that can run simple_action
+	if (!_accums) {
+#if HAVE_MULTITHREAD
+		_nb_accums = click_max_cpu_ids();
+#else
+		_nb_accums = 1;
+#endif
+		_accums = new NeighborAccumulator[_nb_accums];
+	}
+
 	return ret;
 
 }
 
-void EmpowerRXStats::run_timer(Timer *) {
-	// process stations
-	lock.acquire_write();
-	for (NTIter iter = stas.begin(); iter.live();) {
-		// Update stats
-		DstInfo *nfo = &iter.value();
-		nfo->update();
-		// Delete stale entries
-		if (nfo->_silent_window_count > _max_silent_window_count) {
-			iter = stas.erase(iter);
-		} else {
-			++iter;
+void EmpowerRXStats::merge_table(AccumTable &accums, bool station, NeighborAccumulator &acc) {
+	for (ATIter iter = accums.begin(); iter.live();) {
+		NeighborAccum &a = iter.value();
+		// silent for as long as this table was written, it is enough to
+		// know it in the neighbour tables
+		if (!a._packets) {
+			iter = accums.erase(iter);
+			continue;
 		}
+		NeighborShard &sh = shard(iter.key());
+		sh._lock.acquire();
+		NeighborTable &table = station ? sh._stas : sh._aps;
+		NTIter it = table.find(iter.key());
+		DstInfo *nfo = it.get();
+		if (!nfo) {
+			nfo = sh._pool.allocate();
+			nfo->_sma_rssi.set_period(_sma_period);
+			nfo->_iface_id = a._iface_id;
+			nfo->_eth = iter.key();
+			table.set(it, nfo, true);
+		}
+		nfo->add_samples(a._packets, a._accum_rssi, a._squares_rssi, a._last_received);
+		sh._lock.release();
+		acc._merged_samples += a._packets;
+		acc._merged_neighbors++;
+		a._packets = 0;
+		a._accum_rssi = 0;
+		a._squares_rssi = 0;
+		++iter;
 	}
-	// process access points
-	for (NTIter iter = aps.begin(); iter.live();) {
-		// Update aps
-		DstInfo *nfo = &iter.value();
+}
+
+void EmpowerRXStats::merge() {
+	for (unsigned i = 0; i < _nb_accums; i++) {
+		NeighborAccumulator &acc = _accums[i];
+		acc._lock.acquire();
+		acc._stas.swap(acc._spare_stas);
+		acc._aps.swap(acc._spare_aps);
+		acc._lock.release();
+		// the RX thread now writes the other tables, these are ours
+		merge_table(acc._spare_stas, true, acc);
+		merge_table(acc._spare_aps, false, acc);
+	}
+}
+
+void EmpowerRXStats::update_table(NeighborTable &table, DstInfoPool &pool) {
+	for (NTIter iter = table.begin(); iter.live();) {
+		// Update stats
+		DstInfo *nfo = iter.get();
 		nfo->update();
 		// Delete stale entries
 		if (nfo->_silent_window_count > _max_silent_window_count) {
-			iter = aps.erase(iter);
+			pool.deallocate(table.erase(iter));
 		} else {
 			++iter;
 		}
 	}
-	lock.release_write();
-	// process reg mon info
-	/* read from debugfs and copy data in circular array */
+}
+
+void EmpowerRXStats::clear_table(NeighborTable &table, DstInfoPool &pool) {
+	for (NTIter iter = table.begin(); iter.live();) {
+		pool.deallocate(table.erase(iter));
+	}
+}
+
+void EmpowerRXStats::update() {
+	merge();
+	// process stations and access points
+	for (int i = 0; i < NB_SHARDS; i++) {
+		_shards[i]._lock.acquire();
+		update_table(_shards[i]._stas, _shards[i]._pool);
+		update_table(_shards[i]._aps, _shards[i]._pool);
+		_shards[i]._lock.release();
+	}
+}
+
+void EmpowerRXStats::run_timer(Timer *) {
+	update();
 	// rescheduler
 	_timer.schedule_after_msec(_period);
 }
 
+void EmpowerRXStats::neighbors(bool station, int iface_id, Vector<NeighborStats> &out) {
+	for (int i = 0; i < NB_SHARDS; i++) {
+		_shards[i]._lock.acquire();
+		NeighborTable &table = station ? _shards[i]._stas : _shards[i]._aps;
+		for (NTIter iter = table.begin(); iter.live(); iter++) {
+			DstInfo *nfo = iter.get();
+			if (nfo->_iface_id != iface_id) {
+				continue;
+			}
+			NeighborStats n;
+			n._eth = nfo->_eth;
+			n._last_rssi = nfo->_last_rssi;
+			n._last_std = nfo->_last_std;
+			n._last_packets = nfo->_last_packets;
+			n._hist_packets = nfo->_hist_packets;
+			n._sma_rssi = nfo->_sma_rssi.avg();
+			out.push_back(n);
+		}
+		_shards[i]._lock.release();
+	}
+}
+
+void EmpowerRXStats::allocations(uint32_t &chunks, uint64_t &allocs, uint64_t &frees, uint32_t &live) {
+	chunks = 0;
+	allocs = 0;
+	frees = 0;
+	live = 0;
+	for (int i = 0; i < NB_SHARDS; i++) {
+		_shards[i]._lock.acquire();
+		chunks += _shards[i]._pool.chunks();
+		allocs += _shards[i]._pool.allocs();
+		frees += _shards[i]._pool.frees();
+		live += _shards[i]._pool.live();
+		_shards[i]._lock.release();
+	}
+}
+
+void EmpowerRXStats::check_rssi_trigger(RssiTrigger *rssi) {
+	NeighborShard &sh = shard(rssi->_eth);
+	sh._lock.acquire();
+	DstInfo *nfo = sh._stas.get(rssi->_eth);
+	// check if condition matches
+	if (nfo && rssi->matches(nfo) && !rssi->_dispatched) {
+		rssi->_el->send_rssi_trigger(nfo->_iface_id, rssi->_trigger_id, nfo->_sma_rssi.avg());
+		rssi->_dispatched = true;
+	} else if (nfo && !rssi->matches(nfo) && rssi->_dispatched) {
+		rssi->_dispatched = false;
+	}
+	sh._lock.release();
+}
+
 Packet *
 EmpowerRXStats::simple_action(Packet *p) {
 
@@ -208,55 +318,72 @@ EmpowerRXStats::simple_action(Packet *p) {
 
 	uint8_t iface_id = PAINT_ANNO(p);
 
-	lock.acquire_write();
-
-	update_neighbor(ta, station, iface_id, rssi);
+	update_neighbor(ta, station, iface_id, rssi, p->timestamp_anno());
 
 	// check if frame meta-data should be saved
-	for (DTIter qi = _summary_triggers.begin(); qi != _summary_triggers.end(); qi++) {
-		if ((*qi)->_iface_id != iface_id) {
-			continue;
+	uint64_t filter = _summary_filter[iface_id];
+	if (filter & (SUMMARY_ALL | summary_bit(ta))) {
+		summary_lock.acquire();
+		SummaryTrigger *summary = _summary_index.get(summary_key(iface_id, ta));
+		if (summary) {
+			capture_frame(p, summary, ra, ta, rssi, type, subtype, retry, station, iface_id);
 		}
-		if ((*qi)->_eth == ta || (*qi)->_eth.is_broadcast()) {
-			Frame frame = Frame(ra, ta, ceh->tsft, ceh->flags, w->i_seq, rssi, ceh->rate, type, subtype, p->length(), retry, station, iface_id);
-			(*qi)->_frames.push_back(frame);
+		if (filter & SUMMARY_ALL) {
+			summary = _summary_index.get(summary_key(iface_id, EtherAddress::make_broadcast()));
+			if (summary) {
+				capture_frame(p, summary, ra, ta, rssi, type, subtype, retry, station, iface_id);
+			}
 		}
+		summary_lock.release();
 	}
 
-	lock.release_write();
-
 	return p;
 
 }
 
-void EmpowerRXStats::update_neighbor(EtherAddress ta, bool station, uint8_t iface_id, uint8_t rssi) {
-
-	DstInfo *nfo;
+void EmpowerRXStats::capture_frame(Packet *p, SummaryTrigger *summary, EtherAddress ra, EtherAddress ta,
+		int8_t rssi, int type, int subtype, int retry, bool station, uint8_t iface_id) {
+	struct click_wifi *w = (struct click_wifi *) p->data();
+	struct click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p);
+	summary->capture() = Frame(ra, ta, ceh->tsft, ceh->flags, w->i_seq, rssi, ceh->rate, type, subtype, p->length(), retry, station, iface_id);
+}
 
-	if (station) {
-		nfo = stas.get_pointer(ta);
-	} else {
-		nfo = aps.get_pointer(ta);
+// Rebuilds the index and the filters from the list of summary triggers.
+// Called with summary_lock held.
+void EmpowerRXStats::index_summary_triggers() {
+	_summary_index.clear();
+	memset(_summary_filter, 0, sizeof(_summary_filter));
+	for (DTIter qi = _summary_triggers.begin(); qi != _summary_triggers.end(); qi++) {
+		SummaryTrigger *summary = *qi;
+		// frames carry their interface in the paint annotation
+		if (summary->_iface_id < 0 || summary->_iface_id > 255) {
+			continue;
+		}
+		_summary_index.set(summary_key(summary->_iface_id, summary->_eth), summary);
+		_summary_filter[summary->_iface_id] |= summary_bit(summary->_eth);
 	}
+}
 
-	if (!nfo) {
-		if (station) {
-			stas[ta] = DstInfo();
-			nfo = stas.get_pointer(ta);
-			nfo->_sma_rssi = new SMA(_sma_period);
-			nfo->_iface_id = iface_id;
-			nfo->_eth = ta;
-		} else {
-			aps[ta] = DstInfo();
-			nfo = aps.get_pointer(ta);
-			nfo->_sma_rssi = new SMA(_sma_period);
-			nfo->_iface_id = iface_id;
-			nfo->_eth = ta;
-		}
+void EmpowerRXStats::update_neighbor(EtherAddress ta, bool station, uint8_t iface_id, uint8_t rssi, const Timestamp &ts) {
+
+	unsigned id = click_current_cpu_id();
+	NeighborAccumulator &acc = _accums[id < _nb_accums ? id : id % _nb_accums];
+
+	acc._lock.acquire();
+
+	AccumTable &table = station ? acc._stas : acc._aps;
+	NeighborAccum *a = table.get_pointer(ta);
+
+	if (!a) {
+		table[ta] = NeighborAccum();
+		a = table.get_pointer(ta);
+		a->_iface_id = iface_id;
 	}
 
 	// Add sample
-	nfo->add_sample(rssi);
+	a->add_sample(rssi, ts);
+
+	acc._lock.release();
 
 }
 
@@ -295,39 +422,48 @@ void EmpowerRXStats::clear_triggers() {
 	}
 	_rssi_triggers.clear();
 	// clear summary triggers
+	summary_lock.acquire();
 	for (DTIter qi = _summary_triggers.begin(); qi != _summary_triggers.end(); qi++) {
 		(*qi)->_trigger_timer->clear();
 		delete *qi;
 	}
 	_summary_triggers.clear();
+	index_summary_triggers();
+	summary_lock.release();
 }
 
 void EmpowerRXStats::add_summary_trigger(int iface, EtherAddress addr, uint32_t summary_id, int16_t limit, uint16_t period) {
-	SummaryTrigger * summary = new SummaryTrigger(iface, addr, summary_id, limit, period, _el, this);
 	for (DTIter qi = _summary_triggers.begin(); qi != _summary_triggers.end(); qi++) {
-		if (*summary == **qi) {
+		if ((*qi)->_iface_id == iface && (*qi)->_eth == addr) {
 			click_chatter("%{element} :: %s :: summary already defined (%s), ignoring",
 						  this,
 						  __func__,
-						  summary->unparse().c_str());
+						  (*qi)->unparse().c_str());
 			return;
 		}
 	}
+	SummaryTrigger * summary = new SummaryTrigger(iface, addr, summary_id, limit, period, _summary_frames, _el, this);
 	summary->_trigger_timer->assign(&send_summary_trigger_callback, (void *) summary);
 	summary->_trigger_timer->initialize(this);
 	summary->_trigger_timer->schedule_now();
+	summary_lock.acquire();
 	_summary_triggers.push_back(summary);
+	index_summary_triggers();
+	summary_lock.release();
 }
 
 void EmpowerRXStats::del_summary_trigger(uint32_t summary_id) {
+	summary_lock.acquire();
 	for (DTIter qi = _summary_triggers.begin(); qi != _summary_triggers.end(); qi++) {
 		if ((*qi)->_trigger_id == summary_id) {
 			(*qi)->_trigger_timer->clear();
-			_summary_triggers.erase(qi);
 			delete *qi;
+			_summary_triggers.erase(qi);
+			index_summary_triggers();
 			break;
 		}
 	}
+	summary_lock.release();
 }
 
 enum {
@@ -337,7 +473,9 @@ enum {
 	H_SIGNAL_OFFSET,
 	H_RSSI_MATCHES,
 	H_RSSI_TRIGGERS,
-	H_SUMMARY_TRIGGERS
+	H_SUMMARY_TRIGGERS,
+	H_SHARDS,
+	H_ALLOCATIONS
 };
 
 String EmpowerRXStats::read_handler(Element *e, void *thunk) {
@@ -348,15 +486,18 @@ String EmpowerRXStats::read_handler(Element *e, void *thunk) {
 	case H_RSSI_MATCHES: {
 		StringAccum sa;
 		for (RTIter qi = td->_rssi_triggers.begin(); qi != td->_rssi_triggers.end(); qi++) {
-			for (NTIter iter = td->stas.begin(); iter.live(); iter++) {
-				DstInfo *nfo = &iter.value();
-				if (!nfo)
-					continue;
-				if ((*qi)->matches(nfo)) {
-					sa << (*qi)->unparse();
-					sa << " current " << nfo->_sma_rssi->avg();
-					sa << "\n";
+			for (int i = 0; i < NB_SHARDS; i++) {
+				NeighborShard &sh = td->_shards[i];
+				sh._lock.acquire();
+				for (NTIter iter = sh._stas.begin(); iter.live(); iter++) {
+					DstInfo *nfo = iter.get();
+					if ((*qi)->matches(nfo)) {
+						sa << (*qi)->unparse();
+						sa << " current " << nfo->_sma_rssi.avg();
+						sa << "\n";
+					}
 				}
+				sh._lock.release();
 			}
 		}
 		return sa.take_string();
@@ -370,23 +511,61 @@ String EmpowerRXStats::read_handler(Element *e, void *thunk) {
 	}
 	case H_SUMMARY_TRIGGERS: {
 		StringAccum sa;
+		td->summary_lock.acquire();
 		for (DTIter qi = td->_summary_triggers.begin(); qi != td->_summary_triggers.end(); qi++) {
 			sa << (*qi)->unparse() << "\n";
 		}
+		td->summary_lock.release();
 		return sa.take_string();
 	}
 	case H_NEIGHBORS: {
 		StringAccum sa;
-		for (NTIter iter = td->stas.begin(); iter.live(); iter++) {
-			DstInfo *nfo = &iter.value();
-			sa << nfo->unparse();
+		for (int i = 0; i < NB_SHARDS; i++) {
+			NeighborShard &sh = td->_shards[i];
+			sh._lock.acquire();
+			for (NTIter iter = sh._stas.begin(); iter.live(); iter++) {
+				DstInfo *nfo = iter.get();
+				sa << nfo->unparse();
+			}
+			sh._lock.release();
+		}
+		for (int i = 0; i < NB_SHARDS; i++) {
+			NeighborShard &sh = td->_shards[i];
+			sh._lock.acquire();
+			for (NTIter iter = sh._aps.begin(); iter.live(); iter++) {
+				DstInfo *nfo = iter.get();
+				sa << nfo->unparse();
+			}
+			sh._lock.release();
+		}
+		return sa.take_string();
+	}
+	case H_SHARDS: {
+		StringAccum sa;
+		for (int i = 0; i < NB_SHARDS; i++) {
+			NeighborShard &sh = td->_shards[i];
+			sh._lock.acquire();
+			sa << "shard " << i << " stas " << sh._stas.size() << " aps " << sh._aps.size() << "\n";
+			sh._lock.release();
 		}
-		for (NTIter iter = td->aps.begin(); iter.live(); iter++) {
-			DstInfo *nfo = &iter.value();
-			sa << nfo->unparse();
+		for (unsigned i = 0; i < td->_nb_accums; i++) {
+			NeighborAccumulator &acc = td->_accums[i];
+			acc._lock.acquire();
+			sa << "thread " << i << " samples " << acc._merged_samples;
+			sa << " neighbors " << acc._merged_neighbors << "\n";
+			acc._lock.release();
 		}
 		return sa.take_string();
 	}
+	case H_ALLOCATIONS: {
+		StringAccum sa;
+		uint32_t chunks, live;
+		uint64_t allocs, frees;
+		td->allocations(chunks, allocs, frees, live);
+		sa << "chunks " << chunks << " bytes " << (uint64_t) chunks * DstInfoPool::CHUNK * sizeof(DstInfo);
+		sa << " allocs " << allocs << " frees " << frees << " live " << live << "\n";
+		return sa.take_string();
+	}
 	case H_SIGNAL_OFFSET:
 		return String(td->_signal_offset) + "\n";
 	case H_DEBUG:
@@ -404,8 +583,13 @@ int EmpowerRXStats::write_handler(const String &in_s, Element *e, void *vparam,
 
 	switch ((intptr_t) vparam) {
 	case H_RESET: {
-		f->stas.clear();
-		f->aps.clear();
+		for (int i = 0; i < NB_SHARDS; i++) {
+			NeighborShard &sh = f->_shards[i];
+			sh._lock.acquire();
+			f->clear_table(sh._stas, sh._pool);
+			f->clear_table(sh._aps, sh._pool);
+			sh._lock.release();
+		}
 		break;
 	}
 	case H_SIGNAL_OFFSET: {
@@ -428,6 +612,8 @@ int EmpowerRXStats::write_handler(const String &in_s, Element *e, void *vparam,
 
 void EmpowerRXStats::add_handlers() {
 	add_read_handler("neighbors", read_handler, (void *) H_NEIGHBORS);
+	add_read_handler("shards", read_handler, (void *) H_SHARDS);
+	add_read_handler("allocations", read_handler, (void *) H_ALLOCATIONS);
 	add_read_handler("summary_triggers", read_handler, (void *) H_SUMMARY_TRIGGERS);
 	add_read_handler("rssi_matches", read_handler, (void *) H_RSSI_MATCHES);
 	add_read_handler("rssi_triggers", read_handler, (void *) H_RSSI_TRIGGERS);
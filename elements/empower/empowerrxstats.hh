@@ -4,6 +4,7 @@
 #include <click/element.hh>
 #include <click/etheraddress.hh>
 #include <click/hashtable.hh>
+#include <click/hashcontainer.hh>
 #include <click/glue.hh>
 #include <click/timer.hh>
 #include <click/straccum.hh>
@@ -13,6 +14,7 @@
 #include "rssi_trigger.hh"
 #include "dstinfo.hh"
 #include "empowerpacket.hh"
+#include "empowerlvapcache.hh"
 CLICK_DECLS
 
 /*
@@ -26,6 +28,14 @@ CLICK_DECLS
 
  =d
 
+ Frames can come in on several threads at once. Each thread adds the RSSI
+ of the frames it sees to accumulators of its own, which only it and the
+ timer touch. Every PERIOD msecs the timer swaps the accumulators of each
+ thread for a spare set, which only holds the thread up for the swap,
+ merges the ones it took into the neighbour tables, computes the statistics of the period
+ and drops the neighbours that went silent. The tables are split in shards
+ by address, each with a lock, so readers only hold up one shard at a time.
+
  Keyword arguments are:
 
  =over 8
@@ -33,23 +43,127 @@ CLICK_DECLS
  =item EL
  An EmpowerLVAPManager element
 
+ =item SMA_PERIOD
+ Periods in the moving average of the RSSI, up to 32, default 13
+
+ =item PERIOD
+ How often the statistics are computed, in msecs, default 500
+
+ =item SUMMARY_FRAMES
+ Frames a summary trigger keeps between two summaries, up to 65535, default
+ 1024. Older frames are dropped first.
+
  =item DEBUG
  Turn debug on/off
 
  =back 8
 
+ =h neighbors read-only
+
+ The neighbours and their statistics
+
+ =h summary_triggers read-only
+
+ The summary triggers, with the frames in their rings and the frames they
+ captured and dropped
+
+ =h shards read-only
+
+ Neighbours per shard, and samples and neighbours merged from each thread
+
+ =h allocations read-only
+
+ Chunks of memory taken by the neighbour tables, and neighbours allocated
+ from them and given back
+
  =a EmpowerLVAPManager
  */
 
-typedef HashTable<EtherAddress, DstInfo> NeighborTable;
+typedef HashContainer<DstInfo> NeighborTable;
 typedef NeighborTable::iterator NTIter;
 
+// The samples of a neighbour seen by one thread since the last merge
+class NeighborAccum {
+public:
+
+	int _iface_id;
+	uint32_t _packets;
+	uint64_t _accum_rssi;
+	uint64_t _squares_rssi;
+	Timestamp _last_received;
+
+	NeighborAccum() : _iface_id(-1), _packets(0), _accum_rssi(0), _squares_rssi(0) {
+	}
+
+	// ts is when the frame was received, as the device set it; frames
+	// without a timestamp are taken as received now
+	void add_sample(uint8_t rssi, const Timestamp &ts) {
+		_packets++;
+		_accum_rssi += rssi;
+		_squares_rssi += rssi * rssi;
+		if (ts)
+			_last_received = ts;
+		else
+			_last_received.assign_now();
+	}
+
+};
+
+typedef HashTable<EtherAddress, NeighborAccum> AccumTable;
+typedef AccumTable::iterator ATIter;
+
+// Written by one RX thread, drained by the timer. The lock is only
+// contended while the timer swaps the tables for the spare ones, which it
+// then merges without the lock and hands back, emptied, at the next swap.
+class NeighborAccumulator {
+public:
+
+	Spinlock _lock;
+	AccumTable _stas;
+	AccumTable _aps;
+	AccumTable _spare_stas;
+	AccumTable _spare_aps;
+	uint64_t _merged_samples;
+	uint32_t _merged_neighbors;
+	char _pad[CLICK_CACHE_LINE_SIZE]; // keep threads off each other's lines
+
+	NeighborAccumulator() : _merged_samples(0), _merged_neighbors(0) {
+	}
+
+};
+
+// A part of the neighbour tables, by hash of the address, with the pool
+// its entries come from
+class NeighborShard {
+public:
+
+	Spinlock _lock;
+	NeighborTable _stas;
+	NeighborTable _aps;
+	DstInfoPool _pool;
+
+};
+
+// What the controller gets to know about a neighbour, copied out of its
+// shard.
+struct NeighborStats {
+	EtherAddress _eth;
+	int _last_rssi;
+	int _last_std;
+	int _last_packets;
+	int _hist_packets;
+	int _sma_rssi;
+};
+
 typedef Vector<RssiTrigger *> RssiTriggersList;
 typedef RssiTriggersList::iterator RTIter;
 
 typedef Vector<SummaryTrigger *> SummaryTriggersList;
 typedef SummaryTriggersList::iterator DTIter;
 
+// Summary triggers by interface and TA, see summary_key()
+typedef HashTable<uint64_t, SummaryTrigger *> SummaryIndex;
+
 
 class EmpowerLVAPManager;
 
@@ -79,18 +193,49 @@ public:
 
 	void clear_triggers();
 
-	ReadWriteLock lock;
+	// Folds the samples of all threads into the neighbour tables. Timer
+	// side only, the spare accumulator tables are not locked.
+	void merge();
+
+	// Closes a period: merges, computes the statistics of every neighbour
+	// and drops the silent ones. What the timer does every PERIOD msecs.
+	void update();
 
-	NeighborTable aps;
-	NeighborTable stas;
+	// Copies out the neighbours heard on iface_id, stations or access
+	// points.
+	void neighbors(bool station, int iface_id, Vector<NeighborStats> &);
+
+	// Sums the counters of the DstInfo pools of the shards.
+	void allocations(uint32_t &chunks, uint64_t &allocs, uint64_t &frees, uint32_t &live);
+
+	// Tells the controller when the RSSI of the station of rssi crosses
+	// its threshold.
+	void check_rssi_trigger(RssiTrigger *);
+
+	// Taken by the RX threads while they add frames to the summaries.
+	Spinlock summary_lock;
+
+	enum { NB_SHARDS = 16, MAX_SUMMARY_FRAMES = 65535 };
 
 private:
 
+	friend class EmpowerRXStatsBench;
+
 	EmpowerLVAPManager *_el;
 	Timer _timer;
 
+	NeighborShard _shards[NB_SHARDS];
+	NeighborAccumulator *_accums;
+	unsigned _nb_accums;
+
 	RssiTriggersList _rssi_triggers;
 	SummaryTriggersList _summary_triggers;
+	SummaryIndex _summary_index;
+	// For each interface, a bit for the hash of the TA of every summary
+	// trigger, and SUMMARY_ALL if one takes all frames. Read without the
+	// lock to let the frames no trigger wants through at no cost.
+	uint64_t _summary_filter[256];
+	uint32_t _summary_frames;
 
 	int _signal_offset;
 	unsigned _period; // in ms
@@ -102,7 +247,32 @@ private:
 	static int write_handler(const String &, Element *, void *, ErrorHandler *);
 	static String read_handler(Element *, void *);
 
-	void update_neighbor(EtherAddress, bool, uint8_t, uint8_t);
+	NeighborShard &shard(EtherAddress eth) {
+		return _shards[empower_address_hash(eth) & (NB_SHARDS - 1)];
+	}
+
+	static const uint64_t SUMMARY_ALL = 1ULL << 63;
+
+	static uint64_t summary_key(int iface_id, EtherAddress ta) {
+		const uint8_t *d = ta.data();
+		uint64_t key = (uint64_t) (uint32_t) iface_id << 48;
+		for (int i = 0; i < 6; i++)
+			key |= (uint64_t) d[i] << (40 - 8 * i);
+		return key;
+	}
+
+	static uint64_t summary_bit(EtherAddress ta) {
+		return ta.is_broadcast() ? SUMMARY_ALL : 1ULL << (ta.hashcode() % 63);
+	}
+
+	void capture_frame(Packet *, SummaryTrigger *, EtherAddress, EtherAddress, int8_t,
+					   int, int, int, bool, uint8_t);
+	void index_summary_triggers();
+
+	void update_neighbor(EtherAddress, bool, uint8_t, uint8_t, const Timestamp &);
+	void merge_table(AccumTable &, bool, NeighborAccumulator &);
+	void update_table(NeighborTable &, DstInfoPool &);
+	void clear_table(NeighborTable &, DstInfoPool &);
 
 };
 
@@ -63,12 +63,12 @@ void EmpowerTee::push(int, Packet *p) {
 
 	// frame is unicast then send only to the correct interface
 	if (!dst.is_broadcast() && !dst.is_group()) {
-		EmpowerStationState *ess = _el->get_ess(dst);
-		if (!ess) {
+		EmpowerLVAPRecord lvap;
+		if (!_el->lvap_cache()->lookup(dst, lvap)) {
 			p->kill();
 			return;
 		}
-		output(ess->_iface_id).push(p);
+		output(lvap._iface_id).push(p);
 		return;
 	}
 
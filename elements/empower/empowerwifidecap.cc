@@ -127,19 +127,19 @@ EmpowerWifiDecap::push(int, Packet *p) {
 		return;
 	}
 
-    EmpowerStationState *ess = _el->get_ess(src);
+	EmpowerLVAPRecord lvap;
 
-    if (!ess) {
+	if (!_el->lvap_cache()->lookup(src, lvap)) {
 		p->kill();
 		return;
 	}
 
-	if (ess->_bssid != bssid) {
+	if (lvap._bssid != bssid) {
 		p->kill();
 		return;
 	}
 
-	if (!ess->_authentication_status) {
+	if (!lvap.authenticated()) {
 		click_chatter("%{element} :: %s :: station %s not authenticated",
 				      this,
 				      __func__,
@@ -148,7 +148,7 @@ EmpowerWifiDecap::push(int, Packet *p) {
 		return;
 	}
 
-	if (!ess->_association_status) {
+	if (!lvap.associated()) {
 		click_chatter("%{element} :: %s :: station %s not associated",
 				      this,
 				      __func__,
@@ -158,7 +158,7 @@ EmpowerWifiDecap::push(int, Packet *p) {
 	}
 
 	/* broadcast uplink only frame, silently ignore */
-	if ((dst.is_broadcast() || dst.is_group()) && !ess->_set_mask) {
+	if ((dst.is_broadcast() || dst.is_group()) && !lvap.set_mask()) {
 		p->kill();
 		return;
 	}
@@ -168,10 +168,10 @@ EmpowerWifiDecap::push(int, Packet *p) {
 		return;
 	}
 
-	TxPolicyInfo * txp = _el->get_txp(src);
+	TxPolicyInfo * txp = lvap._txp;
 
 	// frame must be encapsulated in another Ethernet frame
-	if (ess->_encap) {
+	if (lvap._encap) {
 
 		p_out = p_out->push_mac_header(14);
 
@@ -181,8 +181,8 @@ EmpowerWifiDecap::push(int, Packet *p) {
 
 		uint16_t ether_type = 0xBBBB;
 
-		memcpy(p_out->data(), ess->_encap.data(), 6);
-		memcpy(p_out->data() + 6, ess->_sta.data(), 6);
+		memcpy(p_out->data(), lvap._encap.data(), 6);
+		memcpy(p_out->data() + 6, lvap._sta.data(), 6);
 		memcpy(p_out->data() + 12, &ether_type, 2);
 
 		txp->update_rx(p_out->length());
@@ -19,6 +19,7 @@
 #include <click/args.hh>
 #include <click/error.hh>
 #include <click/glue.hh>
+#include <click/machine.hh>
 #include <click/packet_anno.hh>
 #include <click/straccum.hh>
 #include <clicknet/ether.h>
@@ -27,91 +28,231 @@
 
 CLICK_DECLS
 
+const uint16_t Minstrel::length_buckets[Minstrel::LENGTH_BUCKETS] = {
+	128, 256, 512, 1024, 1600, 2400, 3900, 8192
+};
+
 Minstrel::Minstrel() 
-  : _tx_policies(0), _timer(this), _lookaround_rate(20), _offset(0),
-	_active(true), _period(500), _ewma_level(75), _debug(false) {
+  : _tx_policies(0), _timer(this), _airtime_hits(0), _airtime_misses(0),
+	_mode(MODE_MINSTREL), _lookaround_rate(20), _offset(0), _active(true),
+	_period(500), _ewma_level(75), _debug(false) {
+	memset(_rate_airtime, 0, sizeof(_rate_airtime));
 }
 
 Minstrel::~Minstrel() {
 }
 
-void Minstrel::run_timer(Timer *)
+/*
+ * Folds the results of the last period of rate i into its probability and
+ * throughput, usecs being the airtime of one frame at that rate.
+ */
+void Minstrel::update_probability(MinstrelDstInfo *nfo, int i, uint32_t usecs)
 {
-	for (MinstrelIter iter = _neighbors.begin(); iter.live(); iter++) {
-		MinstrelDstInfo *nfo = &iter.value();
-		int max_tp = 0, index_max_tp = 0, index_max_tp2 = 0;
-		int max_prob = 0, index_max_prob = 0;
-		uint32_t usecs;
-		int i;
-		uint32_t p;
-		for (i = 0; i < nfo->rates.size(); i++) {
-			if (_transm_time.find(nfo->rates[i]) == _transm_time.end()) {
-				if (nfo->ht)
-					usecs = calc_usecs_wifi_packet_ht(1500, nfo->rates[i], 0);
-				else
-					usecs = calc_usecs_wifi_packet(1500, nfo->rates[i], 0);
-
-				_transm_time.set(nfo->rates[i], usecs);
-			}
+	uint32_t p;
+	if (!usecs) {
+		usecs = 1000000;
+	}
+	/* To avoid rounding issues, probabilities scale from 0 (0%)
+	 * to 18000 (100%) */
+	if (nfo->attempts[i]) {
+		p = (nfo->successes[i] * 18000) / nfo->attempts[i];
+		nfo->hist_successes[i] += nfo->successes[i];
+		nfo->hist_successes_bytes[i] += nfo->successes_bytes[i];
+		nfo->hist_attempts[i] += nfo->attempts[i];
+		nfo->hist_attempts_bytes[i] += nfo->attempts_bytes[i];
+		nfo->cur_prob[i] = p;
+		p = ((p * (100 - _ewma_level)) + (nfo->probability[i] * _ewma_level)) / 100;
+		nfo->probability[i] = p;
+		nfo->cur_tp[i] = p * (1000000 / usecs);
+	}
+	nfo->last_successes[i] = nfo->successes[i];
+	nfo->last_successes_bytes[i] = nfo->successes_bytes[i];
+	nfo->last_attempts[i] = nfo->attempts[i];
+	nfo->last_attempts_bytes[i] = nfo->attempts_bytes[i];
+	nfo->successes[i] = 0;
+	nfo->successes_bytes[i] = 0;
+	nfo->attempts[i] = 0;
+	nfo->attempts_bytes[i] = 0;
+	/* Sample less often below the 10% chance of success.
+	 * Sample less often above the 95% chance of success. */
+	if ((nfo->probability[i] > 17100) || (nfo->probability[i] < 1800)) {
+		nfo->sample_limit[i] = 4;
+	} else {
+		nfo->sample_limit[i] = -1;
+	}
+}
+
+void Minstrel::update_minstrel(MinstrelDstInfo *nfo)
+{
+	int max_tp = 0, index_max_tp = 0, index_max_tp2 = 0;
+	int max_prob = 0, index_max_prob = 0;
+	uint32_t usecs;
+	int i;
+	for (i = 0; i < nfo->rates.size(); i++) {
+		if (_transm_time.find(nfo->rates[i]) == _transm_time.end()) {
+			if (nfo->ht)
+				usecs = calc_usecs_wifi_packet_ht(1500, nfo->rates[i], 0);
 			else
-			{
-				usecs = _transm_time.get(nfo->rates[i]);
-			}
-			if (!usecs) {
-				usecs = 1000000;
-			}
-			/* To avoid rounding issues, probabilities scale from 0 (0%)
-			 * to 18000 (100%) */
-			if (nfo->attempts[i]) {
-				p = (nfo->successes[i] * 18000) / nfo->attempts[i];
-				nfo->hist_successes[i] += nfo->successes[i];
-				nfo->hist_successes_bytes[i] += nfo->successes_bytes[i];
-				nfo->hist_attempts[i] += nfo->attempts[i];
-				nfo->hist_attempts_bytes[i] += nfo->attempts_bytes[i];
-				nfo->cur_prob[i] = p;
-				p = ((p * (100 - _ewma_level)) + (nfo->probability[i] * _ewma_level)) / 100;
-				nfo->probability[i] = p;
-				nfo->cur_tp[i] = p * (1000000 / usecs);
-			}
-			nfo->last_successes[i] = nfo->successes[i];
-			nfo->last_successes_bytes[i] = nfo->successes_bytes[i];
-			nfo->last_attempts[i] = nfo->attempts[i];
-			nfo->last_attempts_bytes[i] = nfo->attempts_bytes[i];
-			nfo->successes[i] = 0;
-			nfo->successes_bytes[i] = 0;
-			nfo->attempts[i] = 0;
-			nfo->attempts_bytes[i] = 0;
-			/* Sample less often below the 10% chance of success.
-			 * Sample less often above the 95% chance of success. */
-			if ((nfo->probability[i] > 17100) || (nfo->probability[i] < 1800)) {
-				nfo->sample_limit[i] = 4;
-			} else {
-				nfo->sample_limit[i] = -1;
-			}
+				usecs = calc_usecs_wifi_packet(1500, nfo->rates[i], 0);
+
+			_transm_time.set(nfo->rates[i], usecs);
 		}
-		for (i = 0; i < nfo->rates.size(); i++) {
-			if (max_tp < nfo->cur_tp[i]) {
-				index_max_tp = i;
-				max_tp = nfo->cur_tp[i];
-			}
-			if (max_prob < nfo->probability[i]) {
-				index_max_prob = i;
-				max_prob = nfo->probability[i];
-			}
+		else
+		{
+			usecs = _transm_time.get(nfo->rates[i]);
 		}
-		max_tp = 0;
-		for (i = 0; i < nfo->rates.size(); i++) {
-			if (i == index_max_tp) {
-				continue;
-			}
-			if (max_tp < nfo->cur_tp[i]) {
-				index_max_tp2 = i;
-				max_tp = nfo->cur_tp[i];
-			}
+		update_probability(nfo, i, usecs);
+	}
+	for (i = 0; i < nfo->rates.size(); i++) {
+		if (max_tp < nfo->cur_tp[i]) {
+			index_max_tp = i;
+			max_tp = nfo->cur_tp[i];
+		}
+		if (max_prob < nfo->probability[i]) {
+			index_max_prob = i;
+			max_prob = nfo->probability[i];
+		}
+	}
+	max_tp = 0;
+	for (i = 0; i < nfo->rates.size(); i++) {
+		if (i == index_max_tp) {
+			continue;
+		}
+		if (max_tp < nfo->cur_tp[i]) {
+			index_max_tp2 = i;
+			max_tp = nfo->cur_tp[i];
+		}
+	}
+	if (nfo->max_tp_rate != index_max_tp) {
+		// airtime estimates were computed at the old rate
+		nfo->airtime.assign(nfo->airtime.size(), 0);
+	}
+	nfo->max_tp_rate = index_max_tp;
+	nfo->max_tp_rate2 = index_max_tp2;
+	nfo->max_prob_rate = index_max_prob;
+}
+
+/*
+ * MINSTREL_HT: one pass over the rates updates their statistics with the
+ * airtime of frames of the average length of the neighbor, and keeps the
+ * two best rates, the most reliable one and the best one of each group.
+ */
+void Minstrel::update_minstrel_ht(MinstrelDstInfo *nfo)
+{
+	int max_tp = 0, max_tp2 = 0, index_max_tp = 0, index_max_tp2 = 0;
+	int max_prob = 0, index_max_prob = 0;
+	uint32_t attempts = 0, attempts_bytes = 0;
+	uint32_t length = length_buckets[length_bucket(nfo->length_avg)];
+
+	nfo->group_max_tp.assign(nfo->group_count(), -1);
+
+	for (int i = 0; i < nfo->rates.size(); i++) {
+		attempts += nfo->attempts[i];
+		attempts_bytes += nfo->attempts_bytes[i];
+		update_probability(nfo, i, rate_airtime(nfo->ht, nfo->rates[i], length));
+		int tp = nfo->cur_tp[i];
+		if (max_tp < tp) {
+			index_max_tp2 = index_max_tp;
+			max_tp2 = max_tp;
+			index_max_tp = i;
+			max_tp = tp;
+		} else if (max_tp2 < tp) {
+			index_max_tp2 = i;
+			max_tp2 = tp;
+		}
+		// the most reliable rate, the fastest one among equals
+		if (max_prob < nfo->probability[i]
+			|| (max_prob == nfo->probability[i] && nfo->cur_tp[index_max_prob] < tp)) {
+			index_max_prob = i;
+			max_prob = nfo->probability[i];
+		}
+		int &best = nfo->group_max_tp[nfo->groups[i]];
+		if (best < 0 || nfo->cur_tp[best] < tp) {
+			best = i;
+		}
+	}
+
+	if (attempts) {
+		nfo->length_avg = ((attempts_bytes / attempts) * (100 - _ewma_level) + nfo->length_avg * _ewma_level) / 100;
+	}
+
+	if (nfo->max_tp_rate != index_max_tp) {
+		// airtime estimates were computed at the old rate
+		nfo->airtime.assign(nfo->airtime.size(), 0);
+	}
+	nfo->max_tp_rate = index_max_tp;
+	nfo->max_tp_rate2 = index_max_tp2;
+	nfo->max_prob_rate = index_max_prob;
+}
+
+/*
+ * Returns the length bucket of frames of the given length.
+ */
+int Minstrel::length_bucket(uint32_t length)
+{
+	int bucket = 0;
+	while (bucket < LENGTH_BUCKETS - 1 && length > length_buckets[bucket]) {
+		bucket++;
+	}
+	return bucket;
+}
+
+/*
+ * Returns the airtime of a frame at the given rate, with length rounded up
+ * to its length bucket, or 0 if the rate is not known.
+ */
+uint32_t Minstrel::rate_airtime(bool ht, int rate, uint32_t length)
+{
+	// the HT airtime table covers MCS 0-15
+	if (rate < 0 || rate >= MAX_RATE || (ht && rate > 15)) {
+		return 0;
+	}
+	int bucket = length_bucket(length);
+	uint32_t &usecs = _rate_airtime[ht][rate][bucket];
+	if (!usecs) {
+		if (ht)
+			usecs = calc_usecs_wifi_packet_ht(length_buckets[bucket], rate, 0);
+		else
+			usecs = calc_usecs_wifi_packet(length_buckets[bucket], rate, 0);
+	}
+	return usecs;
+}
+
+/*
+ * MINSTREL_HT: picks the rate to sample from the next group in turn.
+ * Returns -1 if the rate picked could not beat the best rate even without
+ * losses, sampling it would only waste airtime.
+ */
+int Minstrel::sample_minstrel_ht(MinstrelDstInfo *nfo)
+{
+	int nb_groups = nfo->group_count();
+	for (int n = 0; n < nb_groups; n++) {
+		int g = nfo->sample_group;
+		nfo->sample_group = (g + 1) % nb_groups;
+		int first = nfo->group_start[g];
+		int last = nfo->group_start[g + 1];
+		if (first == last) {
+			continue;
+		}
+		int ndx = nfo->group_rates[click_random(first, last - 1)];
+		uint32_t usecs = rate_airtime(nfo->ht, nfo->rates[ndx], nfo->length_avg);
+		if (!usecs || (int) (18000 * (1000000 / usecs)) <= nfo->cur_tp[nfo->max_tp_rate]) {
+			return -1;
+		}
+		return ndx;
+	}
+	return -1;
+}
+
+void Minstrel::run_timer(Timer *)
+{
+	for (MinstrelIter iter = _neighbors.begin(); iter.live(); iter++) {
+		MinstrelDstInfo *nfo = &iter.value();
+		if (_mode == MODE_MINSTREL_HT) {
+			update_minstrel_ht(nfo);
+		} else {
+			update_minstrel(nfo);
 		}
-		nfo->max_tp_rate = index_max_tp;
-		nfo->max_tp_rate2 = index_max_tp2;
-		nfo->max_prob_rate = index_max_prob;
 	}
 	_timer.schedule_after_msec(_period);
 }
@@ -126,6 +267,8 @@ int Minstrel::initialize(ErrorHandler *)
 int Minstrel::configure(Vector<String> &conf, ErrorHandler *errh)
 {
 
+	String mode = "MINSTREL";
+
 	int ret = Args(conf, this, errh)
 		      .read("OFFSET", _offset)
 		      .read_m("TP", ElementCastArg("TransmissionPolicies"), _tx_policies)
@@ -134,9 +277,22 @@ int Minstrel::configure(Vector<String> &conf, ErrorHandler *errh)
 		      .read("PERIOD", _period)
 		      .read("ACTIVE",  _active)
 		      .read("DEBUG",  _debug)
+		      .read("MODE", WordArg(), mode)
 		      .complete();
 
-	return ret;
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (mode == "MINSTREL") {
+		_mode = MODE_MINSTREL;
+	} else if (mode == "MINSTREL_HT") {
+		_mode = MODE_MINSTREL_HT;
+	} else {
+		return errh->error("MODE must be MINSTREL or MINSTREL_HT");
+	}
+
+	return 0;
 
 }
 
@@ -177,6 +333,116 @@ void Minstrel::process_feedback(Packet *p_in) {
 	return;
 }
 
+/*
+ * Sets a single rate, the first one in rates or 1 Mbps if there is none.
+ * Used for group addressed and management frames.
+ */
+void Minstrel::assign_basic_rate(struct click_wifi_extra *ceh, const Vector<int> &rates, int max_tries)
+{
+	ceh->rate = (rates.size()) ? rates[0] : 2;
+	ceh->rate1 = -1;
+	ceh->rate2 = -1;
+	ceh->rate3 = -1;
+	ceh->max_tries = max_tries;
+	ceh->max_tries1 = 0;
+	ceh->max_tries2 = 0;
+	ceh->max_tries3 = 0;
+}
+
+/*
+ * The rate of the frames of an unreliable multicast group: the highest rate
+ * of its policy, since every frame is sent several times anyway.
+ */
+static int ur_rate(const Vector<int> &rates)
+{
+	int rate = (rates.size()) ? rates[0] : 2;
+	for (int i = 1; i < rates.size(); i++) {
+		if (rates[i] > rate) {
+			rate = rates[i];
+		}
+	}
+	return rate;
+}
+
+uint32_t Minstrel::estimate_usecs_ur(Packet *p, TxPolicyInfo *tx_policy)
+{
+	bool ht = tx_policy->_ht_mcs.size() > 0;
+	uint32_t usecs = rate_airtime(ht, ur_rate(ht ? tx_policy->_ht_mcs : tx_policy->_mcs), p->length());
+	return usecs ? usecs : estimate_usecs(_basic_airtime, p->length(), false, 1);
+}
+
+void Minstrel::assign_ur_rate(struct click_wifi_extra *ceh, TxPolicyInfo *tx_policy)
+{
+	if (tx_policy->_ht_mcs.size()) {
+		assign_basic_rate(ceh, tx_policy->_ht_mcs, 1);
+		ceh->rate = ur_rate(tx_policy->_ht_mcs);
+		ceh->flags |= WIFI_EXTRA_MCS;
+	} else {
+		assign_basic_rate(ceh, tx_policy->_mcs, 1);
+		ceh->rate = ur_rate(tx_policy->_mcs);
+	}
+}
+
+static bool same_rates(const Vector<int> &a, const Vector<int> &b)
+{
+	if (a.size() != b.size()) {
+		return false;
+	}
+	for (int i = 0; i < a.size(); i++) {
+		if (a[i] != b[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Checks the rates of a neighbor against its transmission policy after the
+ * policies changed, or creates the neighbor. Returns 0 if there is no
+ * policy for dst and no neighbor yet.
+ */
+MinstrelDstInfo *Minstrel::refresh_neighbor(EtherAddress dst, MinstrelDstInfo *nfo)
+{
+	// the generation is read before the policy, which is written before the
+	// generation is bumped: a policy changed meanwhile is checked again
+	uint32_t generation = _tx_policies->generation();
+	click_read_fence();
+
+	TxPolicyInfo * tx_policy = _tx_policies->supported(dst);
+
+	if (!tx_policy) {
+		if (nfo && nfo->rates.size()) {
+			nfo->generation = generation;
+			return nfo;
+		}
+		if (_debug) {
+			click_chatter("%{element} :: %s :: rate info not found for %s",
+					this,
+					__func__,
+					dst.unparse().c_str());
+		}
+		return 0;
+	}
+
+	const Vector<int> &rates = tx_policy->_ht_mcs.size() ? tx_policy->_ht_mcs : tx_policy->_mcs;
+
+	if (nfo && nfo->rates.size() && nfo->ht == (tx_policy->_ht_mcs.size() > 0) && same_rates(nfo->rates, rates)) {
+		nfo->generation = generation;
+		return nfo;
+	}
+
+	if (_debug) {
+		click_chatter("%{element} :: %s :: adding %s",
+				this,
+				__func__,
+				dst.unparse().c_str());
+	}
+
+	nfo = insert_neighbor(dst, tx_policy);
+	nfo->generation = generation;
+	return nfo;
+}
+
 void Minstrel::assign_rate(Packet *p_in)
 {
 
@@ -190,26 +456,17 @@ void Minstrel::assign_rate(Packet *p_in)
 
 	memset((void*)ceh, 0, sizeof(struct click_wifi_extra));
 
-	TxPolicyInfo * tx_policy = _tx_policies->supported(dst);
 	if (dst.is_group()) {
+		TxPolicyInfo * tx_policy = _tx_policies->supported(dst);
 		ceh->flags |= WIFI_EXTRA_TX_NOACK;
-		if(!tx_policy || tx_policy->_ht_mcs.size() == 0) {
-			Vector<int> rates = _tx_policies->lookup(dst)->_mcs;
-			ceh->rate = (rates.size()) ? rates[0] : 2;
-		}
-		else {
-			Vector<int> ht_rates = _tx_policies->lookup(dst)->_ht_mcs;
-			ceh->rate = (ht_rates.size()) ? ht_rates[0] : 2;
+		if (tx_policy && tx_policy->_tx_mcast == TX_MCAST_UR && !dst.is_broadcast()) {
+			assign_ur_rate(ceh, tx_policy);
+		} else if (!tx_policy || tx_policy->_ht_mcs.size() == 0) {
+			assign_basic_rate(ceh, tx_policy ? tx_policy->_mcs : _tx_policies->default_tx_policy()->_mcs, 1);
+		} else {
+			assign_basic_rate(ceh, tx_policy->_ht_mcs, 1);
 			ceh->flags |= WIFI_EXTRA_MCS;
 		}
-
-		ceh->rate1 = -1;
-		ceh->rate2 = -1;
-		ceh->rate3 = -1;
-		ceh->max_tries = 1;
-		ceh->max_tries1 = 0;
-		ceh->max_tries2 = 0;
-		ceh->max_tries3 = 0;
 		return;
 	}
 
@@ -222,52 +479,20 @@ void Minstrel::assign_rate(Packet *p_in)
 		if (subtype == WIFI_FC0_SUBTYPE_BEACON || subtype == WIFI_FC0_SUBTYPE_PROBE_RESP) {
 			ceh->flags |= WIFI_EXTRA_TX_NOACK;
 		}
-		Vector<int> rates = _tx_policies->lookup(dst)->_mcs;
-		ceh->rate = (rates.size()) ? rates[0] : 2;
-		ceh->rate1 = -1;
-		ceh->rate2 = -1;
-		ceh->rate3 = -1;
-		ceh->max_tries = 1;
-		ceh->max_tries1 = 0;
-		ceh->max_tries2 = 0;
-		ceh->max_tries3 = 0;
+		assign_basic_rate(ceh, _tx_policies->lookup(dst)->_mcs, 1);
 		return;
 	}
 
+	// the neighbor caches the rates of its policy, the policy itself is
+	// only looked up again when some policy changed
 	MinstrelDstInfo *nfo = _neighbors.findp(dst);
 
-	if (!nfo || !nfo->rates.size()) {
-		if (_debug) {
-			click_chatter("%{element} :: %s :: adding %s",
-					this, 
-					__func__,
-					dst.unparse().c_str());
-		}
-		if (!tx_policy) {
-			if (_debug) {
-				click_chatter("%{element} :: %s :: rate info not found for %s",
-						this, 
-						__func__,
-						dst.unparse().c_str());
-			}
-			Vector<int> rates = _tx_policies->lookup(dst)->_mcs;
-			ceh->rate = (rates.size()) ? rates[0] : 2;
-			ceh->rate1 = -1;
-			ceh->rate2 = -1;
-			ceh->rate3 = -1;
-			ceh->max_tries = WIFI_MAX_RETRIES + 1;
-			ceh->max_tries1 = 0;
-			ceh->max_tries2 = 0;
-			ceh->max_tries3 = 0;
+	if (!nfo || !nfo->rates.size() || nfo->generation != _tx_policies->generation()) {
+		nfo = refresh_neighbor(dst, nfo);
+		if (!nfo) {
+			assign_basic_rate(ceh, _tx_policies->default_tx_policy()->_mcs, WIFI_MAX_RETRIES + 1);
 			return;
 		}
-		if (tx_policy->_ht_mcs.size()) {
-			_neighbors.insert(dst, MinstrelDstInfo(dst, tx_policy->_ht_mcs, true));
-			nfo = _neighbors.findp(dst);
-		} else {
-			_neighbors.insert(dst, MinstrelDstInfo(dst, tx_policy->_mcs, false));
-			nfo = _neighbors.findp(dst);
-		}
 	}
 
 	int ndx;
@@ -285,8 +510,13 @@ void Minstrel::assign_rate(Packet *p_in)
 			nfo->packet_count = 0;
 		}
 		if (nfo->rates.size() > 0) {
-			int sample_ndx = click_random(0, nfo->rates.size() - 1);
-			if (nfo->sample_limit[sample_ndx] != 0) {
+			int sample_ndx;
+			if (_mode == MODE_MINSTREL_HT) {
+				sample_ndx = sample_minstrel_ht(nfo);
+			} else {
+				sample_ndx = click_random(0, nfo->rates.size() - 1);
+			}
+			if (sample_ndx >= 0 && nfo->sample_limit[sample_ndx] != 0) {
 				sample = true;
 				ndx = sample_ndx;
 				nfo->sample_count++;
@@ -362,12 +592,21 @@ String Minstrel::print_rates()
 	for (MinstrelIter iter = _neighbors.begin(); iter.live(); iter++) {
 		MinstrelDstInfo *nfo = &iter.value();
 		sa << nfo->unparse();
+		if (_mode == MODE_MINSTREL_HT) {
+			sa << "Average length " << nfo->length_avg << " (bucket " << length_buckets[length_bucket(nfo->length_avg)] << ")";
+			for (int g = 0; g < nfo->group_count(); g++) {
+				if (nfo->group_max_tp[g] >= 0) {
+					sa << " group " << g << " best " << nfo->rates[nfo->group_max_tp[g]];
+				}
+			}
+			sa << "\n\n";
+		}
 	}
 	return sa.take_string();
 }
 
 enum {
-	H_RATES, H_DEBUG
+	H_RATES, H_DEBUG, H_AIRTIME_CACHE, H_MODE
 };
 
 String Minstrel::read_handler(Element *e, void *thunk) {
@@ -377,6 +616,15 @@ String Minstrel::read_handler(Element *e, void *thunk) {
 		return String(c->_debug) + "\n";
 	case H_RATES:
 		return c->print_rates();
+	case H_MODE:
+		return String(c->_mode == MODE_MINSTREL_HT ? "MINSTREL_HT" : "MINSTREL") + "\n";
+	case H_AIRTIME_CACHE: {
+		StringAccum sa;
+		uint32_t lookups = c->_airtime_hits + c->_airtime_misses;
+		sa << "hits " << c->_airtime_hits << " misses " << c->_airtime_misses;
+		sa << " hit_rate " << (lookups ? (100.0 * c->_airtime_hits) / lookups : 0.0) << "%\n";
+		return sa.take_string();
+	}
 	default:
 		return "<error>\n";
 	}
@@ -400,6 +648,8 @@ int Minstrel::write_handler(const String &in_s, Element *e, void *vparam, ErrorH
 void Minstrel::add_handlers() {
 	add_read_handler("rates", read_handler, H_RATES);
 	add_read_handler("debug", read_handler, H_DEBUG);
+	add_read_handler("airtime_cache", read_handler, H_AIRTIME_CACHE);
+	add_read_handler("mode", read_handler, H_MODE);
 	add_write_handler("debug", write_handler, H_DEBUG);
 }
 
@@ -6,6 +6,7 @@
 #include <click/glue.hh>
 #include <click/timer.hh>
 #include <click/hashtable.hh>
+#include <clicknet/wifi.h>
 #include <elements/wifi/bitrate.hh>
 #include "transmissionpolicies.hh"
 CLICK_DECLS
@@ -15,6 +16,24 @@ CLICK_DECLS
  * Minstrel([, I<KEYWORDS>])
  * =s Wifi
  * Minstrel wireless bit-rate selection algorithm
+ * =d
+ * MODE selects how rates are ranked. MINSTREL, the default, treats the
+ * rates of a neighbor as one list and ranks them by their throughput for
+ * 1500 byte frames. MINSTREL_HT splits the rates in groups, by number of
+ * spatial streams for HT rates and by modulation (DSSS or OFDM) for legacy
+ * rates, ranks them by their throughput for the average frame length of
+ * the neighbor, samples the groups in turn and never samples a rate that
+ * cannot beat the current best one.
+ *
+ * Group frames go out once, without ACK, at the lowest rate of the policy
+ * of the group. Frames for a group with an unreliable multicast (UR) policy
+ * are sent several times by EmpowerQOSManager instead, so they go at the
+ * highest rate of the policy. Receivers do not drop repeated group frames,
+ * so the repeats reach their upper layers, which must cope with duplicates.
+ * =h mode read-only
+ * The rate selection mode
+ * =h airtime_cache read-only
+ * Hits, misses and hit rate of the per-destination airtime estimates
  * =a SetTXRate, FilterTX
  */
 
@@ -39,6 +58,18 @@ public:
 	Vector<int> cur_tp;
 	Vector<int> probability;
 	Vector<int> sample_limit;
+	// airtime at max_tp_rate by length bucket, 0 until first used
+	Vector<uint32_t> airtime;
+	// TransmissionPolicies generation the rates were checked against
+	uint32_t generation;
+	// MINSTREL_HT: group of each rate, rate indexes sorted by group with the
+	// first index of each group, best rate of each group
+	Vector<int> groups;
+	Vector<int> group_rates;
+	Vector<int> group_start;
+	Vector<int> group_max_tp;
+	int sample_group;
+	uint32_t length_avg;
 	int packet_count;
 	int sample_count;
 	int max_tp_rate;
@@ -64,6 +95,11 @@ public:
 		cur_tp = Vector<int>();
 		probability = Vector<int>();
 		sample_limit = Vector<int>();
+		airtime = Vector<uint32_t>();
+		generation = 0;
+		group_start = Vector<int>(1, 0);
+		sample_group = 0;
+		length_avg = 1500;
 		packet_count = 0;
 		sample_count = 0;
 		max_tp_rate = 0;
@@ -92,6 +128,24 @@ public:
 		cur_tp = Vector<int>(supported.size(), 0);
 		probability = Vector<int>(supported.size(), 0);
 		sample_limit = Vector<int>(supported.size(), -1);
+		generation = 0;
+		int nb_groups = 0;
+		for (int i = 0; i < supported.size(); i++) {
+			groups.push_back(rate_group(supported[i], ht_rates));
+			nb_groups = groups[i] >= nb_groups ? groups[i] + 1 : nb_groups;
+		}
+		for (int g = 0; g < nb_groups; g++) {
+			group_start.push_back(group_rates.size());
+			for (int i = 0; i < supported.size(); i++) {
+				if (groups[i] == g) {
+					group_rates.push_back(i);
+				}
+			}
+		}
+		group_start.push_back(group_rates.size());
+		group_max_tp = Vector<int>(group_start.size() - 1, -1);
+		sample_group = 0;
+		length_avg = 1500;
 		packet_count = 0;
 		sample_count = 0;
 		max_tp_rate = 0;
@@ -99,6 +153,15 @@ public:
 		max_prob_rate = 0;
 		ht = ht_rates;
 	}
+	static int rate_group(int rate, bool ht_rate) {
+		if (ht_rate) {
+			return rate / 8;
+		}
+		return is_b_rate(rate) ? 0 : 1;
+	}
+	int group_count() const {
+		return group_start.size() - 1;
+	}
 	int rate_index(int rate) {
 		int ndx = -1;
 		for (int x = 0; x < rates.size(); x++) {
@@ -205,17 +268,22 @@ class Minstrel : public Element { public:
 		struct click_wifi *w = (struct click_wifi *) p->data();
 		EtherAddress dst = EtherAddress(w->i_addr1);
 		if (!dst.is_broadcast() && !dst.is_group()) {
-			uint32_t rate = 1;
 			MinstrelDstInfo *nfo = _neighbors.findp(dst);
 			if (nfo) {
-				rate = nfo->rates[nfo->max_tp_rate];
+				return estimate_usecs(nfo->airtime, p->length(), nfo->ht, nfo->rates[nfo->max_tp_rate]);
+			}
+		}
+		if (dst.is_group() && !dst.is_broadcast()) {
+			TxPolicyInfo *tx_policy = _tx_policies->supported(dst);
+			if (tx_policy && tx_policy->_tx_mcast == TX_MCAST_UR) {
+				return estimate_usecs_ur(p, tx_policy);
 			}
-			return calc_usecs_wifi_packet(p->length(), rate, 0);
-		} else {
-			return calc_usecs_wifi_packet(p->length(), 1, 0);
 		}
+		return estimate_usecs(_basic_airtime, p->length(), false, 1);
 	}
 
+	uint32_t estimate_usecs_ur(Packet *, TxPolicyInfo *);
+
 	MinstrelNeighborTable * neighbors() { return &_neighbors; }
 	TransmissionPolicies * tx_policies() { return _tx_policies; }
 	bool forget_station(EtherAddress addr) { return _neighbors.erase(addr); }
@@ -229,6 +297,7 @@ class Minstrel : public Element { public:
 			_neighbors.insert(dst, MinstrelDstInfo(dst, txp->_mcs, false));
 			nfo = _neighbors.findp(dst);
 		}
+		nfo->generation = _tx_policies->generation();
 		return nfo;
 	}
 
@@ -239,6 +308,62 @@ private:
 	Timer _timer;
 	TTime _transm_time;
 
+	// Airtime tables cover frames up to 8 KB in 16 byte buckets. A frame is
+	// charged the airtime of the longest frame in its bucket.
+	enum { AIRTIME_BUCKET_SHIFT = 4, AIRTIME_BUCKETS = (8192 >> AIRTIME_BUCKET_SHIFT) + 1 };
+
+	Vector<uint32_t> _basic_airtime;
+	uint32_t _airtime_hits;
+	uint32_t _airtime_misses;
+
+	enum { MODE_MINSTREL = 0, MODE_MINSTREL_HT = 1 };
+
+	// MINSTREL_HT ranks rates by the airtime of frames of the average
+	// length of each neighbor, rounded up to one of these lengths
+	enum { LENGTH_BUCKETS = 8, MAX_RATE = 128 };
+	static const uint16_t length_buckets[LENGTH_BUCKETS];
+
+	int _mode;
+	uint32_t _rate_airtime[2][MAX_RATE][LENGTH_BUCKETS];
+
+	uint32_t rate_airtime(bool, int, uint32_t);
+	int length_bucket(uint32_t);
+	void update_probability(MinstrelDstInfo *, int, uint32_t);
+	void update_minstrel(MinstrelDstInfo *);
+	void update_minstrel_ht(MinstrelDstInfo *);
+	int sample_minstrel_ht(MinstrelDstInfo *);
+
+	MinstrelDstInfo *refresh_neighbor(EtherAddress, MinstrelDstInfo *);
+	void assign_basic_rate(struct click_wifi_extra *, const Vector<int> &, int);
+	void assign_ur_rate(struct click_wifi_extra *, TxPolicyInfo *);
+
+
+	// rate is an MCS index if ht is set, a legacy rate otherwise
+	inline uint32_t estimate_usecs(Vector<uint32_t> &airtime, uint32_t length, bool ht, int rate) {
+		uint32_t bucket = (length + (1 << AIRTIME_BUCKET_SHIFT) - 1) >> AIRTIME_BUCKET_SHIFT;
+		if (bucket >= AIRTIME_BUCKETS) {
+			_airtime_misses++;
+			return calc_usecs(length, ht, rate);
+		}
+		if (airtime.empty()) {
+			airtime.resize(AIRTIME_BUCKETS, 0);
+		}
+		if (airtime[bucket]) {
+			_airtime_hits++;
+		} else {
+			_airtime_misses++;
+			airtime[bucket] = calc_usecs(bucket << AIRTIME_BUCKET_SHIFT, ht, rate);
+		}
+		return airtime[bucket];
+	}
+
+	static inline uint32_t calc_usecs(uint32_t length, bool ht, int rate) {
+		if (ht) {
+			return calc_usecs_wifi_packet_ht(length, rate, 0);
+		}
+		return calc_usecs_wifi_packet(length, rate, 0);
+	}
+
 	unsigned _lookaround_rate;
 	unsigned _offset;
 	bool _active;
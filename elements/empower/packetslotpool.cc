@@ -0,0 +1,96 @@
+/*
+ * packetslotpool.{cc,hh} -- packet slots shared by the EmPOWER station queues
+ *
+ * Copyright (c) 2018 CREATE-NET
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "packetslotpool.hh"
+CLICK_DECLS
+
+PacketSlotPool::PacketSlotPool(uint32_t budget) :
+	_free(0), _nb_free(0), _nb_used(0), _nb_used_hwm(0), _budget(budget) {
+	_bytes = 0;
+	_frames = 0;
+	_bytes_hwm = 0;
+	_frames_hwm = 0;
+	_budget_drops = 0;
+	_limit_drops = 0;
+}
+
+PacketSlotPool::~PacketSlotPool() {
+	while (Segment *seg = _free) {
+		_free = seg->_next;
+		delete seg;
+	}
+}
+
+PacketSlotPool::Segment *PacketSlotPool::alloc() {
+
+	_lock.acquire();
+	Segment *seg = _free;
+	if (seg) {
+		_free = seg->_next;
+		_nb_free--;
+	}
+	if (++_nb_used > _nb_used_hwm) {
+		_nb_used_hwm = _nb_used;
+	}
+	_lock.release();
+
+	if (!seg) {
+		seg = new Segment;
+		if (!seg) {
+			_lock.acquire();
+			_nb_used--;
+			_lock.release();
+			return 0;
+		}
+	}
+
+	memset(seg, 0, sizeof(Segment));
+	return seg;
+
+}
+
+void PacketSlotPool::free(Segment *seg) {
+
+	_lock.acquire();
+	_nb_used--;
+	// give memory back after a burst, but keep enough to absorb the next
+	bool keep = _nb_free < _nb_used || _nb_free < FREE_RESERVE;
+	if (keep) {
+		seg->_next = _free;
+		_free = seg;
+		_nb_free++;
+	}
+	_lock.release();
+
+	if (!keep) {
+		delete seg;
+	}
+
+}
+
+String PacketSlotPool::unparse() const {
+	StringAccum sa;
+	uint32_t seg_bytes = sizeof(Segment);
+	sa << "frames " << _frames.value() << " bytes " << _bytes.value() << " budget " << _budget << "\n";
+	sa << "segments used " << _nb_used << " free " << _nb_free << " (" << (_nb_used + _nb_free) * seg_bytes << " bytes)\n";
+	sa << "high_water frames " << _frames_hwm.value() << " bytes " << _bytes_hwm.value() << " segments " << _nb_used_hwm << " (" << _nb_used_hwm * seg_bytes << " bytes)\n";
+	sa << "drops budget " << _budget_drops.value() << " limit " << _limit_drops.value() << "\n";
+	return sa.take_string();
+}
+
+CLICK_ENDDECLS
+ELEMENT_PROVIDES(PacketSlotPool)
@@ -0,0 +1,212 @@
+#ifndef CLICK_EMPOWER_PACKETSLOTPOOL_HH
+#define CLICK_EMPOWER_PACKETSLOTPOOL_HH
+#include <click/packet.hh>
+#include <click/atomic.hh>
+#include <click/sync.hh>
+#include <click/straccum.hh>
+CLICK_DECLS
+
+/*
+ * Packet slots shared by all the station queues of an EmpowerQOSManager.
+ * Slots are handed out in segments of SEGMENT_SLOTS, so a queue only holds
+ * memory for the frames it actually has, and the pool also keeps the byte
+ * budget all the queued frames draw from.
+ *
+ * A frame is admitted if it fits in the budget. A queue that is above its
+ * own limit may still borrow from the pool, but only while less than half
+ * of the budget is in use. The budget is checked and charged in two steps,
+ * so concurrent producers may overshoot it by a few frames.
+ */
+class PacketSlotPool {
+public:
+
+	enum { SEGMENT_SLOTS = 32 };
+
+	struct Segment {
+		Segment *_next;
+		Packet *_slots[SEGMENT_SLOTS];
+	};
+
+	PacketSlotPool(uint32_t budget = DEFAULT_BUDGET);
+	~PacketSlotPool();
+
+	void set_budget(uint32_t budget) { _budget = budget; }
+	uint32_t budget() const { return _budget; }
+
+	// Any thread. Returns a segment with all slots cleared.
+	Segment *alloc();
+	void free(Segment *);
+
+	// Producer side. over_limit tells whether the queue is above its own
+	// limit.
+	bool admit(uint32_t length, bool over_limit) {
+		uint32_t bytes = _bytes;
+		if (bytes + length > _budget) {
+			_budget_drops++;
+			return false;
+		}
+		if (over_limit && bytes + length > _budget / 2) {
+			_limit_drops++;
+			return false;
+		}
+		bytes = (_bytes += length);
+		_frames++;
+		uint32_t hwm;
+		while ((hwm = _bytes_hwm) < bytes && _bytes_hwm.compare_swap(hwm, bytes) != hwm) {
+		}
+		uint32_t frames = _frames;
+		while ((hwm = _frames_hwm) < frames && _frames_hwm.compare_swap(hwm, frames) != hwm) {
+		}
+		return true;
+	}
+
+	// Scheduler side, once for every admitted frame that leaves its queue.
+	void release(uint32_t length) {
+		_bytes -= length;
+		_frames--;
+	}
+
+	String unparse() const;
+
+private:
+
+	enum { DEFAULT_BUDGET = 4194304 };
+
+	// Free segments kept around beyond those in use
+	enum { FREE_RESERVE = 64 };
+
+	SimpleSpinlock _lock;
+	Segment *_free;
+	uint32_t _nb_free;
+	uint32_t _nb_used;
+	uint32_t _nb_used_hwm;
+
+	uint32_t _budget;
+	atomic_uint32_t _bytes;
+	atomic_uint32_t _frames;
+	atomic_uint32_t _bytes_hwm;
+	atomic_uint32_t _frames_hwm;
+	atomic_uint32_t _budget_drops;
+	atomic_uint32_t _limit_drops;
+
+};
+
+/*
+ * Unbounded queue of packets with exactly one producer and one consumer,
+ * built out of segments taken from a PacketSlotPool. The producer links a
+ * new segment when the last one is full, and the consumer gives a segment
+ * back once it has gone past its last slot. Frames are published through
+ * the _pushed counter, so neither side needs a lock. An unused queue holds
+ * no segment at all.
+ */
+class PacketSlotQueue {
+public:
+
+	PacketSlotQueue() : _pool(0), _first(0), _head_seg(0), _head_i(0), _tail_seg(0), _tail_i(0), _pushed(0), _pulled(0) {
+	}
+
+	~PacketSlotQueue() {
+		clear();
+	}
+
+	// Must be called before the queue is shared between threads.
+	void set_pool(PacketSlotPool *pool) {
+		assert(!_tail_seg);
+		_pool = pool;
+	}
+
+	// Producer side.
+	bool push(Packet *p) {
+		if (!_tail_seg || _tail_i == PacketSlotPool::SEGMENT_SLOTS) {
+			PacketSlotPool::Segment *seg = _pool->alloc();
+			if (!seg) {
+				return false;
+			}
+			// the cleared slots must be visible before the segment is
+			click_write_fence();
+			if (_tail_seg) {
+				_tail_seg->_next = seg;
+			} else {
+				_first = seg;
+			}
+			_tail_seg = seg;
+			_tail_i = 0;
+		}
+		_tail_seg->_slots[_tail_i++] = p;
+		click_write_fence();
+		_pushed = _pushed + 1;
+		return true;
+	}
+
+	// Consumer side.
+	Packet *top() {
+		if (_pushed == _pulled) {
+			return 0;
+		}
+		click_read_fence();
+		if (!_head_seg) {
+			_head_seg = _first;
+			_head_i = 0;
+		} else if (_head_i == PacketSlotPool::SEGMENT_SLOTS) {
+			// there is a frame past this segment, so the producer is done
+			// with it
+			PacketSlotPool::Segment *next = _head_seg->_next;
+			_pool->free(_head_seg);
+			_head_seg = next;
+			_head_i = 0;
+		}
+		return _head_seg->_slots[_head_i];
+	}
+
+	// Consumer side.
+	Packet *pull() {
+		Packet *p = top();
+		if (p) {
+			_head_i++;
+			_pulled = _pulled + 1;
+		}
+		return p;
+	}
+
+	uint32_t size() const { return _pushed - _pulled; }
+	bool empty() const { return _pushed == _pulled; }
+
+	// Only safe once neither side is running. Frees the frames left and
+	// gives every segment back to the pool.
+	void clear() {
+		while (Packet *p = pull()) {
+			p->kill();
+		}
+		PacketSlotPool::Segment *seg = _head_seg ? _head_seg : _first;
+		while (seg) {
+			PacketSlotPool::Segment *next = seg->_next;
+			_pool->free(seg);
+			seg = next;
+		}
+		_first = _head_seg = _tail_seg = 0;
+		_head_i = _tail_i = 0;
+	}
+
+private:
+
+	PacketSlotPool *_pool;
+
+	// First segment ever linked, how the consumer finds the producer's
+	// segments the first time around
+	PacketSlotPool::Segment * volatile _first;
+
+	// Consumer side
+	PacketSlotPool::Segment *_head_seg;
+	uint32_t _head_i;
+
+	// Producer side
+	PacketSlotPool::Segment *_tail_seg;
+	uint32_t _tail_i;
+
+	volatile uint32_t _pushed;
+	volatile uint32_t _pulled;
+
+};
+
+CLICK_ENDDECLS
+#endif /* CLICK_EMPOWER_PACKETSLOTPOOL_HH */
@@ -0,0 +1,22 @@
+/*
+ * rwspinlock.{cc,hh} -- reader/writer spinlock
+ *
+ * Copyright (c) 2018 CREATE-NET
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "rwspinlock.hh"
+CLICK_DECLS
+
+CLICK_ENDDECLS
+ELEMENT_PROVIDES(RWSpinlock)
@@ -0,0 +1,73 @@
+#ifndef CLICK_EMPOWER_RWSPINLOCK_HH
+#define CLICK_EMPOWER_RWSPINLOCK_HH
+#include <click/atomic.hh>
+#include <click/machine.hh>
+CLICK_DECLS
+
+/*
+ * Reader/writer spinlock. Click's ReadWriteLock compiles to nothing at
+ * userlevel, which is fine as long as push, pull and the control socket all
+ * run on the same thread. Tables that are read on the data path by several
+ * threads (--enable-user-multithread) and changed by the control path use
+ * this lock instead: readers never exclude each other, a writer first blocks
+ * new readers and then waits for the current ones to leave. The lock is not
+ * recursive. In single-threaded builds it compiles to nothing, like the other
+ * Click locks.
+ */
+class RWSpinlock {
+public:
+
+	RWSpinlock() {
+		_state = 0;
+	}
+
+	inline void acquire_read() {
+#if HAVE_MULTITHREAD
+		while (1) {
+			uint32_t state = _state;
+			if (!(state & WRITER) && _state.compare_swap(state, state + 1) == state) {
+				break;
+			}
+			click_relax_fence();
+		}
+#endif
+	}
+
+	inline void release_read() {
+#if HAVE_MULTITHREAD
+		_state--;
+#endif
+	}
+
+	inline void acquire_write() {
+#if HAVE_MULTITHREAD
+		while (1) {
+			uint32_t state = _state;
+			if (!(state & WRITER) && _state.compare_swap(state, state | WRITER) == state) {
+				break;
+			}
+			click_relax_fence();
+		}
+		// wait for the readers that got in before us
+		while (_state != WRITER) {
+			click_relax_fence();
+		}
+#endif
+	}
+
+	inline void release_write() {
+#if HAVE_MULTITHREAD
+		_state &= ~WRITER;
+#endif
+	}
+
+private:
+
+	enum { WRITER = 0x80000000U };
+
+	atomic_uint32_t _state;
+
+};
+
+CLICK_ENDDECLS
+#endif /* CLICK_EMPOWER_RWSPINLOCK_HH */
@@ -7,77 +7,59 @@
 #include <click/vector.hh>
 CLICK_DECLS
 
+// Simple moving average over the last period values, up to MAX_PERIOD.
+// The window is part of the object, so an SMA can be copied and costs no
+// allocation.
 class SMA {
 public:
-	SMA(unsigned int period) :
-		period(period), head(NULL), tail(NULL), total(0) {
-		window = new int[period];
-		assert(period >= 1);
+
+	enum { MAX_PERIOD = 32 };
+
+	SMA(unsigned int period = 1) : _period(1), _next(0), _count(0), _total(0) {
+		set_period(period);
 	}
-	~SMA() {
-		delete[] window;
+
+	// Sets the period and forgets the values added so far
+	void set_period(unsigned int period) {
+		assert(period >= 1 && period <= MAX_PERIOD);
+		_period = period;
+		_next = 0;
+		_count = 0;
+		_total = 0;
 	}
+
 	// Adds a value to the average, pushing one out if necessary
 	void add(int val) {
-		// Special case: Initialisation
-		if (head == NULL) {
-			head = window;
-			*head = val;
-			tail = head;
-			inc(tail);
-			total = val;
-			return;
-		}
 		// Were we already full?
-		if (head == tail) {
-			// Fix total-cache
-			total -= *head;
-			// Make room
-			inc(head);
+		if (_count == _period) {
+			_total -= _window[_next];
+		} else {
+			_count++;
 		}
 		// Write the value in the next spot.
-		*tail = val;
-		inc(tail);
+		_window[_next] = val;
+		if (++_next == _period) {
+			_next = 0;
+		}
 		// Update our total-cache
-		total += val;
+		_total += val;
 	}
 
 	// Returns the average of the last P elements added to this SMA.
-	// If no elements have been added yet, returns 0.0
+	// If no elements have been added yet, returns 0
 	int avg() const {
-		ptrdiff_t size = this->size();
-		if (size == 0) {
+		if (_count == 0) {
 			return 0; // No entries => 0 average
 		}
-		return (total / (double) size);
+		return _total / (int) _count;
 	}
 
 private:
-	unsigned int period;
-	int * window; // Holds the values to calculate the average of.
-
-	// Logically, head is before tail
-	int * head; // Points at the oldest element we've stored.
-	int * tail; // Points at the newest element we've stored.
-
-	int total; // Cache the total so we don't sum everything each time.
-
-	// Bumps the given pointer up by one.
-	// Wraps to the start of the array if needed.
-	void inc(int * & p) {
-		if (++p >= window + period) {
-			p = window;
-		}
-	}
-
-	// Returns how many numbers we have stored.
-	ptrdiff_t size() const {
-		if (head == NULL)
-			return 0;
-		if (head == tail)
-			return period;
-		return (period + tail - head) % period;
-	}
+	unsigned int _period;
+	unsigned int _next; // where the next value goes, the oldest one once full
+	unsigned int _count; // how many values we have stored
+	int _total; // Cache the total so we don't sum everything each time.
+	int _window[MAX_PERIOD]; // Holds the values to calculate the average of.
 };
 
 CLICK_ENDDECLS
@@ -0,0 +1,272 @@
+#ifndef CLICK_EMPOWER_SOJOURNAQM_HH
+#define CLICK_EMPOWER_SOJOURNAQM_HH
+#include <click/packet.hh>
+#include <click/timestamp.hh>
+#include <click/integers.hh>
+#include <click/straccum.hh>
+#include <clicknet/ether.h>
+#include <clicknet/ip.h>
+#include <clicknet/ip6.h>
+CLICK_DECLS
+
+/*
+ * Settings and counters of the sojourn time AQM of a slice, shared by all
+ * the station queues of the slice. The histogram counts the sojourn time of
+ * every frame leaving the slice, whether the AQM is enabled or not: bucket 0
+ * is below 1 ms, bucket i covers [2^(i-1), 2^i) ms and the last bucket
+ * everything above.
+ */
+class SojournAQMParams {
+public:
+
+	enum { HISTOGRAM_BUCKETS = 12 };
+
+	bool _enabled;
+	bool _ecn;
+	Timestamp _target;
+	Timestamp _interval;
+
+	uint32_t _drops;
+	uint32_t _marks;
+	uint32_t _histogram[HISTOGRAM_BUCKETS];
+
+	SojournAQMParams() : _enabled(false), _ecn(false), _drops(0), _marks(0) {
+		set_target(5000, 100000);
+		memset(_histogram, 0, sizeof(_histogram));
+	}
+
+	void set_target(uint32_t target_usecs, uint32_t interval_usecs) {
+		_target = Timestamp::make_usec(target_usecs / 1000000, target_usecs % 1000000);
+		_interval = Timestamp::make_usec(interval_usecs / 1000000, interval_usecs % 1000000);
+	}
+
+	void record(const Timestamp &sojourn) {
+		uint32_t msecs = sojourn.msecval();
+		int i = 0;
+		while (msecs && i < HISTOGRAM_BUCKETS - 1) {
+			msecs >>= 1;
+			i++;
+		}
+		_histogram[i]++;
+	}
+
+	void record(Packet *p) {
+		if (p->timestamp_anno().sec()) {
+			record(Timestamp::now() - p->timestamp_anno());
+		}
+	}
+
+	String unparse() {
+		StringAccum result;
+		result << "aqm " << (_enabled ? "on" : "off");
+		if (_enabled) {
+			result << " target " << _target << " interval " << _interval << " ecn " << (_ecn ? "on" : "off");
+		}
+		result << " drops " << _drops << " marks " << _marks << " sojourn";
+		for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+			result << " " << _histogram[i];
+		}
+		return result.take_string();
+	}
+
+};
+
+/*
+ * CoDel state of one station queue. The state machine and the control law
+ * are those of the CoDel element (elements/aqm/codel.cc), run on a station
+ * queue instead of an upstream Storage. The sojourn time of a frame is
+ * measured from the timestamp annotation set when it was queued; frames
+ * without one are let through untouched, as CoDel does. With ECN on, frames
+ * of ECN-capable IP flows are marked Congestion Experienced instead of
+ * being dropped.
+ *
+ * Q must provide Packet *pull_raw(), which takes the next frame off the
+ * queue as it was pushed.
+ */
+class SojournAQM {
+public:
+
+	SojournAQM() : _state_drops(0), _dropping(false) {
+	}
+
+	template <typename Q> Packet *dequeue(Q *queue, SojournAQMParams *params);
+
+private:
+
+	Timestamp _first_above_time;
+	Timestamp _drop_next;
+	uint32_t _state_drops;
+	bool _dropping;
+
+	template <typename Q> Packet *dequeue_and_track_sojourn_time(Q *, SojournAQMParams *, const Timestamp &, bool &, bool &);
+	Timestamp control_law(const Timestamp &, SojournAQMParams *);
+	bool drop(Packet *&, SojournAQMParams *);
+	bool mark(Packet *&);
+
+};
+
+template <typename Q>
+inline Packet *SojournAQM::dequeue_and_track_sojourn_time(Q *queue, SojournAQMParams *params, const Timestamp &now, bool &ok_to_drop, bool &valid) {
+
+	ok_to_drop = false;
+	valid = false;
+
+	Packet *p = queue->pull_raw();
+
+	if (!p) {
+		_first_above_time.assign(0, 0);
+		return 0;
+	}
+
+	if (!p->timestamp_anno().sec()) {
+		return p;
+	}
+
+	Timestamp sojourn_time = now - p->timestamp_anno();
+	params->record(sojourn_time);
+
+	if (sojourn_time < params->_target) {
+		_first_above_time.assign(0, 0);
+	} else if (!_first_above_time) {
+		_first_above_time = now + params->_interval;
+	} else if (now >= _first_above_time) {
+		ok_to_drop = true;
+	}
+
+	valid = true;
+	return p;
+
+}
+
+template <typename Q>
+inline Packet *SojournAQM::dequeue(Q *queue, SojournAQMParams *params) {
+
+	if (!params->_enabled) {
+		// only the histogram, and a clock read only for timestamped frames
+		Packet *p = queue->pull_raw();
+		if (p) {
+			params->record(p);
+		}
+		_dropping = false;
+		_first_above_time.assign(0, 0);
+		return p;
+	}
+
+	Timestamp now = Timestamp::now();
+	bool ok_to_drop, valid;
+
+	Packet *p = dequeue_and_track_sojourn_time(queue, params, now, ok_to_drop, valid);
+
+	if (!valid) {
+		_dropping = false;
+		return p;
+	}
+
+	if (_dropping) {
+		if (!ok_to_drop) {
+			_dropping = false;
+		} else {
+			while (now >= _drop_next && _dropping) {
+				++_state_drops;
+				if (!drop(p, params)) {
+					// marked, the frame goes on
+					_drop_next = control_law(_drop_next, params);
+					return p;
+				}
+				p = dequeue_and_track_sojourn_time(queue, params, now, ok_to_drop, valid);
+				if (!ok_to_drop) {
+					_dropping = false;
+				} else {
+					_drop_next = control_law(_drop_next, params);
+				}
+			}
+		}
+	} else if (ok_to_drop && ((now - _drop_next < params->_interval) || (now - _first_above_time >= params->_interval))) {
+		if (drop(p, params)) {
+			p = dequeue_and_track_sojourn_time(queue, params, now, ok_to_drop, valid);
+		}
+		_dropping = true;
+		if (now - _drop_next < params->_interval) {
+			_state_drops = (_state_drops > 2) ? (_state_drops - 2) : 1;
+		} else {
+			_state_drops = 1;
+		}
+		_drop_next = control_law(now, params);
+	}
+
+	return p;
+
+}
+
+// interval / sqrt(drops), with 4 fractional bits as in CoDel
+inline Timestamp SojournAQM::control_law(const Timestamp &t, SojournAQMParams *params) {
+	uint64_t nsecs = (uint64_t) params->_interval.nsecval() * 16;
+	nsecs = int_divide(nsecs, int_sqrt((uint32_t) (_state_drops * 256)));
+	return t + Timestamp::make_nsec((Timestamp::value_type) nsecs);
+}
+
+// Returns false if the frame was marked instead of being dropped.
+inline bool SojournAQM::drop(Packet *&p, SojournAQMParams *params) {
+	if (params->_ecn && mark(p)) {
+		params->_marks++;
+		return false;
+	}
+	params->_drops++;
+	if (p) {
+		p->kill();
+		p = 0;
+	}
+	return true;
+}
+
+// Sets Congestion Experienced on ECN-capable IPv4 and IPv6 frames.
+inline bool SojournAQM::mark(Packet *&p) {
+
+	if (p->length() < sizeof(click_ether)) {
+		return false;
+	}
+
+	uint16_t ether_type = ntohs(((const click_ether *) p->data())->ether_type);
+
+	if (ether_type == ETHERTYPE_IP && p->length() >= sizeof(click_ether) + sizeof(click_ip)) {
+		const click_ip *ip = (const click_ip *) (p->data() + sizeof(click_ether));
+		if ((ip->ip_tos & IP_ECNMASK) == IP_ECN_NOT_ECT || (ip->ip_tos & IP_ECNMASK) == IP_ECN_CE) {
+			return (ip->ip_tos & IP_ECNMASK) == IP_ECN_CE;
+		}
+		WritablePacket *q = p->uniqueify();
+		if (!q) {
+			p = 0;
+			return false;
+		}
+		p = q;
+		click_ip *wip = (click_ip *) (q->data() + sizeof(click_ether));
+		uint16_t old_hw = ((uint16_t *) wip)[0];
+		wip->ip_tos |= IP_ECN_CE;
+		click_update_in_cksum(&wip->ip_sum, old_hw, ((uint16_t *) wip)[0]);
+		return true;
+	}
+
+	if (ether_type == ETHERTYPE_IP6 && p->length() >= sizeof(click_ether) + sizeof(click_ip6)) {
+		const click_ip6 *ip6 = (const click_ip6 *) (p->data() + sizeof(click_ether));
+		uint32_t flow = ntohl(ip6->ip6_flow);
+		uint32_t ecn = (flow >> 20) & IP_ECNMASK;
+		if (ecn == IP_ECN_NOT_ECT || ecn == IP_ECN_CE) {
+			return ecn == IP_ECN_CE;
+		}
+		WritablePacket *q = p->uniqueify();
+		if (!q) {
+			p = 0;
+			return false;
+		}
+		p = q;
+		click_ip6 *wip6 = (click_ip6 *) (q->data() + sizeof(click_ether));
+		wip6->ip6_flow = htonl(flow | (IP_ECN_CE << 20));
+		return true;
+	}
+
+	return false;
+
+}
+
+CLICK_ENDDECLS
+#endif /* CLICK_EMPOWER_SOJOURNAQM_HH */
@@ -22,13 +22,15 @@
 CLICK_DECLS
 
 SummaryTrigger::SummaryTrigger(int iface_id, EtherAddress eth, uint32_t trigger_id, int16_t limit,
-		uint16_t period, EmpowerLVAPManager * el, EmpowerRXStats * ers) :
-		Trigger(trigger_id, period, el, ers), _eth(eth), _iface_id(iface_id), _sent(0), _limit(limit) {
+		uint16_t period, uint32_t capacity, EmpowerLVAPManager * el, EmpowerRXStats * ers) :
+		Trigger(trigger_id, period, el, ers), _eth(eth), _iface_id(iface_id), _sent(0), _limit(limit),
+		_ring(new Frame[capacity]), _capacity(capacity), _head(0), _count(0), _dropped(0),
+		_captured(0), _total_dropped(0) {
 
 }
 
 SummaryTrigger::~SummaryTrigger() {
-	_frames.clear();
+	delete[] _ring;
 }
 
 String SummaryTrigger::unparse() {
@@ -41,7 +43,13 @@ String SummaryTrigger::unparse() {
 	sa << " period ";
 	sa << _period;
 	sa << " frames ";
-	sa << _frames.size();
+	sa << _count;
+	sa << " capacity ";
+	sa << _capacity;
+	sa << " captured ";
+	sa << _captured;
+	sa << " dropped ";
+	sa << (_total_dropped + _dropped);
 	sa << " sent ";
 	sa << _sent;
 	return sa.take_string();
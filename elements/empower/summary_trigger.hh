@@ -8,9 +8,12 @@
 #include "frame.hh"
 CLICK_DECLS
 
-typedef Vector<Frame> FramesList;
-typedef FramesList::iterator FIter;
-
+/*
+ * The frames of a summary are kept in a ring of capacity frames, allocated
+ * with the trigger. When the ring is full the oldest frame is overwritten
+ * and counted as dropped, so a busy channel cannot make a summary grow
+ * between two periods. The ring is emptied when the summary is sent.
+ */
 class SummaryTrigger: public Trigger {
 
 public:
@@ -19,11 +22,50 @@ public:
 	int _iface_id;
 	uint32_t _sent;
 	int16_t _limit;
-	FramesList _frames;
 
-	SummaryTrigger(int, EtherAddress, uint32_t, int16_t, uint16_t, EmpowerLVAPManager *, EmpowerRXStats *);
+	Frame *_ring;
+	uint32_t _capacity;
+	uint32_t _head; // oldest frame
+	uint32_t _count;
+	uint32_t _dropped; // since the last summary
+	uint64_t _captured;
+	uint64_t _total_dropped;
+
+	SummaryTrigger(int, EtherAddress, uint32_t, int16_t, uint16_t, uint32_t, EmpowerLVAPManager *, EmpowerRXStats *);
 	~SummaryTrigger();
 
+	// The slot of the next frame, the oldest one if the ring is full.
+	Frame &capture() {
+		uint32_t i = _head + _count;
+		if (i >= _capacity)
+			i -= _capacity;
+		if (_count < _capacity) {
+			_count++;
+		} else {
+			_dropped++;
+			if (++_head == _capacity)
+				_head = 0;
+		}
+		_captured++;
+		return _ring[i];
+	}
+
+	uint32_t size() const { return _count; }
+
+	// The i-th frame in the ring, oldest first
+	const Frame &frame(uint32_t i) const {
+		i += _head;
+		return _ring[i >= _capacity ? i - _capacity : i];
+	}
+
+	// Empties the ring once its frames have been sent.
+	void reset() {
+		_head = 0;
+		_count = 0;
+		_total_dropped += _dropped;
+		_dropped = 0;
+	}
+
 	String unparse();
 
 	inline bool operator==(const SummaryTrigger &b) {
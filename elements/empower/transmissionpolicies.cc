@@ -19,12 +19,13 @@
 #include <click/args.hh>
 #include <click/error.hh>
 #include <click/glue.hh>
+#include <click/machine.hh>
 #include <click/straccum.hh>
 #include <clicknet/ether.h>
 #include "transmissionpolicies.hh"
 CLICK_DECLS
 
-TransmissionPolicies::TransmissionPolicies() : _default_tx_policy(0) {
+TransmissionPolicies::TransmissionPolicies() : _default_tx_policy(0), _generation(1) {
 }
 
 TransmissionPolicies::~TransmissionPolicies() {
@@ -168,6 +169,11 @@ int TransmissionPolicies::insert(EtherAddress eth, Vector<int> mcs, Vector<int>
 		dst->_ht_mcs = ht_mcs;
 	}
 
+	// readers that see the new generation must also see the new policy,
+	// or they would cache a half-written one until the next change
+	click_write_fence();
+	_generation++;
+
 	return 0;
 
 }
@@ -188,6 +194,7 @@ int TransmissionPolicies::remove(EtherAddress eth) {
 	}
 
 	_tx_table.remove(eth);
+	_generation++;
 
 	return 0;
 
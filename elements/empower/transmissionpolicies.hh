@@ -50,6 +50,10 @@ class TransmissionPolicies : public Element { public:
 
   TxTable * tx_table() { return &_tx_table; }
   TxPolicyInfo * default_tx_policy() { return _default_tx_policy; }
+
+  // Changes whenever a policy is inserted or removed, so that what is
+  // derived from the policies can be cached
+  uint32_t generation() { return _generation; }
   void clear();
 
   TxPolicyInfo * lookup(EtherAddress eth);
@@ -62,6 +66,7 @@ private:
 
   TxTable _tx_table;
   TxPolicyInfo * _default_tx_policy;
+  uint32_t _generation;
 
   static String read_handler(Element *, void *);
 
@@ -0,0 +1,219 @@
+/*
+ * empoweramsdubench.{cc,hh} -- benchmarks A-MSDU aggregation
+ *
+ * Copyright (c) 2018 CREATE-NET
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "empoweramsdubench.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+#include <click/timestamp.hh>
+#include <clicknet/ether.h>
+#include <clicknet/wifi.h>
+#include <clicknet/llc.h>
+#include <elements/empower/empowerqosmanager.hh>
+CLICK_DECLS
+
+enum { BATCH = 256, ETHERTYPE = 0x0800 };
+
+static const uint8_t bench_ra[6] = { 0x02, 0, 0, 0, 0, 1 };
+static const uint8_t bench_ta[6] = { 0x02, 0xff, 0, 0, 0, 1 };
+static const uint8_t bench_sa[6] = { 0x02, 0xee, 0, 0, 0, 1 };
+
+static inline uint32_t padding(uint32_t length) {
+	return (4 - (length % 4)) % 4;
+}
+
+EmpowerAMSDUBench::EmpowerAMSDUBench() : _length(1000), _aggregates(100000) {
+}
+
+int EmpowerAMSDUBench::configure(Vector<String> &conf, ErrorHandler *errh) {
+
+	if (Args(conf, this, errh)
+			.read_all("SUBFRAMES", _subframes)
+			.read("LENGTH", _length)
+			.read("AGGREGATES", _aggregates)
+			.complete() < 0) {
+		return -1;
+	}
+
+	if (_subframes.empty()) {
+		_subframes.push_back(2);
+		_subframes.push_back(4);
+		_subframes.push_back(8);
+	}
+
+	for (int i = 0; i < _subframes.size(); i++) {
+		if (_subframes[i] < 1 || _subframes[i] > 64) {
+			return errh->error("SUBFRAMES must be between 1 and 64");
+		}
+	}
+
+	if (_length <= sizeof(click_ether) || _length > 2304) {
+		return errh->error("LENGTH must be between %d and 2304", (int) sizeof(click_ether) + 1);
+	}
+
+	return 0;
+
+}
+
+/*
+ * Parse an aggregate back and compare it with what was queued. seq is the
+ * sequence number of the first MSDU and is moved past the last one.
+ */
+bool EmpowerAMSDUBench::check(Packet *p, int subframes, uint32_t &seq) {
+
+	const uint8_t *data = p->data();
+	const uint8_t *end = p->end_data();
+
+	const click_wifi *w = (const click_wifi *) data;
+	const click_qos_control *z = (const click_qos_control *) (data + sizeof(click_wifi));
+
+	if (memcmp(w->i_addr1, bench_ra, 6) || memcmp(w->i_addr2, bench_ta, 6) || memcmp(w->i_addr3, bench_sa, 6)) {
+		return false;
+	}
+
+	if (!(z->qos_control & WIFI_QOS_CONTROL_QOS_AMSDU_PRESENT_MASK)) {
+		return false;
+	}
+
+	data += sizeof(click_wifi) + sizeof(click_qos_control);
+
+	uint32_t payload = _length - sizeof(click_ether);
+
+	for (int i = 0; i < subframes; i++, seq++) {
+
+		const click_wifi_amsdu_subframe_header *wa = (const click_wifi_amsdu_subframe_header *) data;
+		uint32_t length = ntohs(wa->len);
+
+		if (length != sizeof(click_llc) + payload || memcmp(wa->da, bench_ra, 6) || memcmp(wa->sa, bench_sa, 6)) {
+			return false;
+		}
+
+		data += sizeof(click_wifi_amsdu_subframe_header);
+
+		if (memcmp(data, WIFI_LLC_HEADER, WIFI_LLC_HEADER_LEN) || ((const uint16_t *) data)[3] != htons(ETHERTYPE)) {
+			return false;
+		}
+
+		data += sizeof(click_llc);
+
+		for (uint32_t j = 0; j < payload; j++) {
+			if (data[j] != (uint8_t) (seq + j)) {
+				return false;
+			}
+		}
+
+		data += payload;
+
+		if (i < subframes - 1) {
+			uint32_t pad = padding(sizeof(click_wifi_amsdu_subframe_header) + length);
+			for (uint32_t j = 0; j < pad; j++) {
+				if (data[j]) {
+					return false;
+				}
+			}
+			data += pad;
+		}
+
+	}
+
+	return data == end;
+
+}
+
+int EmpowerAMSDUBench::run(int subframes, ErrorHandler *errh) {
+
+	// exactly subframes MSDUs fit in the A-MSDU
+	uint32_t subframe = _length - sizeof(click_ether) + sizeof(click_wifi_amsdu_subframe_header) + sizeof(click_llc);
+	uint32_t max_len = subframes * subframe + (subframes - 1) * padding(subframe);
+
+	PacketSlotPool *slots = new PacketSlotPool(subframes * BATCH * _length);
+	AggregationQueue *queue = new AggregationQueue(0, slots, subframes * BATCH, EtherPair(EtherAddress(bench_ra), EtherAddress(bench_ta)));
+
+	Packet *out[BATCH];
+	uint32_t seq = 0, expected = 0;
+	uint32_t built = 0;
+	Timestamp elapsed;
+	int ret = 0;
+
+	while (built < _aggregates && !ret) {
+
+		uint32_t batch = _aggregates - built < (uint32_t) BATCH ? _aggregates - built : (uint32_t) BATCH;
+
+		for (uint32_t i = 0; i < batch * subframes; i++, seq++) {
+			WritablePacket *p = Packet::make(_length);
+			click_ether *eh = (click_ether *) p->data();
+			memcpy(eh->ether_dhost, bench_ra, 6);
+			memcpy(eh->ether_shost, bench_sa, 6);
+			eh->ether_type = htons(ETHERTYPE);
+			for (uint32_t j = 0; j < _length - sizeof(click_ether); j++) {
+				p->data()[sizeof(click_ether) + j] = (uint8_t) (seq + j);
+			}
+			queue->push(p);
+		}
+
+		Timestamp start = Timestamp::now();
+		for (uint32_t i = 0; i < batch; i++) {
+			out[i] = queue->aggregate(max_len);
+		}
+		elapsed += Timestamp::now() - start;
+
+		for (uint32_t i = 0; i < batch; i++) {
+			if (!ret && (!out[i] || !check(out[i], subframes, expected))) {
+				ret = errh->error("%d subframes: aggregate %u is malformed", subframes, built + i);
+			}
+			if (out[i]) {
+				out[i]->kill();
+			}
+		}
+
+		built += batch;
+
+	}
+
+	delete queue;
+	delete slots;
+
+	if (!ret) {
+		double nsecs = elapsed.doubleval() * 1e9;
+		double bits = 8.0 * built * subframes * (_length - sizeof(click_ether));
+		errh->message("%d subframes: %u aggregates of %u bytes, %.1f ns/aggregate, %.2f Gbps",
+				      subframes, built, max_len,
+				      built ? nsecs / built : 0.0,
+				      nsecs > 0 ? bits / nsecs : 0.0);
+	}
+
+	return ret;
+
+}
+
+int EmpowerAMSDUBench::initialize(ErrorHandler *errh) {
+
+	for (int i = 0; i < _subframes.size(); i++) {
+		if (run(_subframes[i], errh) < 0) {
+			return -1;
+		}
+	}
+
+	errh->message("All tests pass!");
+
+	return 0;
+
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(EmpowerAMSDUBench)
+ELEMENT_REQUIRES(userlevel EmpowerQOSManager PacketSlotPool)
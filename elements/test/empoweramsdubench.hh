@@ -0,0 +1,67 @@
+#ifndef CLICK_EMPOWERAMSDUBENCH_HH
+#define CLICK_EMPOWERAMSDUBENCH_HH
+#include <click/element.hh>
+CLICK_DECLS
+
+/*
+=c
+
+EmpowerAMSDUBench([I<KEYWORDS>])
+
+=s test
+
+benchmarks A-MSDU aggregation in the EmPOWER station queues
+
+=d
+
+Runs at initialization time. Queues Ethernet frames of LENGTH bytes for one
+station and builds A-MSDUs of SUBFRAMES subframes each, using the same
+aggregation code as EmpowerQOSManager, then reports the time per aggregate
+and the resulting throughput. Every aggregate is parsed back: the test fails
+if a subframe header, its padding or its payload is wrong.
+
+Keyword arguments are:
+
+=over 8
+
+=item SUBFRAMES
+Number of subframes per A-MSDU. May be given several times, default 2, 4
+and 8
+
+=item LENGTH
+Length of each Ethernet frame, default 1000
+
+=item AGGREGATES
+Number of aggregates built for each SUBFRAMES value, default 100000
+
+=back 8
+
+=e
+
+  click -qe 'EmpowerAMSDUBench(LENGTH 1500, SUBFRAMES 5)'
+
+=a EmpowerQOSManager, EmpowerQueueBench
+*/
+
+class EmpowerAMSDUBench : public Element { public:
+
+	EmpowerAMSDUBench() CLICK_COLD;
+
+	const char *class_name() const		{ return "EmpowerAMSDUBench"; }
+
+	int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+	int initialize(ErrorHandler *) CLICK_COLD;
+
+private:
+
+	Vector<int> _subframes;
+	uint32_t _length;
+	uint32_t _aggregates;
+
+	int run(int, ErrorHandler *);
+	bool check(Packet *, int, uint32_t &);
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,231 @@
+/*
+ * empowerframerbench.{cc,hh} -- benchmarks the reassembly of the controller stream
+ *
+ * Copyright (c) 2018 CREATE-NET
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "empowerframerbench.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/straccum.hh>
+#include <click/timestamp.hh>
+#include <elements/empower/empowerpacket.hh>
+#include <elements/empower/empowerframer.hh>
+CLICK_DECLS
+
+EmpowerFramerBench::EmpowerFramerBench() : _burst(300), _repeat(100) {
+}
+
+int EmpowerFramerBench::configure(Vector<String> &conf, ErrorHandler *errh) {
+
+	if (Args(conf, this, errh)
+			.read("BURST", _burst)
+			.read("REPEAT", _repeat)
+			.complete() < 0) {
+		return -1;
+	}
+
+	if (_burst < 1 || _repeat < 1) {
+		return errh->error("BURST and REPEAT must be positive");
+	}
+
+	return 0;
+
+}
+
+/*
+ * Builds the burst: ADD_LVAP with two SSIDs, SET_PORT with 12 legacy and
+ * 8 HT rates, SET_SLICE, in turn. The sequence number of each message is
+ * its index in the burst.
+ */
+void EmpowerFramerBench::make_stream() {
+
+	static const uint8_t types[] = { EMPOWER_PT_ADD_LVAP, EMPOWER_PT_SET_PORT, EMPOWER_PT_SET_SLICE };
+	static const uint32_t lengths[] = { sizeof(empower_add_lvap) + 2 * 16,
+										sizeof(empower_set_port) + 12 + 8,
+										sizeof(empower_set_slice) };
+
+	StringAccum sa;
+	uint8_t wtp[6] = { 0x00, 0x0d, 0xb9, 0x2f, 0x56, 0x64 };
+
+	for (int i = 0; i < _burst; i++) {
+		uint8_t type = types[i % 3];
+		uint32_t length = lengths[i % 3];
+		char *data = sa.extend(length);
+		memset(data, 0, length);
+		for (uint32_t j = sizeof(empower_header); j < length; j++) {
+			data[j] = (char) (i + j);
+		}
+		empower_header *h = (empower_header *) data;
+		h->set_version(_empower_version);
+		h->set_type(type);
+		h->set_length(length);
+		h->set_seq(i);
+		h->set_xid(i);
+		h->set_wtp(EtherAddress(wtp));
+		_types.push_back(type);
+		_lengths.push_back(length);
+	}
+
+	_stream = sa.take_string();
+
+}
+
+/*
+ * Replays the burst cut in chunks of chunk_size bytes and checks that
+ * every message comes out whole, once and in order.
+ */
+bool EmpowerFramerBench::replay(EmpowerFramer *framer, uint32_t chunk_size, int repeat, ErrorHandler *errh) {
+
+	Timestamp elapsed;
+	uint64_t messages = 0;
+	uint64_t chunks = 0;
+
+	for (int r = 0; r < repeat; r++) {
+
+		Vector<Packet *> burst;
+		for (int offset = 0; offset < _stream.length(); offset += chunk_size) {
+			uint32_t length = _stream.length() - offset;
+			length = length < chunk_size ? length : chunk_size;
+			burst.push_back(Packet::make(_stream.data() + offset, length));
+		}
+
+		int expected = 0;
+		bool ok = true;
+		Timestamp start = Timestamp::now();
+
+		for (int i = 0; i < burst.size(); i++) {
+			framer->push(burst[i]);
+			Packet *m;
+			uint32_t offset;
+			int ret;
+			while ((ret = framer->next(m, offset)) > 0) {
+				empower_header *h = (empower_header *) (m->data() + offset);
+				if (expected >= _burst || h->seq() != (uint32_t) expected
+					|| h->type() != _types[expected] || h->length() != _lengths[expected]
+					|| offset + h->length() > m->length()) {
+					ok = false;
+				}
+				expected++;
+			}
+			if (ret < 0) {
+				ok = false;
+			}
+		}
+
+		elapsed += Timestamp::now() - start;
+		messages += expected;
+		chunks += burst.size();
+
+		if (!ok || expected != _burst || framer->buffered()) {
+			errh->error("chunks of %u bytes: %d of %d messages out of order or damaged", chunk_size, expected, _burst);
+			return false;
+		}
+
+	}
+
+	double secs = elapsed.doubleval();
+	errh->message("chunks of %5u bytes: %8.0f messages/s, %7.1f MB/s, %3llu chunks/burst (%s)",
+				  chunk_size, secs > 0 ? messages / secs : 0.0,
+				  secs > 0 ? repeat * _stream.length() / secs / 1e6 : 0.0,
+				  (unsigned long long) (chunks / repeat), framer->unparse().trim_space().c_str());
+
+	return true;
+
+}
+
+/*
+ * A corrupted header drops the buffered stream. After a reset, as on
+ * reconnection, the next chunk is framed again.
+ */
+bool EmpowerFramerBench::check_resync(ErrorHandler *errh) {
+
+	EmpowerFramer framer;
+	Packet *m;
+	uint32_t offset;
+
+	// half of the first message, then garbage
+	uint32_t half = _lengths[0] / 2;
+	framer.push(Packet::make(_stream.data(), half));
+	if (framer.next(m, offset) != 0 || framer.buffered() != half) {
+		errh->error("split message not buffered");
+		return false;
+	}
+
+	uint8_t garbage[64];
+	memset(garbage, 0xff, sizeof(garbage));
+	framer.push(Packet::make(garbage, sizeof(garbage)));
+	int ret;
+	while ((ret = framer.next(m, offset)) > 0) {
+	}
+	if (ret != -1 || framer.buffered()) {
+		errh->error("corrupted header not detected");
+		return false;
+	}
+
+	framer.push(Packet::make(_stream.data(), _lengths[0] + half));
+	framer.reset();
+	if (framer.buffered()) {
+		errh->error("reset left bytes buffered");
+		return false;
+	}
+
+	framer.push(Packet::make(_stream.data(), _stream.length()));
+	int count = 0;
+	while ((ret = framer.next(m, offset)) > 0) {
+		count++;
+	}
+	if (ret != 0 || count != _burst) {
+		errh->error("framer did not recover after a reset: %d of %d messages", count, _burst);
+		return false;
+	}
+
+	return true;
+
+}
+
+int EmpowerFramerBench::initialize(ErrorHandler *errh) {
+
+	make_stream();
+
+	errh->message("burst of %d messages, %d bytes", _burst, _stream.length());
+
+	static const uint32_t chunk_sizes[] = { 1, 7, 100, 1448 };
+
+	for (unsigned i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); i++) {
+		EmpowerFramer framer;
+		// byte by byte is slow, a few rounds are enough
+		if (!replay(&framer, chunk_sizes[i], chunk_sizes[i] == 1 ? 1 : _repeat, errh)) {
+			return -1;
+		}
+	}
+
+	EmpowerFramer framer;
+	if (!replay(&framer, _stream.length(), _repeat, errh)) {
+		return -1;
+	}
+
+	if (!check_resync(errh)) {
+		return -1;
+	}
+
+	errh->message("All tests pass!");
+
+	return 0;
+
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(EmpowerFramerBench)
+ELEMENT_REQUIRES(userlevel EmpowerFramer)
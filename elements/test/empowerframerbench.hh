@@ -0,0 +1,75 @@
+#ifndef CLICK_EMPOWERFRAMERBENCH_HH
+#define CLICK_EMPOWERFRAMERBENCH_HH
+#include <click/element.hh>
+#include <click/string.hh>
+CLICK_DECLS
+
+/*
+=c
+
+EmpowerFramerBench([I<KEYWORDS>])
+
+=s test
+
+benchmarks the reassembly of the controller stream
+
+=d
+
+Runs at initialization time. Builds a burst of BURST controller messages,
+ADD_LVAP, SET_PORT and SET_SLICE in turn, as the controller sends them when
+an access point joins. The burst is cut into chunks of 1, 7, 100 and 1448
+bytes and of the whole burst. Each burst is then replayed REPEAT times
+through the EmpowerFramer that EmpowerLVAPManager uses, and the bench
+reports messages per second and the share of bytes that had to be copied.
+
+Every message must come out whole, once and in order, whatever the chunk
+size. The bench also checks that a corrupted header drops the buffered
+stream, and that the framer picks up again at the next chunk after a reset.
+
+Keyword arguments are:
+
+=over 8
+
+=item BURST
+Number of messages in the burst, default 300
+
+=item REPEAT
+Number of times each burst is replayed, default 100
+
+=back 8
+
+=e
+
+  EmpowerFramerBench(BURST 300, REPEAT 100);
+
+=a EmpowerLVAPManager
+*/
+
+class EmpowerFramer;
+
+class EmpowerFramerBench : public Element { public:
+
+	EmpowerFramerBench() CLICK_COLD;
+
+	const char *class_name() const		{ return "EmpowerFramerBench"; }
+
+	int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+	int initialize(ErrorHandler *) CLICK_COLD;
+
+private:
+
+	int _burst;
+	int _repeat;
+
+	String _stream;
+	Vector<uint8_t> _types;
+	Vector<uint32_t> _lengths;
+
+	void make_stream();
+	bool replay(EmpowerFramer *, uint32_t, int, ErrorHandler *);
+	bool check_resync(ErrorHandler *);
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,250 @@
+/*
+ * empowermulticastbench.{cc,hh} -- benchmarks the groups of EmpowerMulticastTable
+ *
+ * Copyright (c) 2018 CREATE-NET
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "empowermulticastbench.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+#include <click/timestamp.hh>
+CLICK_DECLS
+
+EmpowerMulticastBench::EmpowerMulticastBench() : _groups(1000), _receivers(100), _lookups(1000000) {
+}
+
+int EmpowerMulticastBench::configure(Vector<String> &conf, ErrorHandler *errh) {
+
+	if (Args(conf, this, errh)
+			.read("GROUPS", _groups)
+			.read("RECEIVERS", _receivers)
+			.read("LOOKUPS", _lookups)
+			.complete() < 0) {
+		return -1;
+	}
+
+	if (_groups < 1 || _groups > 65535) {
+		return errh->error("GROUPS must be between 1 and 65535");
+	}
+
+	if (_receivers < 1 || _receivers > _groups) {
+		return errh->error("RECEIVERS must be between 1 and GROUPS");
+	}
+
+	return 0;
+
+}
+
+/*
+ * The scans of EmpowerMulticastTable before groups were indexed.
+ */
+void EmpowerMulticastBench::legacy_join(EtherAddress sta, IPAddress group) {
+	for (int i = 0; i < _legacy.size(); i++) {
+		if (_legacy[i].group == group) {
+			for (int a = 0; a < _legacy[i].receivers.size(); a++) {
+				if (_legacy[i].receivers[a] == sta) {
+					return;
+				}
+			}
+			_legacy[i].receivers.push_back(sta);
+			return;
+		}
+	}
+}
+
+void EmpowerMulticastBench::legacy_leave_all(EtherAddress sta) {
+	for (int i = 0; i < _legacy.size(); i++) {
+		Vector<EtherAddress> &receivers = _legacy[i].receivers;
+		for (int a = 0; a < receivers.size(); a++) {
+			if (receivers[a] == sta) {
+				receivers.erase(receivers.begin() + a);
+				break;
+			}
+		}
+		if (receivers.empty()) {
+			_legacy.erase(_legacy.begin() + i);
+			i--;
+		}
+	}
+}
+
+Vector<EtherAddress> *EmpowerMulticastBench::legacy_receivers(EtherAddress mac) {
+	for (int i = 0; i < _legacy.size(); i++) {
+		if (_legacy[i].mac_group == mac) {
+			return &_legacy[i].receivers;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Both must have the same receivers in every group, in any order.
+ */
+bool EmpowerMulticastBench::same_receivers(EmpowerMulticastTable *table, ErrorHandler *errh) {
+
+	if (table->nb_groups() != _legacy.size()) {
+		errh->error("%d groups in the table, %d in the legacy one", table->nb_groups(), _legacy.size());
+		return false;
+	}
+
+	for (int i = 0; i < _macs.size(); i++) {
+		Vector<EtherAddress> *a = legacy_receivers(_macs[i]);
+		Vector<EtherAddress> *b = table->get_receivers(_macs[i]);
+		if (!a != !b || (a && a->size() != b->size())) {
+			errh->error("group %s: %d receivers in the table, %d in the legacy one", _ips[i].unparse().c_str(),
+						b ? b->size() : -1, a ? a->size() : -1);
+			return false;
+		}
+		if (!a) {
+			continue;
+		}
+		HashTable<EtherAddress, int> seen;
+		for (int r = 0; r < a->size(); r++) {
+			seen.set((*a)[r], 1);
+		}
+		for (int r = 0; r < b->size(); r++) {
+			if (!seen.get((*b)[r])) {
+				errh->error("group %s: %s is a receiver in the table only", _ips[i].unparse().c_str(),
+							(*b)[r].unparse().c_str());
+				return false;
+			}
+		}
+	}
+
+	return true;
+
+}
+
+int EmpowerMulticastBench::initialize(ErrorHandler *errh) {
+
+	EmpowerMulticastTable *table = new EmpowerMulticastTable;
+	Vector<String> conf;
+	if (table->configure(conf, errh) < 0) {
+		delete table;
+		return -1;
+	}
+
+	for (int i = 0; i < _groups; i++) {
+		IPAddress ip(htonl(0xef010000 + i)); // 239.1.0.0 on
+		_ips.push_back(ip);
+		_macs.push_back(table->ip_mcast_addr_to_mac(ip));
+		uint8_t sta[6] = { 0x02, 0, 0, 0, (uint8_t) (i >> 8), (uint8_t) i };
+		_stas.push_back(EtherAddress(sta));
+	}
+
+	errh->message("%d groups, %d receivers each, %u lookups", _groups, _receivers, _lookups);
+
+	// station s joins groups s to s + RECEIVERS - 1
+	Timestamp start = Timestamp::now();
+	for (int i = 0; i < _groups; i++) {
+		LegacyGroup group;
+		group.group = _ips[i];
+		group.mac_group = _macs[i];
+		_legacy.push_back(group);
+	}
+	for (int s = 0; s < _groups; s++) {
+		for (int k = 0; k < _receivers; k++) {
+			legacy_join(_stas[s], _ips[(s + k) % _groups]);
+		}
+	}
+	Timestamp middle = Timestamp::now();
+	for (int s = 0; s < _groups; s++) {
+		for (int k = 0; k < _receivers; k++) {
+			IPAddress ip = _ips[(s + k) % _groups];
+			table->add_group(ip);
+			table->join_group(_stas[s], ip);
+		}
+	}
+	Timestamp end = Timestamp::now();
+
+	errh->message("join:      legacy %8.1f ms, indexed %8.1f ms",
+				  (middle - start).doubleval() * 1e3, (end - middle).doubleval() * 1e3);
+
+	int ret = 0;
+
+	if (!same_receivers(table, errh)) {
+		ret = -1;
+	}
+
+	Vector<int> groups;
+	for (int i = 0; i < 4096; i++) {
+		groups.push_back(click_random(0, _groups - 1));
+	}
+
+	if (!ret) {
+		uintptr_t sum = 0;
+		start = Timestamp::now();
+		for (uint32_t n = 0; n < _lookups; n++) {
+			sum += legacy_receivers(_macs[groups[n & 4095]])->size();
+		}
+		middle = Timestamp::now();
+		for (uint32_t n = 0; n < _lookups; n++) {
+			sum -= table->get_receivers(_macs[groups[n & 4095]])->size();
+		}
+		end = Timestamp::now();
+		if (sum) {
+			ret = errh->error("lookup: the table and the legacy one disagree");
+		} else {
+			double legacy_nsecs = (middle - start).doubleval() * 1e9 / _lookups;
+			double index_nsecs = (end - middle).doubleval() * 1e9 / _lookups;
+			errh->message("lookup:    legacy %8.1f ns,    indexed %8.1f ns,    %6.1fx",
+						  legacy_nsecs, index_nsecs, index_nsecs > 0 ? legacy_nsecs / index_nsecs : 0.0);
+		}
+	}
+
+	// half the stations leave, then the other half, checking in between
+	if (!ret) {
+		double legacy_secs = 0, index_secs = 0;
+		for (int half = 0; half < 2 && !ret; half++) {
+			start = Timestamp::now();
+			for (int s = half; s < _groups; s += 2) {
+				legacy_leave_all(_stas[s]);
+			}
+			middle = Timestamp::now();
+			for (int s = half; s < _groups; s += 2) {
+				table->leave_all_groups(_stas[s]);
+			}
+			end = Timestamp::now();
+			legacy_secs += (middle - start).doubleval();
+			index_secs += (end - middle).doubleval();
+			if (!same_receivers(table, errh)) {
+				ret = -1;
+			}
+		}
+		if (!ret && table->nb_groups()) {
+			ret = errh->error("leave all: %d groups left behind", table->nb_groups());
+		}
+		if (!ret) {
+			errh->message("leave all: legacy %8.1f us,    indexed %8.1f us    per station",
+						  legacy_secs * 1e6 / _groups, index_secs * 1e6 / _groups);
+		}
+	}
+
+	delete table;
+	_legacy.clear();
+
+	if (ret < 0) {
+		return ret;
+	}
+
+	errh->message("All tests pass!");
+
+	return 0;
+
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(EmpowerMulticastBench)
+ELEMENT_REQUIRES(userlevel EmpowerMulticastTable)
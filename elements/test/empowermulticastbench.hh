@@ -0,0 +1,100 @@
+#ifndef CLICK_EMPOWERMULTICASTBENCH_HH
+#define CLICK_EMPOWERMULTICASTBENCH_HH
+#include <click/element.hh>
+#include <click/etheraddress.hh>
+#include <click/ipaddress.hh>
+#include <elements/empower/empowermulticasttable.hh>
+CLICK_DECLS
+
+/*
+=c
+
+EmpowerMulticastBench([I<KEYWORDS>])
+
+=s test
+
+benchmarks the groups of EmpowerMulticastTable
+
+=d
+
+Runs at initialization time. Creates GROUPS multicast groups and as many
+stations, each joining RECEIVERS groups, so that every group ends up with
+RECEIVERS receivers. It then looks up the receivers of LOOKUPS frames to
+random groups, as the DMS path of EmpowerQOSManager does, and has every
+station leave all its groups, as when its LVAP is removed. Each step is
+done in two ways:
+
+=over 8
+
+=item legacy
+
+A vector of groups, each with a vector of receivers, scanned as
+EmpowerMulticastTable did before, with the erasures made safe.
+
+=item indexed
+
+EmpowerMulticastTable, with groups in hash tables and the groups of every
+station in a table of its own.
+
+=back 8
+
+The bench reports the time of each step, and fails if the two ever find
+different receivers or if a group is left behind.
+
+Keyword arguments are:
+
+=over 8
+
+=item GROUPS
+Number of groups, default 1000
+
+=item RECEIVERS
+Number of receivers per group, at most GROUPS, default 100
+
+=item LOOKUPS
+Number of lookups, default 1000000
+
+=back 8
+
+=e
+
+  EmpowerMulticastBench(GROUPS 1000, RECEIVERS 100);
+
+=a EmpowerMulticastTable
+*/
+
+class EmpowerMulticastBench : public Element { public:
+
+	EmpowerMulticastBench() CLICK_COLD;
+
+	const char *class_name() const		{ return "EmpowerMulticastBench"; }
+
+	int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+	int initialize(ErrorHandler *) CLICK_COLD;
+
+private:
+
+	struct LegacyGroup {
+		IPAddress group;
+		EtherAddress mac_group;
+		Vector<EtherAddress> receivers;
+	};
+
+	int _groups;
+	int _receivers;
+	uint32_t _lookups;
+
+	Vector<LegacyGroup> _legacy;
+	Vector<IPAddress> _ips;
+	Vector<EtherAddress> _macs;
+	Vector<EtherAddress> _stas;
+
+	void legacy_join(EtherAddress, IPAddress);
+	void legacy_leave_all(EtherAddress);
+	Vector<EtherAddress> *legacy_receivers(EtherAddress);
+	bool same_receivers(EmpowerMulticastTable *, ErrorHandler *);
+
+};
+
+CLICK_ENDDECLS
+#endif
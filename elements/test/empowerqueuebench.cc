@@ -0,0 +1,406 @@
+/*
+ * empowerqueuebench.{cc,hh} -- benchmarks the EmPOWER slice queues
+ *
+ * Copyright (c) 2018 CREATE-NET
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "empowerqueuebench.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+#include <click/packet_anno.hh>
+#include <click/timestamp.hh>
+#include <clicknet/ether.h>
+#include <clicknet/wifi.h>
+#include <clicknet/llc.h>
+#include <elements/empower/empowerqosmanager.hh>
+#include <elements/empower/transmissionpolicy.hh>
+#if HAVE_MULTITHREAD
+# include <pthread.h>
+# include <sched.h>
+#endif
+CLICK_DECLS
+
+enum { POOL_SIZE = 2048, FRAME_LENGTH = 64 };
+
+// let the other side run when there are fewer cores than threads
+static inline void bench_yield() {
+#if HAVE_MULTITHREAD
+	sched_yield();
+#else
+	click_relax_fence();
+#endif
+}
+
+// what wifi_encap() adds in front of the Ethernet payload
+static const uint32_t encap_length = sizeof(click_wifi) + sizeof(click_qos_control) + sizeof(click_llc);
+
+EmpowerQueueBench::EmpowerQueueBench() :
+	_producers(1), _stations(0), _packets(1000000), _capacity(500), _scheduler(0) {
+}
+
+int EmpowerQueueBench::configure(Vector<String> &conf, ErrorHandler *errh) {
+
+	if (Args(conf, this, errh)
+			.read("PRODUCERS", _producers)
+			.read_all("STATIONS", _station_counts)
+			.read("PACKETS", _packets)
+			.read("CAPACITY", _capacity)
+			.read("SCHEDULER", _scheduler)
+			.complete() < 0) {
+		return -1;
+	}
+
+	if (_producers < 1 || _producers > 255) {
+		return errh->error("PRODUCERS must be between 1 and 255");
+	}
+
+	if (_station_counts.empty()) {
+		_station_counts.push_back(10);
+		_station_counts.push_back(100);
+		_station_counts.push_back(1000);
+	}
+
+	int max_stations = 0;
+	for (int i = 0; i < _station_counts.size(); i++) {
+		if (_station_counts[i] < 1 || _station_counts[i] > 65535) {
+			return errh->error("STATIONS must be between 1 and 65535");
+		}
+		if (_station_counts[i] > max_stations) {
+			max_stations = _station_counts[i];
+		}
+	}
+
+#if HAVE_MULTITHREAD
+	if ((unsigned) _producers > click_max_cpu_ids()) {
+		return errh->error("PRODUCERS %d needs at least as many Click threads (-j)", _producers);
+	}
+#else
+	if (_producers > 1) {
+		return errh->error("PRODUCERS %d needs --enable-user-multithread", _producers);
+	}
+#endif
+
+	for (int i = 0; i < max_stations; i++) {
+		uint8_t addr[6] = { 0x02, 0, 0, 0, (uint8_t) (i >> 8), (uint8_t) i };
+		_addrs.push_back(EtherAddress(addr));
+	}
+
+	uint8_t bssid[6] = { 0x02, 0xff, 0, 0, 0, 1 };
+	_bssid = EtherAddress(bssid);
+
+	return 0;
+
+}
+
+/*
+ * Push budget frames. When the producer runs out of free frames it waits
+ * for the consumer to hand some back through the returned queue.
+ */
+void EmpowerQueueBench::produce(Producer *pr, uint32_t budget) {
+
+	for (uint32_t i = 0; i < budget; i++) {
+
+		while (pr->free.empty()) {
+			// wait for the consumer to return some frames
+			bench_yield();
+			while (Packet *p = pr->returned.pull()) {
+				pr->free.push_back(p);
+			}
+		}
+
+		Packet *p = pr->free.back();
+		pr->free.pop_back();
+
+		uint32_t n = pr->pushed + pr->drops;
+		uint16_t station = n % _stations;
+		uint32_t seq = ++pr->seq[station];
+
+		WritablePacket *q = (WritablePacket *) p;
+		memcpy(q->data() + sizeof(click_ether), &station, 2);
+		memcpy(q->data() + sizeof(click_ether) + 2, &seq, 4);
+
+		if (pr->queue->enqueue(p, _addrs[station], _bssid)) {
+			pr->pushed++;
+		} else {
+			pr->drops++;
+			pr->free.push_back(p);
+		}
+
+	}
+
+}
+
+#if HAVE_MULTITHREAD
+extern "C" {
+static void *bench_producer(void *arg)
+{
+	EmpowerQueueBench::Producer *pr = static_cast<EmpowerQueueBench::Producer *>(arg);
+# if HAVE___THREAD_STORAGE_CLASS
+	click_current_thread_id = pr->id;
+# endif
+	pr->bench->produce(pr, pr->bench->packets());
+	click_fence();
+	pr->done = 1;
+	return 0;
+}
+}
+#endif
+
+int EmpowerQueueBench::run(int nproducers, ErrorHandler *errh) {
+
+	PacketSlotPool *slots = new PacketSlotPool();
+	SliceQueue *queue = new SliceQueue(0, slots, Slice("bench", 0), _capacity, 0, false, _scheduler);
+
+	Producer *producers = new Producer[nproducers];
+
+	// a producer never has more frames in flight than a station queue holds
+	uint32_t pool = _capacity < (uint32_t) POOL_SIZE ? _capacity : (uint32_t) POOL_SIZE;
+
+	for (int i = 0; i < nproducers; i++) {
+		Producer *pr = &producers[i];
+		pr->bench = this;
+		pr->queue = queue;
+		pr->id = i;
+		pr->pushed = 0;
+		pr->drops = 0;
+		pr->done = 0;
+		pr->seq = Vector<uint32_t>(_stations, 0);
+		pr->returned.set_pool(slots);
+		for (uint32_t j = 0; j < pool; j++) {
+			WritablePacket *p = Packet::make(FRAME_LENGTH);
+			memset(p->data(), 0, p->length());
+			SET_PAINT_ANNO(p, i);
+			pr->free.push_back(p);
+		}
+	}
+
+	// last sequence number seen for each producer/station
+	Vector<uint32_t> last(nproducers * _stations, 0);
+	uint32_t received = 0;
+	int ret = 0;
+
+	Timestamp start = Timestamp::now();
+
+#if HAVE_MULTITHREAD
+	Vector<pthread_t> threads(nproducers, pthread_t());
+	for (int i = 0; i < nproducers; i++) {
+		pthread_create(&threads[i], 0, bench_producer, &producers[i]);
+	}
+#endif
+
+	uint32_t usecs;
+
+	while (true) {
+
+		Packet *p = queue->dequeue(usecs);
+
+#if !HAVE_MULTITHREAD
+		// single thread: alternate one burst of pushes and a full drain
+		if (!p) {
+			for (int i = 0; i < nproducers; i++) {
+				Producer *pr = &producers[i];
+				uint32_t left = _packets - pr->pushed - pr->drops;
+				produce(pr, left < pool ? left : pool);
+				if (left <= pool) {
+					pr->done = 1;
+				}
+			}
+			p = queue->dequeue(usecs);
+		}
+#endif
+
+		if (!p) {
+			bool done = true;
+			for (int i = 0; i < nproducers; i++) {
+				if (!producers[i].done) {
+					done = false;
+				}
+			}
+			if (!done) {
+				bench_yield();
+				continue;
+			}
+			// all producers stopped: whatever they pushed must be out by now
+			click_fence();
+			p = queue->dequeue(usecs);
+		}
+
+		if (!p) {
+			uint32_t pushed = 0;
+			for (int i = 0; i < nproducers; i++) {
+				pushed += producers[i].pushed;
+			}
+			if (received != pushed) {
+				ret = errh->error("%d station(s), %d producer(s): %u frames pushed but %u received", _stations, nproducers, pushed, received);
+			}
+			break;
+		}
+
+		uint16_t station;
+		uint32_t seq;
+		memcpy(&station, p->data() + encap_length, 2);
+		memcpy(&seq, p->data() + encap_length + 2, 4);
+
+		int id = PAINT_ANNO(p);
+		uint32_t &prev = last[id * _stations + station];
+
+		if (seq <= prev && !ret) {
+			ret = errh->error("%d station(s), %d producer(s): producer %d station %u frame %u after %u", _stations, nproducers, id, station, seq, prev);
+		}
+		prev = seq;
+		received++;
+
+		// undo the 802.11 encapsulation and give the frame back
+		p->pull(encap_length - sizeof(click_ether));
+		producers[id].returned.push(p);
+
+	}
+
+	Timestamp elapsed = Timestamp::now() - start;
+
+#if HAVE_MULTITHREAD
+	for (int i = 0; i < nproducers; i++) {
+		pthread_join(threads[i], 0);
+	}
+#endif
+
+	uint32_t drops = 0;
+	for (int i = 0; i < nproducers; i++) {
+		drops += producers[i].drops;
+	}
+
+	if (!ret) {
+		double nsecs = elapsed.doubleval() * 1e9;
+		errh->message("%d station(s), %d producer(s): %u frames, %u drops, %.1f ns/frame, %.2f Mpps",
+				      _stations, nproducers, received, drops,
+				      received ? nsecs / received : 0.0,
+				      nsecs > 0 ? received * 1e3 / nsecs : 0.0);
+	}
+
+	for (int i = 0; i < nproducers; i++) {
+		Producer *pr = &producers[i];
+		while (Packet *p = pr->returned.pull()) {
+			pr->free.push_back(p);
+		}
+		for (int j = 0; j < pr->free.size(); j++) {
+			pr->free[j]->kill();
+		}
+	}
+
+	delete[] producers;
+	delete queue;
+	delete slots;
+
+	return ret;
+
+}
+
+/*
+ * Unreliable multicast: a group frame held by the slice must come out
+ * 1 + UR_COUNT times, numbered 0 to UR_COUNT and all sharing one buffer, and
+ * the airtime of the repeats must be charged to the slice.
+ */
+int EmpowerQueueBench::check_ur(ErrorHandler *errh) {
+
+	enum { UR_COUNT = 3, UR_USECS = 100 };
+
+	PacketSlotPool *slots = new PacketSlotPool();
+	SliceQueue *queue = new SliceQueue(0, slots, Slice("bench", 0), _capacity, 0, false, _scheduler);
+
+	uint8_t group[6] = { 0x01, 0x00, 0x5e, 0, 0, 1 };
+	WritablePacket *p = Packet::make(FRAME_LENGTH);
+	memset(p->data(), 0, p->length());
+	queue->enqueue(p, EtherAddress(group), _bssid);
+
+	uint32_t usecs;
+	Packet *q = queue->dequeue(usecs);
+
+	if (!q) {
+		delete queue;
+		delete slots;
+		return errh->error("UR: the group frame was not dequeued");
+	}
+
+	Packet *out[UR_COUNT + 2];
+	int n = 0;
+	out[n++] = queue->hold_ur(q, UR_COUNT, UR_USECS);
+	while (n < UR_COUNT + 2 && (out[n] = queue->next_ur())) {
+		n++;
+	}
+
+	int ret = 0;
+
+	if (n != UR_COUNT + 1) {
+		ret = errh->error("UR: %d transmissions of a frame sent %d times", n, UR_COUNT + 1);
+	} else if (out[UR_COUNT] != q || !queue->empty()) {
+		ret = errh->error("UR: the slice did not give the frame back last");
+	} else if (queue->_ur_repeats != UR_COUNT || queue->_ur_airtime != UR_COUNT * UR_USECS) {
+		ret = errh->error("UR: %u repeats and %u usecs charged, expected %d and %d",
+						  queue->_ur_repeats, queue->_ur_airtime, UR_COUNT, UR_COUNT * UR_USECS);
+	}
+
+	for (int i = 0; i < n; i++) {
+		if (!ret && out[i]->data() != q->data()) {
+			ret = errh->error("UR: transmission %d was copied", i);
+		}
+		if (!ret && UR_REPEAT_ANNO(out[i]) != i) {
+			ret = errh->error("UR: transmission %d numbered %d", i, UR_REPEAT_ANNO(out[i]));
+		}
+	}
+
+	for (int i = 0; i < n; i++) {
+		out[i]->kill();
+	}
+
+	delete queue;
+	delete slots;
+
+	if (!ret) {
+		errh->message("UR: %d transmissions of one group frame from one buffer", UR_COUNT + 1);
+	}
+
+	return ret;
+
+}
+
+int EmpowerQueueBench::initialize(ErrorHandler *errh) {
+
+	if (check_ur(errh) < 0) {
+		return -1;
+	}
+
+	for (int i = 0; i < _station_counts.size(); i++) {
+
+		_stations = _station_counts[i];
+
+		if (run(1, errh) < 0) {
+			return -1;
+		}
+
+		if (_producers > 1 && run(_producers, errh) < 0) {
+			return -1;
+		}
+
+	}
+
+	errh->message("All tests pass!");
+
+	return 0;
+
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(EmpowerQueueBench)
+ELEMENT_REQUIRES(userlevel EmpowerQOSManager PacketSlotPool)
@@ -0,0 +1,113 @@
+#ifndef CLICK_EMPOWERQUEUEBENCH_HH
+#define CLICK_EMPOWERQUEUEBENCH_HH
+#include <click/element.hh>
+#include <click/etheraddress.hh>
+#include <click/atomic.hh>
+#include <elements/empower/packetslotpool.hh>
+CLICK_DECLS
+
+/*
+=c
+
+EmpowerQueueBench([I<KEYWORDS>])
+
+=s test
+
+benchmarks and stress tests the EmPOWER slice queues
+
+=d
+
+Runs at initialization time. Pushes PACKETS frames per producer into a
+slice queue with STATIONS stations while the main thread drains it through
+the same dequeue path used by EmpowerQOSManager, then reports the time per
+packet. The run is repeated with one producer and with PRODUCERS producers,
+and for every STATIONS value given.
+Each producer is a separate thread, so PRODUCERS greater than 1 requires
+--enable-user-multithread and at least as many Click threads (-j).
+
+Every frame carries a sequence number. The test fails if a frame is lost,
+delivered twice, or delivered out of order within a station.
+
+Before that, the bench sends one frame to a multicast group with
+unreliable multicast repeats and fails unless the slice sends it 4 times,
+from one buffer, with the airtime of the 3 repeats in the slice stats.
+
+Keyword arguments are:
+
+=over 8
+
+=item PRODUCERS
+Number of producer threads, default 1
+
+=item STATIONS
+Number of stations in the slice. May be given several times to compare
+slice sizes, default 10, 100 and 1000
+
+=item PACKETS
+Number of frames pushed by each producer, default 1000000
+
+=item CAPACITY
+Capacity of each station queue, default 500
+
+=item SCHEDULER
+Scheduler used among the stations of the slice: 0 round robin, 1 deficit
+round robin, 2 airtime deficit round robin. Default 0. Without an
+EmpowerQOSManager there are no airtime estimates, so 2 behaves like 0.
+
+=back 8
+
+=e
+
+  click -j 4 -qe 'EmpowerQueueBench(PRODUCERS 4)'
+
+  click -qe 'EmpowerQueueBench(STATIONS 200, STATIONS 2000)'
+
+=a EmpowerQOSManager
+*/
+
+class SliceQueue;
+
+class EmpowerQueueBench : public Element { public:
+
+	EmpowerQueueBench() CLICK_COLD;
+
+	const char *class_name() const		{ return "EmpowerQueueBench"; }
+
+	int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+	int initialize(ErrorHandler *) CLICK_COLD;
+
+	// per producer state, shared with the producer thread
+	struct Producer {
+		EmpowerQueueBench *bench;
+		SliceQueue *queue;
+		int id;
+		Vector<Packet *> free;
+		PacketSlotQueue returned;
+		uint32_t pushed;
+		uint32_t drops;
+		Vector<uint32_t> seq;
+		atomic_uint32_t done;
+	};
+
+	void produce(Producer *, uint32_t);
+	uint32_t packets() const		{ return _packets; }
+
+private:
+
+	int _producers;
+	Vector<int> _station_counts;
+	int _stations;
+	uint32_t _packets;
+	uint32_t _capacity;
+	uint8_t _scheduler;
+
+	Vector<EtherAddress> _addrs;
+	EtherAddress _bssid;
+
+	int run(int, ErrorHandler *);
+	int check_ur(ErrorHandler *);
+
+};
+
+CLICK_ENDDECLS
+#endif
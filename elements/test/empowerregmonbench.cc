@@ -0,0 +1,406 @@
+/*
+ * empowerregmonbench.{cc,hh} -- benchmarks the parsing of the regmon register_log
+ *
+ * Copyright (c) 2018 CREATE-NET
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <click/config.h>
+#include "empowerregmonbench.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+#include <click/timestamp.hh>
+CLICK_DECLS
+
+enum { PARSE_LEGACY, PARSE_TEXT, PARSE_BINARY };
+
+EmpowerRegmonBench::EmpowerRegmonBench() : _nb_samples(1000000), _dir("/tmp"), _keep(false), _checksum(0), _text_bytes(0) {
+}
+
+int EmpowerRegmonBench::configure(Vector<String> &conf, ErrorHandler *errh) {
+
+	if (Args(conf, this, errh)
+			.read("SAMPLES", _nb_samples)
+			.read("DIR", _dir)
+			.read("KEEP", _keep)
+			.complete() < 0) {
+		return -1;
+	}
+
+	if (_nb_samples < 1) {
+		return errh->error("SAMPLES must be positive");
+	}
+
+	return 0;
+
+}
+
+uint32_t EmpowerRegmonBench::checksum(uint32_t sum, const RegmonSample &s) {
+	sum = sum * 31 + s._sec;
+	sum = sum * 31 + s._nsec;
+	sum = sum * 31 + s._mac_ticks;
+	sum = sum * 31 + s._tx;
+	sum = sum * 31 + s._rx;
+	sum = sum * 31 + s._ed;
+	return sum;
+}
+
+/*
+ * One sample per millisecond of a 44 MHz MAC clock, starting close enough
+ * to the wrap around to go through it. The busy counter grows at least as
+ * fast as tx and rx together.
+ */
+void EmpowerRegmonBench::make_samples() {
+
+	RegmonSample s;
+	s._sec = 1500000000;
+	s._nsec = 0;
+	s._mac_ticks = 0xffffffff - 44000 * 500;
+	s._tx = 0;
+	s._rx = 0;
+	s._ed = 0;
+
+	_checksum = 0;
+
+	for (uint32_t i = 0; i < _nb_samples; i++) {
+		uint32_t tx = click_random(0, 20000);
+		uint32_t rx = click_random(0, 20000);
+		s._nsec += 1000000;
+		if (s._nsec == 1000000000) {
+			s._sec++;
+			s._nsec = 0;
+		}
+		s._mac_ticks += 44000;
+		s._tx += tx;
+		s._rx += rx;
+		s._ed += tx + rx + click_random(0, 4000);
+		_samples.push_back(s);
+		_checksum = checksum(_checksum, s);
+	}
+
+}
+
+bool EmpowerRegmonBench::write_logs(ErrorHandler *errh) {
+
+	String text_path = _dir + "/register_log";
+	FILE *text = fopen(text_path.c_str(), "w");
+	if (!text) {
+		errh->error("cannot write %s", text_path.c_str());
+		return false;
+	}
+	for (int i = 0; i < _samples.size(); i++) {
+		const RegmonSample &s = _samples[i];
+		fprintf(text, "%u,%u,%d,%08x,%08x,%08x,%08x\n", s._sec, s._nsec, i, s._mac_ticks, s._tx, s._rx, s._ed);
+	}
+	_text_bytes = ftell(text);
+	fclose(text);
+
+	String binary_path = _dir + "/register_log.bin";
+	FILE *binary = fopen(binary_path.c_str(), "w");
+	if (!binary) {
+		errh->error("cannot write %s", binary_path.c_str());
+		return false;
+	}
+	fwrite(_samples.begin(), sizeof(RegmonSample), _samples.size(), binary);
+	fclose(binary);
+
+	return true;
+
+}
+
+/*
+ * The parser of EmpowerRegmon::run_timer() before the RegmonReader.
+ */
+bool EmpowerRegmonBench::parse_legacy(const String &path, uint32_t &count, uint32_t &sum) {
+
+	FILE * fp;
+	char * line = NULL;
+	size_t len = 0;
+	ssize_t read;
+
+	fp = fopen(path.c_str(), "r");
+
+	if (fp == NULL) {
+		return false;
+	}
+
+	while ((read = getline(&line, &len, fp)) != -1) {
+		Vector<String> values;
+		char* token = strtok(line, ",");
+		while (token != NULL) {
+			values.push_back(String(token));
+			token = strtok(NULL, ",");
+		}
+		RegmonSample s;
+		s._sec = strtoul(values[0].c_str(), NULL, 10);
+		s._nsec = strtoul(values[1].c_str(), NULL, 10);
+		s._mac_ticks = strtoul(values[3].c_str(), NULL, 16);
+		s._tx = strtoul(values[4].c_str(), NULL, 16);
+		s._rx = strtoul(values[5].c_str(), NULL, 16);
+		s._ed = strtoul(values[6].c_str(), NULL, 16);
+		sum = checksum(sum, s);
+		count++;
+	}
+
+	free(line);
+	fclose(fp);
+
+	return true;
+
+}
+
+bool EmpowerRegmonBench::parse_reader(const String &path, bool binary, uint32_t &count, uint32_t &sum) {
+
+	int fd = open(path.c_str(), O_RDONLY);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	RegmonReader *reader = new RegmonReader;
+	reader->set_binary(binary);
+
+	RegmonSample s;
+	ssize_t n;
+
+	while ((n = reader->fill(fd)) > 0) {
+		while (reader->next(s)) {
+			sum = checksum(sum, s);
+			count++;
+		}
+	}
+
+	delete reader;
+	close(fd);
+
+	return n == 0;
+
+}
+
+bool EmpowerRegmonBench::run(const char *name, const String &path, int mode, ErrorHandler *errh) {
+
+	uint32_t count = 0;
+	uint32_t sum = 0;
+
+	Timestamp start = Timestamp::now();
+	bool ok = mode == PARSE_LEGACY ? parse_legacy(path, count, sum) : parse_reader(path, mode == PARSE_BINARY, count, sum);
+	double secs = (Timestamp::now() - start).doubleval();
+
+	if (!ok) {
+		errh->error("%s: cannot read %s", name, path.c_str());
+		return false;
+	}
+
+	if (count != _nb_samples || sum != _checksum) {
+		errh->error("%s: %u of %u samples, checksum %s", name, count, _nb_samples, sum == _checksum ? "ok" : "wrong");
+		return false;
+	}
+
+	errh->message("%-7s %10.0f samples/s", name, secs > 0 ? count / secs : 0.0);
+
+	return true;
+
+}
+
+/*
+ * Lines that do not parse are dropped one by one, the rest still count.
+ */
+bool EmpowerRegmonBench::check_malformed(ErrorHandler *errh) {
+
+	static const char log[] =
+		"1500000000,1000000,0,00000100,00000010,00000020,00000040\n"
+		"garbage\n"
+		"1500000000,2000000,1,00000200\n"
+		"\n"
+		"1500000000,3000000,2,0x00000300,00000030,00000040,00000080\r\n"
+		"1500000000,4000000,3,00000400,00000040,00000050,000000a0,extra\n"
+		"1500000000,5000000,4,zz,00000040,00000050,000000a0\n"
+		"1500000000,6000000,5,00000600,00000050";
+
+	String path = _dir + "/register_log.bad";
+	FILE *f = fopen(path.c_str(), "w");
+	if (!f) {
+		errh->error("cannot write %s", path.c_str());
+		return false;
+	}
+	fwrite(log, 1, sizeof(log) - 1, f);
+	fclose(f);
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		errh->error("cannot read %s", path.c_str());
+		return false;
+	}
+
+	RegmonReader *reader = new RegmonReader;
+	RegmonSample s;
+	uint32_t mac_ticks = 0;
+
+	while (reader->fill(fd) > 0) {
+		while (reader->next(s)) {
+			mac_ticks += s._mac_ticks;
+		}
+	}
+
+	bool ok = reader->samples() == 3 && reader->bad_lines() == 3 && mac_ticks == 0x800;
+
+	if (!ok) {
+		errh->error("malformed lines: %s, mac_ticks %x", reader->unparse().c_str(), mac_ticks);
+	}
+
+	delete reader;
+	close(fd);
+	unlink(path.c_str());
+
+	return ok;
+
+}
+
+/*
+ * Feeds the samples to a tx register and checks every tier against
+ * buckets built from the same measurements here.
+ */
+bool EmpowerRegmonBench::check_history(ErrorHandler *errh) {
+
+	static const uint64_t periods[] = { 1000000, 10000000, 60000000 };
+
+	RegmonRegister reg(EMPOWER_REGMON_TX, 0, 100);
+	for (int t = 0; t < RegmonRegister::NB_TIERS; t++) {
+		reg._tiers[t].configure(periods[t], EmpowerRegmon::MAX_TIER_SIZE);
+	}
+
+	Vector<uint64_t> stamps;
+	Vector<uint32_t> values;
+	uint32_t last_mac_ticks = 0;
+	uint32_t last_tx = 0;
+
+	Timestamp start = Timestamp::now();
+	for (int i = 0; i < _samples.size(); i++) {
+		const RegmonSample &s = _samples[i];
+		bool valid = s._mac_ticks >= last_mac_ticks;
+		uint32_t mac_ticks_delta = valid ? s._mac_ticks - last_mac_ticks : 0;
+		reg.add_sample(s._sec * 1000000LL + s._nsec / 1000, s._tx, mac_ticks_delta, valid);
+		last_mac_ticks = s._mac_ticks;
+	}
+	double secs = (Timestamp::now() - start).doubleval();
+
+	last_mac_ticks = 0;
+	for (int i = 0; i < _samples.size(); i++) {
+		const RegmonSample &s = _samples[i];
+		if (i && s._mac_ticks >= last_mac_ticks) {
+			uint64_t delta = s._tx - last_tx;
+			stamps.push_back(s._sec * 1000000LL + s._nsec / 1000);
+			values.push_back(delta * 18000 / (s._mac_ticks - last_mac_ticks));
+		}
+		last_mac_ticks = s._mac_ticks;
+		last_tx = s._tx;
+	}
+
+	for (int t = 0; t < RegmonRegister::NB_TIERS; t++) {
+
+		RegmonBuckets expected;
+		for (int i = 0; i < values.size(); i++) {
+			uint64_t bucket = stamps[i] - stamps[i] % periods[t];
+			if (!expected.empty() && expected.back()._timestamp == bucket) {
+				expected.back().add(values[i]);
+			} else {
+				RegmonBucket b;
+				b.reset(bucket, values[i]);
+				expected.push_back(b);
+			}
+		}
+
+		RegmonBuckets buckets;
+		reg.history(t + 1, 0, 0, buckets);
+
+		int skip = expected.size() - buckets.size();
+		bool ok = skip >= 0 && (skip == 0 || buckets.size() == EmpowerRegmon::MAX_TIER_SIZE);
+		for (int i = 0; ok && i < buckets.size(); i++) {
+			const RegmonBucket &a = buckets[i], &b = expected[skip + i];
+			ok = a._timestamp == b._timestamp && a._min == b._min && a._max == b._max && a.avg() == b.avg() && a._count == b._count;
+		}
+
+		if (!ok) {
+			errh->error("tier %llus: %d buckets, %d expected", (unsigned long long) periods[t] / 1000000, buckets.size(), expected.size());
+			return false;
+		}
+
+		// a range from the start of a period to just before the start of
+		// the second next one covers two periods
+		if (buckets.size() >= 4) {
+			RegmonBuckets range;
+			uint64_t from = buckets[1]._timestamp;
+			reg.history(t + 1, from, buckets[3]._timestamp - 1, range);
+			if (range.size() != 2 || range[0]._timestamp != from) {
+				errh->error("tier %llus: %d buckets in range", (unsigned long long) periods[t] / 1000000, range.size());
+				return false;
+			}
+		}
+
+	}
+
+	if (stamps.size() >= 100) {
+		RegmonBuckets raw;
+		reg.history(EMPOWER_REGMON_RAW, stamps[stamps.size() - 10], 0, raw);
+		if (raw.size() != 10) {
+			errh->error("raw: %d samples in range", raw.size());
+			return false;
+		}
+	}
+
+	errh->message("history %6.1f ns/sample", secs * 1e9 / _samples.size());
+
+	return true;
+
+}
+
+int EmpowerRegmonBench::initialize(ErrorHandler *errh) {
+
+	make_samples();
+
+	if (!write_logs(errh)) {
+		return -1;
+	}
+
+	String text_path = _dir + "/register_log";
+	String binary_path = _dir + "/register_log.bin";
+
+	errh->message("%u samples, %lu bytes of text, %lu bytes of records", _nb_samples,
+				  (unsigned long) _text_bytes, (unsigned long) (_nb_samples * sizeof(RegmonSample)));
+
+	bool ok = run("legacy", text_path, PARSE_LEGACY, errh)
+		&& run("text", text_path, PARSE_TEXT, errh)
+		&& run("binary", binary_path, PARSE_BINARY, errh)
+		&& check_malformed(errh)
+		&& check_history(errh);
+
+	if (!_keep) {
+		unlink(text_path.c_str());
+		unlink(binary_path.c_str());
+	}
+
+	if (!ok) {
+		return -1;
+	}
+
+	errh->message("All tests pass!");
+
+	return 0;
+
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(EmpowerRegmonBench)
+ELEMENT_REQUIRES(userlevel EmpowerRegmon)
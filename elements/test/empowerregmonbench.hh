@@ -0,0 +1,98 @@
+#ifndef CLICK_EMPOWERREGMONBENCH_HH
+#define CLICK_EMPOWERREGMONBENCH_HH
+#include <click/element.hh>
+#include <click/string.hh>
+#include <elements/empower/empowerregmon.hh>
+CLICK_DECLS
+
+/*
+=c
+
+EmpowerRegmonBench([I<KEYWORDS>])
+
+=s test
+
+benchmarks the parsing of the regmon register_log
+
+=d
+
+Runs at initialization time. Generates SAMPLES synthetic register samples,
+as the regmon driver patch would log them every millisecond. The MAC clock
+runs at 44 MHz and wraps around. The samples are written to DIR/register_log
+as text and to DIR/register_log.bin as binary records. The files are then
+parsed on one core:
+
+=over 8
+
+=item legacy
+
+as EmpowerRegmon did before: getline(), strtok() into a vector of Strings
+and strtoul() on each field
+
+=item text, binary
+
+by the RegmonReader that EmpowerRegmon uses now, in blocks of 64 KB
+
+=back 8
+
+The bench reports samples per second for each, and fails if any parser loses
+or alters a sample. It also checks that malformed lines are skipped and
+counted, and that the 1, 10 and 60 second tiers of a register hold the
+minimum, average and maximum of its samples.
+
+Keyword arguments are:
+
+=over 8
+
+=item SAMPLES
+Number of samples, default 1000000
+
+=item DIR
+Where the synthetic logs are written, default /tmp
+
+=item KEEP
+If true, leave the logs in DIR, for example to point an EmpowerRegmon at
+them. Default false.
+
+=back 8
+
+=e
+
+  EmpowerRegmonBench(SAMPLES 1000000, DIR /tmp);
+
+=a EmpowerRegmon
+*/
+
+class EmpowerRegmonBench : public Element { public:
+
+	EmpowerRegmonBench() CLICK_COLD;
+
+	const char *class_name() const		{ return "EmpowerRegmonBench"; }
+
+	int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+	int initialize(ErrorHandler *) CLICK_COLD;
+
+private:
+
+	uint32_t _nb_samples;
+	String _dir;
+	bool _keep;
+
+	Vector<RegmonSample> _samples;
+	uint32_t _checksum;
+	long _text_bytes;
+
+	static uint32_t checksum(uint32_t, const RegmonSample &);
+
+	void make_samples();
+	bool write_logs(ErrorHandler *);
+	bool parse_legacy(const String &, uint32_t &, uint32_t &);
+	bool parse_reader(const String &, bool, uint32_t &, uint32_t &);
+	bool run(const char *, const String &, int, ErrorHandler *);
+	bool check_malformed(ErrorHandler *);
+	bool check_history(ErrorHandler *);
+
+};
+
+CLICK_ENDDECLS
+#endif
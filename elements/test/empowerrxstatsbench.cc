@@ -0,0 +1,476 @@
+/*
+ * empowerrxstatsbench.{cc,hh} -- benchmarks the neighbour tables of EmpowerRXStats
+ *
+ * Copyright (c) 2018 CREATE-NET
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "empowerrxstatsbench.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+#include <click/packet_anno.hh>
+#include <click/timestamp.hh>
+#include <clicknet/wifi.h>
+#if HAVE_MULTITHREAD
+# include <pthread.h>
+# include <sched.h>
+# include <unistd.h>
+#endif
+CLICK_DECLS
+
+enum { PERIOD_MSECS = 50 };
+
+EmpowerRXStatsBench::EmpowerRXStatsBench() : _neighbors(10000), _frames(2000000), _triggers(256) {
+}
+
+int EmpowerRXStatsBench::configure(Vector<String> &conf, ErrorHandler *errh) {
+
+	if (Args(conf, this, errh)
+			.read("NEIGHBORS", _neighbors)
+			.read_all("THREADS", _thread_counts)
+			.read("FRAMES", _frames)
+			.read("TRIGGERS", _triggers)
+			.complete() < 0) {
+		return -1;
+	}
+
+	if (_neighbors < 1 || _neighbors > 65535) {
+		return errh->error("NEIGHBORS must be between 1 and 65535");
+	}
+
+	if (_triggers < 1 || _triggers > 65535) {
+		return errh->error("TRIGGERS must be between 1 and 65535");
+	}
+
+#if HAVE_MULTITHREAD
+	int max_threads = click_max_cpu_ids();
+#else
+	int max_threads = 1;
+#endif
+
+	if (_thread_counts.empty()) {
+		for (int n = 1; n <= 4 && n <= max_threads; n *= 2) {
+			_thread_counts.push_back(n);
+		}
+	}
+
+	for (int i = 0; i < _thread_counts.size(); i++) {
+		if (_thread_counts[i] < 1 || _thread_counts[i] > max_threads) {
+			return errh->error("THREADS %d needs at least as many Click threads (-j) and --enable-user-multithread", _thread_counts[i]);
+		}
+	}
+
+	return 0;
+
+}
+
+/*
+ * The update of the neighbour table behind one lock, as EmpowerRXStats
+ * would need it without shards and accumulators.
+ */
+void EmpowerRXStatsBench::feed_global(Packet *p) {
+	const click_wifi *w = (const click_wifi *) p->data();
+	EtherAddress ta = EtherAddress(w->i_addr2);
+	_lock.acquire();
+	NeighborAccum *a = _table.get_pointer(ta);
+	if (!a) {
+		_table[ta] = NeighborAccum();
+		a = _table.get_pointer(ta);
+		a->_iface_id = PAINT_ANNO(p);
+	}
+	a->add_sample(WIFI_EXTRA_ANNO(p)->rssi, p->timestamp_anno());
+	_lock.release();
+}
+
+/*
+ * Every thread goes through all the stations, each from a different one.
+ */
+void EmpowerRXStatsBench::feed(Feeder *f) {
+	int n = _packets.size();
+	int next = (f->id * n) / 4;
+	for (uint32_t i = 0; i < _frames; i++) {
+		Packet *p = _packets[next];
+		if (f->mode == SHARDED) {
+			f->ers->simple_action(p);
+		} else {
+			feed_global(p);
+		}
+		if (++next == n) {
+			next = 0;
+		}
+	}
+}
+
+#if HAVE_MULTITHREAD
+extern "C" {
+static void *bench_feeder(void *arg)
+{
+	EmpowerRXStatsBench::Feeder *f = static_cast<EmpowerRXStatsBench::Feeder *>(arg);
+# if HAVE___THREAD_STORAGE_CLASS
+	click_current_thread_id = f->id;
+# endif
+	f->bench->feed(f);
+	click_fence();
+	f->done = 1;
+	return 0;
+}
+}
+#endif
+
+int EmpowerRXStatsBench::run(int nthreads, int mode, ErrorHandler *errh) {
+
+	EmpowerRXStats *ers = new EmpowerRXStats;
+	Vector<String> conf;
+	if (ers->configure(conf, errh) < 0) {
+		delete ers;
+		return -1;
+	}
+
+	Feeder *feeders = new Feeder[nthreads];
+	for (int i = 0; i < nthreads; i++) {
+		feeders[i].bench = this;
+		feeders[i].ers = ers;
+		feeders[i].id = i;
+		feeders[i].mode = mode;
+		feeders[i].done = 0;
+	}
+
+	_table.clear();
+	uint32_t periods = 0;
+
+	Timestamp start = Timestamp::now();
+
+#if HAVE_MULTITHREAD
+	Vector<pthread_t> threads(nthreads, pthread_t());
+	for (int i = 0; i < nthreads; i++) {
+		pthread_create(&threads[i], 0, bench_feeder, &feeders[i]);
+	}
+
+	// close a period now and then, as the timer would
+	while (true) {
+		bool done = true;
+		for (int i = 0; i < nthreads; i++) {
+			if (!feeders[i].done) {
+				done = false;
+			}
+		}
+		if (done) {
+			break;
+		}
+		usleep(PERIOD_MSECS * 1000);
+		if (mode == SHARDED) {
+			ers->update();
+		} else {
+			_lock.acquire();
+			for (ATIter it = _table.begin(); it.live(); it++) {
+				it.value()._packets = 0;
+			}
+			_lock.release();
+		}
+		periods++;
+	}
+
+	for (int i = 0; i < nthreads; i++) {
+		pthread_join(threads[i], 0);
+	}
+#else
+	feed(&feeders[0]);
+#endif
+
+	Timestamp elapsed = Timestamp::now() - start;
+
+	int ret = 0;
+
+	if (mode == SHARDED) {
+		ers->update();
+		Vector<NeighborStats> stas;
+		ers->neighbors(true, 0, stas);
+		uint64_t packets = 0;
+		for (int i = 0; i < stas.size(); i++) {
+			packets += stas[i]._hist_packets;
+		}
+		if (stas.size() != _neighbors || packets != (uint64_t) _frames * nthreads) {
+			ret = errh->error("%d thread(s): %d of %d stations, %llu of %llu frames", nthreads, stas.size(), _neighbors,
+							  (unsigned long long) packets, (unsigned long long) _frames * nthreads);
+		}
+	}
+
+	if (!ret) {
+		double nsecs = elapsed.doubleval() * 1e9;
+		uint64_t frames = (uint64_t) _frames * nthreads;
+		errh->message("%d thread(s) %s: %5.1f ns/frame, %6.2f Mfps, %u periods",
+				      nthreads, mode == SHARDED ? "sharded" : "global ",
+				      nsecs / frames, nsecs > 0 ? frames * 1e3 / nsecs : 0.0, periods);
+	}
+
+	delete[] feeders;
+	delete ers;
+
+	return ret;
+
+}
+
+/*
+ * A flood of probe requests, each from a new random address, for FLOOD
+ * periods. Neighbours expire after 10 silent periods, so the tables hold
+ * about 11 periods worth of them; once there, the pools must have stopped
+ * growing.
+ */
+int EmpowerRXStatsBench::check_flood(ErrorHandler *errh) {
+
+	enum { FLOOD = 60, WARM_UP = 20 };
+
+	EmpowerRXStats *ers = new EmpowerRXStats;
+	Vector<String> conf;
+	if (ers->configure(conf, errh) < 0) {
+		delete ers;
+		return -1;
+	}
+
+	WritablePacket *p = Packet::make(sizeof(click_wifi) + 64);
+	memset(p->data(), 0, p->length());
+	click_wifi *w = (click_wifi *) p->data();
+	w->i_fc[0] = WIFI_FC0_VERSION_0 | WIFI_FC0_TYPE_MGT | WIFI_FC0_SUBTYPE_PROBE_REQ;
+	w->i_fc[1] = WIFI_FC1_DIR_NODS;
+	memset(w->i_addr1, 0xff, 6);
+	click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p);
+	memset(ceh, 0, sizeof(click_wifi_extra));
+	ceh->magic = WIFI_EXTRA_MAGIC;
+	p->timestamp_anno().assign_now();
+
+	uint32_t chunks, live, warm_chunks = 0;
+	uint64_t allocs, frees, updated = 0, update_nsecs = 0;
+
+	for (int period = 0; period < FLOOD; period++) {
+		for (int i = 0; i < _neighbors / 10; i++) {
+			uint32_t r = click_random();
+			uint8_t ta[6] = { 0x02, (uint8_t) period, (uint8_t) (r >> 24), (uint8_t) (r >> 16), (uint8_t) (r >> 8), (uint8_t) r };
+			memcpy(w->i_addr2, ta, 6);
+			ceh->rssi = r % 60;
+			ers->simple_action(p);
+		}
+		Timestamp start = Timestamp::now();
+		ers->update();
+		update_nsecs += (Timestamp::now() - start).nsecval();
+		ers->allocations(chunks, allocs, frees, live);
+		updated += live;
+		if (period == WARM_UP) {
+			ers->allocations(warm_chunks, allocs, frees, live);
+		}
+	}
+
+	ers->allocations(chunks, allocs, frees, live);
+
+	int ret = 0;
+
+	if (allocs - frees != live || chunks > warm_chunks + EmpowerRXStats::NB_SHARDS) {
+		ret = errh->error("flood: %u chunks after %d periods, %u after %d, %llu allocs, %llu frees, %u live",
+						  warm_chunks, WARM_UP, chunks, FLOOD, (unsigned long long) allocs, (unsigned long long) frees, live);
+	} else {
+		errh->message("flood: %llu neighbours, %llu expired, %u live, %u chunks (%u KB), %u of them after %d periods, update %.1f ns/neighbour",
+					  (unsigned long long) allocs, (unsigned long long) frees, live, chunks,
+					  (unsigned) (chunks * DstInfoPool::CHUNK * sizeof(DstInfo) / 1024), chunks - warm_chunks, WARM_UP,
+					  updated ? (double) update_nsecs / updated : 0.0);
+	}
+
+	p->kill();
+	delete ers;
+
+	return ret;
+
+}
+
+/*
+ * How EmpowerRXStats looked for the summary triggers of a frame before they
+ * were indexed: through the whole list, under the lock.
+ */
+bool EmpowerRXStatsBench::scan_summary_triggers(EmpowerRXStats *ers, Packet *p, Vector<Frame> &frames) {
+	const click_wifi *w = (const click_wifi *) p->data();
+	EtherAddress ta = EtherAddress(w->i_addr2);
+	int iface_id = PAINT_ANNO(p);
+	bool matched = false;
+	ers->summary_lock.acquire();
+	for (DTIter qi = ers->_summary_triggers.begin(); qi != ers->_summary_triggers.end(); qi++) {
+		if ((*qi)->_iface_id != iface_id) {
+			continue;
+		}
+		if ((*qi)->_eth == ta || (*qi)->_eth.is_broadcast()) {
+			frames.push_back(Frame(EtherAddress(w->i_addr1), ta, 0, 0, w->i_seq, 0, 0, 0, 0, p->length(), 0, true, iface_id));
+			matched = true;
+		}
+	}
+	ers->summary_lock.release();
+	return matched;
+}
+
+/*
+ * TRIGGERS summary triggers on addresses no station has, and one that takes
+ * every frame of another interface, so that none wants the frames of the
+ * stations. Then a broadcast trigger on the interface of the stations, fed
+ * more frames than its ring holds.
+ */
+int EmpowerRXStatsBench::check_summary(ErrorHandler *errh) {
+
+	enum { CAPACITY = 1000 };
+
+	EmpowerRXStats *ers = new EmpowerRXStats;
+	Vector<String> conf;
+	conf.push_back("SUMMARY_FRAMES " + String((int) CAPACITY));
+	if (ers->configure(conf, errh) < 0) {
+		delete ers;
+		return -1;
+	}
+
+	uint32_t frames = _frames < 1000000 ? _frames : 1000000;
+	int n = _packets.size();
+
+	Timestamp start = Timestamp::now();
+	for (uint32_t i = 0; i < frames; i++) {
+		ers->simple_action(_packets[i % n]);
+	}
+	double none_nsecs = (Timestamp::now() - start).doubleval() * 1e9 / frames;
+
+	for (int i = 0; i < _triggers; i++) {
+		uint8_t ta[6] = { 0x02, 0, 1, 0, (uint8_t) (i >> 8), (uint8_t) i };
+		ers->_summary_triggers.push_back(new SummaryTrigger(0, EtherAddress(ta), i, -1, 1000, CAPACITY, 0, ers));
+	}
+	ers->_summary_triggers.push_back(new SummaryTrigger(1, EtherAddress::make_broadcast(), _triggers, -1, 1000, CAPACITY, 0, ers));
+	ers->index_summary_triggers();
+
+	Vector<Frame> scanned;
+	uint32_t matched = 0;
+
+	start = Timestamp::now();
+	for (uint32_t i = 0; i < frames; i++) {
+		matched += scan_summary_triggers(ers, _packets[i % n], scanned);
+	}
+	Timestamp middle = Timestamp::now();
+	for (uint32_t i = 0; i < frames; i++) {
+		ers->simple_action(_packets[i % n]);
+	}
+	Timestamp end = Timestamp::now();
+
+	double scan_nsecs = (middle - start).doubleval() * 1e9 / frames;
+	double index_nsecs = (end - middle).doubleval() * 1e9 / frames;
+
+	int ret = 0;
+
+	for (DTIter qi = ers->_summary_triggers.begin(); qi != ers->_summary_triggers.end(); qi++) {
+		if ((*qi)->_captured) {
+			ret = errh->error("summary: trigger %u captured %llu frames it does not want",
+							  (*qi)->_trigger_id, (unsigned long long) (*qi)->_captured);
+			break;
+		}
+	}
+
+	if (matched) {
+		ret = errh->error("summary: the scan matched %u frames no trigger wants", matched);
+	}
+
+	if (!ret) {
+		errh->message("summary: %d triggers, no match: no trigger %.1f ns/frame, scan %.1f ns/frame, index %.1f ns/frame",
+					  _triggers + 1, none_nsecs, scan_nsecs, index_nsecs);
+	}
+
+	SummaryTrigger *summary = new SummaryTrigger(0, EtherAddress::make_broadcast(), _triggers + 1, -1, 1000, CAPACITY, 0, ers);
+	ers->_summary_triggers.push_back(summary);
+	ers->index_summary_triggers();
+
+	// the newest CAPACITY of them stay, oldest first
+	uint32_t fed = 2 * CAPACITY + n / 2;
+	for (uint32_t i = 0; i < fed; i++) {
+		ers->simple_action(_packets[i % n]);
+	}
+
+	if (!ret && (summary->size() != CAPACITY || summary->_captured != fed || summary->_dropped != fed - CAPACITY)) {
+		ret = errh->error("summary: fed %u frames, %u in the ring, %llu captured, %u dropped",
+						  fed, summary->size(), (unsigned long long) summary->_captured, summary->_dropped);
+	}
+
+	for (uint32_t i = 0; i < summary->size() && !ret; i++) {
+		const click_wifi *w = (const click_wifi *) _packets[(fed - CAPACITY + i) % n]->data();
+		if (summary->frame(i)._ta != EtherAddress(w->i_addr2)) {
+			ret = errh->error("summary: frame %u of the ring is from %s, not %s", i,
+							  summary->frame(i)._ta.unparse().c_str(), EtherAddress(w->i_addr2).unparse().c_str());
+		}
+	}
+
+	if (!ret) {
+		errh->message("summary: %u frames into a ring of %u, %u dropped", fed, CAPACITY, summary->_dropped);
+	}
+
+	ers->clear_triggers();
+	delete ers;
+
+	return ret;
+
+}
+
+int EmpowerRXStatsBench::initialize(ErrorHandler *errh) {
+
+	for (int i = 0; i < _neighbors; i++) {
+		WritablePacket *p = Packet::make(sizeof(click_wifi) + 64);
+		memset(p->data(), 0, p->length());
+		click_wifi *w = (click_wifi *) p->data();
+		w->i_fc[0] = WIFI_FC0_VERSION_0 | WIFI_FC0_TYPE_DATA;
+		w->i_fc[1] = WIFI_FC1_DIR_TODS;
+		uint8_t ta[6] = { 0x02, 0, 0, 0, (uint8_t) (i >> 8), (uint8_t) i };
+		memcpy(w->i_addr2, ta, 6);
+		memset(w->i_addr1, 0xff, 6);
+		click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p);
+		memset(ceh, 0, sizeof(click_wifi_extra));
+		ceh->magic = WIFI_EXTRA_MAGIC;
+		ceh->rssi = 20 + i % 40;
+		SET_PAINT_ANNO(p, 0);
+		p->timestamp_anno().assign_now();
+		_packets.push_back(p);
+	}
+
+	errh->message("%d stations, %u frames per thread", _neighbors, _frames);
+
+	int ret = 0;
+
+	for (int i = 0; i < _thread_counts.size() && !ret; i++) {
+		if (run(_thread_counts[i], GLOBAL, errh) < 0 || run(_thread_counts[i], SHARDED, errh) < 0) {
+			ret = -1;
+		}
+	}
+
+	if (!ret && check_flood(errh) < 0) {
+		ret = -1;
+	}
+
+	if (!ret && check_summary(errh) < 0) {
+		ret = -1;
+	}
+
+	for (int i = 0; i < _packets.size(); i++) {
+		_packets[i]->kill();
+	}
+	_packets.clear();
+	_table.clear();
+
+	if (ret < 0) {
+		return ret;
+	}
+
+	errh->message("All tests pass!");
+
+	return 0;
+
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(EmpowerRXStatsBench)
+ELEMENT_REQUIRES(userlevel EmpowerRXStats)
@@ -0,0 +1,125 @@
+#ifndef CLICK_EMPOWERRXSTATSBENCH_HH
+#define CLICK_EMPOWERRXSTATSBENCH_HH
+#include <click/element.hh>
+#include <click/etheraddress.hh>
+#include <click/atomic.hh>
+#include <elements/empower/empowerrxstats.hh>
+CLICK_DECLS
+
+/*
+=c
+
+EmpowerRXStatsBench([I<KEYWORDS>])
+
+=s test
+
+benchmarks the neighbour tables of EmpowerRXStats
+
+=d
+
+Runs at initialization time. Feeds FRAMES data frames per thread, from
+NEIGHBORS stations, to an EmpowerRXStats on 1, 2 and 4 threads at once,
+while the main thread closes a period every 50 msecs. Every thread hears
+every station, as radios on the same channel would. Each run is done in
+two ways:
+
+=over 8
+
+=item global
+
+One table under one lock, which is what the tables of EmpowerRXStats need
+to be correct on more than one thread without shards.
+
+=item sharded
+
+EmpowerRXStats, with accumulators per thread merged into sharded tables.
+
+=back 8
+
+The bench reports the time per frame and the frames per second of both,
+and fails if the tables of EmpowerRXStats lose a frame or a station.
+
+Last, it floods EmpowerRXStats with probe requests from NEIGHBORS/10 new
+random addresses per period, for 60 periods, and fails if the neighbour
+pools keep taking memory once the expiry of silent neighbours has caught
+up with the flood.
+
+It then sets up TRIGGERS summary triggers on stations that are not heard,
+and times the frames that no trigger wants, with the index of EmpowerRXStats
+and with the scan of the list of triggers it replaced. Last, it points a
+broadcast trigger at the stations and fails unless the ring of the trigger
+holds the newest frames and counts the others as dropped.
+
+Runs on more than one thread need Click built with
+--enable-user-multithread and started with as many threads (-j).
+
+Keyword arguments are:
+
+=over 8
+
+=item NEIGHBORS
+Number of stations, default 10000
+
+=item THREADS
+Numbers of threads to run with, may be given more than once, default 1, 2
+and 4, as far as there are Click threads
+
+=item FRAMES
+Number of frames per thread, default 2000000
+
+=item TRIGGERS
+Number of summary triggers, default 256
+
+=back 8
+
+=e
+
+  EmpowerRXStatsBench(NEIGHBORS 10000, THREADS 1, THREADS 2, THREADS 4);
+
+=a EmpowerRXStats
+*/
+
+class EmpowerRXStatsBench : public Element { public:
+
+	EmpowerRXStatsBench() CLICK_COLD;
+
+	const char *class_name() const		{ return "EmpowerRXStatsBench"; }
+
+	int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+	int initialize(ErrorHandler *) CLICK_COLD;
+
+	enum { GLOBAL, SHARDED };
+
+	struct Feeder {
+		EmpowerRXStatsBench *bench;
+		EmpowerRXStats *ers;
+		int id;
+		int mode;
+		atomic_uint32_t done;
+	};
+
+	void feed(Feeder *);
+
+private:
+
+	int _neighbors;
+	Vector<int> _thread_counts;
+	uint32_t _frames;
+	int _triggers;
+
+	Vector<Packet *> _packets;
+
+	// the global table
+	Spinlock _lock;
+	AccumTable _table;
+
+	void feed_global(Packet *);
+	int run(int, int, ErrorHandler *);
+	int check_flood(ErrorHandler *);
+	bool scan_summary_triggers(EmpowerRXStats *, Packet *, Vector<Frame> &);
+	int check_summary(ErrorHandler *);
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,198 @@
+/*
+ * empowerslicebench.{cc,hh} -- benchmarks the slice lookup of EmpowerQOSManager
+ *
+ * Copyright (c) 2018 CREATE-NET
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "empowerslicebench.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+#include <click/timestamp.hh>
+#include <elements/empower/empowerlvapcache.hh>
+CLICK_DECLS
+
+EmpowerSliceBench::EmpowerSliceBench() : _tenants(16), _dscps(8), _lookups(10000000) {
+}
+
+int EmpowerSliceBench::configure(Vector<String> &conf, ErrorHandler *errh) {
+
+	if (Args(conf, this, errh)
+			.read("TENANTS", _tenants)
+			.read("DSCPS", _dscps)
+			.read("LOOKUPS", _lookups)
+			.complete() < 0) {
+		return -1;
+	}
+
+	if (_tenants < 1 || _tenants >= EmpowerLVAPCache::MAX_SSIDS) {
+		return errh->error("TENANTS must be between 1 and %d", EmpowerLVAPCache::MAX_SSIDS - 1);
+	}
+
+	if (_dscps < 1 || _dscps > SliceIndex::NB_DSCP / 2) {
+		return errh->error("DSCPS must be between 1 and %d", SliceIndex::NB_DSCP / 2);
+	}
+
+	return 0;
+
+}
+
+/*
+ * The lookup of EmpowerQOSManager::store() before tenants were interned,
+ * SSID passed by value included.
+ */
+SliceQueue *EmpowerSliceBench::lookup_string(String ssid, int dscp) {
+	SliceQueue *sliceq = _slices.get(Slice(ssid, dscp));
+	if (!sliceq && dscp) {
+		sliceq = _slices.get(Slice(ssid, 0));
+	}
+	return sliceq;
+}
+
+/*
+ * Looks up FRAMES random (tenant, DSCP) pairs over and over, by SSID and by
+ * tenant number. With fallback, every DSCP is one off the DSCP of a slice.
+ */
+bool EmpowerSliceBench::run(bool fallback, ErrorHandler *errh) {
+
+	int spacing = SliceIndex::NB_DSCP / _dscps;
+
+	Vector<int> tenants;
+	Vector<int> dscps;
+	for (int i = 0; i < FRAMES; i++) {
+		tenants.push_back(click_random(0, _tenants - 1));
+		dscps.push_back(click_random(0, _dscps - 1) * spacing + (fallback ? 1 : 0));
+	}
+
+	for (int i = 0; i < FRAMES; i++) {
+		if (lookup_string(_ssids[tenants[i]], dscps[i]) != _index.get(_ids[tenants[i]], dscps[i])) {
+			errh->error("tenant %d dscp %d: the index and the slice table disagree", tenants[i], dscps[i]);
+			return false;
+		}
+	}
+
+	uintptr_t sum = 0;
+
+	Timestamp start = Timestamp::now();
+	for (uint32_t n = 0; n < _lookups; n++) {
+		int i = n & (FRAMES - 1);
+		sum += (uintptr_t) lookup_string(_ssids[tenants[i]], dscps[i]);
+	}
+	Timestamp middle = Timestamp::now();
+	for (uint32_t n = 0; n < _lookups; n++) {
+		int i = n & (FRAMES - 1);
+		sum -= (uintptr_t) _index.get(_ids[tenants[i]], dscps[i]);
+	}
+	Timestamp end = Timestamp::now();
+
+	if (sum) {
+		errh->error("the index and the slice table disagree");
+		return false;
+	}
+
+	double string_nsecs = (middle - start).doubleval() * 1e9 / _lookups;
+	double index_nsecs = (end - middle).doubleval() * 1e9 / _lookups;
+
+	errh->message("%s DSCP: string %6.1f ns/lookup, index %6.1f ns/lookup, %5.1fx",
+				  fallback ? "default" : "slice  ", string_nsecs, index_nsecs,
+				  index_nsecs > 0 ? string_nsecs / index_nsecs : 0.0);
+
+	return true;
+
+}
+
+/*
+ * Tenants come and go, each with a station, many times over the size of
+ * the SSID table: their numbers must be given back and handed out again.
+ * A full table gives 0.
+ */
+bool EmpowerSliceBench::check_tenant_ids(ErrorHandler *errh) {
+
+	EmpowerLVAPCache cache;
+	uint8_t addr[6] = { 0x02, 0, 0, 0, 0, 1 };
+
+	for (int t = 0; t < 4 * EmpowerLVAPCache::MAX_SSIDS; t++) {
+		String ssid = "tenant-" + String(t);
+		uint16_t id = cache.intern(ssid);
+		EmpowerLVAPRecord r;
+		r._sta = EtherAddress(addr);
+		r._ssid_id = cache.intern(ssid);
+		if (!id || r._ssid_id != id) {
+			errh->error("tenant %d numbered %u and %u", t, id, r._ssid_id);
+			return false;
+		}
+		cache.publish(r);
+		cache.release(id);
+		cache.remove(r._sta);
+	}
+
+	Vector<uint16_t> ids;
+	for (int t = 1; t < EmpowerLVAPCache::MAX_SSIDS; t++) {
+		ids.push_back(cache.intern("tenant-" + String(t)));
+		if (!ids.back()) {
+			errh->error("no number left for tenant %d of %d", t, EmpowerLVAPCache::MAX_SSIDS - 1);
+			return false;
+		}
+	}
+	if (cache.intern("one too many")) {
+		errh->error("a full SSID table gave a number");
+		return false;
+	}
+	for (int i = 0; i < ids.size(); i++) {
+		cache.release(ids[i]);
+	}
+
+	return true;
+
+}
+
+int EmpowerSliceBench::initialize(ErrorHandler *errh) {
+
+	EmpowerLVAPCache cache;
+	PacketSlotPool pool;
+	int spacing = SliceIndex::NB_DSCP / _dscps;
+
+	for (int t = 0; t < _tenants; t++) {
+		String ssid = "tenant-" + String(t);
+		_ssids.push_back(ssid);
+		_ids.push_back(cache.intern(ssid));
+		for (int d = 0; d < _dscps; d++) {
+			Slice slice(ssid, d * spacing);
+			_slices.set(slice, new SliceQueue(0, &pool, slice, 500, 12000, false, 0));
+		}
+		_index.update(_ids.back(), ssid, _slices);
+	}
+
+	errh->message("%d tenants, %d slices each, %u lookups", _tenants, _dscps, _lookups);
+
+	bool ok = run(false, errh) && run(true, errh) && check_tenant_ids(errh);
+
+	for (SIter it = _slices.begin(); it != _slices.end(); it++) {
+		delete it.value();
+	}
+	_slices.clear();
+
+	if (!ok) {
+		return -1;
+	}
+
+	errh->message("All tests pass!");
+
+	return 0;
+
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(EmpowerSliceBench)
+ELEMENT_REQUIRES(userlevel EmpowerQOSManager EmpowerLVAPCache PacketSlotPool)
@@ -0,0 +1,94 @@
+#ifndef CLICK_EMPOWERSLICEBENCH_HH
+#define CLICK_EMPOWERSLICEBENCH_HH
+#include <click/element.hh>
+#include <elements/empower/empowerqosmanager.hh>
+CLICK_DECLS
+
+/*
+=c
+
+EmpowerSliceBench([I<KEYWORDS>])
+
+=s test
+
+benchmarks the slice lookup of EmpowerQOSManager
+
+=d
+
+Runs at initialization time. Creates TENANTS tenants with DSCPS slices each,
+at DSCPs spread evenly over the 64 values, and looks up the slice of LOOKUPS
+frames of random tenants. Each lookup is done in two ways:
+
+=over 8
+
+=item string
+
+As EmpowerQOSManager did before tenants were interned: the SSID is passed on
+by value, then the slice table is searched by (SSID, DSCP), and searched
+again by (SSID, 0) if the DSCP has no slice of its own.
+
+=item index
+
+Through the SliceIndex, by the tenant number found in the LVAP record.
+
+=back 8
+
+The bench runs once with frames marked with the DSCP of a slice and once
+with frames marked with a DSCP that falls back to the default slice. It
+reports the time per lookup of both ways, and fails if they ever find
+different slices. It also fails if the tenant numbers of an
+EmpowerLVAPCache run out while tenants come and go, fewer than its
+MAX_SSIDS at a time.
+
+Keyword arguments are:
+
+=over 8
+
+=item TENANTS
+Number of tenants, default 16
+
+=item DSCPS
+Number of slices per tenant, from 1 to 32, default 8
+
+=item LOOKUPS
+Number of lookups per run, default 10000000
+
+=back 8
+
+=e
+
+  EmpowerSliceBench(TENANTS 16, DSCPS 8);
+
+=a EmpowerQOSManager
+*/
+
+class EmpowerSliceBench : public Element { public:
+
+	EmpowerSliceBench() CLICK_COLD;
+
+	const char *class_name() const		{ return "EmpowerSliceBench"; }
+
+	int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+	int initialize(ErrorHandler *) CLICK_COLD;
+
+private:
+
+	enum { FRAMES = 4096 };
+
+	int _tenants;
+	int _dscps;
+	uint32_t _lookups;
+
+	Slices _slices;
+	SliceIndex _index;
+	Vector<String> _ssids;
+	Vector<uint16_t> _ids;
+
+	SliceQueue *lookup_string(String, int);
+	bool run(bool, ErrorHandler *);
+	bool check_tenant_ids(ErrorHandler *);
+
+};
+
+CLICK_ENDDECLS
+#endif
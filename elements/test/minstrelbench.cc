@@ -0,0 +1,350 @@
+/*
+ * minstrelbench.{cc,hh} -- benchmarks the Minstrel rate assignment
+ *
+ * Copyright (c) 2018 CREATE-NET
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "minstrelbench.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+#include <click/packet_anno.hh>
+#include <click/timestamp.hh>
+#include <clicknet/wifi.h>
+#include <elements/empower/minstrel.hh>
+CLICK_DECLS
+
+enum { FRAMES = 1024, FRAME_LENGTH = 128, ROUNDS = 20 };
+
+static const char *kind_names[] = { "unicast data", "group data", "management" };
+
+MinstrelBench::MinstrelBench() :
+	_rc(0), _stations(100), _packets(1000000), _group(10), _mgmt(10) {
+}
+
+int MinstrelBench::configure(Vector<String> &conf, ErrorHandler *errh) {
+
+	if (Args(conf, this, errh)
+			.read_mp("RC", ElementCastArg("Minstrel"), _rc)
+			.read("STATIONS", _stations)
+			.read("PACKETS", _packets)
+			.read("GROUP", _group)
+			.read("MGMT", _mgmt)
+			.complete() < 0) {
+		return -1;
+	}
+
+	if (_stations < 1 || _stations > 65535) {
+		return errh->error("STATIONS must be between 1 and 65535");
+	}
+
+	if (_group < 0 || _mgmt < 0 || _group + _mgmt > 100) {
+		return errh->error("GROUP and MGMT must add up to at most 100");
+	}
+
+	for (int i = 0; i < _stations; i++) {
+		uint8_t addr[6] = { 0x02, 0, 0, 0, (uint8_t) (i >> 8), (uint8_t) i };
+		_addrs.push_back(EtherAddress(addr));
+	}
+
+	uint8_t bssid[6] = { 0x02, 0xff, 0, 0, 0, 1 };
+	_bssid = EtherAddress(bssid);
+
+	return 0;
+
+}
+
+Packet *MinstrelBench::make_frame(int kind, int station) {
+
+	WritablePacket *p = Packet::make(FRAME_LENGTH);
+	memset(p->data(), 0, p->length());
+
+	struct click_wifi *w = (struct click_wifi *) p->data();
+
+	if (kind == MGMT) {
+		w->i_fc[0] = WIFI_FC0_VERSION_0 | WIFI_FC0_TYPE_MGT | WIFI_FC0_SUBTYPE_PROBE_RESP;
+	} else {
+		w->i_fc[0] = WIFI_FC0_VERSION_0 | WIFI_FC0_TYPE_DATA | WIFI_FC0_SUBTYPE_QOS;
+	}
+	w->i_fc[1] = WIFI_FC1_DIR_FROMDS;
+
+	if (kind == GROUP) {
+		memcpy(w->i_addr1, EtherAddress::make_broadcast().data(), 6);
+	} else {
+		memcpy(w->i_addr1, _addrs[station].data(), 6);
+	}
+	memcpy(w->i_addr2, _bssid.data(), 6);
+	memcpy(w->i_addr3, _bssid.data(), 6);
+
+	return p;
+
+}
+
+static bool allowed(const Vector<int> &rates, int rate) {
+	for (int i = 0; i < rates.size(); i++) {
+		if (rates[i] == rate) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Checks the rates assigned to a frame against the policy of its
+ * destination.
+ */
+bool MinstrelBench::check(Packet *p, int round, ErrorHandler *errh) {
+
+	struct click_wifi *w = (struct click_wifi *) p->data();
+	struct click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p);
+	EtherAddress dst = EtherAddress(w->i_addr1);
+	int type = w->i_fc[0] & WIFI_FC0_TYPE_MASK;
+	int kind = dst.is_group() ? GROUP : (type == WIFI_FC0_TYPE_MGT ? MGMT : UNICAST);
+
+	TxPolicyInfo *txp = _rc->tx_policies()->lookup(dst);
+
+	if (kind != UNICAST) {
+		TxPolicyInfo *group = kind == GROUP ? _rc->tx_policies()->supported(dst) : 0;
+		const Vector<int> &rates = (group && group->_ht_mcs.size()) ? group->_ht_mcs : txp->_mcs;
+		int rate = rates.size() ? rates[0] : 2;
+		if (ceh->rate != rate || ceh->max_tries != 1) {
+			errh->error("%s%s: frame to %s at rate %d, expected %d",
+					    kind_names[kind], round ? " after update" : "", dst.unparse().c_str(),
+					    ceh->rate, rate);
+			return false;
+		}
+		return true;
+	}
+
+	const Vector<int> &rates = txp->_ht_mcs.size() ? txp->_ht_mcs : txp->_mcs;
+	bool ht = (ceh->flags & WIFI_EXTRA_MCS) != 0;
+
+	if (ht != (txp->_ht_mcs.size() > 0)
+		|| !allowed(rates, ceh->rate) || !allowed(rates, ceh->rate1)
+		|| !allowed(rates, ceh->rate2) || !allowed(rates, ceh->rate3)) {
+		errh->error("%s%s: frame to %s at rates %d/%d/%d/%d%s, not in its policy",
+				    kind_names[kind], round ? " after update" : "", dst.unparse().c_str(),
+				    ceh->rate, ceh->rate1, ceh->rate2, ceh->rate3, ht ? " (HT)" : "");
+		return false;
+	}
+
+	return true;
+
+}
+
+/*
+ * The synthetic channel of a station: every rate above the middle one of
+ * its policy fails.
+ */
+static int channel_limit(TxPolicyInfo *txp) {
+	const Vector<int> &rates = txp->_ht_mcs.size() ? txp->_ht_mcs : txp->_mcs;
+	return rates[rates.size() / 2];
+}
+
+/*
+ * Sends the unicast frames over the synthetic channel for a few statistics
+ * periods, and checks that no station settled on a rate that always fails.
+ */
+bool MinstrelBench::converge(const Vector<Packet *> &frames, ErrorHandler *errh) {
+
+	TransmissionPolicies *tp = _rc->tx_policies();
+	Timestamp elapsed;
+
+	for (int round = 0; round < ROUNDS; round++) {
+		for (int i = 0; i < frames.size(); i++) {
+			Packet *p = frames[i];
+			struct click_wifi *w = (struct click_wifi *) p->data();
+			struct click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p);
+			_rc->assign_rate(p);
+			if (ceh->rate > channel_limit(tp->lookup(EtherAddress(w->i_addr1)))) {
+				ceh->flags |= WIFI_EXTRA_TX_FAIL;
+			}
+			_rc->process_feedback(p);
+		}
+		Timestamp start = Timestamp::now();
+		_rc->run_timer(0);
+		elapsed += Timestamp::now() - start;
+	}
+
+	for (int i = 0; i < _stations; i++) {
+		MinstrelDstInfo *nfo = _rc->neighbors()->findp(_addrs[i]);
+		if (!nfo) {
+			continue;
+		}
+		int limit = channel_limit(tp->lookup(_addrs[i]));
+		if (nfo->rates[nfo->max_tp_rate] > limit) {
+			errh->error("%s settled on rate %d, every rate above %d fails", _addrs[i].unparse().c_str(), nfo->rates[nfo->max_tp_rate], limit);
+			return false;
+		}
+	}
+
+	errh->message("%d station(s), statistics update: %.1f ns/station", _stations, elapsed.doubleval() * 1e9 / (ROUNDS * _stations));
+
+	return true;
+
+}
+
+/*
+ * Checks the airtime estimated for a unicast frame against the one of the
+ * best rate of its destination, for a frame of the length of its airtime
+ * bucket.
+ */
+bool MinstrelBench::check_airtime(Packet *p, ErrorHandler *errh) {
+
+	struct click_wifi *w = (struct click_wifi *) p->data();
+	EtherAddress dst = EtherAddress(w->i_addr1);
+	MinstrelDstInfo *nfo = _rc->neighbors()->findp(dst);
+
+	if (!nfo) {
+		return true;
+	}
+
+	int rate = nfo->rates[nfo->max_tp_rate];
+	int length = (p->length() + 15) & ~15;
+	uint32_t expected = nfo->ht ? calc_usecs_wifi_packet_ht(length, rate, 0) : calc_usecs_wifi_packet(length, rate, 0);
+
+	// twice, the second estimate comes from the cache
+	for (int i = 0; i < 2; i++) {
+		uint32_t usecs = _rc->estimate_usecs_wifi_packet(p);
+		if (usecs != expected) {
+			errh->error("frame to %s at rate %d%s estimated at %u usecs, expected %u",
+					    dst.unparse().c_str(), rate, nfo->ht ? " (HT)" : "", usecs, expected);
+			return false;
+		}
+	}
+
+	return true;
+
+}
+
+double MinstrelBench::run(const Vector<Packet *> &frames) {
+	Timestamp start = Timestamp::now();
+	for (uint32_t i = 0; i < _packets; i++) {
+		_rc->assign_rate(frames[i % frames.size()]);
+	}
+	Timestamp elapsed = Timestamp::now() - start;
+	return _packets ? elapsed.doubleval() * 1e9 / _packets : 0.0;
+}
+
+int MinstrelBench::initialize(ErrorHandler *errh) {
+
+	TransmissionPolicies *tp = _rc->tx_policies();
+	TxPolicyInfo *def = tp->default_tx_policy();
+
+	if (!def->_mcs.size()) {
+		return errh->error("the default transmission policy of %s has no rates", _rc->name().c_str());
+	}
+
+	// even stations get every default rate, HT ones included, odd stations
+	// only the top legacy rates
+	Vector<int> top;
+	for (int i = def->_mcs.size() > 4 ? def->_mcs.size() - 4 : 0; i < def->_mcs.size(); i++) {
+		top.push_back(def->_mcs[i]);
+	}
+
+	for (int i = 0; i < _stations; i++) {
+		if (i % 2) {
+			tp->insert(_addrs[i], top, Vector<int>(), false, TX_MCAST_LEGACY, 0, 2436, 3839);
+		} else {
+			tp->insert(_addrs[i], def->_mcs, def->_ht_mcs, false, TX_MCAST_LEGACY, 0, 2436, 3839);
+		}
+	}
+
+	Vector<Packet *> frames[3], mix;
+
+	for (int i = 0; i < FRAMES; i++) {
+		int station = i % _stations;
+		frames[UNICAST].push_back(make_frame(UNICAST, station));
+		frames[GROUP].push_back(make_frame(GROUP, station));
+		frames[MGMT].push_back(make_frame(MGMT, station));
+		int r = click_random(0, 99);
+		mix.push_back(make_frame(r < _group ? GROUP : (r < _group + _mgmt ? MGMT : UNICAST), click_random(0, _stations - 1)));
+	}
+
+	int ret = 0;
+
+	for (int kind = UNICAST; kind <= MGMT && !ret; kind++) {
+		double nsecs = run(frames[kind]);
+		for (int i = 0; i < frames[kind].size() && !ret; i++) {
+			if (!check(frames[kind][i], 0, errh)) {
+				ret = -1;
+			}
+		}
+		if (!ret) {
+			errh->message("%d station(s), %s: %.1f ns/packet", _stations, kind_names[kind], nsecs);
+		}
+	}
+
+	if (!ret) {
+		double nsecs = run(mix);
+		for (int i = 0; i < mix.size() && !ret; i++) {
+			if (!check(mix[i], 0, errh)) {
+				ret = -1;
+			}
+		}
+		if (!ret) {
+			errh->message("%d station(s), mix %d%% group %d%% management: %.1f ns/packet", _stations, _group, _mgmt, nsecs);
+		}
+	}
+
+	if (!ret && !converge(frames[UNICAST], errh)) {
+		ret = -1;
+	}
+
+	for (int i = 0; i < _stations && i < frames[UNICAST].size() && !ret; i++) {
+		if (!check_airtime(frames[UNICAST][i], errh)) {
+			ret = -1;
+		}
+	}
+
+	// swap the policies of the first two stations: the cached rates must
+	// follow
+	if (!ret && _stations > 1) {
+		tp->insert(_addrs[0], top, Vector<int>(), false, TX_MCAST_LEGACY, 0, 2436, 3839);
+		tp->insert(_addrs[1], def->_mcs, def->_ht_mcs, false, TX_MCAST_LEGACY, 0, 2436, 3839);
+		for (int i = 0; i < 2 && !ret; i++) {
+			for (int j = 0; j < 100 && !ret; j++) {
+				_rc->assign_rate(frames[UNICAST][i]);
+				if (!check(frames[UNICAST][i], 1, errh)) {
+					ret = -1;
+				}
+			}
+		}
+	}
+
+	for (int kind = UNICAST; kind <= MGMT; kind++) {
+		for (int i = 0; i < frames[kind].size(); i++) {
+			frames[kind][i]->kill();
+		}
+	}
+	for (int i = 0; i < mix.size(); i++) {
+		mix[i]->kill();
+	}
+
+	for (int i = 0; i < _stations; i++) {
+		tp->remove(_addrs[i]);
+		_rc->forget_station(_addrs[i]);
+	}
+
+	if (!ret) {
+		errh->message("All tests pass!");
+	}
+
+	return ret;
+
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(MinstrelBench)
+ELEMENT_REQUIRES(userlevel Minstrel)
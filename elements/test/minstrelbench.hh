@@ -0,0 +1,98 @@
+#ifndef CLICK_MINSTRELBENCH_HH
+#define CLICK_MINSTRELBENCH_HH
+#include <click/element.hh>
+#include <click/etheraddress.hh>
+CLICK_DECLS
+
+/*
+=c
+
+MinstrelBench(RC, [I<KEYWORDS>])
+
+=s test
+
+benchmarks the Minstrel rate assignment
+
+=d
+
+Runs at initialization time. Installs a transmission policy for STATIONS
+stations in the TransmissionPolicies of the Minstrel element RC, then hands
+PACKETS frames to RC's rate assignment and reports the time per frame for
+unicast data, group addressed data and management frames alone, and for a
+mix with GROUP percent group addressed and MGMT percent management frames.
+
+The rates assigned are checked against the policies, also after a policy
+was changed: the test fails if a frame is sent at a rate its policy does
+not allow. The unicast frames are then sent over a synthetic channel on
+which every rate above the middle one of a station fails, for a few
+statistics periods of RC. The time RC takes to update its statistics is
+reported, and the test fails if a station settles on a rate that always
+fails, or if the airtime RC estimates for a frame is not that of its
+current rate, HT or legacy. RC must read the destination at OFFSET 4, that is, be placed
+where frames start with the 802.11 header. The policies and neighbors
+created are removed at the end.
+
+Keyword arguments are:
+
+=over 8
+
+=item STATIONS
+Number of stations, default 100
+
+=item PACKETS
+Number of frames per run, default 1000000
+
+=item GROUP
+Percentage of group addressed frames in the mix, default 10
+
+=item MGMT
+Percentage of management frames in the mix, default 10
+
+=back 8
+
+=e
+
+  tpd :: TransmissionPolicy(MCS "2 4 11 22 12 18 24 36 48 72 96 108", HT_MCS "0 1 2 3 4 5 6 7");
+  tp :: TransmissionPolicies(DEFAULT tpd);
+  rc :: Minstrel(OFFSET 4, TP tp);
+  Idle -> rc -> Discard;
+  Idle -> [1] rc;
+  MinstrelBench(rc);
+
+=a Minstrel, TransmissionPolicies
+*/
+
+class Minstrel;
+
+class MinstrelBench : public Element { public:
+
+	MinstrelBench() CLICK_COLD;
+
+	const char *class_name() const		{ return "MinstrelBench"; }
+
+	int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
+	int initialize(ErrorHandler *) CLICK_COLD;
+
+private:
+
+	enum { UNICAST = 0, GROUP = 1, MGMT = 2 };
+
+	Minstrel *_rc;
+	int _stations;
+	uint32_t _packets;
+	int _group;
+	int _mgmt;
+
+	Vector<EtherAddress> _addrs;
+	EtherAddress _bssid;
+
+	Packet *make_frame(int, int);
+	double run(const Vector<Packet *> &);
+	bool check(Packet *, int, ErrorHandler *);
+	bool converge(const Vector<Packet *> &, ErrorHandler *);
+	bool check_airtime(Packet *, ErrorHandler *);
+
+};
+
+CLICK_ENDDECLS
+#endif
@@ -28,6 +28,12 @@
 #define ICMP_PARAMPROB_ANNO(p)		((p)->anno_u8(ICMP_PARAMPROB_ANNO_OFFSET))
 #define SET_ICMP_PARAMPROB_ANNO(p, v)	((p)->set_anno_u8(ICMP_PARAMPROB_ANNO_OFFSET, (v)))
 
+// byte 18
+#define UR_REPEAT_ANNO_OFFSET		18
+#define UR_REPEAT_ANNO_SIZE		1
+#define UR_REPEAT_ANNO(p)		((p)->anno_u8(UR_REPEAT_ANNO_OFFSET))
+#define SET_UR_REPEAT_ANNO(p, v)	((p)->set_anno_u8(UR_REPEAT_ANNO_OFFSET, (v)))
+
 // byte 19
 #define FIX_IP_SRC_ANNO_OFFSET		19
 #define FIX_IP_SRC_ANNO_SIZE		1